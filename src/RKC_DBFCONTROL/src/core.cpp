@@ -14,7 +14,10 @@
 #include <GL/gl.h>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include "../../utils.h"
+#include "../../happy/h2d.hpp"
+#include "../../happy/hprof.hpp"
 
 // GL_BGRA_EXT constant (not always defined in MinGW headers)
 #ifndef GL_BGRA_EXT
@@ -29,6 +32,13 @@ static int g_texWidth = 0;
 static int g_texHeight = 0;
 static bool g_glInitialized = false;
 
+// Frame profiler: OSF_PROFILE=<file> writes a Chrome trace when the game
+// destroys its DBFCONTROL, OSF_PROFILE_OVERLAY=1 draws the timings over the game
+static const char* g_profilePath = nullptr;
+static bool g_profileOverlay = false;
+static h2d::Renderer* g_overlayRenderer = nullptr;
+static h2d::ProfilerOverlay g_overlay;
+
 // Debug logging
 static FILE* g_logFile = nullptr;
 
@@ -117,6 +127,8 @@ static bool InitOpenGL(HWND hwnd, int width, int height) {
 }
 
 static void ShutdownOpenGL() {
+    delete g_overlayRenderer;
+    g_overlayRenderer = nullptr;
     if (g_texture) {
         glDeleteTextures(1, &g_texture);
         g_texture = 0;
@@ -138,11 +150,16 @@ static void PresentOpenGL(void* pixels, int width, int height) {
     wglMakeCurrent(g_hdc, g_hglrc);
     
     // Upload pixels to texture
-    glBindTexture(GL_TEXTURE_2D, g_texture);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_BGRA_EXT, GL_UNSIGNED_BYTE, pixels);
+    {
+        HPROF_SCOPE("upload");
+        glBindTexture(GL_TEXTURE_2D, g_texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_BGRA_EXT, GL_UNSIGNED_BYTE, pixels);
+    }
     
-    // Draw fullscreen quad
+    // Draw fullscreen quad (GetDIBits leaves alpha at 0, so no blending)
     glClear(GL_COLOR_BUFFER_BIT);
+    glDisable(GL_BLEND);
+    glColor4ub(255, 255, 255, 255);
     glBegin(GL_QUADS);
     glTexCoord2f(0, 0); glVertex2f(0, 0);
     glTexCoord2f(1, 0); glVertex2f((float)width, 0);
@@ -150,6 +167,30 @@ static void PresentOpenGL(void* pixels, int width, int height) {
     glTexCoord2f(0, 1); glVertex2f(0, (float)height);
     glEnd();
     
+    if (g_profileOverlay) {
+        // The renderer sets blending, the projection and the viewport; keep
+        // the game's own state out of its reach
+        glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_CURRENT_BIT | GL_TEXTURE_BIT |
+                     GL_VIEWPORT_BIT | GL_TRANSFORM_BIT);
+        glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        if (!g_overlayRenderer) g_overlayRenderer = new h2d::Renderer();
+        g_overlayRenderer->init(width, height);
+        g_overlayRenderer->beginFrame();
+        g_overlay.draw(*g_overlayRenderer, hprof::Profiler::instance(), 8, 8);
+        g_overlayRenderer->endFrame();
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+        glPopMatrix();
+        glPopClientAttrib();
+        glPopAttrib();
+    }
+    
+    HPROF_SCOPE("swap");
     SwapBuffers(g_hdc);
 }
 
@@ -422,6 +463,49 @@ static void InitOriginalFunctions() {
     initialized = true;
 }
 
+// RKC_DIB pool counters (see RKC_DIB_GetPoolStats in RKC_DIB)
+struct RKC_DIB_POOLSTATS {
+    DWORD requests;
+    DWORD systemAllocs;
+    DWORD poolHits;
+    DWORD tempHits;
+    DWORD cachedBytes;
+};
+typedef void (__cdecl *GetPoolStats_t)(RKC_DIB_POOLSTATS* out);
+
+#define DIB_POOL_REPORT_FRAMES 300
+
+/**
+ * Log DIB allocations per frame every DIB_POOL_REPORT_FRAMES frames:
+ * what callers requested (= GlobalAlloc calls without the pool) against
+ * the GlobalAlloc calls that actually happened.
+ */
+static void ReportDIBPool() {
+    static GetPoolStats_t getPoolStats = nullptr;
+    static bool resolved = false;
+    static RKC_DIB_POOLSTATS last = {};
+    static int frames = 0;
+    
+    if (!resolved) {
+        getPoolStats = (GetPoolStats_t)LoadOrigFunc("RKC_DIB.dll", "RKC_DIB_GetPoolStats");
+        if (getPoolStats) getPoolStats(&last);
+        resolved = true;
+    }
+    if (!getPoolStats || !g_logFile) return;
+    if (++frames < DIB_POOL_REPORT_FRAMES) return;
+    
+    RKC_DIB_POOLSTATS now;
+    getPoolStats(&now);
+    DBF_LOG("DIB allocs/frame: %.2f requested -> %.2f GlobalAlloc (%.2f pool, %.2f temp hits), %lu KB cached",
+            (now.requests - last.requests) / (double)frames,
+            (now.systemAllocs - last.systemAllocs) / (double)frames,
+            (now.poolHits - last.poolHits) / (double)frames,
+            (now.tempHits - last.tempHits) / (double)frames,
+            (unsigned long)(now.cachedBytes / 1024));
+    last = now;
+    frames = 0;
+}
+
 /**
  * RKC_DBFCONTROL::Paint - Paint the current frame
  * 
@@ -437,6 +521,7 @@ void __thiscall RKC_DBFCONTROL_Paint(void* self, HDC param_1, int param_2) {
     char* p = (char*)self;
     
     InitOriginalFunctions();
+    ReportDIBPool();
     
     // Check state flag at offset 0x00
     if (*(int*)p != 1) {
@@ -488,12 +573,14 @@ void __thiscall RKC_DBFCONTROL_Paint(void* self, HDC param_1, int param_2) {
                 
                 // Call original TransferToDDB to render into our bitmap
                 if (g_origTransferToDDB) {
+                    HPROF_SCOPE("to ddb");
                     g_origTransferToDDB(dib, memDC, 0, 0);
                 }
                 
                 // Call optional paint callback at this+0x138
                 void (*paintCallback)(HDC) = *(void (**)(HDC))(p + 0x138);
                 if (paintCallback) {
+                    HPROF_SCOPE("paint callback");
                     paintCallback(memDC);
                 }
                 
@@ -513,10 +600,17 @@ void __thiscall RKC_DBFCONTROL_Paint(void* self, HDC param_1, int param_2) {
                     bi.biBitCount = 32;
                     bi.biCompression = BI_RGB;
                     
-                    GetDIBits(memDC, hBitmap, 0, bm.bmHeight, pixels, (BITMAPINFO*)&bi, DIB_RGB_COLORS);
+                    {
+                        HPROF_SCOPE("readback");
+                        GetDIBits(memDC, hBitmap, 0, bm.bmHeight, pixels, (BITMAPINFO*)&bi, DIB_RGB_COLORS);
+                    }
                     
                     // Present to screen with OpenGL
-                    PresentOpenGL(pixels, screenWidth, screenHeight);
+                    {
+                        HPROF_SCOPE("present");
+                        PresentOpenGL(pixels, screenWidth, screenHeight);
+                    }
+                    HPROF_COUNT("uploaded kb", stride * bm.bmHeight / 1024);
                     
                     free(pixels);
                 }
@@ -551,12 +645,17 @@ void __thiscall RKC_DBFCONTROL_Paint(void* self, HDC param_1, int param_2) {
                 "?Paint@RKC_DBFCONTROL@@QAEXPAUHDC__@@H@Z");
         }
         if (origPaint) {
-            origPaint(self, param_1, param_2);
+            {
+                HPROF_SCOPE("present");
+                origPaint(self, param_1, param_2);
+            }
+            HPROF_FRAME();
             return;  // Original calls DrawEnd itself
         }
     }
     
     if (g_origDrawEnd) g_origDrawEnd(self);
+    HPROF_FRAME();
 }
 
 // DLL entry point for cleanup
@@ -565,8 +664,17 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
         case DLL_PROCESS_ATTACH:
             DBF_LOG_INIT();
             DBF_LOG("RKC_DBFCONTROL.dll loaded (OpenGL hook)");
+            g_profilePath = getenv("OSF_PROFILE");
+            g_profileOverlay = getenv("OSF_PROFILE_OVERLAY") != nullptr;
+            if (g_profilePath || g_profileOverlay) {
+                hprof::Profiler::instance().setEnabled(true);
+                DBF_LOG("Profiling on%s", g_profileOverlay ? ", overlay shown" : "");
+            }
             break;
         case DLL_PROCESS_DETACH:
+            if (g_profilePath) {
+                DBF_LOG("Profile trace %s NOT written (DBFCONTROL never destroyed)", g_profilePath);
+            }
             ShutdownOpenGL();
             DBF_LOG("RKC_DBFCONTROL.dll unloaded");
             DBF_LOG_SHUTDOWN();
@@ -608,6 +716,29 @@ void __thiscall RKC_DBFCONTROL_DrawEnd(void* self) {
     }
 }
 
+/**
+ * RKC_DBFCONTROL::~RKC_DBFCONTROL - Write the profile trace, then destroy
+ * USED BY: ShadowFlare.exe (shutdown, after StopAll)
+ *
+ * The exe destroys its DBFCONTROL on the game thread once drawing has
+ * stopped and while every DLL is still loaded: the place to read the shared
+ * profiler's rings and write the trace. DllMain runs under the loader lock,
+ * when other modules' rings may already be gone, so it writes nothing.
+ */
+void __thiscall RKC_DBFCONTROL_destructor(void* self) {
+    if (g_profilePath) {
+        bool written = hprof::Profiler::instance().writeChromeTrace(g_profilePath);
+        DBF_LOG("Profile trace %s %s", g_profilePath, written ? "written" : "NOT written");
+        g_profilePath = nullptr;
+    }
+    typedef void (__thiscall *Destructor_t)(void*);
+    static Destructor_t origDestructor = nullptr;
+    if (!origDestructor) {
+        origDestructor = (Destructor_t)LoadOrigFunc("o_RKC_DBFCONTROL.dll", "??1RKC_DBFCONTROL@@QAE@XZ");
+    }
+    if (origDestructor) origDestructor(self);
+}
+
 /**
  * RKC_DBFCONTROL::SetPaintFunction - Store paint callback pointer
  * USED BY: ShadowFlare.exe
@@ -0,0 +1,69 @@
+/*
+ * bench_convert.cpp - RKC_DIB::Convert throughput for every bit-depth pair
+ * 
+ * Build (MinGW, run under Windows or wine):
+ *   i686-w64-mingw32-g++ -std=c++17 -O2 bench_convert.cpp -o bench_convert.exe
+ * 
+ * Usage: bench_convert [width] [height] [iterations]
+ */
+
+#include "src/core.cpp"
+
+#include <cstdlib>
+
+static void FillRandom(RKC_DIB* dib) {
+    long size = RKC_DIB_GetAlignWidth(dib) * dib->bitmapInfo->biHeight;
+    for (long i = 0; i < size; i++) dib->bitmap[i] = (unsigned char)rand();
+    long count = RKC_DIB_GetPaletteCount(dib);
+    for (long i = 0; i < count; i++) {
+        dib->palette[i].rgbRed = (unsigned char)rand();
+        dib->palette[i].rgbGreen = (unsigned char)rand();
+        dib->palette[i].rgbBlue = (unsigned char)rand();
+        dib->palette[i].rgbReserved = 0;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    long width = argc > 1 ? atol(argv[1]) : 640;
+    long height = argc > 2 ? atol(argv[2]) : 480;
+    long iterations = argc > 3 ? atol(argv[3]) : 50;
+    static const long depths[] = {1, 4, 8, 16, 24};
+    DIB_Init();  // No DllMain when core.cpp is compiled in
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+
+    printf("Convert %ldx%ld, %ld iterations (Mpixel/s)\n", width, height, iterations);
+    printf("src\\dst      1       4       8      16      24\n");
+
+    for (long s = 0; s < 5; s++) {
+        RKC_DIB source;
+        RKC_DIB_constructor(&source);
+        RKC_DIB_Create(&source, width, height, depths[s], 1);
+        FillRandom(&source);
+        printf("%3ld    ", depths[s]);
+
+        for (long d = 0; d < 5; d++) {
+            // First call creates the destination (and, for 16/24 -> palette,
+            // builds the inverse colour map); later calls reuse both
+            RKC_DIB dest;
+            RKC_DIB_constructor(&dest);
+            RKC_DIB_Convert(&dest, &source, depths[d]);
+
+            LARGE_INTEGER start, end;
+            QueryPerformanceCounter(&start);
+            for (long i = 0; i < iterations; i++) {
+                RKC_DIB_Convert(&dest, &source, depths[d]);
+            }
+            QueryPerformanceCounter(&end);
+
+            double seconds = (double)(end.QuadPart - start.QuadPart) / freq.QuadPart;
+            double mpix = (double)width * height * iterations / seconds / 1e6;
+            printf("%8.1f", mpix);
+            RKC_DIB_Release(&dest);
+        }
+        printf("\n");
+        RKC_DIB_Release(&source);
+    }
+    return 0;
+}
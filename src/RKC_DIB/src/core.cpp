@@ -12,7 +12,10 @@
 #include <windows.h>
 #include <cstring>
 #include <cstdio>
+#include <cstdlib>
+#include <algorithm>
 #include "../../utils.h"
+#include "../../happy/hprof.hpp"
 
 /**
  * RKC_DIB class structure - 12 bytes
@@ -35,6 +38,364 @@ public:
 extern "C" long __thiscall RKC_DIB_GetAlignWidth(RKC_DIB* self);
 extern "C" void __thiscall RKC_DIB_Release(RKC_DIB* self);
 
+// ============================================================================
+// DIB MEMORY POOL - OpenShadowFlare extension
+// ============================================================================
+
+/**
+ * Pixel buffers come from a size-classed pool instead of one GlobalAlloc
+ * per DIB, and whole DIBs (header + pixels) released by Release are kept
+ * in a small cache keyed by (width, height, bpp) so the next Create of the
+ * same shape - UPDIB's temporary DIBs, per-pattern scratch DIBs - reuses them.
+ *
+ * Pooled pixel buffers start on a 64-byte boundary. Rows keep the BMP
+ * stride (GetAlignWidth) since original code computes it too, so rows are
+ * 64-byte aligned whenever the stride is a multiple of 64 (640/1280/1920...).
+ *
+ * Pooled buffers are not GlobalAlloc handles. Callers can plug foreign
+ * buffers in with SetBitmap, so a registry of live pooled pointers decides
+ * which free path to use. SetBitmap swaps pointers as the original does and
+ * a pooled buffer it hands out stays in the registry: ownership moves with
+ * the pointer, and whichever DIB it is set into next gives it back to the
+ * pool on Release. Its callers (UPDIB's part holder) swap part pixels in and
+ * out and never GlobalFree what they get back. Parked DIBs and free lists
+ * together hold at most DIB_POOL_MAX_CACHED bytes. Set OSF_DIB_POOL=0 to
+ * turn pooling off entirely.
+ */
+
+#define DIB_POOL_ALIGN      64
+#define DIB_POOL_MIN_SIZE   4096
+#define DIB_POOL_CLASSES    128
+#define DIB_POOL_MAX_CACHED (32 * 1024 * 1024)   // bytes parked in free lists
+#define DIB_TEMP_SLOTS      8
+
+/**
+ * Lives just before the aligned pointer of every pooled buffer.
+ */
+struct DIB_POOLHDR {
+    HGLOBAL raw;              // GlobalAlloc block holding header + buffer
+    DWORD size;               // class size (usable bytes)
+    long classIndex;
+    DIB_POOLHDR* nextFree;
+};
+
+struct DIB_TEMPDIB {
+    BITMAPINFOHEADER* header;
+    unsigned char* bitmap;
+    long width, height, bpp;
+    DWORD size;               // class size of bitmap
+    unsigned long lastUse;
+};
+
+/**
+ * Allocation counters (cumulative). "requests" is what callers asked for,
+ * i.e. the GlobalAlloc calls the original DLL would have made; "systemAllocs"
+ * is what actually reached GlobalAlloc.
+ */
+struct RKC_DIB_POOLSTATS {
+    DWORD requests;
+    DWORD systemAllocs;
+    DWORD poolHits;
+    DWORD tempHits;
+    DWORD cachedBytes;
+};
+
+static CRITICAL_SECTION g_poolLock;
+static bool g_poolEnabled = true;
+static DIB_POOLHDR* g_poolFree[DIB_POOL_CLASSES];
+static DWORD g_poolCachedBytes = 0;
+static DIB_TEMPDIB g_tempDIBs[DIB_TEMP_SLOTS];
+static unsigned long g_tempClock = 0;
+static RKC_DIB_POOLSTATS g_poolStats;
+
+// Live pooled pointers (open addressing, linear probing)
+static void** g_poolLive = nullptr;
+static long g_poolLiveCap = 0;
+static long g_poolLiveUsed = 0;      // live + tombstones
+#define DIB_POOL_TOMBSTONE ((void*)1)
+
+static void DIB_PoolInit() {
+    InitializeCriticalSection(&g_poolLock);
+    char value[8];
+    DWORD len = GetEnvironmentVariableA("OSF_DIB_POOL", value, sizeof(value));
+    if (len > 0 && len < sizeof(value) && value[0] == '0') g_poolEnabled = false;
+}
+
+static inline long DIB_PoolHashSlot(void* ptr, long cap) {
+    return (long)(((ULONG_PTR)ptr / DIB_POOL_ALIGN) * 2654435761u) & (cap - 1);
+}
+
+static long DIB_PoolFindLive(void* ptr) {
+    if (!g_poolLiveCap) return -1;
+    long slot = DIB_PoolHashSlot(ptr, g_poolLiveCap);
+    for (;;) {
+        void* entry = g_poolLive[slot];
+        if (entry == ptr) return slot;
+        if (!entry) return -1;
+        slot = (slot + 1) & (g_poolLiveCap - 1);
+    }
+}
+
+static bool DIB_PoolAddLive(void* ptr) {
+    if ((g_poolLiveUsed + 1) * 2 > g_poolLiveCap) {
+        // Rehash into a table at least twice the live count (drops tombstones)
+        long newCap = g_poolLiveCap ? g_poolLiveCap : 256;
+        while (newCap < (g_poolLiveUsed + 1) * 4) newCap *= 2;
+        void** table = (void**)calloc(newCap, sizeof(void*));
+        if (!table) return false;
+        long live = 0;
+        for (long i = 0; i < g_poolLiveCap; i++) {
+            void* entry = g_poolLive[i];
+            if (!entry || entry == DIB_POOL_TOMBSTONE) continue;
+            long slot = DIB_PoolHashSlot(entry, newCap);
+            while (table[slot]) slot = (slot + 1) & (newCap - 1);
+            table[slot] = entry;
+            live++;
+        }
+        free(g_poolLive);
+        g_poolLive = table;
+        g_poolLiveCap = newCap;
+        g_poolLiveUsed = live;
+    }
+    long slot = DIB_PoolHashSlot(ptr, g_poolLiveCap);
+    while (g_poolLive[slot] && g_poolLive[slot] != DIB_POOL_TOMBSTONE) {
+        slot = (slot + 1) & (g_poolLiveCap - 1);
+    }
+    if (!g_poolLive[slot]) g_poolLiveUsed++;
+    g_poolLive[slot] = ptr;
+    return true;
+}
+
+/**
+ * Size class: 4KB minimum, then four classes per power of two
+ * (at most 25% slack).
+ */
+static long DIB_PoolClass(DWORD size, DWORD* classSize) {
+    if (size <= DIB_POOL_MIN_SIZE) {
+        *classSize = DIB_POOL_MIN_SIZE;
+        return 0;
+    }
+    DWORD pow2 = DIB_POOL_MIN_SIZE;
+    long log2 = 0;
+    while (pow2 * 2 < size) { pow2 *= 2; log2++; }
+    DWORD step = pow2 / 4;
+    DWORD steps = (size - 1) / step + 1;     // 5..8
+    *classSize = steps * step;
+    return 1 + log2 * 4 + (long)(steps - 5);
+}
+
+static inline DIB_POOLHDR* DIB_PoolHeader(void* ptr) {
+    return (DIB_POOLHDR*)((char*)ptr - sizeof(DIB_POOLHDR));
+}
+
+/**
+ * Allocate a pixel buffer. Caller holds g_poolLock.
+ */
+static unsigned char* DIB_PoolAllocLocked(DWORD size) {
+    g_poolStats.requests++;
+    if (!g_poolEnabled) {
+        g_poolStats.systemAllocs++;
+        return (unsigned char*)GlobalAlloc(GMEM_FIXED, size);
+    }
+
+    DWORD classSize;
+    long cls = DIB_PoolClass(size, &classSize);
+    if (cls < DIB_POOL_CLASSES && g_poolFree[cls]) {
+        DIB_POOLHDR* hdr = g_poolFree[cls];
+        void* ptr = (char*)hdr + sizeof(DIB_POOLHDR);
+        if (DIB_PoolAddLive(ptr)) {
+            g_poolFree[cls] = hdr->nextFree;
+            g_poolCachedBytes -= hdr->size;
+            g_poolStats.poolHits++;
+            return (unsigned char*)ptr;
+        }
+    }
+
+    HGLOBAL raw = GlobalAlloc(GMEM_FIXED, classSize + sizeof(DIB_POOLHDR) + DIB_POOL_ALIGN);
+    if (!raw) return nullptr;
+    g_poolStats.systemAllocs++;
+
+    ULONG_PTR aligned = ((ULONG_PTR)raw + sizeof(DIB_POOLHDR) + DIB_POOL_ALIGN - 1) &
+                        ~(ULONG_PTR)(DIB_POOL_ALIGN - 1);
+    DIB_POOLHDR* hdr = DIB_PoolHeader((void*)aligned);
+    hdr->raw = raw;
+    hdr->size = classSize;
+    hdr->classIndex = cls;
+    hdr->nextFree = nullptr;
+    if (!DIB_PoolAddLive((void*)aligned)) {
+        GlobalFree(raw);
+        return nullptr;
+    }
+    return (unsigned char*)aligned;
+}
+
+/**
+ * Put a pooled buffer (already removed from the registry) on its free
+ * list, or give it back to the system once the pool holds
+ * DIB_POOL_MAX_CACHED. Caller holds g_poolLock.
+ */
+static void DIB_PoolReturnLocked(void* ptr) {
+    DIB_POOLHDR* hdr = DIB_PoolHeader(ptr);
+    if (hdr->classIndex >= DIB_POOL_CLASSES ||
+        g_poolCachedBytes + hdr->size > DIB_POOL_MAX_CACHED) {
+        GlobalFree(hdr->raw);
+        return;
+    }
+    hdr->nextFree = g_poolFree[hdr->classIndex];
+    g_poolFree[hdr->classIndex] = hdr;
+    g_poolCachedBytes += hdr->size;
+}
+
+/**
+ * Remove ptr from the live registry. Returns false if it isn't pooled.
+ */
+static bool DIB_PoolUnlinkLocked(void* ptr) {
+    long slot = DIB_PoolFindLive(ptr);
+    if (slot < 0) return false;
+    g_poolLive[slot] = DIB_POOL_TOMBSTONE;
+    return true;
+}
+
+static unsigned char* DIB_AllocBits(DWORD size) {
+    EnterCriticalSection(&g_poolLock);
+    unsigned char* bits = DIB_PoolAllocLocked(size);
+    LeaveCriticalSection(&g_poolLock);
+    return bits;
+}
+
+/**
+ * Free a pixel buffer of either kind (pooled or GlobalAlloc).
+ */
+static void DIB_FreeBits(void* ptr) {
+    EnterCriticalSection(&g_poolLock);
+    if (DIB_PoolUnlinkLocked(ptr)) {
+        DIB_PoolReturnLocked(ptr);
+    } else {
+        GlobalFree(ptr);
+    }
+    LeaveCriticalSection(&g_poolLock);
+}
+
+/**
+ * Allocate a zeroed header + palette block (always a GlobalAlloc block).
+ */
+static BITMAPINFOHEADER* DIB_AllocHeader(SIZE_T size) {
+    EnterCriticalSection(&g_poolLock);
+    g_poolStats.requests++;
+    g_poolStats.systemAllocs++;
+    LeaveCriticalSection(&g_poolLock);
+    return (BITMAPINFOHEADER*)GlobalAlloc(GPTR, size);
+}
+
+/**
+ * Take a cached DIB of this shape. Returns false on a miss.
+ */
+static bool DIB_TakeTempDIB(long width, long height, long bpp,
+                            BITMAPINFOHEADER** header, unsigned char** bitmap) {
+    if (!g_poolEnabled) return false;
+    bool found = false;
+    EnterCriticalSection(&g_poolLock);
+    for (int i = 0; i < DIB_TEMP_SLOTS; i++) {
+        DIB_TEMPDIB& t = g_tempDIBs[i];
+        if (t.header && t.width == width && t.height == height && t.bpp == bpp) {
+            if (!DIB_PoolAddLive(t.bitmap)) break;
+            *header = t.header;
+            *bitmap = t.bitmap;
+            g_poolCachedBytes -= t.size;
+            t.header = nullptr;
+            t.bitmap = nullptr;
+            g_poolStats.requests += 2;
+            g_poolStats.tempHits++;
+            found = true;
+            break;
+        }
+    }
+    LeaveCriticalSection(&g_poolLock);
+    return found;
+}
+
+/**
+ * Drop a parked DIB: pixels to the size-class pool (or the system when the
+ * free lists are full), header to the system. Caller holds g_poolLock.
+ */
+static void DIB_DropTempLocked(DIB_TEMPDIB& t) {
+    g_poolCachedBytes -= t.size;
+    DIB_PoolReturnLocked(t.bitmap);
+    GlobalFree(t.header);
+    t.header = nullptr;
+    t.bitmap = nullptr;
+}
+
+/**
+ * Park a released DIB in the temp cache, evicting the least recently
+ * parked one. Only DIBs whose pixels came from the pool and whose blocks
+ * still fit the shape in the header qualify (SetBitmap can move a buffer
+ * under another DIB's header). Parking never takes the cache over
+ * DIB_POOL_MAX_CACHED: the oldest parked DIBs go first, and if that is not
+ * enough the DIB is refused. Returns false if the caller should free the
+ * memory itself.
+ */
+static bool DIB_ParkTempDIB(BITMAPINFOHEADER* header, unsigned char* bitmap) {
+    if (!g_poolEnabled) return false;
+    long bpp = header->biBitCount;
+    long paletteCount = bpp <= 8 ? (1L << bpp) : 0;
+    DWORD stride = ((header->biWidth * bpp + 31) / 32) * 4;
+    DWORD needed = stride * (DWORD)(header->biHeight < 0 ? -header->biHeight : header->biHeight);
+    if (GlobalSize(header) < (SIZE_T)(0x28 + paletteCount * 4)) return false;
+
+    EnterCriticalSection(&g_poolLock);
+    if (DIB_PoolFindLive(bitmap) < 0 || DIB_PoolHeader(bitmap)->size < needed) {
+        LeaveCriticalSection(&g_poolLock);
+        return false;
+    }
+    DWORD size = DIB_PoolHeader(bitmap)->size;
+
+    int victim = 0;
+    for (int i = 0; i < DIB_TEMP_SLOTS; i++) {
+        if (!g_tempDIBs[i].header) { victim = i; break; }
+        if (g_tempDIBs[i].lastUse < g_tempDIBs[victim].lastUse) victim = i;
+    }
+    if (g_tempDIBs[victim].header) DIB_DropTempLocked(g_tempDIBs[victim]);
+    while (g_poolCachedBytes + size > DIB_POOL_MAX_CACHED) {
+        int oldest = -1;
+        for (int i = 0; i < DIB_TEMP_SLOTS; i++) {
+            if (g_tempDIBs[i].header && (oldest < 0 || g_tempDIBs[i].lastUse < g_tempDIBs[oldest].lastUse)) {
+                oldest = i;
+            }
+        }
+        if (oldest < 0) break;
+        DIB_DropTempLocked(g_tempDIBs[oldest]);
+    }
+    if (g_poolCachedBytes + size > DIB_POOL_MAX_CACHED) {
+        LeaveCriticalSection(&g_poolLock);
+        return false;
+    }
+
+    DIB_PoolUnlinkLocked(bitmap);
+    DIB_TEMPDIB& t = g_tempDIBs[victim];
+    t.header = header;
+    t.bitmap = bitmap;
+    t.width = header->biWidth;
+    t.height = header->biHeight;
+    t.bpp = bpp;
+    t.size = size;
+    t.lastUse = ++g_tempClock;
+    g_poolCachedBytes += size;
+    LeaveCriticalSection(&g_poolLock);
+    return true;
+}
+
+/**
+ * RKC_DIB_GetPoolStats - Copy the cumulative allocation counters
+ * USED BY: RKC_DBFCONTROL.dll (per-frame allocation report)
+ */
+extern "C" void __cdecl RKC_DIB_GetPoolStats(RKC_DIB_POOLSTATS* out) {
+    EnterCriticalSection(&g_poolLock);
+    *out = g_poolStats;
+    out->cachedBytes = g_poolCachedBytes;
+    LeaveCriticalSection(&g_poolLock);
+}
+
 // ============================================================================
 // RKC_DIBHISPEEDMODE FUNCTIONS
 // ============================================================================
@@ -80,11 +441,16 @@ extern "C" void __thiscall RKC_DIB_constructor(RKC_DIB* self) {
  * USED BY: o_RKC_DBFCONTROL.dll, o_RKC_UPDIB.dll
  */
 extern "C" void __thiscall RKC_DIB_Release(RKC_DIB* self) {
+    // A full pooled DIB goes to the temporary DIB cache as a whole
+    if (self->bitmapInfo && self->bitmap && DIB_ParkTempDIB(self->bitmapInfo, self->bitmap)) {
+        self->bitmapInfo = nullptr;
+        self->bitmap = nullptr;
+    }
     if (self->bitmapInfo) {
         GlobalFree(self->bitmapInfo);
     }
     if (self->bitmap) {
-        GlobalFree(self->bitmap);
+        DIB_FreeBits(self->bitmap);
     }
     self->bitmapInfo = nullptr;
     self->palette = nullptr;
@@ -144,13 +510,21 @@ extern "C" int __thiscall RKC_DIB_Create(RKC_DIB* self, long width, long height,
     
     // Allocate BITMAPINFOHEADER + palette
     // Header is 0x28 (40) bytes, each palette entry is 4 bytes (RGBQUAD)
+    // A cached DIB of the same shape supplies both blocks at once
     SIZE_T headerSize = 0x28 + (paletteCount * 4);
-    BITMAPINFOHEADER* pHeader = (BITMAPINFOHEADER*)GlobalAlloc(GPTR, headerSize);
+    BITMAPINFOHEADER* pHeader = nullptr;
+    unsigned char* cachedBits = nullptr;
+    if (allocBitmap == 1 && DIB_TakeTempDIB(width, height, bpp, &pHeader, &cachedBits)) {
+        memset(pHeader, 0, headerSize);   // same state as a fresh GPTR block
+    } else {
+        pHeader = DIB_AllocHeader(headerSize);
+    }
     if (!pHeader) {
         return 0;
     }
     
     self->bitmapInfo = pHeader;
+    self->bitmap = cachedBits;
     
     // Set palette pointer (right after header, or NULL if no palette)
     if (paletteCount == 0) {
@@ -185,7 +559,9 @@ extern "C" int __thiscall RKC_DIB_Create(RKC_DIB* self, long width, long height,
         return 1;  // Header only, no pixel buffer
     }
     
-    self->bitmap = (unsigned char*)GlobalAlloc(GMEM_FIXED, pHeader->biSizeImage);
+    if (!self->bitmap) {
+        self->bitmap = DIB_AllocBits(pHeader->biSizeImage);
+    }
     if (!self->bitmap) {
         RKC_DIB_Release(self);
         return 0;
@@ -511,6 +887,8 @@ extern "C" int __thiscall RKC_DIB_SetPalette(RKC_DIB* self, RGBQUAD* sourcePalet
  * USED BY: o_RKC_UPDIB.dll
  */
 extern "C" unsigned char* __thiscall RKC_DIB_SetBitmap(RKC_DIB* self, unsigned char* newBitmap) {
+    // A pooled buffer stays registered, so it goes back to the pool from
+    // whichever DIB releases it (see DIB MEMORY POOL)
     unsigned char* oldBitmap = self->bitmap;
     self->bitmap = newBitmap;
     return oldBitmap;
@@ -670,7 +1048,7 @@ extern "C" int __thiscall RKC_DIB_ReadFile(RKC_DIB* self, const char* filename,
     
     // Allocate header + palette
     SIZE_T headerSize = 0x28 + (paletteCount * 4);
-    BITMAPINFOHEADER* pHeader = (BITMAPINFOHEADER*)GlobalAlloc(GPTR, headerSize);
+    BITMAPINFOHEADER* pHeader = DIB_AllocHeader(headerSize);
     if (!pHeader) {
         CloseHandle(hFile);
         return 0;
@@ -711,7 +1089,7 @@ extern "C" int __thiscall RKC_DIB_ReadFile(RKC_DIB* self, const char* filename,
     SetFilePointer(hFile, pixelDataOffset, NULL, FILE_BEGIN);
     
     // Allocate pixel buffer
-    self->bitmap = (unsigned char*)GlobalAlloc(GMEM_FIXED, imageSize);
+    self->bitmap = DIB_AllocBits((DWORD)imageSize);
     if (!self->bitmap) {
         RKC_DIB_Release(self);
         CloseHandle(hFile);
@@ -734,6 +1112,231 @@ extern "C" int __thiscall RKC_DIB_ReadFile(RKC_DIB* self, const char* filename,
 // TRANSFER FUNCTIONS - BLIT BETWEEN DIBS
 // ============================================================================
 
+/**
+ * All transfers share one pipeline: clip the rect once, pick a row kernel for
+ * the (source bpp, dest bpp, keyed) combination once, then run the kernel per
+ * row without any format branches. TransferToDIBBatch reuses the same pieces
+ * to amortize validation, stride and palette work over many blits.
+ */
+
+/**
+ * Per-source state shared by all rows of a transfer.
+ * pal16 is only filled for 8bpp -> 16bpp (RGB555 lookup, built once).
+ */
+struct DIB_BLITCTX {
+    const RGBQUAD* palette;
+    long transColor;              // -1 = no colour key
+    WORD srcBpp;
+    unsigned short pal16[256];
+};
+
+/**
+ * Copy one row. src is the START of the source row (kernels add srcX
+ * themselves so 1/4bpp sources can address sub-byte pixels).
+ */
+typedef void (*DIB_BLITROW)(unsigned char* dst, const unsigned char* src, long srcX, long width,
+                            const DIB_BLITCTX& ctx);
+
+static void DIB_BlitRow_8to8(unsigned char* dst, const unsigned char* src, long srcX, long width,
+                             const DIB_BLITCTX& ctx) {
+    memcpy(dst, src + srcX, width);
+}
+
+static void DIB_BlitRow_8to8Key(unsigned char* dst, const unsigned char* src, long srcX, long width,
+                                const DIB_BLITCTX& ctx) {
+    src += srcX;
+    for (long x = 0; x < width; x++) {
+        if (src[x] != ctx.transColor) dst[x] = src[x];
+    }
+}
+
+static void DIB_BlitRow_8to16(unsigned char* dst, const unsigned char* src, long srcX, long width,
+                              const DIB_BLITCTX& ctx) {
+    unsigned short* dst16 = (unsigned short*)dst;
+    src += srcX;
+    for (long x = 0; x < width; x++) dst16[x] = ctx.pal16[src[x]];
+}
+
+static void DIB_BlitRow_8to16Key(unsigned char* dst, const unsigned char* src, long srcX, long width,
+                                 const DIB_BLITCTX& ctx) {
+    unsigned short* dst16 = (unsigned short*)dst;
+    src += srcX;
+    for (long x = 0; x < width; x++) {
+        if (src[x] != ctx.transColor) dst16[x] = ctx.pal16[src[x]];
+    }
+}
+
+static void DIB_BlitRow_8to24(unsigned char* dst, const unsigned char* src, long srcX, long width,
+                              const DIB_BLITCTX& ctx) {
+    src += srcX;
+    for (long x = 0; x < width; x++) {
+        const RGBQUAD& c = ctx.palette[src[x]];
+        dst[x*3 + 0] = c.rgbBlue;
+        dst[x*3 + 1] = c.rgbGreen;
+        dst[x*3 + 2] = c.rgbRed;
+    }
+}
+
+static void DIB_BlitRow_8to24Key(unsigned char* dst, const unsigned char* src, long srcX, long width,
+                                 const DIB_BLITCTX& ctx) {
+    src += srcX;
+    for (long x = 0; x < width; x++) {
+        if (src[x] == ctx.transColor) continue;
+        const RGBQUAD& c = ctx.palette[src[x]];
+        dst[x*3 + 0] = c.rgbBlue;
+        dst[x*3 + 1] = c.rgbGreen;
+        dst[x*3 + 2] = c.rgbRed;
+    }
+}
+
+static void DIB_BlitRow_24to24(unsigned char* dst, const unsigned char* src, long srcX, long width,
+                               const DIB_BLITCTX& ctx) {
+    memcpy(dst, src + srcX * 3, width * 3);
+}
+
+static void DIB_BlitRow_24to24Key(unsigned char* dst, const unsigned char* src, long srcX, long width,
+                                  const DIB_BLITCTX& ctx) {
+    // transColor is packed BGR
+    src += srcX * 3;
+    for (long x = 0; x < width; x++) {
+        unsigned long pixel = src[x*3] | (src[x*3+1] << 8) | (src[x*3+2] << 16);
+        if (pixel != (unsigned long)ctx.transColor) {
+            dst[x*3 + 0] = src[x*3 + 0];
+            dst[x*3 + 1] = src[x*3 + 1];
+            dst[x*3 + 2] = src[x*3 + 2];
+        }
+    }
+}
+
+/**
+ * Read pixel x of a 1bpp or 4bpp row (leftmost pixel in the high bits).
+ */
+static inline unsigned char DIB_LowIndex(const unsigned char* row, long x, WORD bpp) {
+    if (bpp == 4) return (row[x >> 1] >> ((1 - (x & 1)) * 4)) & 0x0F;
+    return (row[x >> 3] >> (7 - (x & 7))) & 1;
+}
+
+static void DIB_BlitRow_LowTo8(unsigned char* dst, const unsigned char* src, long srcX, long width,
+                               const DIB_BLITCTX& ctx) {
+    for (long x = 0; x < width; x++) {
+        unsigned char idx = DIB_LowIndex(src, srcX + x, ctx.srcBpp);
+        if (idx != ctx.transColor) dst[x] = idx;
+    }
+}
+
+static void DIB_BlitRow_LowTo16(unsigned char* dst, const unsigned char* src, long srcX, long width,
+                                const DIB_BLITCTX& ctx) {
+    unsigned short* dst16 = (unsigned short*)dst;
+    for (long x = 0; x < width; x++) {
+        unsigned char idx = DIB_LowIndex(src, srcX + x, ctx.srcBpp);
+        if (idx != ctx.transColor) dst16[x] = ctx.pal16[idx];
+    }
+}
+
+static void DIB_BlitRow_LowTo24(unsigned char* dst, const unsigned char* src, long srcX, long width,
+                                const DIB_BLITCTX& ctx) {
+    for (long x = 0; x < width; x++) {
+        unsigned char idx = DIB_LowIndex(src, srcX + x, ctx.srcBpp);
+        if (idx == ctx.transColor) continue;
+        const RGBQUAD& c = ctx.palette[idx];
+        dst[x*3 + 0] = c.rgbBlue;
+        dst[x*3 + 1] = c.rgbGreen;
+        dst[x*3 + 2] = c.rgbRed;
+    }
+}
+
+/**
+ * Check that a bpp pair is one TransferToDIB accepts.
+ * Source must be 1/4/8/24, dest must be 8/16/24 and not smaller than source.
+ */
+static bool DIB_IsTransferPair(WORD srcBpp, WORD destBpp) {
+    if (srcBpp != 1 && srcBpp != 4 && srcBpp != 8 && srcBpp != 24) return false;
+    if (destBpp != 8 && destBpp != 16 && destBpp != 24) return false;
+    return destBpp >= srcBpp;
+}
+
+/**
+ * Pick the row kernel for a format pair and fill the context.
+ * keyed = false selects the unkeyed kernel (transColor -1 never matches).
+ * Returns NULL for a paletted source without palette; callers treat
+ * that as a no-op.
+ */
+static DIB_BLITROW DIB_SelectBlitKernel(WORD srcBpp, WORD destBpp, const RGBQUAD* palette,
+                                        long transColor, DIB_BLITCTX* ctx) {
+    bool keyed = (transColor != -1);
+    ctx->palette = palette;
+    ctx->transColor = transColor;
+    ctx->srcBpp = srcBpp;
+
+    if (srcBpp == 24) {
+        if (destBpp != 24) return nullptr;
+        return keyed ? DIB_BlitRow_24to24Key : DIB_BlitRow_24to24;
+    }
+    if (destBpp == 8) {
+        // Paletted -> 8bpp copies indices
+        if (srcBpp == 8) return keyed ? DIB_BlitRow_8to8Key : DIB_BlitRow_8to8;
+        return DIB_BlitRow_LowTo8;
+    }
+
+    if (!palette) return nullptr;
+
+    if (destBpp == 16) {
+        // RGB555 (original uses this format)
+        int count = 1 << srcBpp;
+        for (int i = 0; i < count; i++) {
+            const RGBQUAD& c = palette[i];
+            ctx->pal16[i] = ((c.rgbRed & 0xF8) << 7) | ((c.rgbGreen & 0xF8) << 2) | (c.rgbBlue >> 3);
+        }
+        if (srcBpp == 8) return keyed ? DIB_BlitRow_8to16Key : DIB_BlitRow_8to16;
+        return DIB_BlitRow_LowTo16;
+    }
+    if (srcBpp == 8) return keyed ? DIB_BlitRow_8to24Key : DIB_BlitRow_8to24;
+    return DIB_BlitRow_LowTo24;
+}
+
+/**
+ * Clip a transfer against both bitmaps, same rules as the original:
+ * negative dest/source positions shift the rect, then width/height are
+ * clamped to both images. Returns false if nothing is left.
+ */
+static bool DIB_ClipTransfer(long destImgW, long destImgH, long srcImgW, long srcImgH,
+                             long* destX, long* destY, long* width, long* height,
+                             long* srcX, long* srcY) {
+    if (*destX < 0) { *srcX -= *destX; *width += *destX; *destX = 0; }
+    if (*destY < 0) { *srcY -= *destY; *height += *destY; *destY = 0; }
+    if (*srcX < 0) { *destX -= *srcX; *width += *srcX; *srcX = 0; }
+    if (*srcY < 0) { *destY -= *srcY; *height += *srcY; *srcY = 0; }
+
+    if (*destX < 0 || *destX >= destImgW) return false;
+    if (*srcX < 0 || *srcX >= srcImgW) return false;
+
+    if (*destX + *width > destImgW) *width = destImgW - *destX;
+    if (*destY + *height > destImgH) *height = destImgH - *destY;
+    if (*srcX + *width > srcImgW) *width = srcImgW - *srcX;
+    if (*srcY + *height > srcImgH) *height = srcImgH - *srcY;
+
+    return *width > 0 && *height > 0;
+}
+
+/**
+ * Run a row kernel over a clipped rect.
+ * DIBs are bottom-up: y=0 is the LAST row in memory, so both pointers walk
+ * backwards by one stride per visual row.
+ */
+static void DIB_RunBlit(DIB_BLITROW kernel, const DIB_BLITCTX& ctx,
+                        unsigned char* destBits, long destStride, long destImgH, WORD destBpp,
+                        const unsigned char* srcBits, long srcStride, long srcImgH,
+                        long destX, long destY, long width, long height, long srcX, long srcY) {
+    unsigned char* dst = destBits + (destImgH - destY - 1) * destStride + (destBpp * destX / 8);
+    const unsigned char* src = srcBits + (srcImgH - srcY - 1) * srcStride;
+
+    for (long row = 0; row < height; row++) {
+        kernel(dst, src, srcX, width, ctx);
+        dst -= destStride;
+        src -= srcStride;
+    }
+}
+
 /**
  * RKC_DIB::TransferToDIBFast - Fast blit from source DIB to this DIB
  * USED BY: ShadowFlare.exe, o_RKC_UPDIB.dll, o_RKC_RPGSCRN.dll
@@ -755,94 +1358,27 @@ extern "C" int __thiscall RKC_DIB_TransferToDIBFast_7args(
     if (!srcDIB->bitmap || !self->bitmap) return 0;
     if (!srcDIB->bitmapInfo || !self->bitmapInfo) return 0;
     
-    // Get BPP for both
     WORD srcBpp = srcDIB->bitmapInfo->biBitCount;
     WORD destBpp = self->bitmapInfo->biBitCount;
     
-    // For 1bpp and 4bpp, we'd need TransferToDIB - not yet implemented
-    // For now just return 0 (caller will handle it)
-    if (srcBpp == 1 || srcBpp == 4) return 0;
-    
-    // Only support certain combinations
+    // 1bpp and 4bpp go through TransferToDIB
     if (srcBpp != 8 && srcBpp != 24) return 0;
-    if (destBpp != 8 && destBpp != 16 && destBpp != 24) return 0;
-    if (destBpp < srcBpp) return 0;  // Can't reduce BPP
+    if (!DIB_IsTransferPair(srcBpp, destBpp)) return 0;
     
-    // Get dimensions from bitmapInfo
-    long destImgW = self->bitmapInfo->biWidth;
     long destImgH = self->bitmapInfo->biHeight;
-    long srcImgW = srcDIB->bitmapInfo->biWidth;
     long srcImgH = srcDIB->bitmapInfo->biHeight;
-    
-    // Clipping - adjust for negative coordinates
-    if (destX < 0) { srcX -= destX; width += destX; destX = 0; }
-    if (destY < 0) { srcY -= destY; height += destY; destY = 0; }
-    if (srcX < 0) { destX -= srcX; width += srcX; srcX = 0; }
-    if (srcY < 0) { destY -= srcY; height += srcY; srcY = 0; }
-    
-    // Bounds checking
-    if (destX < 0 || destX >= destImgW) return 0;
-    if (srcX < 0 || srcX >= srcImgW) return 0;
-    
-    // Clip to image bounds
-    if (destX + width > destImgW) width = destImgW - destX;
-    if (destY + height > destImgH) height = destImgH - destY;
-    if (srcX + width > srcImgW) width = srcImgW - srcX;
-    if (srcY + height > srcImgH) height = srcImgH - srcY;
-    
-    if (width <= 0 || height <= 0) return 0;
-    
-    // Get strides (bytes per row, DWORD aligned)
-    long srcStride = RKC_DIB_GetAlignWidth(srcDIB);
-    long destStride = RKC_DIB_GetAlignWidth(self);
-    
-    // Calculate byte offsets for starting position
-    // DIBs are bottom-up: row 0 is at the bottom
-    // srcY=0 means top row visually = (height-1) in memory
-    long srcOffset = ((srcImgH - srcY - 1) * srcStride) + (srcBpp * srcX / 8);
-    long destOffset = ((destImgH - destY - 1) * destStride) + (destBpp * destX / 8);
-    
-    unsigned char* srcBits = srcDIB->bitmap;
-    unsigned char* destBits = self->bitmap;
-    RGBQUAD* srcPal = srcDIB->palette;
-    
-    // Copy rows
-    for (long row = 0; row < height; row++) {
-        unsigned char* src = srcBits + srcOffset;
-        unsigned char* dst = destBits + destOffset;
-        
-        if (srcBpp == 8 && destBpp == 8) {
-            // 8->8: Direct copy
-            memcpy(dst, src, width);
-        }
-        else if (srcBpp == 8 && destBpp == 16 && srcPal) {
-            // 8->16: Palette lookup to RGB555
-            unsigned short* dst16 = (unsigned short*)dst;
-            for (long x = 0; x < width; x++) {
-                RGBQUAD& c = srcPal[src[x]];
-                // RGB555: RRRRRGGGGBBBB (original uses this format)
-                dst16[x] = ((c.rgbRed & 0xF8) << 7) | ((c.rgbGreen & 0xF8) << 2) | (c.rgbBlue >> 3);
-            }
-        }
-        else if (srcBpp == 8 && destBpp == 24 && srcPal) {
-            // 8->24: Palette lookup to BGR
-            for (long x = 0; x < width; x++) {
-                RGBQUAD& c = srcPal[src[x]];
-                dst[x*3 + 0] = c.rgbBlue;
-                dst[x*3 + 1] = c.rgbGreen;
-                dst[x*3 + 2] = c.rgbRed;
-            }
-        }
-        else if (srcBpp == 24 && destBpp == 24) {
-            // 24->24: Direct copy
-            memcpy(dst, src, width * 3);
-        }
-        
-        // Move to previous row (DIBs are bottom-up, we go upward visually)
-        srcOffset -= srcStride;
-        destOffset -= destStride;
+    if (!DIB_ClipTransfer(self->bitmapInfo->biWidth, destImgH, srcDIB->bitmapInfo->biWidth, srcImgH,
+                          &destX, &destY, &width, &height, &srcX, &srcY)) {
+        return 0;
     }
     
+    DIB_BLITCTX ctx;
+    DIB_BLITROW kernel = DIB_SelectBlitKernel(srcBpp, destBpp, srcDIB->palette, -1, &ctx);
+    if (!kernel) return 1;
+    
+    DIB_RunBlit(kernel, ctx, self->bitmap, RKC_DIB_GetAlignWidth(self), destImgH, destBpp,
+                srcDIB->bitmap, RKC_DIB_GetAlignWidth(srcDIB), srcImgH,
+                destX, destY, width, height, srcX, srcY);
     return 1;
 }
 
@@ -897,123 +1433,22 @@ extern "C" int __thiscall RKC_DIB_TransferToDIB_8args(
     
     WORD srcBpp = srcDIB->bitmapInfo->biBitCount;
     WORD destBpp = self->bitmapInfo->biBitCount;
+    if (!DIB_IsTransferPair(srcBpp, destBpp)) return 0;
     
-    // Source must be 1/4/8/24, dest must be 8/16/24
-    if (srcBpp != 1 && srcBpp != 4 && srcBpp != 8 && srcBpp != 24) return 0;
-    if (destBpp != 8 && destBpp != 16 && destBpp != 24) return 0;
-    if (destBpp < srcBpp) return 0;  // Can't reduce BPP (except 24->16 not supported)
-    
-    long destImgW = self->bitmapInfo->biWidth;
     long destImgH = self->bitmapInfo->biHeight;
-    long srcImgW = srcDIB->bitmapInfo->biWidth;
     long srcImgH = srcDIB->bitmapInfo->biHeight;
-    
-    // Clipping - adjust for negative coordinates
-    if (destX < 0) { srcX -= destX; width += destX; destX = 0; }
-    if (destY < 0) { srcY -= destY; height += destY; destY = 0; }
-    if (srcX < 0) { destX -= srcX; width += srcX; srcX = 0; }
-    if (srcY < 0) { destY -= srcY; height += srcY; srcY = 0; }
-    
-    if (destX < 0 || destX >= destImgW) return 0;
-    if (srcX < 0 || srcX >= srcImgW) return 0;
-    
-    if (destX + width > destImgW) width = destImgW - destX;
-    if (destY + height > destImgH) height = destImgH - destY;
-    if (srcX + width > srcImgW) width = srcImgW - srcX;
-    if (srcY + height > srcImgH) height = srcImgH - srcY;
-    
-    if (width <= 0 || height <= 0) return 0;
-    
-    long srcStride = RKC_DIB_GetAlignWidth(srcDIB);
-    long destStride = RKC_DIB_GetAlignWidth(self);
-    
-    // Calculate byte offsets - DIBs are bottom-up
-    long srcOffset = ((srcImgH - srcY - 1) * srcStride) + (srcBpp * srcX / 8);
-    long destOffset = ((destImgH - destY - 1) * destStride) + (destBpp * destX / 8);
-    
-    unsigned char* srcBits = srcDIB->bitmap;
-    unsigned char* destBits = self->bitmap;
-    RGBQUAD* srcPal = srcDIB->palette;
-    
-    for (long row = 0; row < height; row++) {
-        unsigned char* src = srcBits + srcOffset;
-        unsigned char* dst = destBits + destOffset;
-        
-        if (srcBpp == 8 && destBpp == 8) {
-            // 8->8 with transparency
-            for (long x = 0; x < width; x++) {
-                if (src[x] != transColor) {
-                    dst[x] = src[x];
-                }
-            }
-        }
-        else if (srcBpp == 8 && destBpp == 16 && srcPal) {
-            // 8->16 with transparency (RGB555)
-            unsigned short* dst16 = (unsigned short*)dst;
-            for (long x = 0; x < width; x++) {
-                unsigned char idx = src[x];
-                if (idx != transColor) {
-                    RGBQUAD& c = srcPal[idx];
-                    dst16[x] = ((c.rgbRed & 0xF8) << 7) | ((c.rgbGreen & 0xF8) << 2) | (c.rgbBlue >> 3);
-                }
-            }
-        }
-        else if (srcBpp == 8 && destBpp == 24 && srcPal) {
-            // 8->24 with transparency
-            for (long x = 0; x < width; x++) {
-                unsigned char idx = src[x];
-                if (idx != transColor) {
-                    RGBQUAD& c = srcPal[idx];
-                    dst[x*3 + 0] = c.rgbBlue;
-                    dst[x*3 + 1] = c.rgbGreen;
-                    dst[x*3 + 2] = c.rgbRed;
-                }
-            }
-        }
-        else if (srcBpp == 24 && destBpp == 24) {
-            // 24->24 with transparency (transColor is packed BGR)
-            for (long x = 0; x < width; x++) {
-                // Pack BGR into long for comparison
-                unsigned long pixel = src[x*3] | (src[x*3+1] << 8) | (src[x*3+2] << 16);
-                if (pixel != (unsigned long)transColor) {
-                    dst[x*3 + 0] = src[x*3 + 0];
-                    dst[x*3 + 1] = src[x*3 + 1];
-                    dst[x*3 + 2] = src[x*3 + 2];
-                }
-            }
-        }
-        else if (srcBpp == 1 && destBpp == 24 && srcPal) {
-            // 1bpp->24 with transparency
-            long bitPos = (srcX * srcBpp) & 7;  // Starting bit position in first byte
-            for (long x = 0; x < width; x++) {
-                unsigned char idx = (src[(srcX + x) / 8] >> (7 - ((srcX + x) & 7))) & 1;
-                if (idx != transColor) {
-                    RGBQUAD& c = srcPal[idx];
-                    dst[x*3 + 0] = c.rgbBlue;
-                    dst[x*3 + 1] = c.rgbGreen;
-                    dst[x*3 + 2] = c.rgbRed;
-                }
-            }
-        }
-        else if (srcBpp == 4 && destBpp == 24 && srcPal) {
-            // 4bpp->24 with transparency
-            for (long x = 0; x < width; x++) {
-                long srcPixelX = srcX + x;
-                unsigned char idx = (src[srcPixelX / 2] >> ((1 - (srcPixelX & 1)) * 4)) & 0x0F;
-                if (idx != transColor) {
-                    RGBQUAD& c = srcPal[idx];
-                    dst[x*3 + 0] = c.rgbBlue;
-                    dst[x*3 + 1] = c.rgbGreen;
-                    dst[x*3 + 2] = c.rgbRed;
-                }
-            }
-        }
-        // Note: 1bpp/4bpp to 8bpp/16bpp not implemented - forward to original if needed
-        
-        srcOffset -= srcStride;
-        destOffset -= destStride;
+    if (!DIB_ClipTransfer(self->bitmapInfo->biWidth, destImgH, srcDIB->bitmapInfo->biWidth, srcImgH,
+                          &destX, &destY, &width, &height, &srcX, &srcY)) {
+        return 0;
     }
     
+    DIB_BLITCTX ctx;
+    DIB_BLITROW kernel = DIB_SelectBlitKernel(srcBpp, destBpp, srcDIB->palette, transColor, &ctx);
+    if (!kernel) return 1;
+    
+    DIB_RunBlit(kernel, ctx, self->bitmap, RKC_DIB_GetAlignWidth(self), destImgH, destBpp,
+                srcDIB->bitmap, RKC_DIB_GetAlignWidth(srcDIB), srcImgH,
+                destX, destY, width, height, srcX, srcY);
     return 1;
 }
 
@@ -1034,36 +1469,1148 @@ extern "C" int __thiscall RKC_DIB_TransferToDIB_4args(
 }
 
 // ============================================================================
-// STUBS FOR UNUSED FUNCTIONS - NOT IMPORTED BY EXE OR OTHER DLLS
+// BATCH TRANSFER - OpenShadowFlare extension (not in the original DLL)
 // ============================================================================
 
-
 /**
- * RKC_DIB::AddOffset - Add color offset to palette
- * NOT REFERENCED - stub
+ * One blit of a TransferToDIBBatch call. Same meaning as the
+ * TransferToDIB arguments; transColor = -1 copies without colour key
+ * (TransferToDIBFast behaviour). RKC_UPDIB declares the same layout as
+ * VS_BLIT.
  */
-extern "C" int __thiscall RKC_DIB_AddOffset(RKC_DIB* self, RGBQUAD offset, int flag) {
-    return 0;
+struct RKC_DIB_BLIT {
+    RKC_DIB* srcDIB;
+    long destX, destY;
+    long width, height;
+    long srcX, srcY;
+    long transColor;
+};
+
+// TransferToDIBBatch flags
+#define DIB_BATCH_SORT     0x01  // Blits don't overlap: reorder by destination row for locality
+#define DIB_BATCH_PARALLEL 0x02  // Composite horizontal bands on the worker pool
+
+static bool DIB_BlitLess(const RKC_DIB_BLIT& a, const RKC_DIB_BLIT& b) {
+    if (a.destY != b.destY) return a.destY < b.destY;
+    return a.destX < b.destX;
 }
 
 /**
- * RKC_DIB::ClearUnusedArea - Clear unused bitmap area
- * NOT REFERENCED - stub
+ * A blit after clipping and kernel selection, ready to run.
+ * ctx indexes DIB_BATCHSTATE::contexts (one entry per source change).
  */
-extern "C" int __thiscall RKC_DIB_ClearUnusedArea(RKC_DIB* self) {
-    return 0;
-}
+struct DIB_PREPBLIT {
+    DIB_BLITROW kernel;
+    long ctx;
+    const unsigned char* srcBits;
+    long srcStride, srcImgH;
+    long destX, destY, width, height, srcX, srcY;
+};
 
 /**
- * RKC_DIB::CompareBitmapColor - Compare pixel color at coordinates
- * NOT REFERENCED - stub
+ * Grow-only scratch buffers reused between batches, so a steady frame
+ * does no allocation. Guarded by lock (one batch at a time).
  */
-extern "C" int __thiscall RKC_DIB_CompareBitmapColor(RKC_DIB* self, long x, long y, RGBQUAD* color) {
-    return 0;
-}
+struct DIB_BATCHSTATE {
+    CRITICAL_SECTION lock;
+    DIB_PREPBLIT* prep;      long prepCap;
+    DIB_BLITCTX* contexts;   long contextCap;
+    long* binCounts;         long binCountCap;   // per band: start offset into binned
+    long* binned;            long binnedCap;     // prep indices grouped by band
 
-/**
- * RKC_DIB::Copy - Deep copy from source DIB
+    // Job currently being composited by the pool
+    unsigned char* destBits;
+    long destStride, destImgH;
+    WORD destBpp;
+    long bandHeight, bandCount;
+    volatile LONG nextBand;
+};
+
+static DIB_BATCHSTATE g_batch;
+
+static void DIB_BatchInit() {
+    InitializeCriticalSection(&g_batch.lock);
+}
+
+static bool DIB_GrowBuffer(void** buffer, long* capacity, long needed, size_t elemSize) {
+    if (needed <= *capacity) return true;
+    long newCap = *capacity ? *capacity : 64;
+    while (newCap < needed) newCap *= 2;
+    void* grown = realloc(*buffer, newCap * elemSize);
+    if (!grown) return false;
+    *buffer = grown;
+    *capacity = newCap;
+    return true;
+}
+
+/**
+ * Run one prepared blit restricted to dest rows [top, bottom).
+ */
+static void DIB_RunPrepBlit(const DIB_PREPBLIT& p, long top, long bottom) {
+    long destY = p.destY, srcY = p.srcY, height = p.height;
+    if (destY < top) { srcY += top - destY; height -= top - destY; destY = top; }
+    if (destY + height > bottom) height = bottom - destY;
+    if (height <= 0) return;
+    DIB_RunBlit(p.kernel, g_batch.contexts[p.ctx], g_batch.destBits, g_batch.destStride,
+                g_batch.destImgH, g_batch.destBpp, p.srcBits, p.srcStride, p.srcImgH,
+                p.destX, destY, p.width, height, p.srcX, srcY);
+}
+
+/**
+ * Claim bands until none are left. Each band runs its blits in the order
+ * they were submitted, so painter's order holds for every pixel.
+ */
+static void DIB_CompositeBands() {
+    for (;;) {
+        long band = InterlockedIncrement(&g_batch.nextBand) - 1;
+        if (band >= g_batch.bandCount) break;
+        long top = band * g_batch.bandHeight;
+        long bottom = top + g_batch.bandHeight;
+        for (long i = g_batch.binCounts[band]; i < g_batch.binCounts[band + 1]; i++) {
+            DIB_RunPrepBlit(g_batch.prep[g_batch.binned[i]], top, bottom);
+        }
+    }
+}
+
+// ============================================================================
+// COMPOSITOR WORKER POOL
+// ============================================================================
+
+/**
+ * Workers are created on first parallel batch (one per extra CPU, max
+ * DIB_MAX_WORKERS) and sleep on a semaphore between frames. The calling
+ * thread composites too. Bands are claimed from a shared counter, so a
+ * worker that finishes early keeps taking bands from the slow ones.
+ */
+#define DIB_MAX_WORKERS  15
+#define DIB_BAND_HEIGHT  64   // rows per band
+#define DIB_MIN_PARALLEL_PIXELS (256 * 256)  // smaller batches run serially
+
+static HANDLE g_workerStart = NULL;   // semaphore, released once per worker per job
+static HANDLE g_workerDone = NULL;    // auto-reset event, set by the last worker
+static volatile LONG g_workersBusy = 0;
+static long g_workerCount = -1;       // -1 = pool not created yet
+
+static DWORD WINAPI DIB_WorkerProc(LPVOID param) {
+    for (;;) {
+        WaitForSingleObject(g_workerStart, INFINITE);
+        DIB_CompositeBands();
+        if (InterlockedDecrement(&g_workersBusy) == 0) SetEvent(g_workerDone);
+    }
+    return 0;
+}
+
+static void DIB_InitWorkers() {
+    if (g_workerCount >= 0) return;
+    g_workerCount = 0;
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long wanted = (long)info.dwNumberOfProcessors - 1;
+    if (wanted > DIB_MAX_WORKERS) wanted = DIB_MAX_WORKERS;
+    if (wanted <= 0) return;
+
+    g_workerStart = CreateSemaphoreA(NULL, 0, DIB_MAX_WORKERS, NULL);
+    g_workerDone = CreateEventA(NULL, FALSE, FALSE, NULL);
+    if (!g_workerStart || !g_workerDone) return;
+
+    for (long i = 0; i < wanted; i++) {
+        HANDLE thread = CreateThread(NULL, 0, DIB_WorkerProc, NULL, 0, NULL);
+        if (!thread) break;
+        CloseHandle(thread);
+        g_workerCount++;
+    }
+}
+
+/**
+ * RKC_DIB::TransferToDIBBatch - Run many blits into this DIB in one pass
+ * USED BY: RKC_UPDIB.dll (VS::Render, the plain parts of one screen per call)
+ *
+ * Destination validation, stride and bpp are resolved once for the whole
+ * batch. Source-dependent state (stride, kernel, RGB555 palette table) is
+ * only rebuilt when the source DIB or colour key changes from the previous
+ * blit, so a layer drawn from one sheet pays for it once.
+ *
+ * Blits are drawn in array order (painter's order). With DIB_BATCH_SORT the
+ * caller promises the blits don't overlap and the ARRAY IS REORDERED in place
+ * by (destY, destX), so rows are written top to bottom.
+ *
+ * With DIB_BATCH_PARALLEL the destination is split into DIB_BAND_HEIGHT row
+ * bands, each blit is binned into the bands it touches, and bands are
+ * composited on the worker pool. Small batches fall back to the serial path.
+ *
+ * Returns: number of blits that drew something
+ */
+extern "C" long __thiscall RKC_DIB_TransferToDIBBatch(
+    RKC_DIB* self, RKC_DIB_BLIT* blits, long count, long flags)
+{
+    if (!blits || count <= 0) return 0;
+    if (!self->bitmap || !self->bitmapInfo) return 0;
+    HPROF_SCOPE("blit");
+    HPROF_COUNT("blits", count);
+    
+    EnterCriticalSection(&g_batch.lock);
+    
+    WORD destBpp = self->bitmapInfo->biBitCount;
+    long destImgW = self->bitmapInfo->biWidth;
+    long destImgH = self->bitmapInfo->biHeight;
+    
+    if (flags & DIB_BATCH_SORT) {
+        std::stable_sort(blits, blits + count, DIB_BlitLess);
+    }
+    
+    // Pass 1: validate, clip and pick kernels (cached while the source repeats)
+    long drawn = 0;
+    long prepCount = 0;
+    long contextCount = 0;
+    long pixels = 0;
+    if (!DIB_GrowBuffer((void**)&g_batch.prep, &g_batch.prepCap, count, sizeof(DIB_PREPBLIT))) {
+        LeaveCriticalSection(&g_batch.lock);
+        return 0;
+    }
+    
+    RKC_DIB* lastSrc = nullptr;
+    const RGBQUAD* lastPalette = nullptr;
+    long lastTrans = 0;
+    DIB_BLITROW kernel = nullptr;
+    WORD srcBpp = 0;
+    long srcImgW = 0, srcImgH = 0, srcStride = 0;
+    bool srcValid = false;
+    
+    for (long i = 0; i < count; i++) {
+        RKC_DIB_BLIT& b = blits[i];
+        RKC_DIB* src = b.srcDIB;
+        if (!src) continue;
+        
+        if (src != lastSrc || src->palette != lastPalette || b.transColor != lastTrans) {
+            lastSrc = src;
+            lastPalette = src->palette;
+            lastTrans = b.transColor;
+            srcValid = false;
+            kernel = nullptr;
+            if (src->bitmap && src->bitmapInfo) {
+                srcBpp = src->bitmapInfo->biBitCount;
+                if (DIB_IsTransferPair(srcBpp, destBpp) &&
+                    DIB_GrowBuffer((void**)&g_batch.contexts, &g_batch.contextCap,
+                                   contextCount + 1, sizeof(DIB_BLITCTX))) {
+                    srcImgW = src->bitmapInfo->biWidth;
+                    srcImgH = src->bitmapInfo->biHeight;
+                    srcStride = RKC_DIB_GetAlignWidth(src);
+                    kernel = DIB_SelectBlitKernel(srcBpp, destBpp, src->palette, b.transColor,
+                                                  &g_batch.contexts[contextCount++]);
+                    srcValid = true;
+                }
+            }
+        }
+        if (!srcValid) continue;
+        
+        DIB_PREPBLIT p;
+        p.destX = b.destX; p.destY = b.destY; p.width = b.width; p.height = b.height;
+        p.srcX = b.srcX; p.srcY = b.srcY;
+        if (!DIB_ClipTransfer(destImgW, destImgH, srcImgW, srcImgH,
+                              &p.destX, &p.destY, &p.width, &p.height, &p.srcX, &p.srcY)) {
+            continue;
+        }
+        drawn++;
+        if (!kernel) continue;
+        
+        p.kernel = kernel;
+        p.ctx = contextCount - 1;
+        p.srcBits = src->bitmap;
+        p.srcStride = srcStride;
+        p.srcImgH = srcImgH;
+        g_batch.prep[prepCount++] = p;
+        pixels += p.width * p.height;
+    }
+    
+    g_batch.destBits = self->bitmap;
+    g_batch.destStride = RKC_DIB_GetAlignWidth(self);
+    g_batch.destImgH = destImgH;
+    g_batch.destBpp = destBpp;
+    
+    bool parallel = (flags & DIB_BATCH_PARALLEL) && pixels >= DIB_MIN_PARALLEL_PIXELS &&
+                    destImgH > DIB_BAND_HEIGHT;
+    if (parallel) {
+        DIB_InitWorkers();
+        parallel = g_workerCount > 0;
+    }
+    
+    long bandCount = (destImgH + DIB_BAND_HEIGHT - 1) / DIB_BAND_HEIGHT;
+    if (parallel) {
+        // Pass 2: bin prepared blits by band (counting sort keeps submission order)
+        long touches = 0;
+        if (!DIB_GrowBuffer((void**)&g_batch.binCounts, &g_batch.binCountCap, bandCount + 1, sizeof(long))) {
+            parallel = false;
+        } else {
+            memset(g_batch.binCounts, 0, (bandCount + 1) * sizeof(long));
+            for (long i = 0; i < prepCount; i++) {
+                const DIB_PREPBLIT& p = g_batch.prep[i];
+                long first = p.destY / DIB_BAND_HEIGHT;
+                long last = (p.destY + p.height - 1) / DIB_BAND_HEIGHT;
+                for (long band = first; band <= last; band++) g_batch.binCounts[band + 1]++;
+                touches += last - first + 1;
+            }
+            if (!DIB_GrowBuffer((void**)&g_batch.binned, &g_batch.binnedCap, touches, sizeof(long))) {
+                parallel = false;
+            }
+        }
+        
+        if (parallel) {
+            for (long band = 0; band < bandCount; band++) {
+                g_batch.binCounts[band + 1] += g_batch.binCounts[band];
+            }
+            // Fill using binCounts[band] as a cursor, then shift back to starts
+            for (long i = 0; i < prepCount; i++) {
+                const DIB_PREPBLIT& p = g_batch.prep[i];
+                long first = p.destY / DIB_BAND_HEIGHT;
+                long last = (p.destY + p.height - 1) / DIB_BAND_HEIGHT;
+                for (long band = first; band <= last; band++) {
+                    g_batch.binned[g_batch.binCounts[band]++] = i;
+                }
+            }
+            for (long band = bandCount; band > 0; band--) {
+                g_batch.binCounts[band] = g_batch.binCounts[band - 1];
+            }
+            g_batch.binCounts[0] = 0;
+            
+            // Pass 3: composite bands on the pool and on this thread
+            g_batch.bandHeight = DIB_BAND_HEIGHT;
+            g_batch.bandCount = bandCount;
+            g_batch.nextBand = 0;
+            long workers = g_workerCount < bandCount - 1 ? g_workerCount : bandCount - 1;
+            g_workersBusy = workers;
+            if (workers > 0) ReleaseSemaphore(g_workerStart, workers, NULL);
+            DIB_CompositeBands();
+            if (workers > 0) WaitForSingleObject(g_workerDone, INFINITE);
+        }
+    }
+    
+    if (!parallel) {
+        for (long i = 0; i < prepCount; i++) {
+            DIB_RunPrepBlit(g_batch.prep[i], 0, destImgH);
+        }
+    }
+    
+    LeaveCriticalSection(&g_batch.lock);
+    return drawn;
+}
+
+// ============================================================================
+// CONVERSION - CHANGE BIT DEPTH
+// ============================================================================
+
+/**
+ * Convert works row by row through one of two intermediate rows:
+ *   - an 8-bit index row for paletted data (1/4/8 bpp), or
+ *   - a 15-bit RGB555 key row for direct-colour data going to a palette.
+ * Every row loop is a flat array walk with no per-pixel format branches.
+ *
+ * Direct colour -> palette uses an inverse colour map: a 32K table giving
+ * the nearest palette index for every RGB555 colour. Building one costs
+ * 32K x palette-size distance checks, so the last few maps are cached and
+ * reused while the palette doesn't change. Batch workers convert on several
+ * threads at once, so the cache is guarded by g_invCmapLock and a map in use
+ * is pinned: it is never evicted or rebuilt under a conversion reading it.
+ */
+
+// ConvertEx flags
+#define DIB_CONVERT_DITHER 0x01  // Ordered (4x4 Bayer) dither when reducing to a palette
+
+#define DIB_INVCMAP_SLOTS 4
+
+struct DIB_INVCMAP {
+    DWORD hash;
+    long count;
+    RGBQUAD palette[256];
+    unsigned long lastUse;
+    long users;               // conversions reading map; pinned while > 0
+    unsigned char map[32768];
+};
+
+static CRITICAL_SECTION g_invCmapLock;
+static DIB_INVCMAP* g_invCmaps[DIB_INVCMAP_SLOTS];
+static unsigned long g_invCmapClock = 0;
+
+static void DIB_InvCmapInit() {
+    InitializeCriticalSection(&g_invCmapLock);
+}
+
+static DWORD DIB_HashPalette(const RGBQUAD* palette, long count) {
+    DWORD hash = 2166136261u;  // FNV-1a
+    const unsigned char* bytes = (const unsigned char*)palette;
+    for (long i = 0; i < count * 4; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Nearest entry to the centre of each RGB555 cell
+static void DIB_BuildInverseColorMap(DIB_INVCMAP* slot, const RGBQUAD* palette, long count) {
+    for (long key = 0; key < 32768; key++) {
+        long r = ((key >> 10) & 0x1F) * 8 + 4;
+        long g = ((key >> 5) & 0x1F) * 8 + 4;
+        long b = (key & 0x1F) * 8 + 4;
+        long best = 0, bestDist = 0x7FFFFFFF;
+        for (long i = 0; i < count; i++) {
+            long dr = r - palette[i].rgbRed;
+            long dg = g - palette[i].rgbGreen;
+            long db = b - palette[i].rgbBlue;
+            long dist = dr * dr + dg * dg + db * db;
+            if (dist < bestDist) { bestDist = dist; best = i; }
+        }
+        slot->map[key] = (unsigned char)best;
+    }
+}
+
+/**
+ * Get the inverse colour map for a palette, building it on a cache miss,
+ * and pin it until DIB_ReleaseInverseColorMap. When every slot is pinned
+ * by another thread the map is built into a private block instead.
+ * Returns NULL only if allocation fails.
+ */
+static DIB_INVCMAP* DIB_AcquireInverseColorMap(const RGBQUAD* palette, long count) {
+    if (count > 256) count = 256;
+    DWORD hash = DIB_HashPalette(palette, count);
+    EnterCriticalSection(&g_invCmapLock);
+    g_invCmapClock++;
+
+    int victim = -1;
+    for (int i = 0; i < DIB_INVCMAP_SLOTS; i++) {
+        DIB_INVCMAP* slot = g_invCmaps[i];
+        if (slot && slot->hash == hash && slot->count == count &&
+            memcmp(slot->palette, palette, count * sizeof(RGBQUAD)) == 0) {
+            slot->lastUse = g_invCmapClock;
+            slot->users++;
+            LeaveCriticalSection(&g_invCmapLock);
+            return slot;
+        }
+        if (!slot) {
+            if (victim < 0 || g_invCmaps[victim]) victim = i;
+        } else if (!slot->users && (victim < 0 || (g_invCmaps[victim] && slot->lastUse < g_invCmaps[victim]->lastUse))) {
+            victim = i;
+        }
+    }
+
+    DIB_INVCMAP* slot = victim >= 0 ? g_invCmaps[victim] : nullptr;
+    if (!slot) {
+        slot = (DIB_INVCMAP*)malloc(sizeof(DIB_INVCMAP));
+        if (!slot) {
+            LeaveCriticalSection(&g_invCmapLock);
+            return nullptr;
+        }
+        if (victim >= 0) g_invCmaps[victim] = slot;
+    }
+    slot->hash = hash;
+    slot->count = count;
+    slot->lastUse = g_invCmapClock;
+    slot->users = 1;
+    memcpy(slot->palette, palette, count * sizeof(RGBQUAD));
+    DIB_BuildInverseColorMap(slot, palette, count);
+    LeaveCriticalSection(&g_invCmapLock);
+    return slot;
+}
+
+static void DIB_ReleaseInverseColorMap(DIB_INVCMAP* cmap) {
+    EnterCriticalSection(&g_invCmapLock);
+    bool cached = false;
+    for (int i = 0; i < DIB_INVCMAP_SLOTS; i++) {
+        if (g_invCmaps[i] == cmap) cached = true;
+    }
+    cmap->users--;
+    LeaveCriticalSection(&g_invCmapLock);
+    if (!cached) free(cmap);
+}
+
+/**
+ * Fill a palette for a freshly created paletted DIB that receives
+ * direct-colour data: 3-3-2 RGB cube for 8bpp, the VGA colours for 4bpp,
+ * black/white for 1bpp.
+ */
+static void DIB_SetDefaultPalette(RGBQUAD* palette, WORD bpp) {
+    static const unsigned char vga[16][3] = {
+        {0,0,0}, {128,0,0}, {0,128,0}, {128,128,0}, {0,0,128}, {128,0,128}, {0,128,128}, {192,192,192},
+        {128,128,128}, {255,0,0}, {0,255,0}, {255,255,0}, {0,0,255}, {255,0,255}, {0,255,255}, {255,255,255}
+    };
+    if (bpp == 8) {
+        for (int i = 0; i < 256; i++) {
+            palette[i].rgbRed = (unsigned char)(((i >> 5) & 7) * 255 / 7);
+            palette[i].rgbGreen = (unsigned char)(((i >> 2) & 7) * 255 / 7);
+            palette[i].rgbBlue = (unsigned char)((i & 3) * 255 / 3);
+            palette[i].rgbReserved = 0;
+        }
+    } else if (bpp == 4) {
+        for (int i = 0; i < 16; i++) {
+            palette[i].rgbRed = vga[i][0];
+            palette[i].rgbGreen = vga[i][1];
+            palette[i].rgbBlue = vga[i][2];
+            palette[i].rgbReserved = 0;
+        }
+    } else {
+        memset(palette, 0, 2 * sizeof(RGBQUAD));
+        palette[1].rgbRed = palette[1].rgbGreen = palette[1].rgbBlue = 255;
+    }
+}
+
+// Unpack a 1/4/8bpp row to one index per byte
+static void DIB_UnpackIndexRow(unsigned char* out, const unsigned char* src, long width, WORD bpp) {
+    if (bpp == 8) {
+        memcpy(out, src, width);
+        return;
+    }
+    for (long x = 0; x < width; x++) out[x] = DIB_LowIndex(src, x, bpp);
+}
+
+/**
+ * Pack an index row into a 1/4/8bpp row. Narrowing follows the original
+ * Convert: 4bpp keeps the low nibble, 1bpp is "index != 0".
+ */
+static void DIB_PackIndexRow(unsigned char* dst, const unsigned char* idx, long width, WORD bpp) {
+    if (bpp == 8) {
+        memcpy(dst, idx, width);
+    } else if (bpp == 4) {
+        for (long x = 0; x + 1 < width; x += 2) {
+            dst[x >> 1] = (unsigned char)((idx[x] << 4) | (idx[x + 1] & 0x0F));
+        }
+        if (width & 1) dst[width >> 1] = (unsigned char)(idx[width - 1] << 4);
+    } else {
+        for (long x = 0; x < width; x += 8) {
+            unsigned char bits = 0;
+            long n = width - x < 8 ? width - x : 8;
+            for (long i = 0; i < n; i++) {
+                if (idx[x + i]) bits |= (unsigned char)(0x80 >> i);
+            }
+            dst[x >> 3] = bits;
+        }
+    }
+}
+
+// Direct-colour row -> RGB555 keys, optionally with ordered dither
+static void DIB_KeyRow(unsigned short* keys, const unsigned char* src, long width, WORD bpp,
+                       long y, bool dither) {
+    static const signed char bayer[4][4] = {
+        {-15,  1, -11,  5}, {  9, -7,  13, -3}, { -9,  7, -13,  3}, { 15, -1,  11, -5}
+    };
+    if (bpp == 16 && !dither) {
+        const unsigned short* src16 = (const unsigned short*)src;
+        for (long x = 0; x < width; x++) keys[x] = src16[x] & 0x7FFF;
+        return;
+    }
+    for (long x = 0; x < width; x++) {
+        long r, g, b;
+        if (bpp == 16) {
+            unsigned short p = ((const unsigned short*)src)[x];
+            r = (p >> 7) & 0xF8; g = (p >> 2) & 0xF8; b = (p << 3) & 0xF8;
+        } else {
+            b = src[x*3 + 0]; g = src[x*3 + 1]; r = src[x*3 + 2];
+        }
+        if (dither) {
+            long d = bayer[y & 3][x & 3];
+            r += d; g += d; b += d;
+            r = r < 0 ? 0 : (r > 255 ? 255 : r);
+            g = g < 0 ? 0 : (g > 255 ? 255 : g);
+            b = b < 0 ? 0 : (b > 255 ? 255 : b);
+        }
+        keys[x] = (unsigned short)(((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3));
+    }
+}
+
+/**
+ * RKC_DIB::ConvertEx - Convert source into this DIB at another bit depth
+ * USED BY: OpenShadowFlare (exported as RKC_DIB_ConvertEx)
+ *
+ * Same as Convert plus flags (DIB_CONVERT_DITHER). Any pair of 1/4/8/16/24
+ * bpp is accepted; converting to the same depth copies pixels and palette.
+ */
+extern "C" int __thiscall RKC_DIB_ConvertEx(RKC_DIB* self, RKC_DIB* source, long bpp, long flags) {
+    if (!source->bitmap || !source->bitmapInfo) return 0;
+    WORD srcBpp = source->bitmapInfo->biBitCount;
+    if (srcBpp != 1 && srcBpp != 4 && srcBpp != 8 && srcBpp != 16 && srcBpp != 24) return 0;
+
+    // Existing destination of the requested depth keeps its palette; an empty
+    // one, or one of another depth, is created at bpp with source's size
+    bool created = false;
+    if (!self->bitmapInfo || self->bitmapInfo->biBitCount != bpp) {
+        if (!RKC_DIB_Create(self, source->bitmapInfo->biWidth, source->bitmapInfo->biHeight, bpp, 1)) {
+            return 0;
+        }
+        created = true;
+    }
+    if (!self->bitmap) return 0;
+    WORD destBpp = self->bitmapInfo->biBitCount;
+    if (destBpp != 1 && destBpp != 4 && destBpp != 8 && destBpp != 16 && destBpp != 24) return 0;
+
+    long width = self->bitmapInfo->biWidth;
+    long height = self->bitmapInfo->biHeight;
+    if (source->bitmapInfo->biWidth < width) width = source->bitmapInfo->biWidth;
+    if (source->bitmapInfo->biHeight < height) height = source->bitmapInfo->biHeight;
+
+    long srcStride = RKC_DIB_GetAlignWidth(source);
+    long destStride = RKC_DIB_GetAlignWidth(self);
+    const unsigned char* src = source->bitmap;
+    unsigned char* dst = self->bitmap;
+
+    bool srcIndexed = (srcBpp <= 8);
+    bool destIndexed = (destBpp <= 8);
+
+    // Same depth: straight row copy
+    if (srcBpp == destBpp) {
+        long rowBytes = (width * srcBpp + 7) / 8;
+        for (long y = 0; y < height; y++) {
+            memcpy(dst + y * destStride, src + y * srcStride, rowBytes);
+        }
+        if (srcIndexed && source->palette && self->palette) {
+            memcpy(self->palette, source->palette, (1 << srcBpp) * sizeof(RGBQUAD));
+        }
+        return 1;
+    }
+
+    // Paletted -> paletted (indices carried over, palette only when widening)
+    if (srcIndexed && destIndexed) {
+        unsigned char* idx = (unsigned char*)malloc(width + 8);
+        if (!idx) return 0;
+        for (long y = 0; y < height; y++) {
+            DIB_UnpackIndexRow(idx, src + y * srcStride, width, srcBpp);
+            DIB_PackIndexRow(dst + y * destStride, idx, width, destBpp);
+        }
+        free(idx);
+        if (destBpp > srcBpp && source->palette) {
+            long count = RKC_DIB_GetPaletteCount(source);
+            if (count > (1 << destBpp)) count = 1 << destBpp;
+            if (count > 0) memcpy(self->palette, source->palette, count * sizeof(RGBQUAD));
+        }
+        return 1;
+    }
+
+    // Paletted -> direct colour: expand through the palette
+    if (srcIndexed) {
+        if (!source->palette) return 0;
+        unsigned char* idx = (unsigned char*)malloc(width + 8);
+        if (!idx) return 0;
+        unsigned short pal16[256];
+        long count = 1 << srcBpp;
+        for (long i = 0; i < count; i++) {
+            const RGBQUAD& c = source->palette[i];
+            pal16[i] = ((c.rgbRed & 0xF8) << 7) | ((c.rgbGreen & 0xF8) << 2) | (c.rgbBlue >> 3);
+        }
+        for (long y = 0; y < height; y++) {
+            DIB_UnpackIndexRow(idx, src + y * srcStride, width, srcBpp);
+            unsigned char* row = dst + y * destStride;
+            if (destBpp == 16) {
+                unsigned short* row16 = (unsigned short*)row;
+                for (long x = 0; x < width; x++) row16[x] = pal16[idx[x]];
+            } else {
+                for (long x = 0; x < width; x++) {
+                    const RGBQUAD& c = source->palette[idx[x]];
+                    row[x*3 + 0] = c.rgbBlue;
+                    row[x*3 + 1] = c.rgbGreen;
+                    row[x*3 + 2] = c.rgbRed;
+                }
+            }
+        }
+        free(idx);
+        return 1;
+    }
+
+    // Direct colour -> direct colour (16 <-> 24)
+    if (!destIndexed) {
+        for (long y = 0; y < height; y++) {
+            const unsigned char* srow = src + y * srcStride;
+            unsigned char* drow = dst + y * destStride;
+            if (destBpp == 16) {
+                unsigned short* d16 = (unsigned short*)drow;
+                for (long x = 0; x < width; x++) {
+                    d16[x] = ((srow[x*3 + 2] & 0xF8) << 7) | ((srow[x*3 + 1] & 0xF8) << 2) | (srow[x*3] >> 3);
+                }
+            } else {
+                const unsigned short* s16 = (const unsigned short*)srow;
+                for (long x = 0; x < width; x++) {
+                    unsigned short p = s16[x];
+                    drow[x*3 + 0] = (unsigned char)((p << 3) & 0xF8);
+                    drow[x*3 + 1] = (unsigned char)((p >> 2) & 0xF8);
+                    drow[x*3 + 2] = (unsigned char)((p >> 7) & 0xF8);
+                }
+            }
+        }
+        return 1;
+    }
+
+    // Direct colour -> paletted: quantize through the inverse colour map
+    if (created) DIB_SetDefaultPalette(self->palette, destBpp);
+    long palCount = RKC_DIB_GetPaletteCount(self);
+    if (palCount > (1 << destBpp)) palCount = 1 << destBpp;
+    if (palCount <= 0) return 0;
+    DIB_INVCMAP* cmap = DIB_AcquireInverseColorMap(self->palette, palCount);
+    if (!cmap) return 0;
+    const unsigned char* invMap = cmap->map;
+
+    unsigned short* keys = (unsigned short*)malloc(width * sizeof(unsigned short));
+    unsigned char* idx = (unsigned char*)malloc(width + 8);
+    if (!keys || !idx) {
+        free(keys);
+        free(idx);
+        DIB_ReleaseInverseColorMap(cmap);
+        return 0;
+    }
+    bool dither = (flags & DIB_CONVERT_DITHER) != 0;
+    for (long y = 0; y < height; y++) {
+        // Dither pattern is anchored to the visual top row (DIBs are bottom-up)
+        DIB_KeyRow(keys, src + y * srcStride, width, srcBpp, height - 1 - y, dither);
+        for (long x = 0; x < width; x++) idx[x] = invMap[keys[x]];
+        DIB_PackIndexRow(dst + y * destStride, idx, width, destBpp);
+    }
+    free(keys);
+    free(idx);
+    DIB_ReleaseInverseColorMap(cmap);
+    return 1;
+}
+
+/**
+ * RKC_DIB::Convert - Convert source into this DIB at another bit depth
+ * USED BY: ShadowFlare.exe
+ *
+ * If this DIB is empty, or not at bpp, it is (re)created with source's
+ * size at bpp; an existing DIB at bpp keeps its size and palette. The original only handled
+ * paletted sources (1/4/8 -> 1/4/8/24); this version accepts every pair,
+ * quantizing 16/24bpp sources to the destination palette.
+ * Returns: 1 on success, 0 on failure
+ */
+extern "C" int __thiscall RKC_DIB_Convert(RKC_DIB* self, RKC_DIB* source, long bpp) {
+    return RKC_DIB_ConvertEx(self, source, bpp, 0);
+}
+
+// ============================================================================
+// PRIMITIVE RASTERIZER - USED BY o_RKC_UPDIB.dll (VSPACKET RenderPoint/Line/Box/Fill)
+// ============================================================================
+
+/**
+ * Common parameters of DrawPoint/DrawLine/DrawBox/DrawFill:
+ *   r, g, b - colour (for 1/4/8 bpp targets, r is the palette index)
+ *   alpha   - strength in 1/1000 units (1000 = opaque)
+ *   flags   - 0x04: additive, 0x08: brightness (alpha < 1000 darkens,
+ *             alpha > 1000 lightens), otherwise alpha blend
+ *   clip    - optional clip rect, right/bottom INCLUSIVE (as in the original)
+ *
+ * The original clipped per pixel inside DrawPoint and built lines and boxes
+ * from DrawPoint calls. Here every primitive is clipped once against
+ * clip ∩ bitmap and then rasterized as horizontal spans, with the paint
+ * mode resolved once per call. Paletted targets ignore alpha/flags and
+ * write the index, like the original 8bpp path.
+ */
+
+// Paint modes, resolved once per Draw* call
+#define DIB_PAINT_NONE    0  // brightness mode at alpha 1000 - nothing to do
+#define DIB_PAINT_COPY    1
+#define DIB_PAINT_BLEND   2
+#define DIB_PAINT_ADD     3
+#define DIB_PAINT_DARKEN  4
+#define DIB_PAINT_LIGHTEN 5
+
+struct DIB_PAINTOP {
+    int mode;
+    unsigned char index;       // 1/4/8 bpp: palette index
+    unsigned short packed16;   // 16 bpp: RGB555 colour for COPY
+    unsigned char bgr[3];      // 24 bpp: colour in memory order
+    long term[3];              // per-channel source term (BGR order)
+    long inv;                  // BLEND: 1000 - alpha, DARKEN/LIGHTEN: factor
+};
+
+struct DIB_RASTER {
+    unsigned char* bits;
+    long stride;
+    long width;
+    long height;
+    WORD bpp;
+};
+
+static bool DIB_GetRaster(RKC_DIB* dib, DIB_RASTER* out) {
+    if (!dib->bitmap || !dib->bitmapInfo) return false;
+    WORD bpp = dib->bitmapInfo->biBitCount;
+    if (bpp != 1 && bpp != 4 && bpp != 8 && bpp != 16 && bpp != 24) return false;
+    out->bits = dib->bitmap;
+    out->stride = RKC_DIB_GetAlignWidth(dib);
+    out->width = dib->bitmapInfo->biWidth;
+    out->height = dib->bitmapInfo->biHeight;
+    out->bpp = bpp;
+    return out->stride > 0;
+}
+
+/**
+ * Intersect bitmap bounds with the optional clip rect.
+ * Output is inclusive on all sides. Returns false if nothing is visible.
+ */
+static bool DIB_GetPaintBounds(const DIB_RASTER& r, const RECT* clip, RECT* out) {
+    out->left = 0;
+    out->top = 0;
+    out->right = r.width - 1;
+    out->bottom = r.height - 1;
+    if (clip) {
+        if (clip->left > out->left) out->left = clip->left;
+        if (clip->top > out->top) out->top = clip->top;
+        if (clip->right < out->right) out->right = clip->right;
+        if (clip->bottom < out->bottom) out->bottom = clip->bottom;
+    }
+    return out->left <= out->right && out->top <= out->bottom;
+}
+
+static void DIB_ResolvePaintOp(DIB_PAINTOP* op, unsigned char r, unsigned char g, unsigned char b,
+                               long alpha, long flags) {
+    op->index = r;
+    op->packed16 = (unsigned short)(((r & 0xF8) << 7) | ((g & 0xF8) << 2) | (b >> 3));
+    op->bgr[0] = b;
+    op->bgr[1] = g;
+    op->bgr[2] = r;
+    op->inv = 0;
+
+    if (flags & 4) {
+        // Additive: alpha > 1000 pushes the added colour towards white
+        op->mode = DIB_PAINT_ADD;
+        for (int i = 0; i < 3; i++) {
+            long c = op->bgr[i];
+            op->term[i] = (alpha <= 1000) ? c * alpha / 1000 : c + (255 - c) * (alpha - 1000) / 1000;
+        }
+    } else if (flags & 8) {
+        // Brightness: colour is ignored
+        if (alpha < 1000) {
+            op->mode = DIB_PAINT_DARKEN;
+            op->inv = 1000 - alpha;
+        } else if (alpha > 1000) {
+            op->mode = DIB_PAINT_LIGHTEN;
+            op->inv = alpha - 1000;
+        } else {
+            op->mode = DIB_PAINT_NONE;
+        }
+    } else if (alpha == 1000) {
+        op->mode = DIB_PAINT_COPY;
+    } else {
+        op->mode = DIB_PAINT_BLEND;
+        op->inv = 1000 - alpha;
+        for (int i = 0; i < 3; i++) {
+            op->term[i] = op->bgr[i] * alpha / 1000;
+        }
+    }
+}
+
+// Apply a non-COPY paint mode to one 8-bit channel (i = BGR channel index)
+static inline unsigned char DIB_PaintChannel(const DIB_PAINTOP& op, int i, long c) {
+    switch (op.mode) {
+        case DIB_PAINT_BLEND:   return (unsigned char)(c * op.inv / 1000 + op.term[i]);
+        case DIB_PAINT_ADD:     c += op.term[i]; return (unsigned char)(c > 255 ? 255 : c);
+        case DIB_PAINT_DARKEN:  return (unsigned char)(c - c * op.inv / 1000);
+        case DIB_PAINT_LIGHTEN: return (unsigned char)(c + (255 - c) * op.inv / 1000);
+        default:                return (unsigned char)c;
+    }
+}
+
+/**
+ * Paint the inclusive span [x0, x1] on row y. Caller has already clipped.
+ */
+static void DIB_PaintSpan(const DIB_RASTER& r, long x0, long x1, long y, const DIB_PAINTOP& op) {
+    if (op.mode == DIB_PAINT_NONE) return;
+
+    unsigned char* row = r.bits + (r.height - y - 1) * r.stride;
+    long count = x1 - x0 + 1;
+
+    switch (r.bpp) {
+        case 1: {
+            for (long x = x0; x <= x1; x++) {
+                unsigned char mask = (unsigned char)(0x80 >> (x & 7));
+                if (op.index & 1) row[x >> 3] |= mask;
+                else row[x >> 3] &= (unsigned char)~mask;
+            }
+            return;
+        }
+        case 4: {
+            unsigned char idx = op.index & 0x0F;
+            for (long x = x0; x <= x1; x++) {
+                unsigned char* p = row + (x >> 1);
+                if (x & 1) *p = (unsigned char)((*p & 0xF0) | idx);
+                else *p = (unsigned char)((*p & 0x0F) | (idx << 4));
+            }
+            return;
+        }
+        case 8:
+            memset(row + x0, op.index, count);
+            return;
+        case 16: {
+            unsigned short* p = (unsigned short*)row + x0;
+            if (op.mode == DIB_PAINT_COPY) {
+                for (long i = 0; i < count; i++) p[i] = op.packed16;
+                return;
+            }
+            for (long i = 0; i < count; i++) {
+                unsigned short px = p[i];
+                unsigned char b = DIB_PaintChannel(op, 0, (px << 3) & 0xF8);
+                unsigned char g = DIB_PaintChannel(op, 1, (px >> 2) & 0xF8);
+                unsigned char rr = DIB_PaintChannel(op, 2, (px >> 7) & 0xF8);
+                p[i] = (unsigned short)(((rr & 0xF8) << 7) | ((g & 0xF8) << 2) | (b >> 3));
+            }
+            return;
+        }
+        case 24: {
+            unsigned char* p = row + x0 * 3;
+            if (op.mode == DIB_PAINT_COPY) {
+                for (long i = 0; i < count; i++, p += 3) {
+                    p[0] = op.bgr[0];
+                    p[1] = op.bgr[1];
+                    p[2] = op.bgr[2];
+                }
+                return;
+            }
+            for (long i = 0; i < count; i++, p += 3) {
+                p[0] = DIB_PaintChannel(op, 0, p[0]);
+                p[1] = DIB_PaintChannel(op, 1, p[1]);
+                p[2] = DIB_PaintChannel(op, 2, p[2]);
+            }
+            return;
+        }
+    }
+}
+
+/**
+ * Rasterize the line (x1,y1)-(x2,y2), both endpoints included.
+ *
+ * Walks the major axis one pixel per step with the minor axis at
+ * floor(i * (minor + 1) / (major + 1)), which is exactly the point set of
+ * the original division-based loop, but computed with an integer error
+ * term. The visible step range is solved up front from the bounds so no
+ * pixel outside them is visited, and x-major lines are emitted as runs.
+ */
+static void DIB_RasterLine(const DIB_RASTER& r, const RECT& bounds, long x1, long y1, long x2, long y2,
+                           const DIB_PAINTOP& op) {
+    long dx = (x2 > x1) ? x2 - x1 : x1 - x2;
+    long dy = (y2 > y1) ? y2 - y1 : y1 - y2;
+    long sx = (x2 >= x1) ? 1 : -1;
+    long sy = (y2 >= y1) ? 1 : -1;
+
+    // Original picks the y-major loop on ties
+    bool xMajor = dx > dy;
+    long major = xMajor ? dx : dy;
+    long minor = xMajor ? dy : dx;
+    long majStart = xMajor ? x1 : y1, majStep = xMajor ? sx : sy;
+    long minStart = xMajor ? y1 : x1, minStep = xMajor ? sy : sx;
+    long majLo = xMajor ? bounds.left : bounds.top, majHi = xMajor ? bounds.right : bounds.bottom;
+    long minLo = xMajor ? bounds.top : bounds.left, minHi = xMajor ? bounds.bottom : bounds.right;
+
+    long long A = minor + 1;
+    long long B = major + 1;
+    long long i0 = 0, i1 = major;
+
+    // Major axis: coordinate = majStart + majStep * i
+    long long a = (long long)(majLo - majStart) * majStep;
+    long long b = (long long)(majHi - majStart) * majStep;
+    if (a > b) { long long t = a; a = b; b = t; }
+    if (a > i0) i0 = a;
+    if (b < i1) i1 = b;
+
+    // Minor axis: offset k(i) = floor(i*A/B) is monotonic, so the visible
+    // offsets [kLo, kHi] map to a contiguous step range
+    long long kLo = (long long)(minLo - minStart) * minStep;
+    long long kHi = (long long)(minHi - minStart) * minStep;
+    if (kLo > kHi) { long long t = kLo; kLo = kHi; kHi = t; }
+    if (kHi < 0) return;
+    if (kLo > 0) {
+        long long first = (kLo * B + A - 1) / A;          // smallest i with k(i) >= kLo
+        if (first > i0) i0 = first;
+    }
+    long long last = ((kHi + 1) * B + A - 1) / A - 1;     // largest i with k(i) <= kHi
+    if (last < i1) i1 = last;
+    if (i0 > i1) return;
+
+    long long k = i0 * A / B;
+    long long err = i0 * A % B;
+    long majPos = majStart + (long)(majStep * i0);
+    long minPos = minStart + (long)(minStep * k);
+
+    if (xMajor) {
+        long runStart = majPos;
+        for (long long i = i0; i <= i1; i++) {
+            long x = majPos;
+            majPos += majStep;
+            err += A;
+            bool stepMinor = err >= B;
+            if (stepMinor || i == i1) {
+                DIB_PaintSpan(r, runStart < x ? runStart : x, runStart < x ? x : runStart, minPos, op);
+                runStart = majPos;
+            }
+            if (stepMinor) {
+                err -= B;
+                minPos += minStep;
+            }
+        }
+    } else {
+        for (long long i = i0; i <= i1; i++) {
+            DIB_PaintSpan(r, minPos, minPos, majPos, op);
+            majPos += majStep;
+            err += A;
+            if (err >= B) {
+                err -= B;
+                minPos += minStep;
+            }
+        }
+    }
+}
+
+/**
+ * RKC_DIB::DrawPoint - Plot one pixel
+ * USED BY: o_RKC_UPDIB.dll
+ *
+ * Returns: 1 if the pixel was painted, 0 if clipped or unsupported bpp
+ */
+extern "C" int __thiscall RKC_DIB_DrawPoint(
+    RKC_DIB* self, long x, long y, unsigned char r, unsigned char g, unsigned char b,
+    long alpha, long flags, RECT* clip)
+{
+    DIB_RASTER raster;
+    RECT bounds;
+    if (!DIB_GetRaster(self, &raster)) return 0;
+    if (!DIB_GetPaintBounds(raster, clip, &bounds)) return 0;
+    if (x < bounds.left || x > bounds.right || y < bounds.top || y > bounds.bottom) return 0;
+
+    DIB_PAINTOP op;
+    DIB_ResolvePaintOp(&op, r, g, b, alpha, flags);
+    DIB_PaintSpan(raster, x, x, y, op);
+    return 1;
+}
+
+/**
+ * RKC_DIB::DrawLine - Draw a line including both endpoints
+ * USED BY: o_RKC_UPDIB.dll
+ *
+ * As in the original, a zero-length line draws nothing.
+ * Returns: 1 on success, 0 if unsupported bpp
+ */
+extern "C" int __thiscall RKC_DIB_DrawLine(
+    RKC_DIB* self, long x1, long y1, long x2, long y2,
+    unsigned char r, unsigned char g, unsigned char b, long alpha, long flags, RECT* clip)
+{
+    DIB_RASTER raster;
+    RECT bounds;
+    if (!DIB_GetRaster(self, &raster)) return 0;
+    if (x1 == x2 && y1 == y2) return 1;
+    if (!DIB_GetPaintBounds(raster, clip, &bounds)) return 1;
+
+    DIB_PAINTOP op;
+    DIB_ResolvePaintOp(&op, r, g, b, alpha, flags);
+    DIB_RasterLine(raster, bounds, x1, y1, x2, y2, op);
+    return 1;
+}
+
+/**
+ * RKC_DIB::DrawBox - Draw a rectangle outline
+ * USED BY: o_RKC_UPDIB.dll
+ *
+ * The original drew four DrawLine edges, blending the corner pixels twice.
+ * Here each outline pixel is painted exactly once: top and bottom rows as
+ * spans, then the left/right columns between them.
+ * Returns: 1 on success, 0 if unsupported bpp
+ */
+extern "C" int __thiscall RKC_DIB_DrawBox(
+    RKC_DIB* self, long x1, long y1, long x2, long y2,
+    unsigned char r, unsigned char g, unsigned char b, long alpha, long flags, RECT* clip)
+{
+    DIB_RASTER raster;
+    RECT bounds;
+    if (!DIB_GetRaster(self, &raster)) return 0;
+    if (!DIB_GetPaintBounds(raster, clip, &bounds)) return 1;
+
+    long left = (x1 < x2) ? x1 : x2;
+    long right = (x1 < x2) ? x2 : x1;
+    long top = (y1 < y2) ? y1 : y2;
+    long bottom = (y1 < y2) ? y2 : y1;
+
+    DIB_PAINTOP op;
+    DIB_ResolvePaintOp(&op, r, g, b, alpha, flags);
+
+    long sl = (left > bounds.left) ? left : bounds.left;
+    long sr = (right < bounds.right) ? right : bounds.right;
+    if (sl <= sr) {
+        if (top >= bounds.top && top <= bounds.bottom) {
+            DIB_PaintSpan(raster, sl, sr, top, op);
+        }
+        if (bottom != top && bottom >= bounds.top && bottom <= bounds.bottom) {
+            DIB_PaintSpan(raster, sl, sr, bottom, op);
+        }
+    }
+
+    long vt = (top + 1 > bounds.top) ? top + 1 : bounds.top;
+    long vb = (bottom - 1 < bounds.bottom) ? bottom - 1 : bounds.bottom;
+    bool drawLeft = left >= bounds.left && left <= bounds.right;
+    bool drawRight = right != left && right >= bounds.left && right <= bounds.right;
+    for (long y = vt; y <= vb; y++) {
+        if (drawLeft) DIB_PaintSpan(raster, left, left, y, op);
+        if (drawRight) DIB_PaintSpan(raster, right, right, y, op);
+    }
+    return 1;
+}
+
+/**
+ * RKC_DIB::DrawFill - Fill a rectangle (corners inclusive)
+ * USED BY: o_RKC_UPDIB.dll
+ *
+ * hispeed is accepted for signature compatibility; the span kernels do the
+ * per-channel math directly instead of going through its lookup tables.
+ * Returns: 1 if anything was filled, 0 if fully clipped or unsupported bpp
+ */
+extern "C" int __thiscall RKC_DIB_DrawFill(
+    RKC_DIB* self, long x1, long y1, long x2, long y2,
+    unsigned char r, unsigned char g, unsigned char b, long alpha, long flags, RECT* clip,
+    void* hispeed)
+{
+    DIB_RASTER raster;
+    RECT bounds;
+    if (!DIB_GetRaster(self, &raster)) return 0;
+    if (!DIB_GetPaintBounds(raster, clip, &bounds)) return 0;
+
+    long left = (x1 < x2) ? x1 : x2;
+    long right = (x1 < x2) ? x2 : x1;
+    long top = (y1 < y2) ? y1 : y2;
+    long bottom = (y1 < y2) ? y2 : y1;
+
+    if (left < bounds.left) left = bounds.left;
+    if (top < bounds.top) top = bounds.top;
+    if (right > bounds.right) right = bounds.right;
+    if (bottom > bounds.bottom) bottom = bounds.bottom;
+    if (left > right || top > bottom) return 0;
+
+    DIB_PAINTOP op;
+    DIB_ResolvePaintOp(&op, r, g, b, alpha, flags);
+    for (long y = top; y <= bottom; y++) {
+        DIB_PaintSpan(raster, left, right, y, op);
+    }
+    return 1;
+}
+
+// ============================================================================
+// STUBS FOR UNUSED FUNCTIONS - NOT IMPORTED BY EXE OR OTHER DLLS
+// ============================================================================
+
+
+/**
+ * RKC_DIB::AddOffset - Add color offset to palette
+ * NOT REFERENCED - stub
+ */
+extern "C" int __thiscall RKC_DIB_AddOffset(RKC_DIB* self, RGBQUAD offset, int flag) {
+    return 0;
+}
+
+/**
+ * RKC_DIB::ClearUnusedArea - Clear unused bitmap area
+ * NOT REFERENCED - stub
+ */
+extern "C" int __thiscall RKC_DIB_ClearUnusedArea(RKC_DIB* self) {
+    return 0;
+}
+
+/**
+ * RKC_DIB::CompareBitmapColor - Compare pixel color at coordinates
+ * NOT REFERENCED - stub
+ */
+extern "C" int __thiscall RKC_DIB_CompareBitmapColor(RKC_DIB* self, long x, long y, RGBQUAD* color) {
+    return 0;
+}
+
+/**
+ * RKC_DIB::Copy - Deep copy from source DIB
  * NOT REFERENCED - stub
  */
 extern "C" int __thiscall RKC_DIB_Copy(RKC_DIB* self, RKC_DIB* source) {
@@ -1097,10 +2644,21 @@ extern "C" int __thiscall RKC_DIB_TransferToDDB_6args(RKC_DIB* self, HDC hdc, lo
 // DLL ENTRY POINT
 // ============================================================================
 
+/**
+ * Set up the pool, batch and inverse colour map locks. DllMain calls this on attach; code that
+ * includes core.cpp directly (bench_convert) calls it before any RKC_DIB call.
+ */
+static void DIB_Init() {
+    DIB_PoolInit();
+    DIB_BatchInit();
+    DIB_InvCmapInit();
+}
+
 BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
     switch (fdwReason) {
         case DLL_PROCESS_ATTACH:
             DisableThreadLibraryCalls(hinstDLL);
+            DIB_Init();
             break;
         case DLL_PROCESS_DETACH:
             break;
@@ -0,0 +1,90 @@
+/*
+ * bench_scenario_prefetch.cpp - Scenario load time with and without the prefetcher
+ *
+ * Walks the given scenarios in order, laps times, the way the game enters them:
+ * RKC_UPDIB_UPD::Read of Scenario\%08d\Scenario.njp, then "playing" for play ms
+ * while the prefetcher works. The first lap teaches it the transitions, later
+ * laps are served from parked arenas. The direct pass loads the same files
+ * without the prefetcher. The UPD cache is off for both, so direct is a full
+ * decode each time.
+ *
+ * Build (MinGW, run under Windows or wine):
+ *   i686-w64-mingw32-g++ -std=c++17 -O2 bench_scenario_prefetch.cpp -o bench_scenario_prefetch.exe
+ *
+ * Usage: bench_scenario_prefetch <game folder> <play ms> <laps> <scenario> <scenario> ...
+ */
+
+#include "src/core.cpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+static double ElapsedMs(const LARGE_INTEGER& start, const LARGE_INTEGER& end, const LARGE_INTEGER& freq) {
+    return (double)(end.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 6) {
+        printf("Usage: %s <game folder> <play ms> <laps> <scenario> <scenario> ...\n", argv[0]);
+        return 1;
+    }
+    DWORD playMs = (DWORD)atol(argv[2]);
+    long laps = atol(argv[3]);
+    std::vector<std::string> files;
+    for (int i = 4; i < argc; i++) {
+        char path[MAX_PATH];
+        snprintf(path, sizeof(path), "%s\\Scenario\\%08ld\\Scenario.njp", argv[1], atol(argv[i]));
+        files.push_back(path);
+    }
+    SetEnvironmentVariableA("OSF_UPD_CACHE", "0");
+
+    LARGE_INTEGER freq, start, end;
+    QueryPerformanceFrequency(&freq);
+    unsigned char upd[0x30];
+    RKC_UPDIB_UPD_constructor(upd);
+
+    // Direct: what every transition costs without the prefetcher
+    double directMs = 0;
+    long loads = 0;
+    for (long lap = 0; lap < laps; lap++) {
+        for (size_t i = 0; i < files.size(); i++) {
+            QueryPerformanceCounter(&start);
+            int ok = UPD_Load(upd, files[i].c_str());
+            QueryPerformanceCounter(&end);
+            if (!ok) {
+                printf("failed: %s\n", files[i].c_str());
+                return 1;
+            }
+            directMs += ElapsedMs(start, end, freq);
+            loads++;
+            UPD_ReleaseArena(upd);
+        }
+    }
+
+    // Prefetched: first lap learns, the rest should mostly be handovers
+    double firstLapMs = 0, laterMs = 0;
+    for (long lap = 0; lap < laps; lap++) {
+        for (size_t i = 0; i < files.size(); i++) {
+            QueryPerformanceCounter(&start);
+            RKC_UPDIB_UPD_Read(upd, (char*)files[i].c_str(), 0);
+            QueryPerformanceCounter(&end);
+            (lap == 0 ? firstLapMs : laterMs) += ElapsedMs(start, end, freq);
+            Sleep(playMs);
+        }
+    }
+    RKC_UPDIB_UPD_Release(upd);
+
+    RKC_UPDIB_PREFETCHSTATS stats;
+    RKC_UPDIB_GetPrefetchStats(&stats);
+    long later = loads - (long)files.size();
+    printf("%u scenarios, %ld laps, %lu ms play time per scenario\n", (unsigned)files.size(), laps, (unsigned long)playMs);
+    printf("direct:        %8.3f ms/transition\n", directMs / loads);
+    printf("first lap:     %8.3f ms/transition (learning)\n", firstLapMs / files.size());
+    if (later > 0) printf("later laps:    %8.3f ms/transition\n", laterMs / later);
+    printf("prefetch: %lu queued, %lu arenas loaded, %lu files warmed, %lu handovers, %lu evicted\n",
+           (unsigned long)stats.scenariosQueued, (unsigned long)stats.updsLoaded, (unsigned long)stats.filesWarmed,
+           (unsigned long)stats.handovers, (unsigned long)stats.evicted);
+    return 0;
+}
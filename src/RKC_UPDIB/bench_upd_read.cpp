@@ -0,0 +1,169 @@
+/*
+ * bench_upd_read.cpp - RKC_UPDIB_UPD::Read load time over a game folder
+ *
+ * Loads every .njp/.upd below the given folder (e.g. the ShadowFlare install or
+ * its Scenario folder) with the native arena loader and reports load time and
+ * how many heap blocks the original loader would have needed for the same data.
+ * Load times are given without the UPD cache, with an empty cache (cold - every
+ * file is decoded and written) and with a filled one (warm - every file is mapped
+ * from its entry). The cache goes to a private directory that is emptied first.
+ *
+ * Build (MinGW, run under Windows or wine):
+ *   i686-w64-mingw32-g++ -std=c++17 -O2 bench_upd_read.cpp -o bench_upd_read.exe
+ *
+ * Usage: bench_upd_read <folder> [iterations] [cache dir]
+ */
+
+#include "src/core.cpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+static bool HasUpdExtension(const char* name) {
+    const char* dot = strrchr(name, '.');
+    return dot && (_stricmp(dot, ".njp") == 0 || _stricmp(dot, ".upd") == 0);
+}
+
+static void CollectFiles(const std::string& dir, std::vector<std::string>* files) {
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((dir + "\\*").c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE) return;
+    do {
+        if (strcmp(data.cFileName, ".") == 0 || strcmp(data.cFileName, "..") == 0) continue;
+        std::string path = dir + "\\" + data.cFileName;
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            CollectFiles(path, files);
+        } else if (HasUpdExtension(data.cFileName)) {
+            files->push_back(path);
+        }
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+}
+
+// Heap blocks the original RKC_UPDIB_UPD::Read allocates for a loaded UPD
+static long OriginalBlockCount(void* upd) {
+    char* p = (char*)upd;
+    long version = *(long*)(p + 0x24);
+    long partsCount = *(long*)(p + 0x0c);
+    long patternCount = *(long*)(p + 0x14);
+    long blocks = 2;                                   // filename, parts table
+    if (version >= 3) {
+        blocks += 2;                                   // pixel block, parts list block
+    } else {
+        for (long i = 0; i < partsCount; i++) {
+            if (*(void**)(*(char**)(p + 0x10) + i * 0x10 + 0x0c)) blocks++;
+        }
+        blocks += patternCount;                        // one parts list each
+    }
+    blocks += 1;                                       // pattern array
+    for (long i = 0; i < patternCount; i++) {
+        char* pattern = *(char**)(p + 0x18) + i * 0x28;
+        if (*(void**)(pattern + 0x08)) blocks++;       // judge
+        if (*(void**)(pattern + 0x20)) blocks++;       // name
+    }
+    long paletteCount = *(long*)(p + 0x1c);
+    if (paletteCount) blocks += 1 + paletteCount;      // DIB array + one header each
+    return blocks;
+}
+
+static double ElapsedMs(const LARGE_INTEGER& start, const LARGE_INTEGER& end, const LARGE_INTEGER& freq) {
+    return (double)(end.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart;
+}
+
+// One load of every file, iterations times; returns ms per pass
+static double LoadAll(void* upd, const std::vector<std::string>& files, long iterations) {
+    LARGE_INTEGER freq, start, end;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+    for (long it = 0; it < iterations; it++) {
+        for (size_t i = 0; i < files.size(); i++) {
+            if (RKC_UPDIB_UPD_Read(upd, (char*)files[i].c_str(), 0)) RKC_UPDIB_UPD_Release(upd);
+        }
+    }
+    QueryPerformanceCounter(&end);
+    return ElapsedMs(start, end, freq) / iterations;
+}
+
+static void ClearCache(const std::string& dir) {
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((dir + "\\*.upc").c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE) return;
+    do {
+        DeleteFileA((dir + "\\" + data.cFileName).c_str());
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <folder> [iterations] [cache dir]\n", argv[0]);
+        return 1;
+    }
+    long iterations = argc > 2 ? atol(argv[2]) : 5;
+
+    // Private cache directory, so the cold pass really starts empty
+    std::string cacheDir;
+    if (argc > 3) {
+        cacheDir = argv[3];
+    } else {
+        char temp[MAX_PATH];
+        GetTempPathA(sizeof(temp), temp);
+        cacheDir = std::string(temp) + "osf_bench_upd_cache";
+    }
+    SetEnvironmentVariableA("OSF_UPD_CACHE", cacheDir.c_str());
+    SetEnvironmentVariableA("OSF_UPD_PREFETCH", "0");   // Scenario folders would wake it
+    UPD_CacheInit();
+    ClearCache(cacheDir);
+
+    std::vector<std::string> files;
+    CollectFiles(argv[1], &files);
+    printf("%u UPD/NJP files below %s\n", (unsigned)files.size(), argv[1]);
+    if (files.empty()) return 1;
+
+    LARGE_INTEGER freq, start, end;
+    QueryPerformanceFrequency(&freq);
+
+    unsigned char upd[0x30];
+    RKC_UPDIB_UPD_constructor(upd);
+
+    // First load per file is the cold one (OS file cache permitting); no UPD cache yet
+    g_updCacheEnabled = false;
+    long failed = 0, blocks = 0;
+    double bytes = 0, firstMs = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        QueryPerformanceCounter(&start);
+        int ok = RKC_UPDIB_UPD_Read(upd, (char*)files[i].c_str(), 0);
+        QueryPerformanceCounter(&end);
+        firstMs += ElapsedMs(start, end, freq);
+        if (!ok) {
+            printf("  failed: %s\n", files[i].c_str());
+            failed++;
+            continue;
+        }
+        bytes += UPD_GetArena(upd)->size;
+        blocks += OriginalBlockCount(upd);
+        RKC_UPDIB_UPD_Release(upd);
+    }
+    double decodeMs = LoadAll(upd, files, iterations);
+
+    // Cold: every Read decodes and writes its entry. Warm: every Read maps one.
+    g_updCacheEnabled = true;
+    double coldMs = LoadAll(upd, files, 1);
+    double warmMs = LoadAll(upd, files, iterations);
+
+    long loaded = (long)files.size() - failed;
+    printf("loaded %ld, failed %ld, %.1f MB decoded\n", loaded, failed, bytes / (1024.0 * 1024.0));
+    printf("first pass:   %8.2f ms total, %6.3f ms/file (no UPD cache)\n", firstMs, firstMs / files.size());
+    printf("decode:       %8.2f ms total, %6.3f ms/file (no UPD cache, %ld iterations)\n",
+           decodeMs, decodeMs / files.size(), iterations);
+    printf("cache cold:   %8.2f ms total, %6.3f ms/file (decode + write entry)\n", coldMs, coldMs / files.size());
+    printf("cache warm:   %8.2f ms total, %6.3f ms/file (%ld iterations)\n",
+           warmMs, warmMs / files.size(), iterations);
+    printf("cache: %ld hits, %ld misses, %ld rebuilds, %ld writes in %s\n",
+           (long)g_updCacheStats.hits, (long)g_updCacheStats.misses, (long)g_updCacheStats.rebuilds,
+           (long)g_updCacheStats.writes, cacheDir.c_str());
+    printf("heap blocks: %ld with the original loader, %ld with the arena\n", blocks, loaded);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * bench_vs_render.cpp - VS packet queue and render throughput
+ *
+ * Sets up a UPDIB the way ShadowFlare.exe does (2 VS blocks of 32 virtual
+ * screens, HISPEEDMODE tables, a 640x480 24bpp back buffer) with one UPD
+ * loaded, then plays frames of a busy battle scene: packets per frame sprites
+ * spread over the screens, a quarter of them blended, some scaled or mirrored,
+ * submitted with RKC_UPDIB::SetPacket, drawn with RKC_UPDIB::Render and
+ * dropped with FlushVSBlock. Queue-only frames (submit + flush) are timed
+ * separately; with o_RKC_UPDIB.dll next to it they are also timed against the
+ * original's linked list. The cull counters of the last frame are printed too.
+ *
+ * Needs RKC_DIB.dll (and o_RKC_DIB.dll) in the working directory.
+ *
+ * Build (MinGW, run under Windows or wine):
+ *   i686-w64-mingw32-g++ -std=c++17 -O2 bench_vs_render.cpp -o bench_vs_render.exe
+ *
+ * Usage: bench_vs_render <njp/upd file> [packets per frame] [frames]
+ */
+
+#include "src/core.cpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+typedef void* (__thiscall *Ctor_t)(void* self);
+typedef int (__thiscall *DIBCreate_t)(void* self, long width, long height, long bpp, int clear);
+typedef int (__thiscall *SetPacket_t)(void* self, long block, long vs, long updNo, long patternNo,
+    long paletteNo, long flags, long x, long y, long scaleX, long scaleY, long alpha, long unknown,
+    long exParam, short r, short g, short b, RECT* clip, RKC_DIB* dib);
+typedef void (__thiscall *FlushVSBlock_t)(void* self, long index);
+typedef int (__thiscall *Initialize_t)(void* self, long vsBlocks, long vsCount, long updCount, int hispeed);
+
+struct FRAMEPACKET {
+    long vs, patternNo, flags, x, y, scale, alpha;
+};
+
+static double ElapsedMs(const LARGE_INTEGER& start, const LARGE_INTEGER& end, const LARGE_INTEGER& freq) {
+    return (double)(end.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart;
+}
+
+// One frame's worth of packets, the same every frame
+static void MakeScene(FRAMEPACKET* scene, long count, long patternCount) {
+    srand(1);
+    for (long i = 0; i < count; i++) {
+        FRAMEPACKET* f = &scene[i];
+        f->vs = rand() % 32;
+        f->patternNo = rand() % patternCount;
+        f->x = rand() % 640;
+        f->y = rand() % 480;
+        f->flags = 0;
+        f->scale = 1000;
+        f->alpha = 1000;
+        long kind = rand() % 16;
+        if (kind < 4) f->alpha = 300 + rand() % 600;                 // blended effects
+        else if (kind == 4) f->flags |= VSPACKET_FLAG_ADD;           // additive glow
+        else if (kind == 5) f->scale = 500 + rand() % 1000;          // zoomed
+        else if (kind == 6) f->flags |= VSPACKET_FLAG_MIRRORX;       // facing left
+    }
+}
+
+static void Submit(SetPacket_t setPacket, void* updib, const FRAMEPACKET* scene, long count) {
+    for (long i = 0; i < count; i++) {
+        const FRAMEPACKET* f = &scene[i];
+        setPacket(updib, f->vs & 1, f->vs, 0, f->patternNo, -1, f->flags, f->x, f->y, f->scale, f->scale,
+                  f->alpha, 1000, 0, 1000, 1000, 1000, nullptr, nullptr);
+    }
+}
+
+// Submit + flush only; returns ms per frame
+static double QueueFrames(SetPacket_t setPacket, FlushVSBlock_t flush, void* updib,
+                          const FRAMEPACKET* scene, long count, long frames) {
+    LARGE_INTEGER freq, start, end;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+    for (long frame = 0; frame < frames; frame++) {
+        Submit(setPacket, updib, scene, count);
+        flush(updib, -1);
+    }
+    QueryPerformanceCounter(&end);
+    return ElapsedMs(start, end, freq) / frames;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <njp/upd file> [packets per frame] [frames]\n", argv[0]);
+        return 1;
+    }
+    long count = argc > 2 ? atol(argv[2]) : 3000;
+    long frames = argc > 3 ? atol(argv[3]) : 200;
+    SetEnvironmentVariableA("OSF_UPD_CACHE", "0");
+    SetEnvironmentVariableA("OSF_UPD_PREFETCH", "0");
+
+    Ctor_t dibCtor = (Ctor_t)LoadOrigFunc("RKC_DIB.dll", "??0RKC_DIB@@QAE@XZ");
+    DIBCreate_t dibCreate = (DIBCreate_t)LoadOrigFunc("RKC_DIB.dll", "?Create@RKC_DIB@@QAEHJJJH@Z");
+    Ctor_t hispeedCtor = (Ctor_t)LoadOrigFunc("RKC_DIB.dll", "??0RKC_DIBHISPEEDMODE@@QAE@XZ");
+    if (!dibCtor || !dibCreate || !hispeedCtor) {
+        printf("RKC_DIB.dll not found\n");
+        return 1;
+    }
+
+    // UPD slot 0 holds the sprites
+    static unsigned char upd[0x30];
+    RKC_UPDIB_UPD_constructor(upd);
+    if (!UPD_Load(upd, argv[1]) || RKC_UPDIB_UPD_GetPatternCount(upd) == 0) {
+        printf("failed: %s\n", argv[1]);
+        return 1;
+    }
+    void* upds[1] = { upd };
+
+    // RKC_UPDIB as its constructor, Initialize(2, 32, ...) and CreateTemporaryDIB leave it
+    static char updib[0x30];
+    memset(updib, 0, sizeof(updib));
+    *(long*)(updib + 0x04) = 1;
+    *(void***)(updib + 0x08) = upds;
+    for (long i = 0; i < RKC_UPDIB_UPD_GetPartsCount(upd); i++) {
+        char* parts = (char*)RKC_UPDIB_UPD_GetParts(upd, i);
+        if (*(long*)(updib + 0x14) < *(long*)(parts + 0x04)) *(long*)(updib + 0x14) = *(long*)(parts + 0x04);
+        if (*(long*)(updib + 0x18) < *(long*)(parts + 0x08)) *(long*)(updib + 0x18) = *(long*)(parts + 0x08);
+    }
+    dibCtor(updib + 0x1c);
+    dibCreate(updib + 0x1c, *(long*)(updib + 0x14), *(long*)(updib + 0x18), 8, 1);
+    *(void**)(updib + 0x28) = hispeedCtor(GlobalAlloc(GMEM_FIXED, 0x11a300));
+    *(void**)(updib + 0x2c) = dibCtor(GlobalAlloc(GPTR, 0x0c));
+    dibCreate(*(void**)(updib + 0x2c), 1, 1, 8, 0);
+    for (long i = 0; i < 2; i++) {
+        RKC_UPDIB_VSBLOCK_CreateVS(RKC_UPDIB_InsertVSBlock(updib, 0), 32);
+    }
+
+    static char backBuffer[0x0c];
+    dibCtor(backBuffer);
+    dibCreate(backBuffer, 640, 480, 24, 1);
+
+    FRAMEPACKET* scene = (FRAMEPACKET*)GlobalAlloc(GMEM_FIXED, count * sizeof(FRAMEPACKET));
+    MakeScene(scene, count, RKC_UPDIB_UPD_GetPatternCount(upd));
+
+    // Warm-up frame grows the packet arrays to their steady size
+    Submit(RKC_UPDIB_SetPacket, updib, scene, count);
+    RKC_UPDIB_Render(updib, (RKC_DIB*)backBuffer, -1, 0, 0, 0, nullptr);
+    RKC_UPDIB_FlushVSBlock(updib, -1);
+
+    LARGE_INTEGER freq, start, mid, end;
+    QueryPerformanceFrequency(&freq);
+    double submitMs = 0, renderMs = 0;
+    for (long frame = 0; frame < frames; frame++) {
+        QueryPerformanceCounter(&start);
+        Submit(RKC_UPDIB_SetPacket, updib, scene, count);
+        QueryPerformanceCounter(&mid);
+        RKC_UPDIB_Render(updib, (RKC_DIB*)backBuffer, -1, 0, 0, 0, nullptr);
+        RKC_UPDIB_FlushVSBlock(updib, -1);
+        QueryPerformanceCounter(&end);
+        submitMs += ElapsedMs(start, mid, freq);
+        renderMs += ElapsedMs(mid, end, freq);
+    }
+    submitMs /= frames;
+    renderMs /= frames;
+    double queueMs = QueueFrames(RKC_UPDIB_SetPacket, RKC_UPDIB_FlushVSBlock, updib, scene, count, frames);
+
+    printf("%ld packets/frame, %ld frames, %ld patterns from %s\n", count, frames,
+           RKC_UPDIB_UPD_GetPatternCount(upd), argv[1]);
+    printf("submit:       %8.3f ms/frame\n", submitMs);
+    printf("render+flush: %8.3f ms/frame\n", renderMs);
+    printf("frame:        %8.3f ms/frame, %.2f M packets/s\n", submitMs + renderMs,
+           count / (submitMs + renderMs) / 1000.0);
+    printf("queue only:   %8.3f ms/frame, %.2f M packets/s\n", queueMs, count / queueMs / 1000.0);
+
+    // Cull counters of the last rendered frame (OSF_VS_CULL=0 to compare without)
+    RKC_UPDIB_CULLSTATS cull;
+    RKC_UPDIB_GetCullStats(&cull);
+    printf("cull: %lu drawn, %lu clipped, %lu occluded (%lu occluders), %lu parts skipped\n",
+           (unsigned long)cull.drawn, (unsigned long)cull.clipped, (unsigned long)cull.occluded,
+           (unsigned long)cull.occluders, (unsigned long)cull.partsSkipped);
+
+    // The original's queue, if it is around: same packets into its own UPDIB
+    SetPacket_t origSetPacket = (SetPacket_t)LoadOrigFunc("o_RKC_UPDIB.dll",
+        "?SetPacket@RKC_UPDIB@@QAEHJJJJJJJJJJJJJFFFPAUtagRECT@@PAVRKC_DIB@@@Z");
+    FlushVSBlock_t origFlush = (FlushVSBlock_t)LoadOrigFunc("o_RKC_UPDIB.dll", "?FlushVSBlock@RKC_UPDIB@@QAEXJ@Z");
+    Ctor_t origCtor = (Ctor_t)LoadOrigFunc("o_RKC_UPDIB.dll", "??0RKC_UPDIB@@QAE@XZ");
+    Initialize_t origInitialize = (Initialize_t)LoadOrigFunc("o_RKC_UPDIB.dll", "?Initialize@RKC_UPDIB@@QAEHJJJH@Z");
+    if (origSetPacket && origFlush && origCtor && origInitialize) {
+        void* original = origCtor(GlobalAlloc(GPTR, 0x30));
+        origInitialize(original, 2, 32, 1, 0);
+        double origMs = QueueFrames(origSetPacket, origFlush, original, scene, count, frames);
+        printf("original queue only: %8.3f ms/frame, %.2f M packets/s\n", origMs, count / origMs / 1000.0);
+    }
+    return 0;
+}
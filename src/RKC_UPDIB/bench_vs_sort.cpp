@@ -0,0 +1,137 @@
+/*
+ * bench_vs_sort.cpp - Draw order by sort key vs linked-list insertion
+ *
+ * Queues a crowded screen of objects (ground shadows, characters, effects and
+ * UI over a tall map, many sharing a row) each frame and orders them back to
+ * front by layer, y and priority two ways: inserting every object into a
+ * linked list after the last one that draws before it, and SetPacket +
+ * RKC_UPDIB_SetSortKey and one radix sort of the screen. Both orders are
+ * compared packet by packet before anything is timed. No pixels are drawn,
+ * so no DIBs are needed.
+ *
+ * The list is keyed the same way as the packets, so this measures the cost of
+ * the two methods for a caller with a total order. It is not the game's
+ * RKC_RPGSCRN_OBJECTDISP sort, which orders by bounding-box overlap and which
+ * keys do not reproduce.
+ *
+ * Build (MinGW, run under Windows or wine):
+ *   i686-w64-mingw32-g++ -std=c++17 -O2 bench_vs_sort.cpp -o bench_vs_sort.exe
+ *
+ * Usage: bench_vs_sort [frames] [objects] [objects] ...   (default 1000 2000 5000 10000)
+ */
+
+#include "src/core.cpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+struct SCENEOBJECT {
+    long layer, y, priority, x;
+    SCENEOBJECT* next;   // Original-style display list link
+};
+
+static double ElapsedMs(const LARGE_INTEGER& start, const LARGE_INTEGER& end, const LARGE_INTEGER& freq) {
+    return (double)(end.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart;
+}
+
+static void MakeScene(SCENEOBJECT* scene, long count) {
+    srand(1);
+    for (long i = 0; i < count; i++) {
+        SCENEOBJECT* o = &scene[i];
+        long kind = rand() % 16;
+        o->layer = kind < 3 ? 0 : kind < 13 ? 1 : kind < 15 ? 2 : 3;   // shadow, character, effect, UI
+        o->y = (rand() % 200) * 8;                                       // tile rows, plenty of ties
+        o->priority = rand() % 4;
+        o->x = rand() % 640;
+    }
+}
+
+static bool DrawsBefore(const SCENEOBJECT* a, const SCENEOBJECT* b) {
+    if (a->layer != b->layer) return a->layer < b->layer;
+    if (a->y != b->y) return a->y < b->y;
+    return a->priority < b->priority;
+}
+
+// Original: walk from the head, insert after every object that does not draw after it
+static SCENEOBJECT* InsertSortAll(SCENEOBJECT* scene, long count) {
+    SCENEOBJECT* head = nullptr;
+    for (long i = 0; i < count; i++) {
+        SCENEOBJECT* o = &scene[i];
+        SCENEOBJECT** link = &head;
+        while (*link && !DrawsBefore(o, *link)) link = &(*link)->next;
+        o->next = *link;
+        *link = o;
+    }
+    return head;
+}
+
+static void SubmitKeyed(void* updib, const SCENEOBJECT* scene, long count) {
+    for (long i = 0; i < count; i++) {
+        const SCENEOBJECT* o = &scene[i];
+        RKC_UPDIB_SetPacket(updib, 0, 0, 0, 0, -1, 0, o->x, o->y, 1000, 1000, 1000, 1000, 0,
+                            1000, 1000, 1000, nullptr, nullptr);
+        RKC_UPDIB_SetSortKey(updib, 0, 0, o->layer, o->y, o->priority);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    long frames = argc > 1 ? atol(argv[1]) : 100;
+    std::vector<long> sizes;
+    for (int i = 2; i < argc; i++) sizes.push_back(atol(argv[i]));
+    if (sizes.empty()) sizes = { 1000, 2000, 5000, 10000 };
+
+    // A UPDIB with one block of one screen is all SetPacket needs
+    static char updib[0x30];
+    memset(updib, 0, sizeof(updib));
+    RKC_UPDIB_VSBLOCK_CreateVS(RKC_UPDIB_InsertVSBlock(updib, 0), 1);
+    void* screen = RKC_UPDIB_VSBLOCK_GetVScreen(RKC_UPDIB_GetVSBlock(updib, 0), 0);
+
+    LARGE_INTEGER freq, start, end;
+    QueryPerformanceFrequency(&freq);
+    printf("%ld frames per size\n", frames);
+    printf("%8s %14s %14s %14s %8s\n", "objects", "list ms/frame", "key ms/frame", "sort ms/frame", "speedup");
+
+    for (size_t s = 0; s < sizes.size(); s++) {
+        long count = sizes[s];
+        std::vector<SCENEOBJECT> scene(count);
+        MakeScene(scene.data(), count);
+
+        // Same order both ways, ties included
+        SCENEOBJECT* head = InsertSortAll(scene.data(), count);
+        SubmitKeyed(updib, scene.data(), count);
+        VS_QUEUE* q = *(VS_QUEUE**)((char*)screen + 0x04);
+        VS_SORTITEM* sorted = VS_SortPackets(q);
+        for (long i = 0; i < count; i++, head = head->next) {
+            if (sorted[i].packet != head - scene.data()) {
+                printf("order differs at %ld of %ld objects\n", i, count);
+                return 1;
+            }
+        }
+        RKC_UPDIB_FlushVSBlock(updib, -1);
+
+        QueryPerformanceCounter(&start);
+        for (long frame = 0; frame < frames; frame++) InsertSortAll(scene.data(), count);
+        QueryPerformanceCounter(&end);
+        double listMs = ElapsedMs(start, end, freq) / frames;
+
+        double sortMs = 0;
+        LARGE_INTEGER mid;
+        QueryPerformanceCounter(&start);
+        for (long frame = 0; frame < frames; frame++) {
+            SubmitKeyed(updib, scene.data(), count);
+            QueryPerformanceCounter(&mid);
+            VS_SortPackets(q);
+            QueryPerformanceCounter(&end);
+            sortMs += ElapsedMs(mid, end, freq);
+            RKC_UPDIB_FlushVSBlock(updib, -1);
+        }
+        QueryPerformanceCounter(&end);
+        double keyMs = ElapsedMs(start, end, freq) / frames;
+        sortMs /= frames;
+
+        printf("%8ld %14.3f %14.3f %14.3f %7.1fx\n", count, listMs, keyMs, sortMs, listMs / keyMs);
+    }
+    printf("key = SetPacket + SetSortKey + sort; sort = the radix sort alone\n");
+    return 0;
+}
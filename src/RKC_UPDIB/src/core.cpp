@@ -8,7 +8,9 @@
  */
 
 #include <windows.h>
+#include <cstddef>
 #include <cstring>
+#include "../../happy/hprof.hpp"
 
 // Forward declarations
 class RKC_DIB;
@@ -42,8 +44,27 @@ struct RKC_UPDIB_UPD_PARTS;
  *   +0x14: long patternCount     - Number of patterns
  *   +0x18: RKC_UPDIB_PATTERN* patterns - Patterns array
  *   +0x1c: long paletteCount     - Number of palettes
- *   +0x20: void* palettes        - Palette data
+ *   +0x20: RKC_DIB* palettes     - Array of 8bpp header-only DIBs (12 bytes each)
  *   +0x24: long versionNo        - UPD format version
+ *   +0x28: void* partsBits       - Version 3: one block holding all parts pixels
+ *   +0x2c: void* partsLists      - Version 3: one block holding all parts lists
+ */
+
+/**
+ * RKC_UPDIB_UPD_PARTS layout (0x10 bytes):
+ *   +0x00: long bpp              - 1, 4 or 8
+ *   +0x04: long width
+ *   +0x08: long height
+ *   +0x0c: unsigned char* bits   - Bottom-up rows, DWORD aligned like a DIB
+ */
+
+/**
+ * RKC_UPDIB_PARTSLIST layout (0x1c bytes):
+ *   +0x00: long flags            - Bit 30 mirrors X, bit 31 mirrors Y
+ *   +0x04: long x, +0x08: long y - Offset inside the pattern
+ *   +0x0c: long exParam          - Added to the packet's exParam
+ *   +0x10: long scaleX, +0x14: long scaleY - Zoom in 1/1000
+ *   +0x18: RKC_UPDIB_UPD_PARTS* parts - NULL if the file index is out of range
  */
 
 /**
@@ -52,6 +73,7 @@ struct RKC_UPDIB_UPD_PARTS;
  *   +0x04: long updCount         - Number of loaded UPDs
  *   +0x08: RKC_UPDIB_UPD** upds  - Array of UPD pointers
  *   ...
+ *   +0x14: long tempWidth, +0x18: long tempHeight - Largest part (CreateTemporaryDIB)
  *   +0x1c: RKC_DIB tempDIB       - Temporary DIB (embedded, 12 bytes)
  *   +0x28: RKC_DIBHISPEEDMODE* hispeedMode - Fast blending lookup tables
  *   +0x2c: RKC_DIB* dibPtr       - Another DIB pointer
@@ -259,8 +281,8 @@ extern "C" void* __thiscall RKC_UPDIB_GetUpd(void* self, long index) {
 
 /**
  * RKC_UPDIB_VS class layout (8 bytes):
- *   +0x00: void* unknown1        - First pointer (linked list?)
- *   +0x04: void* vsPacketList    - First VSPacket in list
+ *   +0x00: RKC_UPDIB* updib      - Owning UPDIB
+ *   +0x04: VS_QUEUE* queue       - Packet array (original: newest packet of a linked list)
  */
 
 /**
@@ -280,10 +302,10 @@ extern "C" void* __thiscall RKC_UPDIB_VS_constructor(void* self) {
 
 /**
  * RKC_UPDIB_VSBLOCK class layout (0x14 bytes):
- *   +0x00: void* vsList         - List of VS objects
- *   +0x04: long vsCount         - Count of VS objects  
- *   +0x08: void* unknown1
- *   +0x0c: void* unknown2
+ *   +0x00: RKC_UPDIB* updib     - Owning UPDIB
+ *   +0x04: long vsCount         - Count of VS objects
+ *   +0x08: RKC_UPDIB_VS* vs     - VS array (8 bytes each)
+ *   +0x0c: void* prevBlock      - Previous block in linked list
  *   +0x10: void* nextBlock      - Next block in linked list
  */
 
@@ -307,15 +329,41 @@ extern "C" void* __thiscall RKC_UPDIB_VSBLOCK_constructor(void* self) {
 
 /**
  * RKC_UPDIB_VSPACKET class layout (0x54 bytes):
- *   +0x00-0x10: Various pointers/values (zeroed)
- *   +0x14-0x20: Four longs set to 1000 (0x3e8)
- *   +0x24-0x28: Two longs (zeroed)
- *   +0x2c: long set to -1
- *   +0x30-0x34: Three shorts set to 1000
- *   +0x38-0x3c: Two longs (zeroed)  
- *   +0x3c: void* nextPacket - Next packet in linked list
- *   +0x50: long (zeroed)
+ *   +0x00: RKC_UPDIB* updib     - Owning UPDIB
+ *   +0x04: long flags           - Packet flags (see VSPACKET_FLAG_*)
+ *   +0x08: long exParam         - Extra TransferToDIBEx parameter
+ *   +0x0c: long x               - Position (primitives: x1)
+ *   +0x10: long y               - Position (primitives: y1)
+ *   +0x14: long scaleX          - Zoom in 1/1000, default 1000 (primitives: x2)
+ *   +0x18: long scaleY          - Zoom in 1/1000, default 1000 (primitives: y2)
+ *   +0x1c: long alpha           - Strength in 1/1000, default 1000
+ *   +0x20: long unknown         - Default 1000
+ *   +0x24: long updNo           - UPD index in owning UPDIB
+ *   +0x28: long patternNo       - Pattern index in UPD
+ *   +0x2c: long paletteNo       - Palette index, -1 = pattern default
+ *   +0x30: short r, +0x32: short g, +0x34: short b - Tint (primitives: colour)
+ *   +0x36: short cull           - Padding in the original; occlusion mark here (VS_CULL_*)
+ *   +0x38: u64 sortKey          - Original: prev/next packet in the VS list; here the
+ *                                 draw order key (see RKC_UPDIB_SetSortKey), 0 = none
+ *   +0x40: RECT clip            - Packet clip rect (with VSPACKET_FLAG_CLIP)
+ *   +0x50: RKC_DIB* dib         - Source DIB (with VSPACKET_FLAG_DIB)
  */
+#define VSPACKET_FLAG_OPAQUE     0x0001  // No colour key
+#define VSPACKET_FLAG_ADD        0x0002  // Additive blend
+#define VSPACKET_FLAG_NOCLIP     0x0004  // Ignore the render clip rect
+#define VSPACKET_FLAG_BLENDEX    0x0008  // TransferToDIBEx blend flag 0x10
+#define VSPACKET_FLAG_INVERT     0x0010  // Invert the palette
+#define VSPACKET_FLAG_CLIP       0x0020  // Clip to the packet's own rect
+#define VSPACKET_FLAG_BRIGHTNESS 0x0040  // Darken/lighten by alpha
+#define VSPACKET_FLAG_FONT       0x0080  // Colour 1 straight from r/g/b (SetStringsPacket)
+#define VSPACKET_FLAG_POINT      0x0100
+#define VSPACKET_FLAG_LINE       0x0200
+#define VSPACKET_FLAG_BOX        0x0400
+#define VSPACKET_FLAG_FILL       0x0800
+#define VSPACKET_FLAG_DIB        0x1000  // Blit packet+0x50 instead of a pattern
+#define VSPACKET_FLAG_GREY       0x2000  // Grey the palette (max of r, g, b)
+#define VSPACKET_FLAG_MIRRORX    0x40000000
+#define VSPACKET_FLAG_MIRRORY    0x80000000
 
 /**
  * RKC_UPDIB_VSPACKET::constructor - Initialize VSPACKET object
@@ -349,12 +397,142 @@ extern "C" void* __thiscall RKC_UPDIB_VSPACKET_constructor(void* self) {
     
     // Zero remaining
     *(long*)(p + 0x38) = 0;
-    *(long*)(p + 0x3c) = 0;  // nextPacket
+    *(long*)(p + 0x3c) = 0;  // sortKey
     *(long*)(p + 0x50) = 0;
     
     return self;
 }
 
+// ============================================================================
+// IMPORTS - RKC_DIB.dll and o_RKC_UPDIB.dll, resolved once by InitImports
+// ============================================================================
+
+typedef int (__thiscall *DIB_DrawPoint_t)(RKC_DIB* self, long x, long y, unsigned char r,
+    unsigned char g, unsigned char b, long alpha, long flags, RECT* clip);
+typedef int (__thiscall *DIB_DrawRect_t)(RKC_DIB* self, long x1, long y1, long x2, long y2,
+    unsigned char r, unsigned char g, unsigned char b, long alpha, long flags, RECT* clip);
+typedef int (__thiscall *DIB_DrawFill_t)(RKC_DIB* self, long x1, long y1, long x2, long y2,
+    unsigned char r, unsigned char g, unsigned char b, long alpha, long flags, RECT* clip,
+    RKC_DIBHISPEEDMODE* hispeed);
+
+typedef int (__thiscall *DIB_Transfer_t)(RKC_DIB* self, long x, long y, long width, long height,
+    RKC_DIB* src, long srcX, long srcY, long colorKey);
+typedef int (__thiscall *DIB_TransferFast_t)(RKC_DIB* self, long x, long y, long width, long height,
+    RKC_DIB* src, long srcX, long srcY);
+typedef int (__thiscall *DIB_TransferEx_t)(RKC_DIB* self, long x, long y, long width, long height,
+    RKC_DIB* src, long srcX, long srcY, long exParam, long colorKey, long alpha, long flags,
+    RKC_DIBHISPEEDMODE* hispeed);
+typedef int (__thiscall *DIB_TransferExAt_t)(RKC_DIB* self, long x, long y, RKC_DIB* src,
+    long exParam, long colorKey, long alpha, long flags, RKC_DIBHISPEEDMODE* hispeed);
+typedef int (__thiscall *DIB_Zoom_t)(RKC_DIB* self, RECT* dest, RKC_DIB* src, RECT* srcRect,
+    long colorKey);
+typedef int (__thiscall *DIB_ZoomEx_t)(RKC_DIB* self, RECT* dest, RKC_DIB* src, RECT* srcRect,
+    long exParam, long colorKey, long alpha, long flags);
+
+// RKC_DIB_BLIT, one blit of RKC_DIB_TransferToDIBBatch (OpenShadowFlare extension)
+struct VS_BLIT {
+    RKC_DIB* srcDIB;
+    long destX, destY;
+    long width, height;
+    long srcX, srcY;
+    long transColor;
+};
+#define DIB_BATCH_PARALLEL 0x02  // Composite row bands on RKC_DIB's worker pool
+typedef long (__thiscall *DIB_TransferBatch_t)(RKC_DIB* self, VS_BLIT* blits, long count, long flags);
+typedef unsigned char* (__thiscall *DIB_SetBitmap_t)(RKC_DIB* self, unsigned char* bits);
+typedef int (__thiscall *DIB_SetPalette_t)(RKC_DIB* self, RGBQUAD* colors);
+
+static DIB_DrawPoint_t g_dibDrawPoint = nullptr;
+static DIB_DrawRect_t g_dibDrawLine = nullptr;
+static DIB_DrawRect_t g_dibDrawBox = nullptr;
+static DIB_DrawFill_t g_dibDrawFill = nullptr;
+static DIB_Transfer_t g_dibTransfer = nullptr;
+static DIB_TransferFast_t g_dibTransferFast = nullptr;
+static DIB_TransferEx_t g_dibTransferEx = nullptr;
+static DIB_TransferExAt_t g_dibTransferExAt = nullptr;
+static DIB_Zoom_t g_dibZoom = nullptr;
+static DIB_ZoomEx_t g_dibZoomEx = nullptr;
+static DIB_TransferBatch_t g_dibTransferBatch = nullptr;  // Null with an RKC_DIB.dll without it
+static DIB_SetBitmap_t g_dibSetBitmap = nullptr;
+static DIB_SetPalette_t g_dibSetPalette = nullptr;
+
+// Original UPD functions, for UPDs loaded by o_RKC_UPDIB.dll
+typedef void (__thiscall *UPD_Release_t)(void* self);
+static UPD_Release_t g_origUpdRelease = nullptr;
+static UPD_Release_t g_origUpdDestructor = nullptr;
+
+// Original RKC_UPDIB methods the UPD slots still call into
+typedef int (__thiscall *UPDIB_ReadUpd_t)(void* self, long index, char* filename, long flags,
+                                          long iconWidth, long iconHeight, int createTemporary);
+typedef int (__thiscall *UPDIB_Initialize_t)(void* self, long vsBlocks, long vsCount,
+                                             long updCount, int hispeed);
+typedef void (__thiscall *UPDIB_Method_t)(void* self);
+static UPDIB_ReadUpd_t g_origReadUpd = nullptr;
+static UPDIB_Initialize_t g_origInitialize = nullptr;
+static UPDIB_Method_t g_origCreateTemporaryDIB = nullptr;
+static UPDIB_Method_t g_origUpdibDestructor = nullptr;
+static UPDIB_Method_t g_origUpdibRelease = nullptr;
+
+// Helper to load a function from another DLL (already loaded by the game)
+static void* LoadOrigFunc(const char* dll, const char* name) {
+    HMODULE mod = GetModuleHandleA(dll);
+    if (!mod) mod = LoadLibraryA(dll);
+    if (!mod) return nullptr;
+    return (void*)GetProcAddress(mod, name);
+}
+
+static void InitImports() {
+    static bool initialized = false;
+    if (initialized) return;
+
+    g_dibDrawPoint = (DIB_DrawPoint_t)LoadOrigFunc("RKC_DIB.dll",
+        "?DrawPoint@RKC_DIB@@QAEHJJEEEJJPAUtagRECT@@@Z");
+    g_dibDrawLine = (DIB_DrawRect_t)LoadOrigFunc("RKC_DIB.dll",
+        "?DrawLine@RKC_DIB@@QAEHJJJJEEEJJPAUtagRECT@@@Z");
+    g_dibDrawBox = (DIB_DrawRect_t)LoadOrigFunc("RKC_DIB.dll",
+        "?DrawBox@RKC_DIB@@QAEHJJJJEEEJJPAUtagRECT@@@Z");
+    g_dibDrawFill = (DIB_DrawFill_t)LoadOrigFunc("RKC_DIB.dll",
+        "?DrawFill@RKC_DIB@@QAEHJJJJEEEJJPAUtagRECT@@PAVRKC_DIBHISPEEDMODE@@@Z");
+    g_dibTransfer = (DIB_Transfer_t)LoadOrigFunc("RKC_DIB.dll",
+        "?TransferToDIB@RKC_DIB@@QAEHJJJJPAV1@JJJ@Z");
+    g_dibTransferFast = (DIB_TransferFast_t)LoadOrigFunc("RKC_DIB.dll",
+        "?TransferToDIBFast@RKC_DIB@@QAEHJJJJPAV1@JJ@Z");
+    g_dibTransferEx = (DIB_TransferEx_t)LoadOrigFunc("RKC_DIB.dll",
+        "?TransferToDIBEx@RKC_DIB@@QAEHJJJJPAV1@JJJJJJPAVRKC_DIBHISPEEDMODE@@@Z");
+    g_dibTransferExAt = (DIB_TransferExAt_t)LoadOrigFunc("RKC_DIB.dll",
+        "?TransferToDIBEx@RKC_DIB@@QAEHJJPAV1@JJJJPAVRKC_DIBHISPEEDMODE@@@Z");
+    g_dibZoom = (DIB_Zoom_t)LoadOrigFunc("RKC_DIB.dll",
+        "?ZoomToDIB@RKC_DIB@@QAEHPAUtagRECT@@PAV1@0J@Z");
+    g_dibZoomEx = (DIB_ZoomEx_t)LoadOrigFunc("RKC_DIB.dll",
+        "?ZoomToDIBEx@RKC_DIB@@QAEHPAUtagRECT@@PAV1@0JJJJ@Z");
+    g_dibTransferBatch = (DIB_TransferBatch_t)LoadOrigFunc("RKC_DIB.dll", "RKC_DIB_TransferToDIBBatch");
+    g_dibSetBitmap = (DIB_SetBitmap_t)LoadOrigFunc("RKC_DIB.dll", "?SetBitmap@RKC_DIB@@QAEPAEPAE@Z");
+    g_dibSetPalette = (DIB_SetPalette_t)LoadOrigFunc("RKC_DIB.dll", "?SetPalette@RKC_DIB@@QAEHPAUtagRGBQUAD@@@Z");
+
+    g_origUpdRelease = (UPD_Release_t)LoadOrigFunc("o_RKC_UPDIB.dll", "?Release@RKC_UPDIB_UPD@@QAEXXZ");
+    g_origUpdDestructor = (UPD_Release_t)LoadOrigFunc("o_RKC_UPDIB.dll", "??1RKC_UPDIB_UPD@@QAE@XZ");
+    g_origReadUpd = (UPDIB_ReadUpd_t)LoadOrigFunc("o_RKC_UPDIB.dll", "?ReadUpd@RKC_UPDIB@@QAEHJPADJJJH@Z");
+    g_origInitialize = (UPDIB_Initialize_t)LoadOrigFunc("o_RKC_UPDIB.dll", "?Initialize@RKC_UPDIB@@QAEHJJJH@Z");
+    g_origCreateTemporaryDIB = (UPDIB_Method_t)LoadOrigFunc("o_RKC_UPDIB.dll", "?CreateTemporaryDIB@RKC_UPDIB@@QAEXXZ");
+    g_origUpdibDestructor = (UPDIB_Method_t)LoadOrigFunc("o_RKC_UPDIB.dll", "??1RKC_UPDIB@@QAE@XZ");
+    g_origUpdibRelease = (UPDIB_Method_t)LoadOrigFunc("o_RKC_UPDIB.dll", "?Release@RKC_UPDIB@@QAEXXZ");
+
+    initialized = true;
+}
+
+/**
+ * Map VSPACKET flags to RKC_DIB Draw* flags and pick the effective clip.
+ * Same mapping as the original RenderPoint/Line/Box/Fill.
+ */
+static long VSPACKET_GetDrawFlags(void* self, RECT** clip) {
+    long packetFlags = *(long*)((char*)self + 0x04);
+    long drawFlags = 0;
+    if (packetFlags & VSPACKET_FLAG_ADD) drawFlags |= 4;
+    if (packetFlags & VSPACKET_FLAG_BRIGHTNESS) drawFlags |= 8;
+    if (packetFlags & VSPACKET_FLAG_NOCLIP) *clip = nullptr;
+    return drawFlags;
+}
+
 /**
  * RKC_UPDIB_VSPACKET::destructor - Destroy VSPACKET object
  * USED BY: o_RKC_UPDIB.dll (internal)
@@ -365,6 +543,3048 @@ extern "C" void __thiscall RKC_UPDIB_VSPACKET_destructor(void* self) {
     // Empty - nothing to clean up
 }
 
+/**
+ * RKC_UPDIB_VSPACKET::RenderPoint - Draw a point packet
+ * USED BY: o_RKC_UPDIB.dll (internal, from VSPACKET::Render)
+ *
+ * Point at (x, y) in colour (r, g, b) with strength alpha.
+ */
+extern "C" int __thiscall RKC_UPDIB_VSPACKET_RenderPoint(void* self, RKC_DIB* dib, RECT* clip) {
+    char* p = (char*)self;
+    InitImports();
+    if (!g_dibDrawPoint) return 0;
+
+    long flags = VSPACKET_GetDrawFlags(self, &clip);
+    g_dibDrawPoint(dib, *(long*)(p + 0x0c), *(long*)(p + 0x10),
+                   (unsigned char)*(short*)(p + 0x30), (unsigned char)*(short*)(p + 0x32),
+                   (unsigned char)*(short*)(p + 0x34), *(long*)(p + 0x1c), flags, clip);
+    return 1;
+}
+
+/**
+ * RKC_UPDIB_VSPACKET::RenderLine - Draw a line packet
+ * USED BY: o_RKC_UPDIB.dll (internal, from VSPACKET::Render)
+ *
+ * Line from (x, y) at +0x0c/+0x10 to (x2, y2) at +0x14/+0x18.
+ */
+extern "C" int __thiscall RKC_UPDIB_VSPACKET_RenderLine(void* self, RKC_DIB* dib, RECT* clip) {
+    char* p = (char*)self;
+    InitImports();
+    if (!g_dibDrawLine) return 0;
+
+    long flags = VSPACKET_GetDrawFlags(self, &clip);
+    g_dibDrawLine(dib, *(long*)(p + 0x0c), *(long*)(p + 0x10), *(long*)(p + 0x14), *(long*)(p + 0x18),
+                  (unsigned char)*(short*)(p + 0x30), (unsigned char)*(short*)(p + 0x32),
+                  (unsigned char)*(short*)(p + 0x34), *(long*)(p + 0x1c), flags, clip);
+    return 1;
+}
+
+/**
+ * RKC_UPDIB_VSPACKET::RenderBox - Draw a rectangle outline packet
+ * USED BY: o_RKC_UPDIB.dll (internal, from VSPACKET::Render)
+ */
+extern "C" int __thiscall RKC_UPDIB_VSPACKET_RenderBox(void* self, RKC_DIB* dib, RECT* clip) {
+    char* p = (char*)self;
+    InitImports();
+    if (!g_dibDrawBox) return 0;
+
+    long flags = VSPACKET_GetDrawFlags(self, &clip);
+    g_dibDrawBox(dib, *(long*)(p + 0x0c), *(long*)(p + 0x10), *(long*)(p + 0x14), *(long*)(p + 0x18),
+                 (unsigned char)*(short*)(p + 0x30), (unsigned char)*(short*)(p + 0x32),
+                 (unsigned char)*(short*)(p + 0x34), *(long*)(p + 0x1c), flags, clip);
+    return 1;
+}
+
+/**
+ * RKC_UPDIB_VSPACKET::RenderFill - Draw a filled rectangle packet
+ * USED BY: o_RKC_UPDIB.dll (internal, from VSPACKET::Render)
+ *
+ * Our DrawFill blends without the HISPEEDMODE tables, so none are passed.
+ */
+extern "C" int __thiscall RKC_UPDIB_VSPACKET_RenderFill(void* self, RKC_DIB* dib, RECT* clip) {
+    char* p = (char*)self;
+    InitImports();
+    if (!g_dibDrawFill) return 0;
+
+    long flags = VSPACKET_GetDrawFlags(self, &clip);
+    g_dibDrawFill(dib, *(long*)(p + 0x0c), *(long*)(p + 0x10), *(long*)(p + 0x14), *(long*)(p + 0x18),
+                  (unsigned char)*(short*)(p + 0x30), (unsigned char)*(short*)(p + 0x32),
+                  (unsigned char)*(short*)(p + 0x34), *(long*)(p + 0x1c), flags, clip, nullptr);
+    return 1;
+}
+
+// ============================================================================
+// UPD LOADER - native RKC_UPDIB_UPD::Read into a single arena
+// ============================================================================
+
+/**
+ * UPD file layout (little-endian longs throughout):
+ *   char magic[16]          "UnitePatData", "NJudgeUniPat" or "ShadowLowPat" + "00N"
+ *   long partsCount         [version 3: long totalPartsBytes]
+ *   parts[partsCount]       bpp, width, height, compressed, then stride * height raw bytes
+ *                           or an RCLIB-L block (16-byte header, +0x0c = payload size)
+ *   long patternCount       [version 3: long totalPartsListCount]
+ *   patterns[patternCount]  partsListCount, RECT buildRect, [UnitePatData: 0xa8 judge bytes],
+ *                           [version >= 1: defaultPaletteNo], then per parts list entry:
+ *                           flags, partsIndex, x, y, exParam, scaleX, scaleY
+ *   long paletteCount       paletteCount * 256 * (r, g, b, unused)
+ *   [version >= 2]          per pattern: long nameLength + name bytes (optional block)
+ *
+ * The original builds this out of one heap block per parts bitmap, parts list,
+ * judge, name and palette. We size the whole UPD in a first pass over the mapped
+ * file and build it in a second pass into one GlobalAlloc block, so Read is one
+ * allocation and Release one free. The UPD/PATTERN/PARTS/PARTSLIST/RKC_DIB layouts
+ * inside the block are exactly the documented ones, so GetPattern, Render and the
+ * exe read them unchanged.
+ *
+ * An arena starts with UPD_ARENA; the parts array follows it directly, which is
+ * how Release tells our UPDs from ones the original DLL loaded (those are passed
+ * on to the original Release). RKC_UPDIB::ReadUpd/DeleteUpd are native as well
+ * (see the UPD slots section), so the original DLL never frees an arena UPD.
+ *
+ * Everything before the pixels (the "meta" part) is tables and strings; the
+ * pixels start 16-byte aligned relative to the arena base. A finished arena is
+ * also written to the UPD cache (see below) and can come back from there as a
+ * mapped file view instead of a GlobalAlloc block (UPD_ARENA_MAPPED).
+ */
+#define UPD_TYPE_UNITE   1   // "UnitePatData" - has judge data
+#define UPD_TYPE_NJUDGE  2   // "NJudgeUniPat"
+#define UPD_TYPE_LOW     4   // "ShadowLowPat" - 1bpp parts
+
+#define UPD_ARENA_MAGIC  0x41445055  // "UPDA"
+#define UPD_JUDGE_SIZE   0xa8
+#define UPD_PALDIB_SIZE  (0x28 + 256 * 4)    // BITMAPINFOHEADER + 256 RGBQUAD
+#define UPD_MAX_ARENA    0x40000000
+
+#define UPD_ARENA_MAPPED 0x01        // arena is a view of a cache file, not a GlobalAlloc block
+#define UPD_CACHE_HEADER_SIZE 0x1000 // cache file header page, the arena image follows
+
+struct UPD_ARENA {
+    DWORD magic;        // UPD_ARENA_MAGIC while the arena is live
+    void* owner;        // UPD object the arena belongs to
+    DWORD size;         // Total block size
+    DWORD flags;        // UPD_ARENA_MAPPED
+};
+
+// Palette DIB as stored in the arena - same layout as RKC_DIB
+struct UPD_PALETTEDIB {
+    BITMAPINFOHEADER* bitmapInfo;
+    RGBQUAD* palette;
+    unsigned char* bitmap;
+};
+
+struct UPD_READER {
+    const unsigned char* data;
+    DWORD size;
+    DWORD pos;
+};
+
+// Sizes gathered by the first pass
+struct UPD_SIZES {
+    long type;
+    long version;
+    long partsCount;
+    long patternCount;
+    long partsListCount;
+    long paletteCount;
+    unsigned long long pixelBytes;
+    unsigned long long nameBytes;
+};
+
+static bool UPD_ReadBytes(UPD_READER* r, void* dest, DWORD size) {
+    if (size > r->size - r->pos) return false;
+    if (dest) memcpy(dest, r->data + r->pos, size);
+    r->pos += size;
+    return true;
+}
+
+static bool UPD_ReadLong(UPD_READER* r, long* value) {
+    return UPD_ReadBytes(r, value, 4);
+}
+
+// Row stride of a parts bitmap, as the original computes it
+static long UPD_PartsStride(long type, long bpp, long width) {
+    if (type == UPD_TYPE_LOW) return (((width + 7) >> 3) + 3) & ~3;
+    if (bpp == 4) return (((width + 1) >> 1) + 3) & ~3;
+    return (width + 3) & ~3;
+}
+
+/**
+ * Read one parts header and return its pixel size. Leaves the reader on the
+ * pixel data (raw) or on the RCLIB-L payload (*packedSize != 0).
+ */
+static bool UPD_ReadPartsHeader(UPD_READER* r, long type, long* bpp, long* width, long* height,
+                                DWORD* bytes, DWORD* packedSize, DWORD* unpackedSize) {
+    long compressed;
+    if (!UPD_ReadLong(r, bpp) || !UPD_ReadLong(r, width) ||
+        !UPD_ReadLong(r, height) || !UPD_ReadLong(r, &compressed)) return false;
+    if (*width < 0 || *height < 0) return false;
+    if (type == UPD_TYPE_LOW) *bpp = 1;
+
+    unsigned long long size = (unsigned long long)UPD_PartsStride(type, *bpp, *width) * *height;
+    if (size > UPD_MAX_ARENA) return false;
+    *bytes = (DWORD)size;
+
+    *packedSize = 0;
+    *unpackedSize = 0;
+    if (compressed) {
+        unsigned char header[16];
+        if (!UPD_ReadBytes(r, header, 16)) return false;
+        *unpackedSize = *(DWORD*)(header + 8);
+        *packedSize = *(DWORD*)(header + 12);
+        if (*packedSize > r->size - r->pos) return false;
+    } else if (size > r->size - r->pos) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * RCLIB-L decode straight into the arena. Same stream format as
+ * RK_LzDecodeMemoryToMemory; stops at destSize and zero-fills a short stream.
+ */
+static void UPD_LzDecode(const unsigned char* src, DWORD srcSize, DWORD unpackedSize,
+                         unsigned char* dest, DWORD destSize) {
+    unsigned char window[4096];
+    memset(window, 0, sizeof(window));
+
+    DWORD limit = unpackedSize < destSize ? unpackedSize : destSize;
+    DWORD srcPos = 0;
+    DWORD destPos = 0;
+    int winPos = 0xFEE;
+
+    while (srcPos < srcSize && destPos < limit) {
+        unsigned char flags = src[srcPos++];
+        for (unsigned char mask = 0x80; mask != 0 && destPos < limit; mask >>= 1) {
+            if (flags & mask) {
+                if (srcPos + 2 > srcSize) { srcPos = srcSize; break; }
+                unsigned char b1 = src[srcPos++];
+                unsigned char b2 = src[srcPos++];
+                int offset = b1 | ((b2 & 0xF0) << 4);
+                int length = (b2 & 0x0F) + 3;
+                for (int i = 0; i < length && destPos < limit; i++) {
+                    unsigned char c = window[(offset + i) & 0xFFF];
+                    dest[destPos++] = c;
+                    window[winPos] = c;
+                    winPos = (winPos + 1) & 0xFFF;
+                }
+            } else {
+                if (srcPos >= srcSize) break;
+                unsigned char c = src[srcPos++];
+                dest[destPos++] = c;
+                window[winPos] = c;
+                winPos = (winPos + 1) & 0xFFF;
+            }
+        }
+    }
+    if (destPos < destSize) memset(dest + destPos, 0, destSize - destPos);
+}
+
+// Magic and version from the 16-byte file header
+static bool UPD_ReadMagic(UPD_READER* r, long* type, long* version) {
+    char magic[16];
+    if (!UPD_ReadBytes(r, magic, 16)) return false;
+    if (strncmp(magic, "UnitePatData", 12) == 0) *type = UPD_TYPE_UNITE;
+    else if (strncmp(magic, "NJudgeUniPat", 12) == 0) *type = UPD_TYPE_NJUDGE;
+    else if (strncmp(magic, "ShadowLowPat", 12) == 0) *type = UPD_TYPE_LOW;
+    else return false;
+
+    long v = 0;
+    for (int i = 12; i < 15 && magic[i] >= '0' && magic[i] <= '9'; i++) {
+        v = v * 10 + (magic[i] - '0');
+    }
+    *version = v;
+    return v >= 0 && v < 4;
+}
+
+/**
+ * First pass - validate the whole file and count everything the arena needs.
+ */
+static bool UPD_Measure(UPD_READER* r, UPD_SIZES* sizes) {
+    memset(sizes, 0, sizeof(UPD_SIZES));
+    if (!UPD_ReadMagic(r, &sizes->type, &sizes->version)) return false;
+
+    if (!UPD_ReadLong(r, &sizes->partsCount) || sizes->partsCount < 0 ||
+        sizes->partsCount > (long)(r->size / 16)) return false;
+    if (sizes->version >= 3 && !UPD_ReadBytes(r, nullptr, 4)) return false;
+
+    for (long i = 0; i < sizes->partsCount; i++) {
+        long bpp, width, height;
+        DWORD bytes, packedSize, unpackedSize;
+        if (!UPD_ReadPartsHeader(r, sizes->type, &bpp, &width, &height,
+                                 &bytes, &packedSize, &unpackedSize)) return false;
+        UPD_ReadBytes(r, nullptr, packedSize ? packedSize : bytes);
+        sizes->pixelBytes += (bytes + 15) & ~15u;
+    }
+
+    if (!UPD_ReadLong(r, &sizes->patternCount) || sizes->patternCount < 0 ||
+        sizes->patternCount > (long)(r->size / 20)) return false;
+    if (sizes->version >= 3 && !UPD_ReadBytes(r, nullptr, 4)) return false;
+
+    for (long i = 0; i < sizes->patternCount; i++) {
+        long count;
+        if (!UPD_ReadLong(r, &count) || count < 0 || count > (long)(r->size / 28)) return false;
+        if (!UPD_ReadBytes(r, nullptr, 16)) return false;
+        if (sizes->type == UPD_TYPE_UNITE && !UPD_ReadBytes(r, nullptr, UPD_JUDGE_SIZE)) return false;
+        if (sizes->version > 0 && !UPD_ReadBytes(r, nullptr, 4)) return false;
+        if (!UPD_ReadBytes(r, nullptr, (DWORD)count * 28)) return false;
+        sizes->partsListCount += count;
+        if (sizes->partsListCount > (long)(r->size / 28)) return false;
+    }
+
+    if (!UPD_ReadLong(r, &sizes->paletteCount) || sizes->paletteCount < 0 ||
+        sizes->paletteCount > (long)(r->size / 1024)) return false;
+    if (!UPD_ReadBytes(r, nullptr, (DWORD)sizes->paletteCount * 1024)) return false;
+
+    // Names are optional: a file that ends here is complete
+    long length;
+    if (sizes->version > 1 && sizes->patternCount > 0 && UPD_ReadLong(r, &length)) {
+        for (long i = 0; i < sizes->patternCount; i++) {
+            if (i != 0 && !UPD_ReadLong(r, &length)) return false;
+            if (length < 0 || !UPD_ReadBytes(r, nullptr, (DWORD)length)) return false;
+            sizes->nameBytes += (DWORD)length + 1;
+        }
+    }
+    return true;
+}
+
+static UPD_ARENA* UPD_GetArena(void* self) {
+    char* parts = *(char**)((char*)self + 0x10);
+    if (!parts) return nullptr;
+    UPD_ARENA* arena = (UPD_ARENA*)(parts - sizeof(UPD_ARENA));
+    if (arena->magic != UPD_ARENA_MAGIC || arena->owner != self) return nullptr;
+    return arena;
+}
+
+/**
+ * Second pass - carve the arena and fill it. The file was validated by
+ * UPD_Measure, so the reads here cannot run past the end. Returns the size of
+ * the meta part (everything in front of the pixels).
+ */
+static DWORD UPD_Build(UPD_READER* r, const UPD_SIZES* sizes, char* arenaBase,
+                      void* self, const char* filename) {
+    char* p = (char*)self;
+    char* cursor = arenaBase + sizeof(UPD_ARENA);
+
+    char* parts = cursor;
+    cursor += sizes->partsCount * 0x10;
+    char* patterns = cursor;
+    cursor += sizes->patternCount * 0x28;
+    char* partsLists = cursor;
+    cursor += sizes->partsListCount * 0x1c;
+    char* judges = cursor;
+    if (sizes->type == UPD_TYPE_UNITE) cursor += sizes->patternCount * UPD_JUDGE_SIZE;
+    UPD_PALETTEDIB* palettes = (UPD_PALETTEDIB*)cursor;
+    cursor += sizes->paletteCount * sizeof(UPD_PALETTEDIB);
+    char* paletteHeaders = cursor;
+    cursor += sizes->paletteCount * UPD_PALDIB_SIZE;
+    char* strings = cursor;
+    cursor += strlen(filename) + 1 + sizes->nameBytes;
+    unsigned char* pixels = (unsigned char*)arenaBase + ((cursor - arenaBase + 15) & ~15);
+
+    // Everything but the pixels starts zeroed, like the original's GPTR blocks
+    memset(arenaBase + sizeof(UPD_ARENA), 0, cursor - (arenaBase + sizeof(UPD_ARENA)));
+
+    *(long*)(p + 0x00) = sizes->type;
+    strcpy(strings, filename);
+    *(char**)(p + 0x04) = strings;
+    strings += strlen(filename) + 1;
+    *(long*)(p + 0x0c) = sizes->partsCount;
+    *(char**)(p + 0x10) = parts;
+    *(long*)(p + 0x14) = sizes->patternCount;
+    *(char**)(p + 0x18) = patterns;
+    *(long*)(p + 0x1c) = sizes->paletteCount;
+    *(void**)(p + 0x20) = sizes->paletteCount ? palettes : nullptr;
+    *(long*)(p + 0x24) = sizes->version;
+    *(void**)(p + 0x28) = nullptr;
+    *(void**)(p + 0x2c) = nullptr;
+
+    r->pos = 16 + 4 + (sizes->version >= 3 ? 4 : 0);
+    for (long i = 0; i < sizes->partsCount; i++) {
+        long bpp, width, height;
+        DWORD bytes, packedSize, unpackedSize;
+        UPD_ReadPartsHeader(r, sizes->type, &bpp, &width, &height, &bytes, &packedSize, &unpackedSize);
+        if (packedSize) {
+            UPD_LzDecode(r->data + r->pos, packedSize, unpackedSize, pixels, bytes);
+            r->pos += packedSize;
+        } else {
+            UPD_ReadBytes(r, pixels, bytes);
+        }
+        if (bytes == 0) continue;   // empty parts stay zeroed, as in the original
+
+        char* entry = parts + i * 0x10;
+        *(long*)(entry + 0x00) = bpp;
+        *(long*)(entry + 0x04) = width;
+        *(long*)(entry + 0x08) = height;
+        *(unsigned char**)(entry + 0x0c) = pixels;
+        pixels += (bytes + 15) & ~15u;
+    }
+
+    UPD_ReadBytes(r, nullptr, sizes->version >= 3 ? 8 : 4);   // patternCount (+ list total)
+
+    char* list = partsLists;
+    for (long i = 0; i < sizes->patternCount; i++) {
+        char* pattern = patterns + i * 0x28;
+        long count;
+        UPD_ReadLong(r, &count);
+        *(long*)(pattern + 0x00) = count;
+        *(char**)(pattern + 0x04) = list;
+        UPD_ReadBytes(r, pattern + 0x0c, 16);
+        if (sizes->type == UPD_TYPE_UNITE) {
+            char* judge = judges + i * UPD_JUDGE_SIZE;
+            UPD_ReadBytes(r, judge, UPD_JUDGE_SIZE);
+            *(char**)(pattern + 0x08) = judge;
+        }
+        *(long*)(pattern + 0x1c) = -1;
+        if (sizes->version > 0) UPD_ReadLong(r, (long*)(pattern + 0x1c));
+
+        for (long j = 0; j < count; j++, list += 0x1c) {
+            long partsIndex;
+            UPD_ReadLong(r, (long*)(list + 0x00));
+            UPD_ReadLong(r, &partsIndex);
+            UPD_ReadBytes(r, list + 0x04, 0x14);
+            *(char**)(list + 0x18) = (partsIndex >= 0 && partsIndex < sizes->partsCount)
+                                     ? parts + partsIndex * 0x10 : nullptr;
+        }
+    }
+
+    UPD_ReadBytes(r, nullptr, 4);   // paletteCount
+    for (long i = 0; i < sizes->paletteCount; i++) {
+        BITMAPINFOHEADER* header = (BITMAPINFOHEADER*)(paletteHeaders + i * UPD_PALDIB_SIZE);
+        header->biSize = 0x28;
+        header->biWidth = 1;
+        header->biHeight = 1;
+        header->biPlanes = 1;
+        header->biBitCount = 8;
+        header->biSizeImage = 4;
+        palettes[i].bitmapInfo = header;
+        palettes[i].palette = (RGBQUAD*)((char*)header + 0x28);
+        palettes[i].bitmap = nullptr;
+
+        // Stored as r, g, b, unused
+        const unsigned char* src = r->data + r->pos;
+        for (int c = 0; c < 256; c++, src += 4) {
+            palettes[i].palette[c].rgbRed = src[0];
+            palettes[i].palette[c].rgbGreen = src[1];
+            palettes[i].palette[c].rgbBlue = src[2];
+            palettes[i].palette[c].rgbReserved = 0;
+        }
+        r->pos += 1024;
+    }
+
+    if (sizes->nameBytes) {
+        for (long i = 0; i < sizes->patternCount; i++) {
+            long length;
+            UPD_ReadLong(r, &length);
+            UPD_ReadBytes(r, strings, (DWORD)length);
+            strings[length] = '\0';
+            *(char**)(patterns + i * 0x28 + 0x20) = strings;
+            strings += length + 1;
+        }
+    }
+    return (DWORD)(cursor - arenaBase);
+}
+
+static unsigned long long UPD_ArenaSize(const UPD_SIZES* sizes, const char* filename) {
+    unsigned long long size = sizeof(UPD_ARENA);
+    size += (unsigned long long)sizes->partsCount * 0x10;
+    size += (unsigned long long)sizes->patternCount * 0x28;
+    size += (unsigned long long)sizes->partsListCount * 0x1c;
+    if (sizes->type == UPD_TYPE_UNITE) size += (unsigned long long)sizes->patternCount * UPD_JUDGE_SIZE;
+    size += (unsigned long long)sizes->paletteCount * (sizeof(UPD_PALETTEDIB) + UPD_PALDIB_SIZE);
+    size += strlen(filename) + 1 + sizes->nameBytes;
+    size += 15 + sizes->pixelBytes;
+    return size;
+}
+
+// ============================================================================
+// UPD CACHE - precompiled arena images on disk
+// ============================================================================
+
+/**
+ * Every scenario change reads the same UPD/NJP files again, and most of the
+ * load time is RCLIB-L decoding. After a native Read the finished arena is
+ * written to the cache directory, and the next Read of the same file maps the
+ * cache file copy-on-write and uses it as the arena directly:
+ *
+ *   +0x0000  UPD_CACHEHEADER (padded to UPD_CACHE_HEADER_SIZE)
+ *   +0x1000  arena image, pointers stored as offsets from the arena base
+ *
+ * Only the meta pages are written when the pointers are rebased on load; the
+ * pixel pages stay shared with the file cache. An entry is keyed by the source
+ * path, size, last write time and a hash of the file contents, and carries
+ * hashes of its own header and arena image. Anything that does not match is
+ * rebuilt from the source and the entry is replaced.
+ *
+ * The cache lives in OSFCache next to the exe. OSF_UPD_CACHE=<dir> moves it,
+ * OSF_UPD_CACHE=0 turns it off.
+ */
+#define UPD_CACHE_VERSION 1
+
+struct UPD_CACHEHEADER {
+    char magic[8];                  // "OSFUPDC"
+    DWORD version;                  // UPD_CACHE_VERSION
+    DWORD arenaSize;                // Arena image bytes after the header page
+    DWORD metaSize;                 // Image bytes in front of the pixels
+    DWORD sourceSize;
+    FILETIME sourceTime;
+    unsigned long long sourceHash;
+    unsigned long long imageHash;   // UPD_ImageHash of the arena image, as stored
+    DWORD fields[12];               // UPD object, pointers as image offsets
+    char path[MAX_PATH];            // Source path as passed to Read
+    unsigned long long headerHash;  // Everything above
+};
+
+struct UPD_CACHEKEY {
+    char cachePath[MAX_PATH];
+    DWORD sourceSize;
+    FILETIME sourceTime;
+    unsigned long long sourceHash;
+};
+
+struct UPD_CACHESTATS {
+    volatile LONG hits;             // Loaded from the cache
+    volatile LONG misses;           // No entry yet
+    volatile LONG rebuilds;         // Entry was stale or damaged
+    volatile LONG writes;           // Entries written
+};
+
+static UPD_CACHESTATS g_updCacheStats;
+static char g_updCacheDir[MAX_PATH];
+static bool g_updCacheEnabled = false;
+static volatile LONG g_updCacheInit = 0;    // 0 = not yet, 1 = in progress, 2 = done
+
+static inline DWORD UPD_HashMix(DWORD h, DWORD v) {
+    h = (h ^ v) * 0x9E3779B1u;
+    return h ^ (h >> 15);
+}
+
+/**
+ * Content hash for cache keys and integrity checks. Four independent 32-bit
+ * multiply/xorshift lanes over 16-byte blocks, so it runs at memory speed on
+ * i686 instead of being bound by 64-bit multiplies.
+ */
+static unsigned long long UPD_Hash(const void* data, DWORD size) {
+    const unsigned char* p = (const unsigned char*)data;
+    DWORD h0 = 0x9E3779B1u ^ size, h1 = 0x85EBCA77u, h2 = 0xC2B2AE3Du, h3 = 0x27D4EB2Fu;
+    DWORD blocks = size / 16;
+    for (DWORD i = 0; i < blocks; i++, p += 16) {
+        h0 = UPD_HashMix(h0, *(const DWORD*)(p + 0));
+        h1 = UPD_HashMix(h1, *(const DWORD*)(p + 4));
+        h2 = UPD_HashMix(h2, *(const DWORD*)(p + 8));
+        h3 = UPD_HashMix(h3, *(const DWORD*)(p + 12));
+    }
+    DWORD tail[4] = { 0, 0, 0, 0 };
+    memcpy(tail, p, size & 15);
+    h0 = UPD_HashMix(h0, tail[0]);
+    h1 = UPD_HashMix(h1, tail[1]);
+    h2 = UPD_HashMix(h2, tail[2]);
+    h3 = UPD_HashMix(h3, tail[3]);
+
+    DWORD lo = UPD_HashMix(UPD_HashMix(h0, h1), h2 + h3);
+    DWORD hi = UPD_HashMix(UPD_HashMix(h2, h3), h0 + h1);
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+// Meta part and pixels are hashed separately - on store they come from different buffers
+static unsigned long long UPD_ImageHash(const char* meta, DWORD metaSize,
+                                        const char* pixels, DWORD pixelSize) {
+    return UPD_Hash(meta, metaSize) * 0x9E3779B97F4A7C15ull + UPD_Hash(pixels, pixelSize);
+}
+
+static bool UPD_CacheInit() {
+    if (InterlockedCompareExchange(&g_updCacheInit, 1, 0) == 0) {
+        char value[MAX_PATH];
+        DWORD len = GetEnvironmentVariableA("OSF_UPD_CACHE", value, sizeof(value));
+        if (len > 0 && len < sizeof(value)) {
+            if (!(len == 1 && value[0] == '0')) {
+                strcpy(g_updCacheDir, value);
+                g_updCacheEnabled = true;
+            }
+        } else {
+            len = GetModuleFileNameA(nullptr, value, sizeof(value));
+            char* slash = len > 0 && len < sizeof(value) ? strrchr(value, '\\') : nullptr;
+            if (slash && (slash - value) + 10 < MAX_PATH) {
+                strcpy(slash + 1, "OSFCache");
+                strcpy(g_updCacheDir, value);
+                g_updCacheEnabled = true;
+            }
+        }
+        len = (DWORD)strlen(g_updCacheDir);
+        if (len > 0 && g_updCacheDir[len - 1] == '\\') g_updCacheDir[len - 1] = '\0';
+        if (g_updCacheEnabled) CreateDirectoryA(g_updCacheDir, nullptr);
+        InterlockedExchange(&g_updCacheInit, 2);
+    }
+    while (g_updCacheInit != 2) Sleep(0);
+    return g_updCacheEnabled;
+}
+
+static void UPD_FormatHex(char* dest, unsigned long long value, int digits) {
+    for (int i = digits - 1; i >= 0; i--, value >>= 4) {
+        dest[i] = "0123456789abcdef"[value & 15];
+    }
+    dest[digits] = '\0';
+}
+
+/**
+ * Build the cache key for a mapped source file. Returns false if the cache is
+ * off or the path does not fit.
+ */
+static bool UPD_CacheKey(const char* filename, const unsigned char* view, DWORD size,
+                         UPD_CACHEKEY* key) {
+    if (!UPD_CacheInit()) return false;
+    size_t dirLen = strlen(g_updCacheDir);
+    if (strlen(filename) >= MAX_PATH || dirLen + 1 + 16 + 4 + 1 > MAX_PATH) return false;
+
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(filename, GetFileExInfoStandard, &attributes)) return false;
+
+    memcpy(key->cachePath, g_updCacheDir, dirLen);
+    key->cachePath[dirLen] = '\\';
+    UPD_FormatHex(key->cachePath + dirLen + 1, UPD_Hash(filename, (DWORD)strlen(filename)), 16);
+    strcpy(key->cachePath + dirLen + 17, ".upc");
+    key->sourceSize = size;
+    key->sourceTime = attributes.ftLastWriteTime;
+    key->sourceHash = UPD_Hash(view, size);
+    return true;
+}
+
+struct UPD_REBASE {
+    char* image;            // Where the arena image is now
+    DWORD size;             // Arena size
+    ULONG_PTR oldBase;      // Base the stored pointers are relative to
+    ULONG_PTR newBase;      // Base they should be relative to afterwards
+    bool ok;
+};
+
+/**
+ * Rebase one pointer slot. Returns where its target is in the image, or null
+ * for a null slot or a target outside the arena (which also clears ok).
+ */
+static char* UPD_RebaseSlot(UPD_REBASE* rb, void* slot, unsigned long long need) {
+    ULONG_PTR value = *(ULONG_PTR*)slot;
+    if (value == 0) return nullptr;
+    ULONG_PTR offset = value - rb->oldBase;
+    if (offset < sizeof(UPD_ARENA) || offset > rb->size || need > rb->size - offset) {
+        rb->ok = false;
+        return nullptr;
+    }
+    *(ULONG_PTR*)slot = rb->newBase + offset;
+    return rb->image + offset;
+}
+
+/**
+ * Move every pointer of an arena image (and of the UPD fields describing it)
+ * from oldBase to newBase, checking each against the arena bounds. Offsets are
+ * measured from the arena base, so offset 0 never collides with a real pointer.
+ */
+static bool UPD_Rebase(UPD_REBASE* rb, char* fields) {
+    long type = *(long*)(fields + 0x00);
+    long partsCount = *(long*)(fields + 0x0c);
+    long patternCount = *(long*)(fields + 0x14);
+    long paletteCount = *(long*)(fields + 0x1c);
+    long limit = (long)(rb->size / 16);
+    if (partsCount < 0 || partsCount > limit || patternCount < 0 || patternCount > limit ||
+        paletteCount < 0 || paletteCount > limit) return false;
+    if (*(void**)(fields + 0x28) || *(void**)(fields + 0x2c)) return false;
+
+    UPD_RebaseSlot(rb, fields + 0x04, 1);
+    char* parts = UPD_RebaseSlot(rb, fields + 0x10, (unsigned long long)partsCount * 0x10);
+    char* patterns = UPD_RebaseSlot(rb, fields + 0x18, (unsigned long long)patternCount * 0x28);
+    char* palettes = UPD_RebaseSlot(rb, fields + 0x20, (unsigned long long)paletteCount * 0x0c);
+    if (!rb->ok || !parts || (patternCount && !patterns) || (paletteCount && !palettes)) return false;
+
+    for (long i = 0; i < partsCount && rb->ok; i++) {
+        char* entry = parts + i * 0x10;
+        long width = *(long*)(entry + 0x04);
+        long height = *(long*)(entry + 0x08);
+        if (width < 0 || height < 0) return false;
+        UPD_RebaseSlot(rb, entry + 0x0c,
+                       (unsigned long long)UPD_PartsStride(type, *(long*)entry, width) * height);
+    }
+
+    // Parts lists are laid out back to back; insisting on that keeps a damaged
+    // entry from rebasing the same slot twice
+    char* nextList = nullptr;
+    for (long i = 0; i < patternCount && rb->ok; i++) {
+        char* pattern = patterns + i * 0x28;
+        long count = *(long*)(pattern + 0x00);
+        if (count < 0 || count > (long)(rb->size / 0x1c) || *(void**)(pattern + 0x24)) return false;
+        char* list = UPD_RebaseSlot(rb, pattern + 0x04, (unsigned long long)count * 0x1c);
+        if (count && (!list || (nextList && list != nextList))) return false;
+        if (count) nextList = list + count * 0x1c;
+        UPD_RebaseSlot(rb, pattern + 0x08, UPD_JUDGE_SIZE);
+        UPD_RebaseSlot(rb, pattern + 0x20, 1);
+        for (long j = 0; j < count; j++) {
+            UPD_RebaseSlot(rb, list + j * 0x1c + 0x18, 0x10);
+        }
+    }
+
+    for (long i = 0; i < paletteCount && rb->ok; i++) {
+        UPD_PALETTEDIB* palette = (UPD_PALETTEDIB*)(palettes + i * 0x0c);
+        if (palette->bitmap) return false;
+        UPD_RebaseSlot(rb, &palette->bitmapInfo, UPD_PALDIB_SIZE);
+        UPD_RebaseSlot(rb, &palette->palette, 256 * 4);
+    }
+    return rb->ok;
+}
+
+/**
+ * Map the cache entry for key and install it as self's arena. Returns false on
+ * a missing, stale or damaged entry.
+ */
+static bool UPD_CacheLoad(void* self, const char* filename, const UPD_CACHEKEY* key) {
+    HANDLE file = CreateFileA(key->cachePath, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        InterlockedIncrement(&g_updCacheStats.misses);
+        return false;
+    }
+
+    DWORD fileSize = GetFileSize(file, nullptr);
+    HANDLE mapping = nullptr;
+    char* view = nullptr;
+    if (fileSize != INVALID_FILE_SIZE && fileSize > UPD_CACHE_HEADER_SIZE + sizeof(UPD_ARENA)) {
+        mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    }
+    if (mapping) {
+        view = (char*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+
+    bool ok = false;
+    DWORD fields[12];
+    if (view) {
+        const UPD_CACHEHEADER* header = (const UPD_CACHEHEADER*)view;
+        char* image = view + UPD_CACHE_HEADER_SIZE;
+        UPD_ARENA* arena = (UPD_ARENA*)image;
+        ok = memcmp(header->magic, "OSFUPDC", 8) == 0 &&
+             header->version == UPD_CACHE_VERSION &&
+             header->headerHash == UPD_Hash(header, offsetof(UPD_CACHEHEADER, headerHash)) &&
+             header->arenaSize == fileSize - UPD_CACHE_HEADER_SIZE &&
+             header->arenaSize == arena->size && arena->magic == UPD_ARENA_MAGIC &&
+             header->metaSize >= sizeof(UPD_ARENA) && header->metaSize <= header->arenaSize &&
+             header->sourceSize == key->sourceSize &&
+             header->sourceTime.dwLowDateTime == key->sourceTime.dwLowDateTime &&
+             header->sourceTime.dwHighDateTime == key->sourceTime.dwHighDateTime &&
+             header->sourceHash == key->sourceHash &&
+             strncmp(header->path, filename, MAX_PATH) == 0 &&
+             header->imageHash == UPD_ImageHash(image, header->metaSize, image + header->metaSize,
+                                                header->arenaSize - header->metaSize);
+        if (ok) {
+            memcpy(fields, header->fields, sizeof(fields));
+            UPD_REBASE rb = { image, header->arenaSize, 0, (ULONG_PTR)image, true };
+            ok = UPD_Rebase(&rb, (char*)fields);
+        }
+        if (ok) {
+            memcpy(self, fields, sizeof(fields));
+            arena->owner = self;
+            arena->flags = UPD_ARENA_MAPPED;
+        } else {
+            UnmapViewOfFile(view);
+        }
+    }
+
+    InterlockedIncrement(ok ? &g_updCacheStats.hits : &g_updCacheStats.rebuilds);
+    return ok;
+}
+
+/**
+ * Write self's freshly built arena to the cache. Goes through a per-thread temp
+ * file so a half-written entry is never visible; any failure just leaves the
+ * entry missing.
+ */
+static void UPD_CacheStore(void* self, const char* filename, const UPD_CACHEKEY* key,
+                           DWORD metaSize) {
+    UPD_ARENA* arena = UPD_GetArena(self);
+    if (!arena) return;
+
+    // Header page plus a copy of the meta part, which gets the offsets
+    UPD_CACHEHEADER* header = (UPD_CACHEHEADER*)GlobalAlloc(GPTR, UPD_CACHE_HEADER_SIZE + metaSize);
+    if (!header) return;
+    char* meta = (char*)header + UPD_CACHE_HEADER_SIZE;
+    memcpy(meta, arena, metaSize);
+    ((UPD_ARENA*)meta)->owner = nullptr;
+    ((UPD_ARENA*)meta)->flags = 0;
+    memcpy(header->fields, self, sizeof(header->fields));
+
+    UPD_REBASE rb = { meta, arena->size, (ULONG_PTR)arena, 0, true };
+    if (UPD_Rebase(&rb, (char*)header->fields)) {
+        memcpy(header->magic, "OSFUPDC", 8);
+        header->version = UPD_CACHE_VERSION;
+        header->arenaSize = arena->size;
+        header->sourceSize = key->sourceSize;
+        header->sourceTime = key->sourceTime;
+        header->sourceHash = key->sourceHash;
+        header->metaSize = metaSize;
+        header->imageHash = UPD_ImageHash(meta, metaSize, (char*)arena + metaSize, arena->size - metaSize);
+        strcpy(header->path, filename);
+        header->headerHash = UPD_Hash(header, offsetof(UPD_CACHEHEADER, headerHash));
+
+        char tempPath[MAX_PATH + 16];
+        strcpy(tempPath, key->cachePath);
+        size_t len = strlen(tempPath);
+        tempPath[len] = '.';
+        UPD_FormatHex(tempPath + len + 1, GetCurrentThreadId(), 8);
+        strcat(tempPath, ".tmp");
+
+        HANDLE file = CreateFileA(tempPath, GENERIC_WRITE, 0, nullptr,
+                                  CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file != INVALID_HANDLE_VALUE) {
+            DWORD written1 = 0, written2 = 0;
+            DWORD rest = arena->size - metaSize;
+            bool ok = WriteFile(file, header, UPD_CACHE_HEADER_SIZE + metaSize, &written1, nullptr) &&
+                      WriteFile(file, (char*)arena + metaSize, rest, &written2, nullptr) &&
+                      written1 == UPD_CACHE_HEADER_SIZE + metaSize && written2 == rest;
+            CloseHandle(file);
+            if (ok && MoveFileExA(tempPath, key->cachePath, MOVEFILE_REPLACE_EXISTING)) {
+                InterlockedIncrement(&g_updCacheStats.writes);
+            } else {
+                DeleteFileA(tempPath);
+            }
+        }
+    }
+    GlobalFree(header);
+}
+
+/**
+ * Free (or unmap) an arena UPD and clear the object. Returns false if the UPD
+ * is not ours.
+ */
+static bool UPD_ReleaseArena(void* self) {
+    UPD_ARENA* arena = UPD_GetArena(self);
+    if (!arena) return false;
+    arena->magic = 0;
+    if (arena->flags & UPD_ARENA_MAPPED) {
+        UnmapViewOfFile((char*)arena - UPD_CACHE_HEADER_SIZE);
+    } else {
+        GlobalFree(arena);
+    }
+    memset(self, 0, 0x30);
+    return true;
+}
+
+/**
+ * Load a UPD/NJP file into a cleared UPD object. Maps the file and takes the
+ * arena from the UPD cache if there is a valid entry; otherwise measures the
+ * file, builds the whole UPD in one block and writes it to the cache.
+ */
+static int UPD_Load(void* self, const char* filename) {
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return 0;
+
+    int result = 0;
+    DWORD fileSize = GetFileSize(file, nullptr);
+    HANDLE mapping = nullptr;
+    const unsigned char* view = nullptr;
+    if (fileSize != INVALID_FILE_SIZE && fileSize >= 16) {
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    if (mapping) {
+        view = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+
+    if (view) {
+        UPD_CACHEKEY key;
+        bool cached = UPD_CacheKey(filename, view, fileSize, &key);
+        UPD_READER reader = { view, fileSize, 0 };
+        UPD_SIZES sizes;
+        if (cached && UPD_CacheLoad(self, filename, &key)) {
+            result = 1;
+        } else if (UPD_Measure(&reader, &sizes)) {
+            unsigned long long size = UPD_ArenaSize(&sizes, filename);
+            UPD_ARENA* arena = size <= UPD_MAX_ARENA ? (UPD_ARENA*)GlobalAlloc(GMEM_FIXED, (SIZE_T)size) : nullptr;
+            if (arena) {
+                arena->magic = UPD_ARENA_MAGIC;
+                arena->owner = self;
+                arena->size = (DWORD)size;
+                arena->flags = 0;
+                DWORD metaSize = UPD_Build(&reader, &sizes, (char*)arena, self, filename);
+                if (cached) UPD_CacheStore(self, filename, &key, metaSize);
+                result = 1;
+            }
+        }
+        UnmapViewOfFile(view);
+    }
+    if (mapping) CloseHandle(mapping);
+    CloseHandle(file);
+    return result;
+}
+
+// ============================================================================
+// UPD PREFETCH - background loading of the next scenario set
+// ============================================================================
+
+/**
+ * Entering a scenario (state 1 of SFUpdateGameState) loads
+ * Scenario\%08d\Scenario.Njp/.Scs/.Mct and the player's Animation00.caf/.sdw/.njp
+ * synchronously behind the loading screen. A worker thread loads the likely
+ * next set while the current scenario is being played:
+ *
+ *   - .njp/.upd files are loaded into an arena (and so into the UPD cache) and
+ *     parked in a slot. The next RKC_UPDIB_UPD::Read of the same path takes the
+ *     arena over with one compare-exchange on the slot state instead of loading.
+ *   - .Scs/.Mct/.caf/.sdw are read once, so they come from the OS file cache
+ *     when the exe and RKC_RPG_SCRIPT open them.
+ *
+ * Which scenario comes next is learned: each scenario .njp read records a
+ * previous -> current link, links are kept in scenario.lnk in the UPD cache
+ * directory, and the UPD_PREFETCH_FANOUT most frequent successors of the
+ * scenario just entered are queued. New links only mark the file dirty; the
+ * worker writes it after each wake, outside g_prefetchLock, and the
+ * RKC_UPDIB destructor writes whatever is still pending. Paths are built the way the game spelled
+ * the last scenario and player paths it read. RKC_UPDIB_AddScenarioLink and
+ * RKC_UPDIB_PrefetchScenario let a caller that knows the map graph feed it
+ * directly. OSF_UPD_PREFETCH=0 disables the prefetcher (no thread, no learning).
+ */
+#define UPD_PREFETCH_SLOTS   8      // parked UPDs waiting for their Read
+#define UPD_PREFETCH_QUEUE   16     // scenarios waiting for the worker
+#define UPD_PREFETCH_FANOUT  2      // successors queued per scenario entered
+#define UPD_SCENARIO_LINKS   1024
+#define UPD_SCENARIO_LINK_MAGIC 0x4B4E4C53  // "SLNK"
+
+#define UPD_SLOT_FREE     0
+#define UPD_SLOT_LOADING  1         // owned by the worker
+#define UPD_SLOT_READY    2         // parked, may be taken or evicted
+#define UPD_SLOT_TAKEN    3         // owned by the Read taking it over
+
+struct UPD_PREFETCHSLOT {
+    volatile LONG state;
+    DWORD stamp;                    // Load order, oldest is evicted first
+    DWORD sourceSize;               // Source file when it was loaded
+    FILETIME sourceTime;
+    char path[MAX_PATH];
+    unsigned char upd[0x30];        // UPD object owning the parked arena
+};
+
+struct UPD_SCENARIOLINK {
+    long from;
+    long to;
+    long count;
+};
+
+/**
+ * Counters for the prefetcher (cumulative).
+ */
+struct RKC_UPDIB_PREFETCHSTATS {
+    DWORD scenariosQueued;
+    DWORD updsLoaded;               // Arenas parked by the worker
+    DWORD filesWarmed;              // Other files read into the OS cache
+    DWORD handovers;                // Reads served from a parked arena
+    DWORD evicted;                  // Parked arenas dropped unused or stale
+};
+
+static UPD_PREFETCHSLOT g_prefetchSlots[UPD_PREFETCH_SLOTS];
+static DWORD g_prefetchClock = 0;
+static long g_prefetchQueue[UPD_PREFETCH_QUEUE];
+static long g_prefetchQueueCount = 0;
+static UPD_SCENARIOLINK g_scenarioLinks[UPD_SCENARIO_LINKS];
+static long g_scenarioLinkCount = 0;
+static long g_lastScenario = -1;
+static char g_scenarioPrefix[MAX_PATH];    // Text in front of "Scenario\%08d\"
+static char g_scenarioLeaf[MAX_PATH];      // UPD file name inside the scenario folder
+static char g_playerSet[MAX_PATH];         // Player animation path without extension
+static bool g_linksDirty = false;          // Links changed since scenario.lnk was written
+static CRITICAL_SECTION g_prefetchLock;
+static CRITICAL_SECTION g_linkSaveLock;    // One writer of scenario.lnk at a time
+static HANDLE g_prefetchEvent = nullptr;
+static volatile LONG g_prefetchInit = 0;   // 0 = not yet, 1 = in progress, 2 = done
+static RKC_UPDIB_PREFETCHSTATS g_prefetchStats;
+
+/**
+ * Split a path of the form <prefix>Scenario\<8 digits>\<leaf>. Returns the
+ * scenario number or -1.
+ */
+static long UPD_ParseScenarioPath(const char* path, size_t* prefixLength) {
+    for (const char* p = path; *p; p++) {
+        if (_strnicmp(p, "Scenario\\", 9) != 0) continue;
+        if (p != path && p[-1] != '\\' && p[-1] != '/' && p[-1] != ':') continue;
+        long number = 0;
+        int digits = 0;
+        while (digits < 8 && p[9 + digits] >= '0' && p[9 + digits] <= '9') {
+            number = number * 10 + (p[9 + digits] - '0');
+            digits++;
+        }
+        if (digits == 8 && p[17] == '\\' && p[18] != '\0' && !strchr(p + 18, '\\')) {
+            *prefixLength = p - path;
+            return number;
+        }
+    }
+    return -1;
+}
+
+static void UPD_LinkFilePath(char* path) {
+    size_t length = strlen(g_updCacheDir);
+    memcpy(path, g_updCacheDir, length);
+    strcpy(path + length, "\\scenario.lnk");
+}
+
+static void UPD_LoadLinks() {
+    if (!UPD_CacheInit() || strlen(g_updCacheDir) + 14 >= MAX_PATH) return;
+    char path[MAX_PATH];
+    UPD_LinkFilePath(path);
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return;
+    DWORD header[2], read = 0;
+    if (ReadFile(file, header, sizeof(header), &read, nullptr) && read == sizeof(header) &&
+        header[0] == UPD_SCENARIO_LINK_MAGIC && header[1] <= UPD_SCENARIO_LINKS) {
+        DWORD bytes = header[1] * sizeof(UPD_SCENARIOLINK);
+        if (ReadFile(file, g_scenarioLinks, bytes, &read, nullptr) && read == bytes) {
+            g_scenarioLinkCount = (long)header[1];
+        }
+    }
+    CloseHandle(file);
+}
+
+/**
+ * Write scenario.lnk if the links changed. The links are copied under
+ * g_prefetchLock and written outside it, so the game thread never waits on
+ * the file. Caller must not hold g_prefetchLock.
+ */
+static void UPD_SaveLinks() {
+    static UPD_SCENARIOLINK links[UPD_SCENARIO_LINKS];   // Guarded by g_linkSaveLock
+    EnterCriticalSection(&g_linkSaveLock);
+    EnterCriticalSection(&g_prefetchLock);
+    bool dirty = g_linksDirty;
+    long count = g_scenarioLinkCount;
+    if (dirty) memcpy(links, g_scenarioLinks, count * sizeof(UPD_SCENARIOLINK));
+    g_linksDirty = false;
+    LeaveCriticalSection(&g_prefetchLock);
+
+    bool saved = !dirty;
+    char path[MAX_PATH];
+    if (dirty && UPD_CacheInit() && strlen(g_updCacheDir) + 14 < MAX_PATH) {
+        UPD_LinkFilePath(path);
+        HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, nullptr,
+                                  CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file != INVALID_HANDLE_VALUE) {
+            DWORD header[2] = { UPD_SCENARIO_LINK_MAGIC, (DWORD)count };
+            DWORD written, bytes = count * sizeof(UPD_SCENARIOLINK);
+            saved = WriteFile(file, header, sizeof(header), &written, nullptr) && written == sizeof(header) &&
+                    WriteFile(file, links, bytes, &written, nullptr) && written == bytes;
+            CloseHandle(file);
+        }
+    }
+    if (!saved) {
+        // Try again on the next wake
+        EnterCriticalSection(&g_prefetchLock);
+        g_linksDirty = true;
+        LeaveCriticalSection(&g_prefetchLock);
+    }
+    LeaveCriticalSection(&g_linkSaveLock);
+}
+
+// Caller holds g_prefetchLock. Returns true if the link is new.
+static bool UPD_AddLink(long from, long to, long weight) {
+    for (long i = 0; i < g_scenarioLinkCount; i++) {
+        if (g_scenarioLinks[i].from == from && g_scenarioLinks[i].to == to) {
+            g_scenarioLinks[i].count += weight;
+            return false;
+        }
+    }
+    if (g_scenarioLinkCount >= UPD_SCENARIO_LINKS) return false;
+    g_scenarioLinks[g_scenarioLinkCount].from = from;
+    g_scenarioLinks[g_scenarioLinkCount].to = to;
+    g_scenarioLinks[g_scenarioLinkCount].count = weight;
+    g_scenarioLinkCount++;
+    return true;
+}
+
+// Caller holds g_prefetchLock
+static bool UPD_QueueScenario(long scenario) {
+    for (long i = 0; i < g_prefetchQueueCount; i++) {
+        if (g_prefetchQueue[i] == scenario) return false;
+    }
+    if (g_prefetchQueueCount >= UPD_PREFETCH_QUEUE) return false;
+    g_prefetchQueue[g_prefetchQueueCount++] = scenario;
+    g_prefetchStats.scenariosQueued++;
+    return true;
+}
+
+/**
+ * Replace the queue with the most frequent successors of scenario - anything
+ * still queued was predicted from a scenario the player has left.
+ * Caller holds g_prefetchLock.
+ */
+static bool UPD_QueueSuccessors(long scenario) {
+    g_prefetchQueueCount = 0;
+    for (int n = 0; n < UPD_PREFETCH_FANOUT; n++) {
+        long best = -1;
+        for (long i = 0; i < g_scenarioLinkCount; i++) {
+            const UPD_SCENARIOLINK* link = &g_scenarioLinks[i];
+            if (link->from != scenario || link->to == scenario) continue;
+            bool queued = false;
+            for (long q = 0; q < g_prefetchQueueCount; q++) {
+                if (g_prefetchQueue[q] == link->to) queued = true;
+            }
+            if (!queued && (best < 0 || link->count > g_scenarioLinks[best].count)) best = i;
+        }
+        if (best < 0) break;
+        UPD_QueueScenario(g_scenarioLinks[best].to);
+    }
+    return g_prefetchQueueCount > 0;
+}
+
+/**
+ * Free a parked arena. The slot must be owned by the caller (LOADING or TAKEN).
+ */
+static void UPD_DropSlot(UPD_PREFETCHSLOT* slot) {
+    UPD_ReleaseArena(slot->upd);
+    InterlockedIncrement((volatile LONG*)&g_prefetchStats.evicted);
+}
+
+/**
+ * Load one .njp/.upd into a slot. A free slot is used first, then the oldest
+ * parked one is evicted.
+ */
+static void UPD_PrefetchUpd(const char* path) {
+    if (strlen(path) >= MAX_PATH) return;
+    for (int i = 0; i < UPD_PREFETCH_SLOTS; i++) {
+        if (g_prefetchSlots[i].state == UPD_SLOT_READY && strcmp(g_prefetchSlots[i].path, path) == 0) return;
+    }
+
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attributes)) return;
+
+    UPD_PREFETCHSLOT* slot = nullptr;
+    for (int i = 0; i < UPD_PREFETCH_SLOTS && !slot; i++) {
+        if (InterlockedCompareExchange(&g_prefetchSlots[i].state, UPD_SLOT_LOADING, UPD_SLOT_FREE) == UPD_SLOT_FREE) {
+            slot = &g_prefetchSlots[i];
+        }
+    }
+    while (!slot) {
+        UPD_PREFETCHSLOT* oldest = nullptr;
+        for (int i = 0; i < UPD_PREFETCH_SLOTS; i++) {
+            if (g_prefetchSlots[i].state == UPD_SLOT_READY &&
+                (!oldest || g_prefetchSlots[i].stamp < oldest->stamp)) oldest = &g_prefetchSlots[i];
+        }
+        if (!oldest) return;    // everything is being taken over right now
+        if (InterlockedCompareExchange(&oldest->state, UPD_SLOT_LOADING, UPD_SLOT_READY) == UPD_SLOT_READY) {
+            UPD_DropSlot(oldest);
+            slot = oldest;
+        }
+    }
+
+    strcpy(slot->path, path);
+    slot->sourceSize = attributes.nFileSizeLow;
+    slot->sourceTime = attributes.ftLastWriteTime;
+    memset(slot->upd, 0, sizeof(slot->upd));
+    if (UPD_Load(slot->upd, path)) {
+        slot->stamp = ++g_prefetchClock;
+        InterlockedIncrement((volatile LONG*)&g_prefetchStats.updsLoaded);
+        InterlockedExchange(&slot->state, UPD_SLOT_READY);
+    } else {
+        InterlockedExchange(&slot->state, UPD_SLOT_FREE);
+    }
+}
+
+// Read a file once so the next open is served from the OS file cache
+static void UPD_WarmFile(const char* path) {
+    static char buffer[0x10000];    // worker thread only
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return;
+    DWORD read;
+    while (ReadFile(file, buffer, sizeof(buffer), &read, nullptr) && read == sizeof(buffer)) {}
+    CloseHandle(file);
+    InterlockedIncrement((volatile LONG*)&g_prefetchStats.filesWarmed);
+}
+
+// Replace the extension of path (everything after the last '.') with ext
+static bool UPD_SwapExtension(char* dest, const char* path, const char* ext) {
+    const char* dot = strrchr(path, '.');
+    size_t base = dot ? (size_t)(dot + 1 - path) : strlen(path);
+    if (base + strlen(ext) + (dot ? 0 : 1) >= MAX_PATH) return false;
+    memcpy(dest, path, base);
+    if (!dot) dest[base++] = '.';
+    strcpy(dest + base, ext);
+    return true;
+}
+
+static DWORD WINAPI UPD_PrefetchProc(LPVOID) {
+    for (;;) {
+        WaitForSingleObject(g_prefetchEvent, INFINITE);
+        for (;;) {
+            // Build the file set under the lock, load it outside
+            char upd[MAX_PATH], scenarioUpd[MAX_PATH], player[MAX_PATH];
+            EnterCriticalSection(&g_prefetchLock);
+            if (g_prefetchQueueCount == 0) {
+                LeaveCriticalSection(&g_prefetchLock);
+                break;
+            }
+            long scenario = g_prefetchQueue[0];
+            g_prefetchQueueCount--;
+            memmove(g_prefetchQueue, g_prefetchQueue + 1, g_prefetchQueueCount * sizeof(long));
+
+            size_t prefix = strlen(g_scenarioPrefix);
+            bool haveScenario = prefix + 18 + strlen(g_scenarioLeaf) < MAX_PATH;
+            if (haveScenario) {
+                memcpy(scenarioUpd, g_scenarioPrefix, prefix);
+                memcpy(scenarioUpd + prefix, "Scenario\\", 9);
+                for (int i = 7; i >= 0; i--, scenario /= 10) {
+                    scenarioUpd[prefix + 9 + i] = (char)('0' + scenario % 10);
+                }
+                scenarioUpd[prefix + 17] = '\\';
+                strcpy(scenarioUpd + prefix + 18, g_scenarioLeaf);
+            }
+            strcpy(player, g_playerSet);
+            LeaveCriticalSection(&g_prefetchLock);
+
+            if (haveScenario) {
+                UPD_PrefetchUpd(scenarioUpd);
+                if (UPD_SwapExtension(upd, scenarioUpd, "Scs")) UPD_WarmFile(upd);
+                if (UPD_SwapExtension(upd, scenarioUpd, "Mct")) UPD_WarmFile(upd);
+            }
+            if (player[0]) {
+                if (UPD_SwapExtension(upd, player, "caf")) UPD_WarmFile(upd);
+                if (UPD_SwapExtension(upd, player, "sdw")) UPD_WarmFile(upd);
+                if (UPD_SwapExtension(upd, player, "njp")) UPD_PrefetchUpd(upd);
+            }
+        }
+        UPD_SaveLinks();
+    }
+    return 0;
+}
+
+static bool UPD_PrefetchInit() {
+    if (InterlockedCompareExchange(&g_prefetchInit, 1, 0) == 0) {
+        InitializeCriticalSection(&g_prefetchLock);
+        InitializeCriticalSection(&g_linkSaveLock);
+        strcpy(g_scenarioLeaf, "Scenario.Njp");
+        UPD_LoadLinks();
+        // OSF_UPD_PREFETCH=0 turns the prefetcher off
+        char value[4];
+        DWORD len = GetEnvironmentVariableA("OSF_UPD_PREFETCH", value, sizeof(value));
+        bool disabled = len == 1 && value[0] == '0';
+        g_prefetchEvent = disabled ? nullptr : CreateEventA(nullptr, FALSE, FALSE, nullptr);
+        if (g_prefetchEvent) {
+            HANDLE thread = CreateThread(nullptr, 0, UPD_PrefetchProc, nullptr, 0, nullptr);
+            if (thread) {
+                CloseHandle(thread);
+            } else {
+                CloseHandle(g_prefetchEvent);
+                g_prefetchEvent = nullptr;
+            }
+        }
+        InterlockedExchange(&g_prefetchInit, 2);
+    }
+    while (g_prefetchInit != 2) Sleep(0);
+    return g_prefetchEvent != nullptr;
+}
+
+/**
+ * Learn from a UPD read: remember how the game spells scenario and player
+ * paths, record the scenario transition and queue the likely next scenarios.
+ */
+static void UPD_PrefetchNotice(const char* filename) {
+    size_t length = strlen(filename);
+    if (length >= MAX_PATH) return;
+    const char* leaf = strrchr(filename, '\\');
+    leaf = leaf ? leaf + 1 : filename;
+    bool player = _stricmp(leaf, "Animation00.njp") == 0;
+    size_t prefix = 0;
+    long scenario = player ? -1 : UPD_ParseScenarioPath(filename, &prefix);
+    if (!player && scenario < 0) return;
+    if (!UPD_PrefetchInit()) return;
+
+    bool wake = false;
+    EnterCriticalSection(&g_prefetchLock);
+    if (player) {
+        memcpy(g_playerSet, filename, length - 4);
+        g_playerSet[length - 4] = '\0';
+    } else {
+        memcpy(g_scenarioPrefix, filename, prefix);
+        g_scenarioPrefix[prefix] = '\0';
+        strcpy(g_scenarioLeaf, filename + prefix + 18);
+        if (scenario != g_lastScenario) {
+            if (g_lastScenario >= 0) {
+                UPD_AddLink(g_lastScenario, scenario, 1);
+                g_linksDirty = true;
+            }
+            g_lastScenario = scenario;
+            wake = UPD_QueueSuccessors(scenario) || g_linksDirty;
+        }
+    }
+    LeaveCriticalSection(&g_prefetchLock);
+    if (wake) SetEvent(g_prefetchEvent);
+}
+
+/**
+ * Move a parked arena for filename into self. The source file must still have
+ * the size and write time it had when it was prefetched.
+ */
+static bool UPD_TakePrefetched(void* self, const char* filename) {
+    if (g_prefetchInit != 2) return false;
+    for (int i = 0; i < UPD_PREFETCH_SLOTS; i++) {
+        UPD_PREFETCHSLOT* slot = &g_prefetchSlots[i];
+        if (slot->state != UPD_SLOT_READY || strcmp(slot->path, filename) != 0) continue;
+        if (InterlockedCompareExchange(&slot->state, UPD_SLOT_TAKEN, UPD_SLOT_READY) != UPD_SLOT_READY) continue;
+
+        // The path may have changed between the check and the exchange
+        WIN32_FILE_ATTRIBUTE_DATA attributes;
+        bool same = strcmp(slot->path, filename) == 0 &&
+                    GetFileAttributesExA(filename, GetFileExInfoStandard, &attributes) &&
+                    attributes.nFileSizeLow == slot->sourceSize &&
+                    attributes.ftLastWriteTime.dwLowDateTime == slot->sourceTime.dwLowDateTime &&
+                    attributes.ftLastWriteTime.dwHighDateTime == slot->sourceTime.dwHighDateTime;
+        if (same) {
+            UPD_ARENA* arena = UPD_GetArena(slot->upd);
+            memcpy(self, slot->upd, 0x30);
+            arena->owner = self;
+            memset(slot->upd, 0, sizeof(slot->upd));
+            InterlockedIncrement((volatile LONG*)&g_prefetchStats.handovers);
+        } else {
+            UPD_DropSlot(slot);
+        }
+        InterlockedExchange(&slot->state, UPD_SLOT_FREE);
+        if (same) return true;
+    }
+    return false;
+}
+
+/**
+ * RKC_UPDIB_UPD::constructor - Initialize UPD object
+ * NOT REFERENCED (o_RKC_UPDIB.dll constructs its own UPDs)
+ */
+extern "C" void* __thiscall RKC_UPDIB_UPD_constructor(void* self) {
+    memset(self, 0, 0x30);
+    return self;
+}
+
+/**
+ * RKC_UPDIB_UPD::Release - Free all UPD data
+ * USED BY: ShadowFlare.exe
+ *
+ * Arena UPDs are one free; UPDs loaded by the original DLL go to its Release.
+ */
+extern "C" void __thiscall RKC_UPDIB_UPD_Release(void* self) {
+    if (UPD_ReleaseArena(self)) return;
+    InitImports();
+    if (g_origUpdRelease) g_origUpdRelease(self);
+}
+
+/**
+ * RKC_UPDIB_UPD::destructor
+ * NOT REFERENCED
+ */
+extern "C" void __thiscall RKC_UPDIB_UPD_destructor(void* self) {
+    if (UPD_ReleaseArena(self)) return;
+    InitImports();
+    if (g_origUpdDestructor) g_origUpdDestructor(self);
+}
+
+/**
+ * RKC_UPDIB_UPD::Read - Load a UPD/NJP file
+ * USED BY: RKC_UPDIB::ReadUpd
+ *
+ * Takes over the prefetched arena for this file if there is one, otherwise
+ * loads it (see UPD_Load). flags is unused, as in the original. Returns 1 on
+ * success, 0 on failure.
+ */
+extern "C" int __thiscall RKC_UPDIB_UPD_Read(void* self, char* filename, long flags) {
+    RKC_UPDIB_UPD_Release(self);
+    if (!filename) return 0;
+    UPD_PrefetchNotice(filename);
+    if (UPD_TakePrefetched(self, filename)) return 1;
+    return UPD_Load(self, filename);
+}
+
+/**
+ * RKC_UPDIB_UPD::GetParts - Get parts bitmap entry
+ * USED BY: ShadowFlare.exe
+ *
+ * Like the original, only the upper bound is checked.
+ */
+extern "C" void* __thiscall RKC_UPDIB_UPD_GetParts(void* self, long index) {
+    char* p = (char*)self;
+    if (index >= *(long*)(p + 0x0c)) return nullptr;
+    return *(char**)(p + 0x10) + index * 0x10;
+}
+
+/**
+ * RKC_UPDIB_UPD::GetPattern - Get pattern by index
+ * USED BY: ShadowFlare.exe, o_RKC_RPGSCRN.dll
+ *
+ * Like the original, only the upper bound is checked.
+ */
+extern "C" void* __thiscall RKC_UPDIB_UPD_GetPattern(void* self, long index) {
+    char* p = (char*)self;
+    if (index >= *(long*)(p + 0x14)) return nullptr;
+    return *(char**)(p + 0x18) + index * 0x28;
+}
+
+/**
+ * RKC_UPDIB_UPD::GetPaletteDIB - Get palette holder DIB
+ * NOT REFERENCED
+ */
+extern "C" RKC_DIB* __thiscall RKC_UPDIB_UPD_GetPaletteDIB(void* self, long index) {
+    char* p = (char*)self;
+    if (index < 0 || index >= *(long*)(p + 0x1c)) return nullptr;
+    return (RKC_DIB*)(*(char**)(p + 0x20) + index * 0x0c);
+}
+
+/**
+ * RKC_UPDIB_UPD::GetPalette - Get palette colours
+ * NOT REFERENCED
+ */
+extern "C" void* __thiscall RKC_UPDIB_UPD_GetPalette(void* self, long index) {
+    char* p = (char*)self;
+    if (index < 0 || index >= *(long*)(p + 0x1c)) return nullptr;
+    return *(void**)(*(char**)(p + 0x20) + index * 0x0c + 0x04);
+}
+
+// ============================================================================
+// VS RENDER QUEUE - native VS/VSBLOCK/VSPACKET
+// ============================================================================
+
+/**
+ * The original keeps every VS as a doubly linked list of heap-allocated
+ * packets: one new per SetPacket, one delete per packet at FlushVSBlock, and
+ * Render first walks to the tail to draw in submission order. A battle scene
+ * queues thousands of packets a frame, so here every VS owns a flat packet
+ * array instead. Packets are appended in submission order, a flush only resets
+ * the count and the array is kept for the next frame, so a steady frame does
+ * no heap work at all. Render walks the array front to back.
+ *
+ * Packets keep the documented 0x54 byte layout because callers fill them in
+ * through the pointer InsertVSPacket returns (SetStringsPacket does the same);
+ * the prev/next fields at +0x38/+0x3c hold the sort key instead. A packet pointer is valid
+ * until the next insert into the same VS, which was never a problem for the
+ * callers: they fill a packet in right after inserting it.
+ *
+ * Packet indices keep the original meaning: 0 is the packet inserted last.
+ * Inserting at 0 (the only index the game uses) is an append; other indices
+ * shift the newer packets up by one.
+ *
+ * Blocks keep the original VSBLOCK layout and list, but are allocated here, so
+ * Initialize and the destructor free them before o_RKC_UPDIB.dll's Release
+ * can see them.
+ */
+struct VS_QUEUE {
+    long count;        // Packets queued since the last flush
+    long capacity;     // Packets the array has room for
+    long keyed;        // Packets given a sort key since the last flush
+    long sortedFrame;  // Culling pass whose order VS_Order holds, 0 = none
+};
+
+#define VSPACKET_SIZE     0x54
+#define VS_QUEUE_MIN      64     // Packets in a new array, doubled when full
+
+static inline char* VS_Packets(VS_QUEUE* q) {
+    return (char*)(q + 1);
+}
+
+// Packet positions in draw order, after the packets (valid while sortedFrame says so)
+static inline long* VS_Order(VS_QUEUE* q) {
+    return (long*)(VS_Packets(q) + (size_t)q->capacity * VSPACKET_SIZE);
+}
+
+// Queue of a VS, grown so one more packet fits; null if out of memory
+static VS_QUEUE* VS_Reserve(void* vs) {
+    VS_QUEUE* q = *(VS_QUEUE**)((char*)vs + 0x04);
+    if (q && q->count < q->capacity) return q;
+
+    long capacity = q ? q->capacity * 2 : VS_QUEUE_MIN;
+    VS_QUEUE* grown = (VS_QUEUE*)GlobalAlloc(GMEM_FIXED,
+                                             sizeof(VS_QUEUE) + (SIZE_T)capacity * (VSPACKET_SIZE + sizeof(long)));
+    if (!grown) return nullptr;
+    grown->count = 0;
+    grown->keyed = 0;
+    grown->sortedFrame = 0;
+    if (q) {
+        grown->count = q->count;
+        grown->keyed = q->keyed;
+        memcpy(VS_Packets(grown), VS_Packets(q), (size_t)q->count * VSPACKET_SIZE);
+        GlobalFree(q);
+    }
+    grown->capacity = capacity;
+    *(VS_QUEUE**)((char*)vs + 0x04) = grown;
+    return grown;
+}
+
+// Packet at original index (0 = newest), or null
+static inline char* VS_PacketAt(void* vs, long index) {
+    VS_QUEUE* q = *(VS_QUEUE**)((char*)vs + 0x04);
+    if (!q || index < 0 || index >= q->count) return nullptr;
+    return VS_Packets(q) + (q->count - 1 - index) * VSPACKET_SIZE;
+}
+
+/**
+ * Draw order keys. The original has no depth sort of its own; the game queues
+ * packets in the order it wants them drawn. A caller that has a total draw
+ * order (layer, then depth, then priority) can instead give a packet a sort
+ * key right after queueing it and let Render sort the screen once per frame:
+ *
+ *   bits 56-63: layer                 0..255
+ *   bits 32-55: depth (usually y)     -0x800000..0x7fffff, biased
+ *   bits 16-31: priority              -0x8000..0x7fff, biased
+ *   bits  0-15: submission index      filled in by the sort
+ *
+ * The sort is a stable LSD radix sort over the top six bytes, so equal keys
+ * keep submission order even past 65536 packets, and passes whose byte is the
+ * same for every packet are skipped. Packets without a key keep key 0 and draw
+ * first, in submission order. A screen nobody keyed is not sorted at all, so
+ * the game's own order is untouched unless it asks for keys.
+ *
+ * Keys are opt-in and nothing in the game sets them. They are not a
+ * replacement for RKC_RPGSCRN_OBJECTDISP's SortDisplayObject: that orders
+ * objects by pairwise bounding-box overlap, a partial order no key from
+ * layer and y reproduces, so the exe keeps queueing objects in that order
+ * and SetPacket and SetStringsPacket leave the key at 0.
+ */
+struct VS_SORTITEM {
+    unsigned long long key;
+    long packet;       // Position in the packet array
+    long reserved;
+};
+
+static VS_SORTITEM* g_vsSortItems = nullptr;  // Two halves of g_vsSortCapacity items
+static long g_vsSortCapacity = 0;
+
+static inline unsigned long long VS_MakeSortKey(long layer, long depth, long priority) {
+    if (layer < 0) layer = 0;
+    if (layer > 0xff) layer = 0xff;
+    if (depth < -0x800000) depth = -0x800000;
+    if (depth > 0x7fffff) depth = 0x7fffff;
+    if (priority < -0x8000) priority = -0x8000;
+    if (priority > 0x7fff) priority = 0x7fff;
+    return ((unsigned long long)layer << 56) |
+           ((unsigned long long)(depth + 0x800000) << 32) |
+           ((unsigned long long)(priority + 0x8000) << 16);
+}
+
+// Packet positions of q in ascending key order, or null if out of memory
+static VS_SORTITEM* VS_SortPackets(VS_QUEUE* q) {
+    HPROF_SCOPE("sort");
+    long count = q->count;
+    if (count > g_vsSortCapacity) {
+        long capacity = g_vsSortCapacity ? g_vsSortCapacity : VS_QUEUE_MIN;
+        while (capacity < count) capacity *= 2;
+        VS_SORTITEM* items = (VS_SORTITEM*)GlobalAlloc(GMEM_FIXED, (SIZE_T)capacity * 2 * sizeof(VS_SORTITEM));
+        if (!items) return nullptr;
+        if (g_vsSortItems) GlobalFree(g_vsSortItems);
+        g_vsSortItems = items;
+        g_vsSortCapacity = capacity;
+    }
+
+    VS_SORTITEM* src = g_vsSortItems;
+    VS_SORTITEM* dst = g_vsSortItems + g_vsSortCapacity;
+    long histogram[6][256];
+    memset(histogram, 0, sizeof(histogram));
+    const char* packets = VS_Packets(q);
+    for (long i = 0; i < count; i++) {
+        unsigned long long key = *(const unsigned long long*)(packets + i * VSPACKET_SIZE + 0x38);
+        key = (key & ~0xffffULL) | (unsigned long long)(i & 0xffff);
+        src[i].key = key;
+        src[i].packet = i;
+        for (long pass = 0; pass < 6; pass++) histogram[pass][(key >> (16 + pass * 8)) & 0xff]++;
+    }
+
+    for (long pass = 0; pass < 6; pass++) {
+        long shift = 16 + pass * 8;
+        long* counts = histogram[pass];
+        if (counts[(src[0].key >> shift) & 0xff] == count) continue;
+        long offset = 0;
+        for (long b = 0; b < 256; b++) {
+            long n = counts[b];
+            counts[b] = offset;
+            offset += n;
+        }
+        for (long i = 0; i < count; i++) dst[counts[(src[i].key >> shift) & 0xff]++] = src[i];
+        VS_SORTITEM* swap = src;
+        src = dst;
+        dst = swap;
+    }
+    return src;
+}
+
+/**
+ * RKC_UPDIB_VSPACKET::SetPacket - Copy another packet
+ * USED BY: o_RKC_UPDIB.dll (internal)
+ *
+ * Everything but the list links at +0x38/+0x3c (the sort key here), like the
+ * original.
+ */
+extern "C" void* __thiscall RKC_UPDIB_VSPACKET_SetPacket_copy(void* self, void* packet) {
+    char* p = (char*)self;
+    const char* src = (const char*)packet;
+    memcpy(p, src, 0x36);
+    memcpy(p + 0x40, src + 0x40, 0x14);
+    return self;
+}
+
+/**
+ * RKC_UPDIB_VSPACKET::SetPacket - Fill in every field
+ * USED BY: o_RKC_UPDIB.dll (internal, from ReadUpd icons)
+ *
+ * clip may be null, which leaves the packet clip rect as it was.
+ */
+extern "C" void* __thiscall RKC_UPDIB_VSPACKET_SetPacket_full(void* self, void* updib, long updNo,
+                                                              long patternNo, long paletteNo, long flags,
+                                                              long x, long y, long scaleX, long scaleY,
+                                                              long alpha, long unknown, long exParam,
+                                                              short r, short g, short b,
+                                                              RECT* clip, RKC_DIB* dib) {
+    char* p = (char*)self;
+    *(void**)(p + 0x00) = updib;
+    *(long*)(p + 0x04) = flags;
+    *(long*)(p + 0x08) = exParam;
+    *(long*)(p + 0x0c) = x;
+    *(long*)(p + 0x10) = y;
+    *(long*)(p + 0x14) = scaleX;
+    *(long*)(p + 0x18) = scaleY;
+    *(long*)(p + 0x1c) = alpha;
+    *(long*)(p + 0x20) = unknown;
+    *(long*)(p + 0x24) = updNo;
+    *(long*)(p + 0x28) = patternNo;
+    *(long*)(p + 0x2c) = paletteNo;
+    *(short*)(p + 0x30) = r;
+    *(short*)(p + 0x32) = g;
+    *(short*)(p + 0x34) = b;
+    if (clip) *(RECT*)(p + 0x40) = *clip;
+    *(RKC_DIB**)(p + 0x50) = dib;
+    return self;
+}
+
+// TransferToDIBEx/ZoomToDIBEx blend flags for a packet
+static inline long VSPACKET_BlendFlags(long flags) {
+    long blend = 0;
+    if (flags & VSPACKET_FLAG_ADD) blend |= 4;
+    if (flags & VSPACKET_FLAG_BLENDEX) blend |= 0x10;
+    return blend;
+}
+
+// Whether a blit needs the Ex path (alpha, exParam or a blend mode)
+static inline bool VSPACKET_NeedsEx(long flags, long alpha, long exParam) {
+    return alpha != 1000 || exParam != 0 || (flags & (VSPACKET_FLAG_ADD | VSPACKET_FLAG_BLENDEX)) != 0;
+}
+
+// Move a colour channel towards 0 (tint < 0) or 255 (tint > 0) by tint/1000
+static inline unsigned char VSPACKET_Tint(unsigned char c, short tint) {
+    int delta = tint < 1 ? c * tint : (0xff - c) * tint;
+    return (unsigned char)(c + (char)(delta / 1000));
+}
+
+/**
+ * Set up the palette of the DIB a part is blitted from. 1bpp parts get their
+ * foreground colour from the tint (the original derives all three channels
+ * from r); font packets take colours 0 and 2 from the palette and colour 1
+ * from the low bytes of r/g/b; everything else gets the palette, tinted,
+ * inverted and greyed as the flags say.
+ */
+static void VSPACKET_SetupPalette(const char* p, RKC_DIB* src, long bpp, RGBQUAD* palette) {
+    RGBQUAD* colors = *(RGBQUAD**)((char*)src + 0x04);
+    long flags = *(long*)(p + 0x04);
+    short r = *(short*)(p + 0x30);
+    short g = *(short*)(p + 0x32);
+    short b = *(short*)(p + 0x34);
+
+    if (bpp == 1) {
+        unsigned char fg = (unsigned char)((r - 1000) * 0xff / 1000);
+        colors[1].rgbRed = r < 1000 ? 0 : fg;
+        colors[1].rgbGreen = g < 1000 ? 0 : fg;
+        colors[1].rgbBlue = b < 1000 ? 0 : fg;
+        return;
+    }
+    if (flags & VSPACKET_FLAG_FONT) {
+        // Index 8 of the source palette, as in the original
+        colors[0] = palette[0];
+        colors[2] = palette[8];
+        colors[1].rgbRed = (unsigned char)r;
+        colors[1].rgbGreen = (unsigned char)g;
+        colors[1].rgbBlue = (unsigned char)b;
+        return;
+    }
+
+    g_dibSetPalette(src, palette);
+    long count = bpp == 4 ? 16 : 256;
+    if (r != 1000 || g != 1000 || b != 1000) {
+        short dr = r - 1000, dg = g - 1000, db = b - 1000;
+        for (long i = 0; i < count; i++) {
+            colors[i].rgbRed = VSPACKET_Tint(colors[i].rgbRed, dr);
+            colors[i].rgbGreen = VSPACKET_Tint(colors[i].rgbGreen, dg);
+            colors[i].rgbBlue = VSPACKET_Tint(colors[i].rgbBlue, db);
+        }
+    }
+    if (flags & VSPACKET_FLAG_INVERT) {
+        for (long i = 0; i < count; i++) {
+            colors[i].rgbRed = 0xff - colors[i].rgbRed;
+            colors[i].rgbGreen = 0xff - colors[i].rgbGreen;
+            colors[i].rgbBlue = 0xff - colors[i].rgbBlue;
+        }
+    }
+    if (flags & VSPACKET_FLAG_GREY) {
+        for (long i = 0; i < count; i++) {
+            unsigned char v = colors[i].rgbRed;
+            if (v < colors[i].rgbGreen) v = colors[i].rgbGreen;
+            if (v < colors[i].rgbBlue) v = colors[i].rgbBlue;
+            colors[i].rgbRed = colors[i].rgbGreen = colors[i].rgbBlue = v;
+        }
+    }
+}
+
+// Blit packet+0x50, clipped to the packet rect with VSPACKET_FLAG_CLIP
+static int VSPACKET_RenderDIB(const char* p, RKC_DIB* dib) {
+    RKC_DIB* src = *(RKC_DIB**)(p + 0x50);
+    if (!src) return 1;
+    BITMAPINFOHEADER* header = *(BITMAPINFOHEADER**)src;
+    long flags = *(long*)(p + 0x04);
+    long left = *(long*)(p + 0x0c), top = *(long*)(p + 0x10);
+    long right = header->biWidth - 1 + left, bottom = header->biHeight - 1 + top;
+    long srcX = 0, srcY = 0;
+    if (flags & VSPACKET_FLAG_CLIP) {
+        const RECT* rc = (const RECT*)(p + 0x40);
+        if (left < rc->left) { srcX = rc->left - left; left = rc->left; }
+        if (rc->right < right) right = rc->right;
+        if (top < rc->top) { srcY = rc->top - top; top = rc->top; }
+        if (rc->bottom < bottom) bottom = rc->bottom;
+    }
+    long w = right - left + 1, h = bottom - top + 1;
+    long colorKey = (flags & VSPACKET_FLAG_OPAQUE) ? -1 : 0;
+    HPROF_SCOPE("blit");
+    HPROF_COUNT("blits", 1);
+    long alpha = *(long*)(p + 0x1c);
+    long exParam = *(long*)(p + 0x08);
+
+    if (!VSPACKET_NeedsEx(flags, alpha, exParam)) {
+        if (colorKey == -1) g_dibTransferFast(dib, left, top, w, h, src, srcX, srcY);
+        else g_dibTransfer(dib, left, top, w, h, src, srcX, srcY, colorKey);
+        return 1;
+    }
+    char* updib = *(char**)p;
+    g_dibTransferEx(dib, left, top, w, h, src, srcX, srcY, exParam, colorKey, alpha,
+                    VSPACKET_BlendFlags(flags), *(RKC_DIBHISPEEDMODE**)(updib + 0x28));
+    return 1;
+}
+
+/**
+ * Culling counters, reset by every RKC_UPDIB::Render of all blocks (once a
+ * frame in the game) and read with RKC_UPDIB_GetCullStats.
+ */
+struct RKC_UPDIB_CULLSTATS {
+    DWORD frames;                   // Full renders so far
+    DWORD packets;                  // Packets queued in the last frame
+    DWORD drawn;                    // Packets handed to VSPACKET::Render
+    DWORD clipped;                  // Packets outside the target/clip rect
+    DWORD clean;                    // Packets outside the dirty region
+    DWORD occluded;                 // Packets under an opaque packet drawn later
+    DWORD occluders;                // Opaque rects collected for the frame
+    DWORD partsSkipped;             // Parts of drawn packets that missed the target
+};
+
+static RKC_UPDIB_CULLSTATS g_vsCullStats;
+
+// Target rect of a part, inclusive, before any clipping (same math as the original)
+static void VSPACKET_PartRect(const char* p, const char* entry, long pw, long ph, RECT* dst) {
+    long flags = *(long*)(p + 0x04);
+    long x = *(long*)(p + 0x0c), y = *(long*)(p + 0x10);
+    long scaleX = *(long*)(p + 0x14), scaleY = *(long*)(p + 0x18);
+    long partScaledW = *(long*)(entry + 0x10) * pw / 1000;
+    long partScaledH = *(long*)(entry + 0x14) * ph / 1000;
+    long lx = (flags & VSPACKET_FLAG_MIRRORX) ? -partScaledW - *(long*)(entry + 0x04) : *(long*)(entry + 0x04);
+    long ly = (flags & VSPACKET_FLAG_MIRRORY) ? -partScaledH - *(long*)(entry + 0x08) : *(long*)(entry + 0x08);
+    dst->left = scaleX * lx / 1000 + x;
+    dst->top = scaleY * ly / 1000 + y;
+    dst->right = (partScaledW + lx) * scaleX / 1000 - 1 + x;
+    dst->bottom = (partScaledH + ly) * scaleY / 1000 - 1 + y;
+}
+
+// Pixel rect of dib, inclusive; false if it has no header
+static inline bool VS_TargetRect(RKC_DIB* dib, RECT* target) {
+    BITMAPINFOHEADER* header = dib ? *(BITMAPINFOHEADER**)dib : nullptr;
+    if (!header) return false;
+    target->left = 0;
+    target->top = 0;
+    target->right = header->biWidth - 1;
+    target->bottom = (header->biHeight < 0 ? -header->biHeight : header->biHeight) - 1;
+    return true;
+}
+
+static inline bool VS_Intersects(const RECT& a, const RECT& b) {
+    return a.left <= b.right && b.left <= a.right && a.top <= b.bottom && b.top <= a.bottom;
+}
+
+/**
+ * Part batch. While VS::Render draws a whole screen, parts that would go to
+ * TransferToDIB/TransferToDIBFast (unscaled, unmirrored, no blending) are
+ * queued and drawn with one RKC_DIB_TransferToDIBBatch call. The palette
+ * holder DIB is rebound for every part, so each queued part keeps a frozen
+ * copy of it: header, palette as set up for the part, and bits pointer.
+ * Every other draw into the target (Ex, Zoom, DIB packets, primitives)
+ * flushes the queue first, so painter's order is unchanged. Opaque 1/4bpp
+ * parts, which TransferToDIBFast refuses, keep their own call too. Batches
+ * are drawn in row bands on RKC_DIB's worker pool; each band keeps the
+ * submission order.
+ */
+struct VS_PARTVIEW {
+    BITMAPINFOHEADER* bitmapInfo;   // RKC_DIB layout; pointers set at flush
+    RGBQUAD* palette;
+    unsigned char* bitmap;
+    BITMAPINFOHEADER header;
+    RGBQUAD colors[256];
+};
+
+// Grow-only, reused every screen
+struct VS_PARTBATCH {
+    RKC_DIB* dib;                   // Target being collected for, null = draw parts directly
+    VS_PARTVIEW* views;             // views[i] is the source of blits[i]; one GlobalAlloc block
+    VS_BLIT* blits;                 // with views, right after views[capacity - 1]
+    long count;
+    long capacity;
+};
+
+static VS_PARTBATCH g_vsParts;
+
+static void VS_FlushParts() {
+    if (!g_vsParts.count) return;
+    for (long i = 0; i < g_vsParts.count; i++) {
+        VS_PARTVIEW* view = &g_vsParts.views[i];
+        view->bitmapInfo = &view->header;
+        view->palette = view->colors;
+        g_vsParts.blits[i].srcDIB = (RKC_DIB*)view;
+    }
+    g_dibTransferBatch(g_vsParts.dib, g_vsParts.blits, g_vsParts.count, DIB_BATCH_PARALLEL);
+    g_vsParts.count = 0;
+}
+
+// Start collecting parts drawn into dib (no-op without the batch export)
+static void VS_BeginParts(RKC_DIB* dib) {
+    InitImports();
+    g_vsParts.count = 0;
+    g_vsParts.dib = g_dibTransferBatch ? dib : nullptr;
+}
+
+static void VS_EndParts() {
+    VS_FlushParts();
+    g_vsParts.dib = nullptr;
+}
+
+/**
+ * Queue a part blitted from src (left, top, width, height rects). False if
+ * it has to be drawn directly: not collecting for dib, a format the batch
+ * would draw differently, or out of memory.
+ */
+static bool VS_QueuePart(RKC_DIB* dib, RKC_DIB* src, long bpp, long colorKey, const RECT& dst,
+                         const RECT& from) {
+    if (!g_vsParts.dib || g_vsParts.dib != dib) return false;
+    if (colorKey == -1 && bpp != 8 && bpp != 24) return false;
+    if (g_vsParts.count == g_vsParts.capacity) {
+        long capacity = g_vsParts.capacity ? g_vsParts.capacity * 2 : VS_QUEUE_MIN;
+        VS_PARTVIEW* views = (VS_PARTVIEW*)GlobalAlloc(GMEM_FIXED,
+            (SIZE_T)capacity * (sizeof(VS_PARTVIEW) + sizeof(VS_BLIT)));
+        if (!views) return false;
+        VS_BLIT* blits = (VS_BLIT*)(views + capacity);
+        if (g_vsParts.count) {
+            memcpy(views, g_vsParts.views, g_vsParts.count * sizeof(VS_PARTVIEW));
+            memcpy(blits, g_vsParts.blits, g_vsParts.count * sizeof(VS_BLIT));
+        }
+        if (g_vsParts.views) GlobalFree(g_vsParts.views);
+        g_vsParts.views = views;
+        g_vsParts.blits = blits;
+        g_vsParts.capacity = capacity;
+    }
+
+    VS_PARTVIEW* view = &g_vsParts.views[g_vsParts.count];
+    view->header = **(BITMAPINFOHEADER**)src;
+    view->bitmap = *(unsigned char**)((char*)src + 0x08);
+    long colors = bpp <= 8 ? 1L << bpp : 0;
+    if (colors) memcpy(view->colors, *(RGBQUAD**)((char*)src + 0x04), colors * sizeof(RGBQUAD));
+
+    VS_BLIT* blit = &g_vsParts.blits[g_vsParts.count++];
+    blit->srcDIB = nullptr;
+    blit->destX = dst.left;
+    blit->destY = dst.top;
+    blit->width = dst.right;
+    blit->height = dst.bottom;
+    blit->srcX = from.left;
+    blit->srcY = from.top;
+    blit->transColor = colorKey;
+    return true;
+}
+
+/**
+ * RKC_UPDIB_VSPACKET::Render - Draw one packet into dib
+ * USED BY: o_RKC_UPDIB.dll (internal, from VS::Render and ReadUpd icons)
+ *
+ * Primitives go to RenderPoint/Line/Box/Fill, DIB packets blit packet+0x50;
+ * pattern packets blit every part of the pattern through a palette holder DIB
+ * (the UPD's palette DIB for plain inverted packets, else updib+0x2c), via the
+ * UPDIB's temporary DIB when the part is mirrored. Parts are clipped to clip
+ * and the packet rect only when unscaled. Same RKC_DIB calls as the original,
+ * minus those for parts that miss dib entirely: they are skipped before the
+ * holder, mirror and palette work. Inside VS::Render of a whole screen,
+ * plain parts go into the part batch instead. Returns 0 if the UPD, pattern,
+ * palette or a parts bitmap is missing.
+ */
+extern "C" int __thiscall RKC_UPDIB_VSPACKET_Render(void* self, RKC_DIB* dib, RECT* clip) {
+    char* p = (char*)self;
+    long flags = *(long*)(p + 0x04);
+    if (flags & (VSPACKET_FLAG_POINT | VSPACKET_FLAG_LINE | VSPACKET_FLAG_BOX | VSPACKET_FLAG_FILL |
+                 VSPACKET_FLAG_DIB)) {
+        VS_FlushParts();
+    }
+    if (flags & VSPACKET_FLAG_POINT) return RKC_UPDIB_VSPACKET_RenderPoint(self, dib, clip);
+    if (flags & VSPACKET_FLAG_LINE) return RKC_UPDIB_VSPACKET_RenderLine(self, dib, clip);
+    if (flags & VSPACKET_FLAG_BOX) return RKC_UPDIB_VSPACKET_RenderBox(self, dib, clip);
+    if (flags & VSPACKET_FLAG_FILL) return RKC_UPDIB_VSPACKET_RenderFill(self, dib, clip);
+
+    InitImports();
+    if (!g_dibTransfer || !g_dibTransferFast || !g_dibTransferEx || !g_dibTransferExAt ||
+        !g_dibZoom || !g_dibZoomEx || !g_dibSetBitmap || !g_dibSetPalette) return 0;
+    if (flags & VSPACKET_FLAG_DIB) return VSPACKET_RenderDIB(p, dib);
+
+    char* updib = *(char**)p;
+    void* upd = RKC_UPDIB_GetUpd(updib, *(long*)(p + 0x24));
+    if (!upd) return 0;
+    char* pattern = (char*)RKC_UPDIB_UPD_GetPattern(upd, *(long*)(p + 0x28));
+    if (!pattern) return 0;
+
+    long paletteNo = *(long*)(p + 0x2c);
+    if (paletteNo == -1) paletteNo = *(long*)(pattern + 0x1c);
+    RGBQUAD* palette = (RGBQUAD*)RKC_UPDIB_UPD_GetPalette(upd, paletteNo);
+    if (!palette) return 0;
+
+    short r = *(short*)(p + 0x30), g = *(short*)(p + 0x32), b = *(short*)(p + 0x34);
+    RKC_DIB* holder;
+    if (r == 1000 && g == 1000 && b == 1000 && (flags & VSPACKET_FLAG_INVERT)) {
+        holder = RKC_UPDIB_UPD_GetPaletteDIB(upd, paletteNo);
+        if (!holder) return 0;
+    } else {
+        holder = *(RKC_DIB**)(updib + 0x2c);
+    }
+
+    const RECT* build = (const RECT*)(pattern + 0x0c);
+    if (build->right == 0 || build->bottom == 0) return 0;
+
+    RKC_DIBHISPEEDMODE* hispeed = *(RKC_DIBHISPEEDMODE**)(updib + 0x28);
+    long scaleX = *(long*)(p + 0x14), scaleY = *(long*)(p + 0x18);
+    long alpha = *(long*)(p + 0x1c);
+    bool unscaled = scaleX == 1000 && scaleY == 1000;
+    long colorKey = (flags & VSPACKET_FLAG_OPAQUE) ? -1 : 0;
+    RECT target;
+    bool hasTarget = VS_TargetRect(dib, &target);
+
+    long partsCount = *(long*)pattern;
+    char* partsList = *(char**)(pattern + 0x04);
+    for (long i = 0; i < partsCount; i++) {
+        char* entry = partsList + i * 0x1c;
+        char* parts = *(char**)(entry + 0x18);
+        if (!parts) return 0;
+        long bpp = *(long*)(parts + 0x00);
+        long pw = *(long*)(parts + 0x04), ph = *(long*)(parts + 0x08);
+
+        // Part rect in the pattern, flipped with the packet, then scaled
+        RECT dst, from;
+        VSPACKET_PartRect(p, entry, pw, ph, &dst);
+        if (hasTarget && !VS_Intersects(dst, target)) {
+            g_vsCullStats.partsSkipped++;
+            continue;
+        }
+        from.left = 0;
+        from.top = 0;
+        from.right = pw - 1;
+        from.bottom = ph - 1;
+
+        if (clip && !(flags & VSPACKET_FLAG_NOCLIP) && unscaled) {
+            if (dst.left < clip->left) { from.left = clip->left - dst.left; dst.left = clip->left; }
+            if (clip->right < dst.right) { from.right += clip->right - dst.right; dst.right = clip->right; }
+            if (dst.top < clip->top) { from.top = clip->top - dst.top; dst.top = clip->top; }
+            if (clip->bottom < dst.bottom) { from.bottom += clip->bottom - dst.bottom; dst.bottom = clip->bottom; }
+        }
+        if ((flags & VSPACKET_FLAG_CLIP) && unscaled) {
+            const RECT* rc = (const RECT*)(p + 0x40);
+            if (dst.left < rc->left) { from.left += rc->left - dst.left; dst.left = rc->left; }
+            if (rc->right < dst.right) { from.right += rc->right - dst.right; dst.right = rc->right; }
+            if (dst.top < rc->top) { from.top += rc->top - dst.top; dst.top = rc->top; }
+            if (rc->bottom < dst.bottom) { from.bottom += rc->bottom - dst.bottom; dst.bottom = rc->bottom; }
+        }
+
+        // From here on both rects are left, top, width, height
+        dst.right = dst.right - dst.left + 1;
+        dst.bottom = dst.bottom - dst.top + 1;
+        from.right = from.right - from.left + 1;
+        from.bottom = from.bottom - from.top + 1;
+        if (dst.right > 0 && dst.bottom > 0 && from.right > 0 && from.bottom > 0) {
+            BITMAPINFOHEADER* header = *(BITMAPINFOHEADER**)holder;
+            header->biBitCount = (WORD)bpp;
+            header->biWidth = pw;
+            header->biHeight = ph;
+            g_dibSetBitmap(holder, *(unsigned char**)(parts + 0x0c));
+
+            // Mirroring is the part's own flip toggled by the packet's
+            long entryFlags = *(long*)(entry + 0x00);
+            long mirror = ((entryFlags ^ flags) & VSPACKET_FLAG_MIRRORX) ? 1 : 0;
+            if ((entryFlags ^ flags) & VSPACKET_FLAG_MIRRORY) mirror |= 2;
+            RKC_DIB* src = holder;
+            if (mirror) {
+                src = (RKC_DIB*)(updib + 0x1c);
+                g_dibTransferExAt(src, 0, 0, holder, 0, -1, 1000, mirror, hispeed);
+            }
+            VSPACKET_SetupPalette(p, src, bpp, palette);
+
+            long exParam = *(long*)(entry + 0x0c) + *(long*)(p + 0x08);
+            bool ex = VSPACKET_NeedsEx(flags, alpha, exParam);
+            bool zoom = from.right != dst.right || from.bottom != dst.bottom;
+            if (zoom || ex || mirror || !VS_QueuePart(dib, src, bpp, colorKey, dst, from)) {
+                VS_FlushParts();
+                HPROF_SCOPE("blit");
+                HPROF_COUNT("blits", 1);
+                if (zoom && ex) {
+                    g_dibZoomEx(dib, &dst, src, &from, exParam, colorKey, alpha, VSPACKET_BlendFlags(flags));
+                } else if (zoom) {
+                    g_dibZoom(dib, &dst, src, &from, colorKey);
+                } else if (ex) {
+                    g_dibTransferEx(dib, dst.left, dst.top, dst.right, dst.bottom, src, from.left, from.top,
+                                    exParam, colorKey, alpha, VSPACKET_BlendFlags(flags), hispeed);
+                } else if (colorKey == -1) {
+                    g_dibTransferFast(dib, dst.left, dst.top, dst.right, dst.bottom, src, from.left, from.top);
+                } else {
+                    g_dibTransfer(dib, dst.left, dst.top, dst.right, dst.bottom, src, from.left, from.top, colorKey);
+                }
+            }
+            g_dibSetBitmap(holder, nullptr);
+        }
+    }
+    return 1;
+}
+
+/**
+ * Culling. Before a packet is drawn its bounds are checked against what it
+ * could still change:
+ *   - the target DIB, and the clip rect where VSPACKET::Render applies it
+ *   - the dirty region set with RKC_UPDIB_SetDirtyRegion, if any
+ *   - opaque packets drawn later in the same frame (full renders only)
+ * Pattern bounds come from the build rect ({left, top, width, height} around
+ * the packet position, the rect RKC_RPGSCRN culls its objects with), flipped
+ * and scaled with the packet. Primitives and patterns with an empty build rect
+ * are never culled.
+ *
+ * Occlusion needs to know what comes later, so a full RKC_UPDIB::Render first
+ * walks the frame in reverse draw order. Unscaled opaque packets without
+ * blending add their 8/24bpp parts of at least VS_OCCLUDER_MIN_AREA pixels as
+ * occluders, since TransferToDIBFast writes those rects whole. A packet whose
+ * visible bounds lie inside one occluder is marked at +0x36, and the draw pass
+ * skips it.
+ *
+ * OSF_VS_CULL=0 turns packet culling off. Parts that miss the target are
+ * skipped either way, which never changes a pixel.
+ */
+#define VS_CULL_NONE          0
+#define VS_CULL_CLIP          1
+#define VS_CULL_CLEAN         2
+#define VS_CULL_OCCLUDED      3
+#define VS_DIRTY_MAX          32    // More dirty rects are merged into one
+#define VS_OCCLUDER_MAX       32    // Largest occluders kept per frame
+#define VS_OCCLUDER_MIN_AREA  1024  // Pixels; smaller opaque parts are not worth testing against
+
+static RECT g_vsDirty[VS_DIRTY_MAX];
+static long g_vsDirtyCount = 0;           // 0 = everything is dirty
+static RECT g_vsOccluders[VS_OCCLUDER_MAX];
+static long g_vsOccluderCount = 0;
+static bool g_vsOcclusionPass = false;    // Marks at +0x36 are current
+static long g_vsCullEnabled = -1;         // -1 = OSF_VS_CULL not read yet
+
+static bool VS_CullEnabled() {
+    if (g_vsCullEnabled == -1) {
+        char value[4];
+        DWORD len = GetEnvironmentVariableA("OSF_VS_CULL", value, sizeof(value));
+        g_vsCullEnabled = (len == 1 && value[0] == '0') ? 0 : 1;
+    }
+    return g_vsCullEnabled == 1;
+}
+
+static inline bool VS_Clip(RECT* r, const RECT& by) {
+    if (r->left < by.left) r->left = by.left;
+    if (r->top < by.top) r->top = by.top;
+    if (r->right > by.right) r->right = by.right;
+    if (r->bottom > by.bottom) r->bottom = by.bottom;
+    return r->left <= r->right && r->top <= r->bottom;
+}
+
+// Whether TransferToDIBFast writes every pixel of a srcBpp -> destBpp blit
+static inline bool VS_OpaqueBlit(long srcBpp, long destBpp) {
+    return (srcBpp == 8 || srcBpp == 24) && (destBpp == 8 || destBpp == 16 || destBpp == 24) &&
+           destBpp >= srcBpp;
+}
+
+/**
+ * Inclusive rect a pattern or DIB packet can touch, within its own clip rect.
+ * useClip says whether VSPACKET::Render also clips it to the render clip.
+ * False if the packet has no known bounds.
+ */
+static bool VSPACKET_Bounds(const char* p, RECT* bounds, bool* useClip) {
+    long flags = *(long*)(p + 0x04);
+    if (flags & (VSPACKET_FLAG_POINT | VSPACKET_FLAG_LINE | VSPACKET_FLAG_BOX | VSPACKET_FLAG_FILL)) {
+        return false;
+    }
+    long x = *(long*)(p + 0x0c), y = *(long*)(p + 0x10);
+    bool unscaled = true;
+    *useClip = false;
+    if (flags & VSPACKET_FLAG_DIB) {
+        RKC_DIB* src = *(RKC_DIB**)(p + 0x50);
+        BITMAPINFOHEADER* header = src ? *(BITMAPINFOHEADER**)src : nullptr;
+        if (!header) return false;
+        bounds->left = x;
+        bounds->top = y;
+        bounds->right = x + header->biWidth - 1;
+        bounds->bottom = y + header->biHeight - 1;
+    } else {
+        char* updib = *(char**)p;
+        void* upd = updib ? RKC_UPDIB_GetUpd(updib, *(long*)(p + 0x24)) : nullptr;
+        char* pattern = upd ? (char*)RKC_UPDIB_UPD_GetPattern(upd, *(long*)(p + 0x28)) : nullptr;
+        if (!pattern) return false;
+        const RECT* build = (const RECT*)(pattern + 0x0c);
+        long scaleX = *(long*)(p + 0x14), scaleY = *(long*)(p + 0x18);
+        if (build->right <= 0 || build->bottom <= 0 || scaleX <= 0 || scaleY <= 0) return false;
+
+        // Exclusive edges, flipped like VSPACKET_PartRect flips the parts
+        long left = build->left, right = build->left + build->right;
+        long top = build->top, bottom = build->top + build->bottom;
+        if (flags & VSPACKET_FLAG_MIRRORX) {
+            long flipped = -right;
+            right = -left;
+            left = flipped;
+        }
+        if (flags & VSPACKET_FLAG_MIRRORY) {
+            long flipped = -bottom;
+            bottom = -top;
+            top = flipped;
+        }
+        // One pixel of slack for the rounding of scaled parts
+        bounds->left = x + scaleX * left / 1000 - 1;
+        bounds->top = y + scaleY * top / 1000 - 1;
+        bounds->right = x + scaleX * right / 1000 + 1;
+        bounds->bottom = y + scaleY * bottom / 1000 + 1;
+        unscaled = scaleX == 1000 && scaleY == 1000;
+        *useClip = unscaled && !(flags & VSPACKET_FLAG_NOCLIP);
+    }
+    if ((flags & VSPACKET_FLAG_CLIP) && unscaled && !VS_Clip(bounds, *(const RECT*)(p + 0x40))) {
+        bounds->right = bounds->left - 1;
+    }
+    return true;
+}
+
+/**
+ * Why p need not be drawn (VS_CULL_*). visible gets the part of its bounds
+ * that can show; known is false for packets without bounds.
+ */
+static long VSPACKET_Cull(const char* p, const RECT& target, const RECT* clip, RECT* visible, bool* known) {
+    bool useClip;
+    *known = VSPACKET_Bounds(p, visible, &useClip);
+    if (!*known) return VS_CULL_NONE;
+    if (!VS_Clip(visible, target)) return VS_CULL_CLIP;
+    if (useClip && clip && !VS_Clip(visible, *clip)) return VS_CULL_CLIP;
+    if (g_vsDirtyCount == 0) return VS_CULL_NONE;
+    for (long i = 0; i < g_vsDirtyCount; i++) {
+        if (VS_Intersects(*visible, g_vsDirty[i])) return VS_CULL_NONE;
+    }
+    return VS_CULL_CLEAN;
+}
+
+static void VS_AddOccluder(const RECT& r) {
+    long area = (r.right - r.left + 1) * (r.bottom - r.top + 1);
+    if (area < VS_OCCLUDER_MIN_AREA) return;
+    if (g_vsOccluderCount < VS_OCCLUDER_MAX) {
+        g_vsOccluders[g_vsOccluderCount++] = r;
+        return;
+    }
+    long smallest = 0, smallestArea = 0;
+    for (long i = 0; i < VS_OCCLUDER_MAX; i++) {
+        const RECT& o = g_vsOccluders[i];
+        long a = (o.right - o.left + 1) * (o.bottom - o.top + 1);
+        if (i == 0 || a < smallestArea) {
+            smallest = i;
+            smallestArea = a;
+        }
+    }
+    if (smallestArea < area) g_vsOccluders[smallest] = r;
+}
+
+static bool VS_IsOccluded(const RECT& visible) {
+    for (long i = 0; i < g_vsOccluderCount; i++) {
+        const RECT& o = g_vsOccluders[i];
+        if (o.left <= visible.left && visible.right <= o.right &&
+            o.top <= visible.top && visible.bottom <= o.bottom) return true;
+    }
+    return false;
+}
+
+// Add the rects an opaque packet is sure to overwrite as occluders
+static void VSPACKET_AddOccluders(const char* p, const RECT& target, const RECT* clip, long destBpp) {
+    long flags = *(long*)(p + 0x04);
+    long alpha = *(long*)(p + 0x1c);
+    long exParam = *(long*)(p + 0x08);
+    if (!(flags & VSPACKET_FLAG_OPAQUE) || (flags & VSPACKET_FLAG_CLIP)) return;
+    if (*(long*)(p + 0x14) != 1000 || *(long*)(p + 0x18) != 1000) return;
+
+    if (flags & VSPACKET_FLAG_DIB) {
+        RKC_DIB* src = *(RKC_DIB**)(p + 0x50);
+        BITMAPINFOHEADER* header = src ? *(BITMAPINFOHEADER**)src : nullptr;
+        if (!header || !*(void**)((char*)src + 0x08)) return;
+        if (VSPACKET_NeedsEx(flags, alpha, exParam) || !VS_OpaqueBlit(header->biBitCount, destBpp)) return;
+        RECT r;
+        r.left = *(long*)(p + 0x0c);
+        r.top = *(long*)(p + 0x10);
+        r.right = r.left + header->biWidth - 1;
+        r.bottom = r.top + header->biHeight - 1;
+        if (VS_Clip(&r, target)) VS_AddOccluder(r);
+        return;
+    }
+
+    // Only patterns VSPACKET::Render is sure to draw to the end
+    char* updib = *(char**)p;
+    void* upd = updib ? RKC_UPDIB_GetUpd(updib, *(long*)(p + 0x24)) : nullptr;
+    char* pattern = upd ? (char*)RKC_UPDIB_UPD_GetPattern(upd, *(long*)(p + 0x28)) : nullptr;
+    if (!pattern) return;
+    long paletteNo = *(long*)(p + 0x2c);
+    if (paletteNo == -1) paletteNo = *(long*)(pattern + 0x1c);
+    if (!RKC_UPDIB_UPD_GetPalette(upd, paletteNo)) return;
+    short r = *(short*)(p + 0x30), g = *(short*)(p + 0x32), b = *(short*)(p + 0x34);
+    if (r == 1000 && g == 1000 && b == 1000 && (flags & VSPACKET_FLAG_INVERT) &&
+        !RKC_UPDIB_UPD_GetPaletteDIB(upd, paletteNo)) return;
+    long partsCount = *(long*)pattern;
+    char* partsList = *(char**)(pattern + 0x04);
+    for (long i = 0; i < partsCount; i++) {
+        if (!*(char**)(partsList + i * 0x1c + 0x18)) return;
+    }
+
+    bool useClip = clip && !(flags & VSPACKET_FLAG_NOCLIP);
+    for (long i = 0; i < partsCount; i++) {
+        char* entry = partsList + i * 0x1c;
+        char* parts = *(char**)(entry + 0x18);
+        if (*(long*)(entry + 0x10) != 1000 || *(long*)(entry + 0x14) != 1000) continue;
+        if (VSPACKET_NeedsEx(flags, alpha, *(long*)(entry + 0x0c) + exParam)) continue;
+        if (!*(void**)(parts + 0x0c) || !VS_OpaqueBlit(*(long*)(parts + 0x00), destBpp)) continue;
+        RECT rect;
+        VSPACKET_PartRect(p, entry, *(long*)(parts + 0x04), *(long*)(parts + 0x08), &rect);
+        if (!VS_Clip(&rect, target)) continue;
+        if (useClip && !VS_Clip(&rect, *clip)) continue;
+        VS_AddOccluder(rect);
+    }
+}
+
+/**
+ * Packet positions of a keyed screen in ascending key order, or null if the
+ * screen is not keyed (or the sort ran out of memory). With culling on, the
+ * marking pass sorts every keyed screen once and VS::Render draws from the
+ * same order; nothing can queue packets in between.
+ */
+static const long* VS_SortedOrder(VS_QUEUE* q) {
+    if (!q->keyed || q->count < 2) return nullptr;
+    long* order = VS_Order(q);
+    if (g_vsOcclusionPass && q->sortedFrame == (long)g_vsCullStats.frames) return order;
+    VS_SORTITEM* items = VS_SortPackets(q);
+    if (!items) return nullptr;
+    for (long i = 0; i < q->count; i++) order[i] = items[i].packet;
+    q->sortedFrame = (long)g_vsCullStats.frames;
+    return order;
+}
+
+// Position in the packet array of the i-th packet VS::Render(-1, order) draws
+static inline long VS_DrawPosition(const VS_QUEUE* q, const long* sorted, long order, long i) {
+    long n = order == 0 ? i : q->count - 1 - i;
+    return sorted ? sorted[n] : n;
+}
+
+// Mark the packets of one screen, the last one drawn first
+static void VS_MarkScreen(void* vs, long order, const RECT& target, const RECT* clip, long destBpp) {
+    VS_QUEUE* q = *(VS_QUEUE**)((char*)vs + 0x04);
+    if (!q || q->count == 0) return;
+    const long* sorted = VS_SortedOrder(q);
+    char* packets = VS_Packets(q);
+    for (long i = q->count - 1; i >= 0; i--) {
+        char* packet = packets + VS_DrawPosition(q, sorted, order, i) * VSPACKET_SIZE;
+        RECT visible;
+        bool known;
+        long cull = VSPACKET_Cull(packet, target, clip, &visible, &known);
+        if (cull == VS_CULL_NONE && known) {
+            if (VS_IsOccluded(visible)) cull = VS_CULL_OCCLUDED;
+            else VSPACKET_AddOccluders(packet, target, clip, destBpp);
+        }
+        *(short*)(packet + 0x36) = (short)cull;
+    }
+}
+
+/**
+ * Start a frame for RKC_UPDIB::Render(-1, order, screenOrder, packetOrder):
+ * reset the counters and, with culling on, mark every packet by walking the
+ * blocks, screens and packets in reverse draw order.
+ */
+static void VS_BeginFrame(void* updib, RKC_DIB* dib, long order, long screenOrder, long packetOrder,
+                          const RECT* clip) {
+    DWORD frames = g_vsCullStats.frames + 1;
+    memset(&g_vsCullStats, 0, sizeof(g_vsCullStats));
+    g_vsCullStats.frames = frames;
+    g_vsOccluderCount = 0;
+    g_vsOcclusionPass = false;
+
+    RECT target;
+    InitImports();
+    if (!VS_CullEnabled() || !VS_TargetRect(dib, &target)) return;
+    if (!g_dibTransfer || !g_dibTransferFast || !g_dibTransferEx || !g_dibTransferExAt ||
+        !g_dibZoom || !g_dibZoomEx || !g_dibSetBitmap || !g_dibSetPalette) return;
+    long destBpp = (*(BITMAPINFOHEADER**)dib)->biBitCount;
+
+    char* block = *(char**)updib;
+    if (order != 0) {
+        while (block && *(char**)(block + 0x10)) block = *(char**)(block + 0x10);
+    }
+    while (block) {
+        char* screens = *(char**)(block + 0x08);
+        long count = *(long*)(block + 0x04);
+        for (long i = 0; i < count; i++) {
+            long screen = screenOrder == 0 ? i : count - 1 - i;
+            VS_MarkScreen(screens + screen * 8, packetOrder, target, clip, destBpp);
+        }
+        block = *(char**)(block + (order == 0 ? 0x10 : 0x0c));
+    }
+    g_vsCullStats.occluders = g_vsOccluderCount;
+    g_vsOcclusionPass = true;
+}
+
+/**
+ * RKC_UPDIB_VS::InsertVSPacket - Queue a new default packet
+ * USED BY: o_RKC_UPDIB.dll (internal)
+ *
+ * The new packet gets index index; 0 appends it. Returns null if index is
+ * past the end (the original crashed) or memory runs out.
+ */
+extern "C" void* __thiscall RKC_UPDIB_VS_InsertVSPacket(void* self, long index) {
+    VS_QUEUE* q = *(VS_QUEUE**)((char*)self + 0x04);
+    long count = q ? q->count : 0;
+    if (index < 0 || index > count) return nullptr;
+    q = VS_Reserve(self);
+    if (!q) return nullptr;
+
+    char* slot = VS_Packets(q) + (count - index) * VSPACKET_SIZE;
+    if (index > 0) memmove(slot + VSPACKET_SIZE, slot, (size_t)index * VSPACKET_SIZE);
+    q->count++;
+
+    memset(slot, 0, VSPACKET_SIZE);
+    RKC_UPDIB_VSPACKET_constructor(slot);
+    *(void**)slot = *(void**)self;
+    return slot;
+}
+
+/**
+ * RKC_UPDIB_VS::DeleteVSPacket - Remove one packet
+ * NOT REFERENCED
+ */
+extern "C" int __thiscall RKC_UPDIB_VS_DeleteVSPacket(void* self, long index) {
+    char* packet = VS_PacketAt(self, index);
+    if (!packet) return 0;
+    VS_QUEUE* q = *(VS_QUEUE**)((char*)self + 0x04);
+    memmove(packet, packet + VSPACKET_SIZE, (size_t)index * VSPACKET_SIZE);
+    q->count--;
+    return 1;
+}
+
+/**
+ * RKC_UPDIB_VS::GetVSPacket - Get packet by index (0 = newest)
+ * NOT REFERENCED
+ */
+extern "C" void* __thiscall RKC_UPDIB_VS_GetVSPacket(void* self, long index) {
+    return VS_PacketAt(self, index);
+}
+
+/**
+ * RKC_UPDIB_VS::GetVSPacketCount - Get number of queued packets
+ * NOT REFERENCED
+ */
+extern "C" long __thiscall RKC_UPDIB_VS_GetVSPacketCount(void* self) {
+    VS_QUEUE* q = *(VS_QUEUE**)((char*)self + 0x04);
+    return q ? q->count : 0;
+}
+
+/**
+ * RKC_UPDIB_VS::FlushVSPacket - Drop all packets, keeping the array
+ * USED BY: o_RKC_UPDIB.dll (internal, from FlushVScreen)
+ */
+extern "C" void __thiscall RKC_UPDIB_VS_FlushVSPacket(void* self) {
+    VS_QUEUE* q = *(VS_QUEUE**)((char*)self + 0x04);
+    if (q) {
+        q->count = 0;
+        q->keyed = 0;
+    }
+}
+
+/**
+ * RKC_UPDIB_VS::Release - Free the packet array
+ * USED BY: o_RKC_UPDIB.dll (internal)
+ */
+extern "C" void __thiscall RKC_UPDIB_VS_Release(void* self) {
+    char* p = (char*)self;
+    if (*(void**)(p + 0x04)) GlobalFree(*(void**)(p + 0x04));
+    *(void**)(p + 0x04) = nullptr;
+    *(void**)(p + 0x00) = nullptr;
+}
+
+/**
+ * RKC_UPDIB_VS::destructor
+ * USED BY: o_RKC_UPDIB.dll (internal)
+ */
+extern "C" void __thiscall RKC_UPDIB_VS_destructor(void* self) {
+    RKC_UPDIB_VS_Release(self);
+}
+
+/**
+ * RKC_UPDIB_VS::Render - Render queued packets
+ * USED BY: o_RKC_UPDIB.dll (internal, from VSBLOCK::Render)
+ *
+ * index -1 renders all packets, in submission order if order is 0 and newest
+ * first otherwise; any other index renders that packet only. If packets were
+ * given sort keys, "submission order" is ascending key order instead. Packets
+ * that cannot show are skipped (see VSPACKET_Cull).
+ */
+extern "C" int __thiscall RKC_UPDIB_VS_Render(void* self, RKC_DIB* dib, long index, long order, RECT* clip) {
+    if (index != -1) {
+        char* packet = VS_PacketAt(self, index);
+        if (packet) RKC_UPDIB_VSPACKET_Render(packet, dib, clip);
+        return 1;
+    }
+
+    VS_QUEUE* q = *(VS_QUEUE**)((char*)self + 0x04);
+    if (!q) return 1;
+    HPROF_COUNT("packets", q->count);
+    char* packets = VS_Packets(q);
+    const long* sorted = VS_SortedOrder(q);
+    RECT target;
+    bool cull = VS_CullEnabled() && VS_TargetRect(dib, &target);
+    g_vsCullStats.packets += q->count;
+    VS_BeginParts(dib);
+    for (long i = 0; i < q->count; i++) {
+        char* packet = packets + VS_DrawPosition(q, sorted, order, i) * VSPACKET_SIZE;
+        long reason = VS_CULL_NONE;
+        if (g_vsOcclusionPass) {
+            reason = *(short*)(packet + 0x36);
+        } else if (cull) {
+            RECT visible;
+            bool known;
+            reason = VSPACKET_Cull(packet, target, clip, &visible, &known);
+        }
+        if (reason == VS_CULL_CLIP) g_vsCullStats.clipped++;
+        else if (reason == VS_CULL_CLEAN) g_vsCullStats.clean++;
+        else if (reason == VS_CULL_OCCLUDED) g_vsCullStats.occluded++;
+        if (reason != VS_CULL_NONE) continue;
+        g_vsCullStats.drawn++;
+        RKC_UPDIB_VSPACKET_Render(packet, dib, clip);
+    }
+    VS_EndParts();
+    return 1;
+}
+
+/**
+ * RKC_UPDIB_VS::SetPacket - Queue a copy of packet
+ * NOT REFERENCED (RKC_UPDIB::SetPacket did this in the original)
+ */
+extern "C" void* __thiscall RKC_UPDIB_VS_SetPacket(void* self, long index, void* packet) {
+    void* inserted = RKC_UPDIB_VS_InsertVSPacket(self, index);
+    if (!inserted) return nullptr;
+    RKC_UPDIB_VSPACKET_SetPacket_copy(inserted, packet);
+    *(void**)inserted = *(void**)self;
+    return inserted;
+}
+
+/**
+ * RKC_UPDIB_VS::SetPacket - Queue a pattern/DIB/primitive packet
+ * USED BY: o_RKC_RPGSCRN.dll
+ */
+extern "C" void* __thiscall RKC_UPDIB_VS_SetPacket_full(void* self, long index, long updNo, long patternNo,
+                                                        long paletteNo, long flags, long x, long y,
+                                                        long scaleX, long scaleY, long alpha, long unknown,
+                                                        long exParam, short r, short g, short b,
+                                                        RECT* clip, RKC_DIB* dib) {
+    void* inserted = RKC_UPDIB_VS_InsertVSPacket(self, index);
+    if (!inserted) return nullptr;
+    return RKC_UPDIB_VSPACKET_SetPacket_full(inserted, *(void**)self, updNo, patternNo, paletteNo, flags,
+                                             x, y, scaleX, scaleY, alpha, unknown, exParam, r, g, b,
+                                             clip, dib);
+}
+
+// Free the VS array of a block
+static void VSBLOCK_FreeScreens(char* block) {
+    char* screens = *(char**)(block + 0x08);
+    if (screens) {
+        for (long i = 0; i < *(long*)(block + 0x04); i++) {
+            RKC_UPDIB_VS_Release(screens + i * 8);
+        }
+        GlobalFree(screens);
+    }
+    *(void**)(block + 0x08) = nullptr;
+    *(long*)(block + 0x04) = 0;
+}
+
+/**
+ * RKC_UPDIB_VSBLOCK::Release - Free the VS array
+ * USED BY: o_RKC_UPDIB.dll (internal)
+ *
+ * Like the original, this also clears the next block pointer but not prev.
+ */
+extern "C" void __thiscall RKC_UPDIB_VSBLOCK_Release(void* self) {
+    char* p = (char*)self;
+    VSBLOCK_FreeScreens(p);
+    *(void**)(p + 0x10) = nullptr;
+    *(void**)(p + 0x00) = nullptr;
+}
+
+/**
+ * RKC_UPDIB_VSBLOCK::destructor
+ * USED BY: o_RKC_UPDIB.dll (internal)
+ */
+extern "C" void __thiscall RKC_UPDIB_VSBLOCK_destructor(void* self) {
+    RKC_UPDIB_VSBLOCK_Release(self);
+}
+
+/**
+ * RKC_UPDIB_VSBLOCK::CreateVS - (Re)create count virtual screens
+ * USED BY: o_RKC_UPDIB.dll (internal, from Initialize)
+ */
+extern "C" int __thiscall RKC_UPDIB_VSBLOCK_CreateVS(void* self, long count) {
+    char* p = (char*)self;
+    if (count < 0) return 0;
+
+    VSBLOCK_FreeScreens(p);
+
+    void* updib = *(void**)(p + 0x00);
+    char* screens = nullptr;
+    if (count > 0) {
+        screens = (char*)GlobalAlloc(GPTR, (SIZE_T)count * 8);
+        if (!screens) return 0;
+        for (long i = 0; i < count; i++) {
+            *(void**)(screens + i * 8) = updib;
+        }
+    }
+    *(char**)(p + 0x08) = screens;
+    *(long*)(p + 0x04) = count;
+    return 1;
+}
+
+/**
+ * RKC_UPDIB_VSBLOCK::GetVSCount - Get number of virtual screens
+ * NOT REFERENCED
+ */
+extern "C" long __thiscall RKC_UPDIB_VSBLOCK_GetVSCount(void* self) {
+    return *(long*)((char*)self + 0x04);
+}
+
+/**
+ * RKC_UPDIB_VSBLOCK::GetVScreen - Get virtual screen by index
+ * USED BY: o_RKC_RPGSCRN.dll
+ *
+ * Like the original, only the upper bound is checked.
+ */
+extern "C" void* __thiscall RKC_UPDIB_VSBLOCK_GetVScreen(void* self, long index) {
+    char* p = (char*)self;
+    if (index >= *(long*)(p + 0x04)) return nullptr;
+    return *(char**)(p + 0x08) + index * 8;
+}
+
+/**
+ * RKC_UPDIB_VSBLOCK::FlushVScreen - Drop the packets of every virtual screen
+ * USED BY: o_RKC_UPDIB.dll (internal, from FlushVSBlock)
+ */
+extern "C" void __thiscall RKC_UPDIB_VSBLOCK_FlushVScreen(void* self) {
+    char* p = (char*)self;
+    for (long i = 0; i < *(long*)(p + 0x04); i++) {
+        RKC_UPDIB_VS_FlushVSPacket(*(char**)(p + 0x08) + i * 8);
+    }
+}
+
+/**
+ * RKC_UPDIB_VSBLOCK::Render - Render virtual screens
+ * USED BY: ShadowFlare.exe
+ *
+ * index -1 renders every screen, last to first if order is 0, each with
+ * packet order packetOrder; any other index renders that screen only, in
+ * submission order.
+ */
+extern "C" int __thiscall RKC_UPDIB_VSBLOCK_Render(void* self, RKC_DIB* dib, long index, long order,
+                                                   long packetOrder, RECT* clip) {
+    HPROF_SCOPE("render");
+    char* p = (char*)self;
+    char* screens = *(char**)(p + 0x08);
+    long count = *(long*)(p + 0x04);
+    if (index != -1) {
+        RKC_UPDIB_VS_Render(screens + index * 8, dib, -1, 0, clip);
+    } else if (order == 0) {
+        for (long i = count - 1; i >= 0; i--) RKC_UPDIB_VS_Render(screens + i * 8, dib, -1, packetOrder, clip);
+    } else {
+        for (long i = 0; i < count; i++) RKC_UPDIB_VS_Render(screens + i * 8, dib, -1, packetOrder, clip);
+    }
+    return 1;
+}
+
+/**
+ * RKC_UPDIB::GetVSBlockCount - Get number of VS blocks
+ * NOT REFERENCED
+ */
+extern "C" long __thiscall RKC_UPDIB_GetVSBlockCount(void* self) {
+    long count = 0;
+    for (char* block = *(char**)self; block; block = *(char**)(block + 0x10)) count++;
+    return count;
+}
+
+/**
+ * RKC_UPDIB::GetVSBlock - Get VS block by index
+ * USED BY: ShadowFlare.exe, o_RKC_RPGSCRN.dll
+ */
+extern "C" void* __thiscall RKC_UPDIB_GetVSBlock(void* self, long index) {
+    char* block = *(char**)self;
+    for (long i = 0; block && i != index; i++) block = *(char**)(block + 0x10);
+    return block;
+}
+
+/**
+ * RKC_UPDIB::InsertVSBlock - Create a VS block at index
+ * USED BY: o_RKC_UPDIB.dll (internal, from Initialize)
+ *
+ * The new block has no virtual screens yet (see VSBLOCK::CreateVS).
+ */
+extern "C" void* __thiscall RKC_UPDIB_InsertVSBlock(void* self, long index) {
+    if (index < 0 || index > RKC_UPDIB_GetVSBlockCount(self)) return nullptr;
+    char* block = (char*)GlobalAlloc(GMEM_FIXED, 0x14);
+    if (!block) return nullptr;
+    RKC_UPDIB_VSBLOCK_constructor(block);
+    *(void**)block = self;
+
+    char* prev = index == 0 ? nullptr : (char*)RKC_UPDIB_GetVSBlock(self, index - 1);
+    char* next = prev ? *(char**)(prev + 0x10) : *(char**)self;
+    *(char**)(block + 0x0c) = prev;
+    *(char**)(block + 0x10) = next;
+    if (next) *(char**)(next + 0x0c) = block;
+    if (prev) *(char**)(prev + 0x10) = block;
+    else *(char**)self = block;
+    return block;
+}
+
+/**
+ * RKC_UPDIB::DeleteVSBlock - Free the VS block at index
+ * USED BY: o_RKC_UPDIB.dll (internal, from Release)
+ */
+extern "C" int __thiscall RKC_UPDIB_DeleteVSBlock(void* self, long index) {
+    char* block = (char*)RKC_UPDIB_GetVSBlock(self, index);
+    if (index < 0 || !block) return 0;
+
+    char* prev = *(char**)(block + 0x0c);
+    char* next = *(char**)(block + 0x10);
+    if (next) *(char**)(next + 0x0c) = prev;
+    if (prev) *(char**)(prev + 0x10) = next;
+    else *(char**)self = next;
+
+    RKC_UPDIB_VSBLOCK_destructor(block);
+    GlobalFree(block);
+    return 1;
+}
+
+/**
+ * RKC_UPDIB::FlushVSBlock - Drop the packets of one (or, with -1, every) block
+ * USED BY: ShadowFlare.exe
+ */
+extern "C" void __thiscall RKC_UPDIB_FlushVSBlock(void* self, long index) {
+    if (index != -1) {
+        void* block = RKC_UPDIB_GetVSBlock(self, index);
+        if (block) RKC_UPDIB_VSBLOCK_FlushVScreen(block);
+        return;
+    }
+    for (char* block = *(char**)self; block; block = *(char**)(block + 0x10)) {
+        RKC_UPDIB_VSBLOCK_FlushVScreen(block);
+    }
+}
+
+/**
+ * RKC_UPDIB::Render - Render VS blocks into dib
+ * USED BY: ShadowFlare.exe
+ *
+ * index -1 renders every block, last to first if order is 0, passing
+ * screenOrder and packetOrder on; any other index renders that block with
+ * default orders. Rendering every block counts as a frame for the cull
+ * counters and is the only case with occlusion culling.
+ */
+extern "C" int __thiscall RKC_UPDIB_Render(void* self, RKC_DIB* dib, long index, long order,
+                                           long screenOrder, long packetOrder, RECT* clip) {
+    if (index != -1) {
+        void* block = RKC_UPDIB_GetVSBlock(self, index);
+        if (block) RKC_UPDIB_VSBLOCK_Render(block, dib, -1, 0, 0, clip);
+        return 1;
+    }
+
+    VS_BeginFrame(self, dib, order, screenOrder, packetOrder, clip);
+    char* block = *(char**)self;
+    if (order == 0) {
+        while (block && *(char**)(block + 0x10)) block = *(char**)(block + 0x10);
+        for (; block; block = *(char**)(block + 0x0c)) {
+            RKC_UPDIB_VSBLOCK_Render(block, dib, -1, screenOrder, packetOrder, clip);
+        }
+    } else {
+        for (; block; block = *(char**)(block + 0x10)) {
+            RKC_UPDIB_VSBLOCK_Render(block, dib, -1, screenOrder, packetOrder, clip);
+        }
+    }
+    g_vsOcclusionPass = false;
+    return 1;
+}
+
+/**
+ * RKC_UPDIB::SetPacket - Queue a packet on virtual screen vs of block block
+ * USED BY: ShadowFlare.exe
+ *
+ * The original filled a stack packet and queued a copy; filling the queued
+ * packet directly gives the same result. Returns 1 on success.
+ */
+extern "C" int __thiscall RKC_UPDIB_SetPacket(void* self, long block, long vs, long updNo, long patternNo,
+                                              long paletteNo, long flags, long x, long y, long scaleX,
+                                              long scaleY, long alpha, long unknown, long exParam,
+                                              short r, short g, short b, RECT* clip, RKC_DIB* dib) {
+    void* vsBlock = RKC_UPDIB_GetVSBlock(self, block);
+    if (!vsBlock) return 0;
+    void* screen = RKC_UPDIB_VSBLOCK_GetVScreen(vsBlock, vs);
+    if (!screen) return 0;
+    void* packet = RKC_UPDIB_VS_InsertVSPacket(screen, 0);
+    if (!packet) return 0;
+    RKC_UPDIB_VSPACKET_SetPacket_full(packet, self, updNo, patternNo, paletteNo, flags, x, y, scaleX,
+                                      scaleY, alpha, unknown, exParam, r, g, b, clip, dib);
+    *(void**)packet = *(void**)screen;
+    return 1;
+}
+
+/**
+ * RKC_UPDIB::SetStringsPacket - Queue one packet per character of text
+ * USED BY: ShadowFlare.exe
+ *
+ * UPD updNo is a font: pattern 0's build rect is 16x16 single-byte glyphs,
+ * each pattern from 1 on holds 16x16 double-byte glyphs for one Shift-JIS lead
+ * byte. Characters go left to right from (x, y); LF returns to x and moves
+ * down by the glyph height plus lineSpacing. maxBytes (0 = no limit) stops
+ * before the character that would pass it. Returns 0 if the block, screen or
+ * font is missing.
+ */
+extern "C" int __thiscall RKC_UPDIB_SetStringsPacket(void* self, long block, long vs, long updNo,
+                                                     long x, long y, char* text, unsigned char r,
+                                                     unsigned char g, unsigned char b, long flags,
+                                                     long maxBytes, long charSpacing, long lineSpacing,
+                                                     long alpha) {
+    void* vsBlock = RKC_UPDIB_GetVSBlock(self, block);
+    if (!vsBlock) return 0;
+    void* screen = RKC_UPDIB_VSBLOCK_GetVScreen(vsBlock, vs);
+    if (!screen) return 0;
+    void* upd = RKC_UPDIB_GetUpd(self, updNo);
+    if (!upd) return 0;
+    char* font = (char*)RKC_UPDIB_UPD_GetPattern(upd, 0);
+    if (!font) return 0;
+
+    long w = *(long*)(font + 0x14) / 16;
+    long h = *(long*)(font + 0x18) / 16;
+    if (maxBytes == 0) maxBytes = 2000000;
+
+    long cx = x;
+    long used = 0;
+    for (const unsigned char* s = (const unsigned char*)text; *s; s++) {
+        unsigned char c = *s;
+        bool singleByte = (c < 0x80 || c > 0x9f) && c < 0xe0;
+        if (singleByte) {
+            if (used + 1 > maxBytes) return 1;
+            if (c == '\n') {
+                y += h + lineSpacing;
+                cx = x;
+            } else if (c == ' ') {
+                cx += w + charSpacing;
+            } else {
+                char* pattern = (char*)RKC_UPDIB_UPD_GetPattern(upd, 0);
+                char* packet = pattern ? (char*)RKC_UPDIB_VS_InsertVSPacket(screen, 0) : nullptr;
+                if (packet) {
+                    // Glyph c sits at column c & 15, row c >> 4 of pattern 0
+                    *(long*)(packet + 0x04) = flags | VSPACKET_FLAG_CLIP | 0x80;
+                    *(long*)(packet + 0x0c) = cx - (c & 0xf) * w;
+                    *(long*)(packet + 0x10) = y - (c >> 4) * h;
+                    *(long*)(packet + 0x1c) = alpha;
+                    *(long*)(packet + 0x24) = updNo;
+                    *(long*)(packet + 0x28) = 0;
+                    *(long*)(packet + 0x2c) = *(long*)(pattern + 0x1c);
+                    *(short*)(packet + 0x30) = r;
+                    *(short*)(packet + 0x32) = g;
+                    *(short*)(packet + 0x34) = b;
+                    *(long*)(packet + 0x40) = cx;
+                    *(long*)(packet + 0x44) = y;
+                    *(long*)(packet + 0x48) = cx + w - 1;
+                    *(long*)(packet + 0x4c) = y + h - 1;
+                }
+                cx += w + charSpacing;
+            }
+            used++;
+        } else {
+            if (used + 2 > maxBytes) return 1;
+            long patternNo = (c < 0x80 || c > 0x9f) ? c - 0xbf : c - 0x7f;
+            unsigned char c2 = s[1];
+            char* pattern = (char*)RKC_UPDIB_UPD_GetPattern(upd, patternNo);
+            char* packet = pattern ? (char*)RKC_UPDIB_VS_InsertVSPacket(screen, 0) : nullptr;
+            if (packet) {
+                // Trail byte c2 picks column c2 & 15, row c2 >> 4; glyphs are 2w wide
+                *(long*)(packet + 0x04) = flags | VSPACKET_FLAG_CLIP | 0x80;
+                *(long*)(packet + 0x0c) = cx - (c2 & 0xf) * w * 2;
+                *(long*)(packet + 0x10) = y - (c2 >> 4) * h;
+                *(long*)(packet + 0x1c) = alpha;
+                *(long*)(packet + 0x24) = updNo;
+                *(long*)(packet + 0x28) = patternNo;
+                *(long*)(packet + 0x2c) = -1;
+                *(short*)(packet + 0x30) = r;
+                *(short*)(packet + 0x32) = g;
+                *(short*)(packet + 0x34) = b;
+                *(long*)(packet + 0x40) = cx;
+                *(long*)(packet + 0x44) = y;
+                *(long*)(packet + 0x48) = cx + w * 2 - 1;
+                *(long*)(packet + 0x4c) = y + h - 1;
+            }
+            cx += charSpacing + w * 2;
+            used += 2;
+            if (!s[1]) break;
+            s++;
+        }
+    }
+    return 1;
+}
+
+/**
+ * RKC_UPDIB_SetSortKey - Give the packet queued last on a screen a draw order key
+ * NOT REFERENCED by the game (opt-in extension export; see the draw order keys)
+ *
+ * Call right after SetPacket. From then on the screen draws back to front by
+ * layer, then depth, then priority, then submission order (see
+ * VS_MakeSortKey). Out of range values are clamped. Returns 0 if the block or
+ * screen is missing or empty.
+ */
+extern "C" int __cdecl RKC_UPDIB_SetSortKey(void* updib, long block, long vs, long layer, long depth,
+                                            long priority) {
+    void* vsBlock = RKC_UPDIB_GetVSBlock(updib, block);
+    if (!vsBlock || vs < 0) return 0;
+    void* screen = RKC_UPDIB_VSBLOCK_GetVScreen(vsBlock, vs);
+    if (!screen) return 0;
+    char* packet = VS_PacketAt(screen, 0);
+    if (!packet) return 0;
+    *(unsigned long long*)(packet + 0x38) = VS_MakeSortKey(layer, depth, priority);
+    (*(VS_QUEUE**)((char*)screen + 0x04))->keyed++;
+    return 1;
+}
+
+/**
+ * RKC_UPDIB_SetDirtyRegion - Limit rendering to the given rects
+ * USED BY: OpenShadowFlare (exported as RKC_UPDIB_SetDirtyRegion)
+ *
+ * Rects are inclusive target pixels, like the render clip. Packets that touch
+ * none of them are skipped until the region is changed again; null or count 0
+ * makes everything dirty. More than VS_DIRTY_MAX rects are merged into their
+ * bounding rect. Returns 1.
+ */
+extern "C" int __cdecl RKC_UPDIB_SetDirtyRegion(const RECT* rects, long count) {
+    if (!rects || count <= 0) {
+        g_vsDirtyCount = 0;
+        return 1;
+    }
+    if (count <= VS_DIRTY_MAX) {
+        memcpy(g_vsDirty, rects, (size_t)count * sizeof(RECT));
+        g_vsDirtyCount = count;
+        return 1;
+    }
+    RECT merged = rects[0];
+    for (long i = 1; i < count; i++) {
+        if (rects[i].left < merged.left) merged.left = rects[i].left;
+        if (rects[i].top < merged.top) merged.top = rects[i].top;
+        if (rects[i].right > merged.right) merged.right = rects[i].right;
+        if (rects[i].bottom > merged.bottom) merged.bottom = rects[i].bottom;
+    }
+    g_vsDirty[0] = merged;
+    g_vsDirtyCount = 1;
+    return 1;
+}
+
+/**
+ * RKC_UPDIB_GetCullStats - Copy the cull counters of the last frame
+ * USED BY: OpenShadowFlare (exported as RKC_UPDIB_GetCullStats)
+ */
+extern "C" void __cdecl RKC_UPDIB_GetCullStats(RKC_UPDIB_CULLSTATS* out) {
+    if (out) *out = g_vsCullStats;
+}
+
+// ============================================================================
+// RKC_UPDIB UPD SLOTS - ReadUpd/DeleteUpd on the native loader
+// ============================================================================
+
+/**
+ * RKC_UPDIB::ReadUpd is GetUpd + RKC_UPDIB_UPD::Read (plus optional pattern
+ * icons), so doing it here puts the exe's loads on the native loader, the UPD
+ * cache and the prefetcher. Arena UPDs must never reach o_RKC_UPDIB.dll's own
+ * UPD Release: DeleteUpd is native too, and Initialize and the destructor
+ * (which release every UPD internally) free arena UPDs before calling the
+ * original. They free the native VS blocks for the same reason, and
+ * Initialize creates them itself once the original has set up the rest.
+ */
+// Free every arena UPD in the UPD block, leaving cleared objects behind
+static void UPDIB_ReleaseArenaUpds(void* self) {
+    char* p = (char*)self;
+    void** upds = *(void***)(p + 0x08);
+    if (!upds) return;
+    for (long i = 0; i < *(long*)(p + 0x04); i++) {
+        if (upds[i]) UPD_ReleaseArena(upds[i]);
+    }
+}
+
+// Free the native VS blocks, so the original's Release finds none
+static void UPDIB_ReleaseVSBlocks(void* self) {
+    while (RKC_UPDIB_DeleteVSBlock(self, 0) == 1) {}
+}
+
+/**
+ * RKC_UPDIB::constructor
+ * USED BY: ShadowFlare.exe
+ *
+ * Native, so the VS block list at +0x00 (walked only by the native VS block
+ * code) is known to start empty. Leaves the object as the original does:
+ * every field zero, which is also a constructed temporary DIB
+ * (RKC_DIB::constructor only clears its three pointers). Initialize sets up
+ * the rest.
+ */
+extern "C" void* __thiscall RKC_UPDIB_constructor(void* self) {
+    memset(self, 0, 0x30);
+    return self;
+}
+
+/**
+ * RKC_UPDIB::CreateTemporaryDIB - Size the temporary DIB for the largest part
+ * USED BY: ShadowFlare.exe
+ *
+ * Still the original's. It reads the UPD block (+0x04/+0x08) and each
+ * part's width and height, which native UPDs keep in the original layout,
+ * and writes +0x14 to +0x27. It has no business with the native VS block
+ * list at +0x00, and the list is put back after the call so nothing it
+ * does there could lose the native blocks.
+ */
+extern "C" void __thiscall RKC_UPDIB_CreateTemporaryDIB(void* self) {
+    InitImports();
+    if (!g_origCreateTemporaryDIB) return;
+    void* blocks = *(void**)self;
+    g_origCreateTemporaryDIB(self);
+    *(void**)self = blocks;
+}
+
+/**
+ * RKC_UPDIB::ReadUpd - Load a UPD file into UPD slot index
+ * USED BY: ShadowFlare.exe
+ *
+ * With iconWidth and iconHeight set the original also renders an icon per
+ * pattern; that case is still handed to o_RKC_UPDIB.dll (the exe never asks
+ * for it). createTemporary == 1 resizes the temporary DIB afterwards.
+ */
+extern "C" int __thiscall RKC_UPDIB_ReadUpd(void* self, long index, char* filename, long flags,
+                                            long iconWidth, long iconHeight, int createTemporary) {
+    void* upd = RKC_UPDIB_GetUpd(self, index);
+    if (!upd) return 0;
+    InitImports();
+
+    if (iconWidth != 0 && iconHeight != 0) {
+        UPD_ReleaseArena(upd);
+        if (!g_origReadUpd) return 0;
+        return g_origReadUpd(self, index, filename, flags, iconWidth, iconHeight, createTemporary);
+    }
+
+    if (!RKC_UPDIB_UPD_Read(upd, filename, flags)) return 0;
+    if (createTemporary == 1) RKC_UPDIB_CreateTemporaryDIB(self);
+    return 1;
+}
+
+/**
+ * RKC_UPDIB::DeleteUpd - Release the UPD in slot index
+ * USED BY: ShadowFlare.exe
+ */
+extern "C" int __thiscall RKC_UPDIB_DeleteUpd(void* self, long index, int createTemporary) {
+    void* upd = RKC_UPDIB_GetUpd(self, index);
+    if (!upd) return 0;
+    RKC_UPDIB_UPD_Release(upd);
+    if (createTemporary == 1) RKC_UPDIB_CreateTemporaryDIB(self);
+    return 1;
+}
+
+/**
+ * RKC_UPDIB::Initialize - Create VS blocks and the UPD block
+ * USED BY: ShadowFlare.exe
+ *
+ * vsBlocks blocks of vsCount virtual screens each. On failure everything is
+ * released again, as in the original.
+ */
+extern "C" int __thiscall RKC_UPDIB_Initialize(void* self, long vsBlocks, long vsCount,
+                                               long updCount, int hispeed) {
+    UPDIB_ReleaseVSBlocks(self);
+    UPDIB_ReleaseArenaUpds(self);
+    InitImports();
+    if (!g_origInitialize || !g_origUpdibRelease) return 0;
+    if (!g_origInitialize(self, 0, 0, updCount, hispeed)) return 0;
+
+    // Blocks go in at 0 like the original's, so block 0 is the last one made
+    for (long i = 0; i < vsBlocks; i++) {
+        void* block = RKC_UPDIB_InsertVSBlock(self, 0);
+        if (!block || !RKC_UPDIB_VSBLOCK_CreateVS(block, vsCount)) {
+            UPDIB_ReleaseVSBlocks(self);
+            g_origUpdibRelease(self);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * RKC_UPDIB::destructor
+ * USED BY: ShadowFlare.exe
+ */
+extern "C" void __thiscall RKC_UPDIB_destructor(void* self) {
+    UPDIB_ReleaseVSBlocks(self);
+    UPDIB_ReleaseArenaUpds(self);
+    if (g_prefetchInit == 2 && g_prefetchEvent) UPD_SaveLinks();  // Links the worker has not written yet
+    InitImports();
+    if (g_origUpdibDestructor) g_origUpdibDestructor(self);
+}
+
+/**
+ * RKC_UPDIB_PrefetchScenario - Queue a scenario set for background loading
+ * USED BY: OpenShadowFlare (exported as RKC_UPDIB_PrefetchScenario)
+ *
+ * Paths are built like the last scenario path the game read (Scenario\%08d\
+ * relative to the working directory until then). Returns 1 if queued.
+ */
+extern "C" int __cdecl RKC_UPDIB_PrefetchScenario(long scenarioNo) {
+    if (scenarioNo < 0 || scenarioNo > 99999999 || !UPD_PrefetchInit()) return 0;
+    EnterCriticalSection(&g_prefetchLock);
+    bool queued = UPD_QueueScenario(scenarioNo);
+    LeaveCriticalSection(&g_prefetchLock);
+    if (queued) SetEvent(g_prefetchEvent);
+    return queued ? 1 : 0;
+}
+
+/**
+ * RKC_UPDIB_AddScenarioLink - Tell the prefetcher that from leads to to
+ * USED BY: OpenShadowFlare (exported as RKC_UPDIB_AddScenarioLink)
+ *
+ * weight is added to the learned count, so known map exits can outrank
+ * transitions seen once. Returns 1 on success.
+ */
+extern "C" int __cdecl RKC_UPDIB_AddScenarioLink(long from, long to, long weight) {
+    if (from < 0 || to < 0 || from == to || weight <= 0 || !UPD_PrefetchInit()) return 0;
+    EnterCriticalSection(&g_prefetchLock);
+    UPD_AddLink(from, to, weight);
+    g_linksDirty = true;
+    LeaveCriticalSection(&g_prefetchLock);
+    SetEvent(g_prefetchEvent);
+    return 1;
+}
+
+/**
+ * RKC_UPDIB_GetPrefetchStats - Copy the prefetcher counters
+ * USED BY: OpenShadowFlare (exported as RKC_UPDIB_GetPrefetchStats)
+ */
+extern "C" void __cdecl RKC_UPDIB_GetPrefetchStats(RKC_UPDIB_PREFETCHSTATS* out) {
+    if (out) *out = g_prefetchStats;
+}
+
 // ============================================================================
 // STUBS FOR UNUSED FUNCTIONS - NOT IMPORTED BY EXE OR OTHER DLLS
 // ============================================================================
@@ -375,48 +3595,19 @@ extern "C" void* __thiscall RKC_UPDIB_PATTERN_operatorAssign(void* self, const v
 extern "C" void __thiscall RKC_UPDIB_PATTERN_Release(void* self) {}
 
 // RKC_UPDIB_UPD stubs
-extern "C" void* __thiscall RKC_UPDIB_UPD_constructor(void* self) { return self; }
-extern "C" void __thiscall RKC_UPDIB_UPD_destructor(void* self) {}
 extern "C" void* __thiscall RKC_UPDIB_UPD_operatorAssign(void* self, const void* src) { return self; }
-extern "C" RKC_DIB* __thiscall RKC_UPDIB_UPD_GetPaletteDIB(void* self, long index) { return nullptr; }
-extern "C" void* __thiscall RKC_UPDIB_UPD_GetPalette(void* self, long index) { return nullptr; }
-extern "C" int __thiscall RKC_UPDIB_UPD_Read(void* self, char* filename, long flags) { return 0; }
 
 // RKC_UPDIB stubs
 extern "C" void* __thiscall RKC_UPDIB_operatorAssign(void* self, const void* src) { return self; }
 extern "C" int __thiscall RKC_UPDIB_CreateUpdBlock(void* self, long count) { return 0; }
-extern "C" int __thiscall RKC_UPDIB_DeleteVSBlock(void* self, long index) { return 0; }
 extern "C" int __thiscall RKC_UPDIB_ExchangeUpd(void* self, long a, long b) { return 0; }
-extern "C" long __thiscall RKC_UPDIB_GetVSBlockCount(void* self) { return 0; }
-extern "C" void* __thiscall RKC_UPDIB_InsertVSBlock(void* self, long index) { return nullptr; }
 extern "C" void __thiscall RKC_UPDIB_Release(void* self) {}
 
 // RKC_UPDIB_VS stubs
-extern "C" void __thiscall RKC_UPDIB_VS_destructor(void* self) {}
 extern "C" void* __thiscall RKC_UPDIB_VS_operatorAssign(void* self, const void* src) { return self; }
-extern "C" int __thiscall RKC_UPDIB_VS_DeleteVSPacket(void* self, long index) { return 0; }
-extern "C" void __thiscall RKC_UPDIB_VS_FlushVSPacket(void* self) {}
-extern "C" long __thiscall RKC_UPDIB_VS_GetVSPacketCount(void* self) { return 0; }
-extern "C" void* __thiscall RKC_UPDIB_VS_GetVSPacket(void* self, long index) { return nullptr; }
-extern "C" void* __thiscall RKC_UPDIB_VS_InsertVSPacket(void* self, long index) { return nullptr; }
-extern "C" void __thiscall RKC_UPDIB_VS_Release(void* self) {}
-extern "C" int __thiscall RKC_UPDIB_VS_Render(void* self, RKC_DIB* dib, long x, long y, RECT* clip) { return 0; }
-extern "C" void* __thiscall RKC_UPDIB_VS_SetPacket(void* self, long index, void* packet) { return nullptr; }
 
 // RKC_UPDIB_VSBLOCK stubs
-extern "C" void __thiscall RKC_UPDIB_VSBLOCK_destructor(void* self) {}
 extern "C" void* __thiscall RKC_UPDIB_VSBLOCK_operatorAssign(void* self, const void* src) { return self; }
-extern "C" int __thiscall RKC_UPDIB_VSBLOCK_CreateVS(void* self, long count) { return 0; }
-extern "C" void __thiscall RKC_UPDIB_VSBLOCK_FlushVScreen(void* self) {}
-extern "C" long __thiscall RKC_UPDIB_VSBLOCK_GetVSCount(void* self) { return 0; }
-extern "C" void __thiscall RKC_UPDIB_VSBLOCK_Release(void* self) {}
 
 // RKC_UPDIB_VSPACKET stubs
 extern "C" void* __thiscall RKC_UPDIB_VSPACKET_operatorAssign(void* self, const void* src) { return self; }
-extern "C" int __thiscall RKC_UPDIB_VSPACKET_Render(void* self, RKC_DIB* dib, RECT* clip) { return 0; }
-extern "C" int __thiscall RKC_UPDIB_VSPACKET_RenderBox(void* self, RKC_DIB* dib, RECT* clip) { return 0; }
-extern "C" int __thiscall RKC_UPDIB_VSPACKET_RenderFill(void* self, RKC_DIB* dib, RECT* clip) { return 0; }
-extern "C" int __thiscall RKC_UPDIB_VSPACKET_RenderLine(void* self, RKC_DIB* dib, RECT* clip) { return 0; }
-extern "C" int __thiscall RKC_UPDIB_VSPACKET_RenderPoint(void* self, RKC_DIB* dib, RECT* clip) { return 0; }
-extern "C" void* __thiscall RKC_UPDIB_VSPACKET_SetPacket_copy(void* self, void* packet) { return nullptr; }
-extern "C" void* __thiscall RKC_UPDIB_VSPACKET_SetPacket_full(void* self, void* updib, long a, long b, long c, long d, long e, long f, long g, long h, long i, long j, short k, short l, short m, RECT* clip, RKC_DIB* dib) { return nullptr; }
@@ -63,8 +63,10 @@ for dir in "${dirs[@]}"; do
     
     # Extra libs for specific DLLs
     EXTRA_LIBS=""
+    EXTRA_SRCS=""
     if [ "$dir" = "RKC_DBFCONTROL" ]; then
         EXTRA_LIBS="-lopengl32"
+        EXTRA_SRCS="$SCRIPT_DIR/happy/h2d.cpp"  # Profiler overlay
     fi
     if [ "$dir" = "RKC_DSOUND" ]; then
         EXTRA_LIBS="-lwinmm"
@@ -73,7 +75,7 @@ for dir in "${dirs[@]}"; do
     $CXX -shared -static-libgcc -static-libstdc++ \
         -std=c++17 \
         -o "$BUILD_DIR/$dir.dll" \
-        "$SCRIPT_DIR/$dir/src/core.cpp" \
+        "$SCRIPT_DIR/$dir/src/core.cpp" $EXTRA_SRCS \
         "$SCRIPT_DIR/$dir/dll.def" \
         -lgdi32 -lcomdlg32 $EXTRA_LIBS \
         2>&1
@@ -1,27 +1,56 @@
 /**
  * OpenShadowFlare Debug/Tracing System
- * 
+ *
  * Provides function call tracing and crash diagnostics.
  * Enable by defining OSF_DEBUG before including this header.
- * 
+ *
  * MANDATORY: Every implemented function MUST use OSF_FUNC_TRACE at the start!
- * 
+ *
  * Usage in DLL code:
  *   #define OSF_DEBUG 1
  *   #define DLL_NAME "RK_FUNCTION"
  *   #include "../../debug.h"
- *   
+ *
  *   int __cdecl SomeFunction(int arg) {
  *       OSF_FUNC_TRACE("arg=%d", arg);  // Logs ENTER and EXIT automatically
  *       // ... function code ...
  *       return result;
  *   }
- *   
+ *
  *   // For functions with no args:
  *   void __cdecl SimpleFunction() {
  *       OSF_FUNC_TRACE_NOARGS;
  *       // ...
  *   }
+ *
+ * Tracing is cheap enough to leave on in hot functions: an ENTER or EXIT is
+ * one 64-byte binary record (TSC timestamp, call site ID, the raw arguments)
+ * written to a lock-free ring owned by the calling thread, with no lock, no
+ * formatting and no I/O. A background thread writes the rings out every
+ * OSF_TRACE_FLUSH_MS to osf_trace_<DLL_NAME>.bin, delta and varint coded
+ * (see trace_format.h); trace_decode turns that into the familiar text:
+ *   trace_decode osf_trace_RK_FUNCTION.bin osf_trace.log
+ * A ring that laps its flusher loses its oldest records, which the trace
+ * reports. On a crash the newest OSF_TRACE_BUFFER_SIZE records of all
+ * threads are formatted into osf_crash.log, as before.
+ *
+ * What gets traced is set per DLL and per function at startup, from the
+ * file named by OSF_TRACE_CONFIG (default osf_trace.cfg, one rule a line,
+ * # comments) and then the OSF_TRACE environment variable (rules split by ;):
+ *   OSF_TRACE=*=count;RK_FUNCTION::RK_Check*=sample:100;RK_GetSJISLen=rate:50
+ * A rule is <pattern>=<mode>. The pattern is DLL::func, func (any DLL) or
+ * DLL::* (the whole DLL); names may end in * to match a prefix. The most
+ * specific pattern wins (function before DLL, exact before prefix), the last
+ * rule among equals. Modes:
+ *   on          trace every call (the default)
+ *   off         nothing
+ *   sample:N    trace one call in N
+ *   rate:N[/B]  trace at most N calls a second, bursts of up to B (default N)
+ *   count       trace nothing, count calls and time them
+ * Sampled and rate-limited calls are traced ENTER and EXIT alike. At
+ * OSF_DEBUG_SHUTDOWN the counts of every site not simply on, with latency
+ * percentiles for count mode, go to osf_counts_<DLL_NAME>.txt, most called
+ * first.
  */
 
 #ifndef OSF_DEBUG_H
@@ -31,124 +60,662 @@
 #include <cstdio>
 #include <cstdarg>
 
-// Ring buffer size for tracking recent function calls
+// Entries the crash handler writes to osf_crash.log, and their length
 #define OSF_TRACE_BUFFER_SIZE 256
 #define OSF_TRACE_ENTRY_LEN 256
 
+// Records kept per thread (64 bytes each), threads and call sites traced
+#define OSF_TRACE_RING_RECORDS 8192
+#define OSF_TRACE_MAX_THREADS 64
+#define OSF_TRACE_MAX_SITES 4096
+
+// How often the flusher writes the rings out
+#define OSF_TRACE_FLUSH_MS 50
+
+// Config rules kept, and count mode's latency buckets (powers of two of
+// TSC ticks, the last one open-ended)
+#define OSF_TRACE_MAX_RULES 64
+#define OSF_TRACE_HIST_BUCKETS 40
+
+#ifndef DLL_NAME
+#define DLL_NAME "UNKNOWN"
+#endif
+
 #ifdef OSF_DEBUG
 
+#include <intrin.h>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include "trace_format.h"
+
 // Global trace state
 namespace OsfDebug {
-    // Ring buffer of recent function calls
-    static char g_traceBuffer[OSF_TRACE_BUFFER_SIZE][OSF_TRACE_ENTRY_LEN];
-    static int g_traceIndex = 0;
-    static CRITICAL_SECTION g_traceLock;
-    static bool g_initialized = false;
+    using OsfTrace::Record;
+
+    // One OSF_FUNC_TRACE / OSF_TRACE use; its index is the records' site ID
+    enum Mode : uint8_t { MODE_ON, MODE_OFF, MODE_SAMPLE, MODE_RATE, MODE_COUNT };
+
+    struct Site {
+        const char* dll;
+        const char* func;
+        const char* fmt;
+        std::atomic<bool> ready;
+        bool written;                       // Flusher only
+
+        // From the config rules, fixed once ready
+        Mode mode;
+        uint32_t every;                     // MODE_SAMPLE
+        uint32_t perSecond, burst;          // MODE_RATE
+        uint64_t interval, slack;           // MODE_RATE, in QPC ticks
+
+        // Counted in every mode but on and off
+        std::atomic<uint64_t> calls;
+        std::atomic<uint64_t> traced;
+        std::atomic<uint64_t> tat;          // MODE_RATE: when the bucket is full again (QPC)
+        std::atomic<uint64_t> totalTicks;   // MODE_COUNT, TSC
+        std::atomic<uint64_t> maxTicks;
+        std::atomic<uint64_t> histogram[OSF_TRACE_HIST_BUCKETS];
+    };
+
+    // "<dll>::<func>=<mode>"; either name may be * or end in *
+    struct Rule {
+        char dll[32];
+        char func[64];
+        Mode mode;
+        uint32_t param, burst;
+    };
+
+    // Written only by its thread. head counts every record ever written, so
+    // record i lives in records[i % OSF_TRACE_RING_RECORDS] until overwritten
+    struct ThreadRing {
+        DWORD threadId;
+        std::atomic<uint32_t> head;
+        uint32_t tail;                      // Flusher only: records taken
+        bool announced;                     // Flusher only: 'T' block written
+        Record records[OSF_TRACE_RING_RECORDS];
+    };
+
+    static Site g_sites[OSF_TRACE_MAX_SITES];
+    static std::atomic<int> g_siteCount{0};
+    static std::atomic<ThreadRing*> g_rings[OSF_TRACE_MAX_THREADS];
+    static std::atomic<int> g_ringCount{0};
+    static thread_local ThreadRing* t_ring = nullptr;
+    static thread_local bool t_noRing = false;
+
+    enum { STATE_NONE, STATE_STARTING, STATE_RUNNING, STATE_SHUT_DOWN };
+    static std::atomic<int> g_state{STATE_NONE};
     static FILE* g_logFile = nullptr;
     static bool g_logToFile = true;
-    static bool g_logToConsole = false;
-    
+    static HANDLE g_flushEvent = nullptr;
+    static HANDLE g_flushThread = nullptr;
+    static std::atomic<bool> g_stop{false};
+    static std::atomic<int> g_draining{0};
+
+    // Clock: the TSC is turned into time against QueryPerformanceCounter
+    static OsfTrace::StartTime g_start;
+    static uint64_t g_startTsc = 0;
+    static LARGE_INTEGER g_startQpc;
+    static LARGE_INTEGER g_qpcFreq;
+
+    // Flusher state (held by whoever holds g_draining)
+    static OsfTrace::BlockWriter g_writer;
+    static Record g_stage[OSF_TRACE_RING_RECORDS];
+    static int g_sitesWritten = 0;
+
+    // Config rules, read once by Initialize
+    static Rule g_rules[OSF_TRACE_MAX_RULES];
+    static int g_ruleCount = 0;
+    static char g_badRules[4][64];
+    static int g_badRuleCount = 0;
+
+    inline uint64_t NsSinceStart(const LARGE_INTEGER& qpc) {
+        uint64_t ticks = static_cast<uint64_t>(qpc.QuadPart - g_startQpc.QuadPart);
+        uint64_t freq = static_cast<uint64_t>(g_qpcFreq.QuadPart);
+        return ticks / freq * 1000000000ull + ticks % freq * 1000000000ull / freq;
+    }
+
+    // TSC ticks to ns, from the clocks now and at start
+    inline double NsPerTick() {
+        LARGE_INTEGER qpc;
+        QueryPerformanceCounter(&qpc);
+        uint64_t tscSpan = __rdtsc() - g_startTsc;
+        return tscSpan ? static_cast<double>(NsSinceStart(qpc)) / tscSpan : 0.0;
+    }
+
+    inline bool LockDrain(DWORD timeoutMs) {
+        DWORD start = GetTickCount();
+        while (g_draining.exchange(1, std::memory_order_acquire)) {
+            if (GetTickCount() - start >= timeoutMs) return false;
+            Sleep(1);
+        }
+        return true;
+    }
+
+    inline void UnlockDrain() {
+        g_draining.store(0, std::memory_order_release);
+    }
+
+    // Write out one ring's records up to head. Records the thread overwrote
+    // before or while they were copied are counted as dropped
+    inline void DrainRing(int index, ThreadRing* ring, uint32_t head) {
+        const uint32_t size = OSF_TRACE_RING_RECORDS;
+        uint32_t lost = 0;
+        if (head - ring->tail > size) {
+            lost = head - ring->tail - size;
+            ring->tail = head - size;
+        }
+        uint32_t count = head - ring->tail;
+        for (uint32_t i = 0; i < count; i++) {
+            g_stage[i] = ring->records[(ring->tail + i) % size];
+        }
+        // The slot of head2 - size may be mid-write too, hence the + 1
+        uint32_t head2 = ring->head.load(std::memory_order_acquire);
+        uint32_t first = 0;
+        if (head2 - ring->tail >= size) {
+            first = head2 - ring->tail - size + 1;
+            if (first > count) first = count;
+            lost += first;
+        }
+        g_writer.records(index, g_stage + first, count - first, g_startTsc);
+        if (lost) g_writer.dropped(index, lost);
+        ring->tail = head;
+    }
+
+    // Everything recorded so far goes to the file. Caller holds g_draining
+    inline void Drain() {
+        if (!g_logFile) return;
+
+        // Heads first: any site a record up to them uses is ready by then
+        int rings = g_ringCount.load(std::memory_order_acquire);
+        if (rings > OSF_TRACE_MAX_THREADS) rings = OSF_TRACE_MAX_THREADS;
+        uint32_t heads[OSF_TRACE_MAX_THREADS];
+        for (int i = 0; i < rings; i++) {
+            ThreadRing* ring = g_rings[i].load(std::memory_order_acquire);
+            heads[i] = ring ? ring->head.load(std::memory_order_acquire) : 0;
+        }
+
+        int sites = g_siteCount.load(std::memory_order_acquire);
+        if (sites > OSF_TRACE_MAX_SITES) sites = OSF_TRACE_MAX_SITES;
+        for (int i = g_sitesWritten; i < sites; i++) {
+            Site& site = g_sites[i];
+            if (site.written || !site.ready.load(std::memory_order_acquire)) continue;
+            g_writer.site(i, site.dll, site.func, site.fmt);
+            site.written = true;
+        }
+        while (g_sitesWritten < sites && g_sites[g_sitesWritten].written) g_sitesWritten++;
+
+        for (int i = 0; i < rings; i++) {
+            ThreadRing* ring = g_rings[i].load(std::memory_order_acquire);
+            if (!ring) continue;
+            if (!ring->announced) {
+                g_writer.thread(i, ring->threadId);
+                ring->announced = true;
+            }
+            DrainRing(i, ring, heads[i]);
+        }
+
+        // A clock sample each time; the decoder times everything by the last
+        LARGE_INTEGER qpc;
+        QueryPerformanceCounter(&qpc);
+        g_writer.clock(__rdtsc() - g_startTsc, NsSinceStart(qpc));
+        g_writer.flush();
+    }
+
+    static DWORD WINAPI FlushThread(LPVOID) {
+        while (!g_stop.load()) {
+            WaitForSingleObject(g_flushEvent, OSF_TRACE_FLUSH_MS);
+            if (LockDrain(0)) {
+                if (!g_stop.load()) Drain();
+                UnlockDrain();
+            }
+        }
+        return 0;
+    }
+
+    // "*", "name" or "prefix*"
+    inline bool NameMatches(const char* pattern, const char* name) {
+        size_t len = strlen(pattern);
+        if (len && pattern[len - 1] == '*') return strncmp(pattern, name, len - 1) == 0;
+        return strcmp(pattern, name) == 0;
+    }
+
+    // 0 for "*", 1 for a prefix, 2 for an exact name
+    inline int NameSpecificity(const char* pattern) {
+        size_t len = strlen(pattern);
+        return len && pattern[len - 1] == '*' ? (len == 1 ? 0 : 1) : 2;
+    }
+
+    // Copies text[0, len) without surrounding blanks
+    inline void CopyName(char* out, size_t outSize, const char* text, size_t len) {
+        while (len && (*text == ' ' || *text == '\t')) { text++; len--; }
+        while (len && strchr(" \t\r\n", text[len - 1])) len--;
+        if (len >= outSize) len = outSize - 1;
+        memcpy(out, text, len);
+        out[len] = '\0';
+    }
+
+    inline bool ParseMode(const char* mode, Rule& rule) {
+        unsigned param = 0, burst = 0;
+        if (strcmp(mode, "on") == 0) {
+            rule.mode = MODE_ON;
+        } else if (strcmp(mode, "off") == 0) {
+            rule.mode = MODE_OFF;
+        } else if (strcmp(mode, "count") == 0) {
+            rule.mode = MODE_COUNT;
+        } else if (sscanf(mode, "sample:%u", &param) == 1 && param > 0) {
+            rule.mode = MODE_SAMPLE;
+        } else if (sscanf(mode, "rate:%u/%u", &param, &burst) >= 1 && param > 0) {
+            rule.mode = MODE_RATE;
+            rule.burst = burst ? burst : param;
+        } else {
+            return false;
+        }
+        rule.param = param;
+        return true;
+    }
+
+    // One "<pattern>=<mode>" rule, blanks allowed around either. Ones that
+    // do not parse are kept for the counts report
+    inline void AddRule(const char* text, size_t len) {
+        while (len && strchr(" \t\r\n", text[len - 1])) len--;
+        while (len && (*text == ' ' || *text == '\t')) { text++; len--; }
+        if (!len) return;
+
+        Rule rule = {};
+        const char* eq = static_cast<const char*>(memchr(text, '=', len));
+        const char* scope = eq ? static_cast<const char*>(memchr(text, ':', eq - text)) : nullptr;
+        char mode[32] = "";
+        if (eq) CopyName(mode, sizeof(mode), eq + 1, len - (eq + 1 - text));
+        bool ok = eq && g_ruleCount < OSF_TRACE_MAX_RULES && ParseMode(mode, rule);
+        if (ok && scope && scope[1] == ':') {
+            CopyName(rule.dll, sizeof(rule.dll), text, scope - text);
+            CopyName(rule.func, sizeof(rule.func), scope + 2, eq - (scope + 2));
+        } else if (ok) {
+            strcpy(rule.dll, "*");
+            CopyName(rule.func, sizeof(rule.func), text, eq - text);
+        }
+        if (ok && (!rule.dll[0] || !rule.func[0])) ok = false;
+        if (!ok) {
+            if (g_badRuleCount < 4) CopyName(g_badRules[g_badRuleCount], sizeof(g_badRules[0]), text, len);
+            g_badRuleCount++;
+            return;
+        }
+        g_rules[g_ruleCount++] = rule;
+    }
+
+    // Rules split by any of separators; # starts a comment up to the next one
+    inline void AddRules(const char* text, const char* separators) {
+        while (*text) {
+            size_t len = strcspn(text, separators);
+            const char* comment = static_cast<const char*>(memchr(text, '#', len));
+            AddRule(text, comment ? comment - text : len);
+            text += len;
+            if (*text) text++;
+        }
+    }
+
+    // The config file, then OSF_TRACE, so that the environment has the last word
+    inline void LoadRules() {
+        char path[MAX_PATH] = "osf_trace.cfg";
+        DWORD len = GetEnvironmentVariableA("OSF_TRACE_CONFIG", path, sizeof(path));
+        if (len >= sizeof(path)) path[0] = '\0';
+        else if (len == 0) strcpy(path, "osf_trace.cfg");
+        if (FILE* file = path[0] ? fopen(path, "r") : nullptr) {
+            char line[256];
+            while (fgets(line, sizeof(line), file)) AddRules(line, "\n");
+            fclose(file);
+        }
+
+        static char value[4096];
+        len = GetEnvironmentVariableA("OSF_TRACE", value, sizeof(value));
+        if (len > 0 && len < sizeof(value)) AddRules(value, ";\n");
+    }
+
+    // Settle a new site's mode from the most specific matching rule
+    inline void ApplyRules(Site& site) {
+        const Rule* best = nullptr;
+        int bestScore = -1;
+        for (int i = 0; i < g_ruleCount; i++) {
+            const Rule& rule = g_rules[i];
+            if (!NameMatches(rule.dll, site.dll) || !NameMatches(rule.func, site.func)) continue;
+            int score = NameSpecificity(rule.func) * 3 + NameSpecificity(rule.dll);
+            if (score >= bestScore) {
+                best = &rule;
+                bestScore = score;
+            }
+        }
+        site.mode = best ? best->mode : MODE_ON;
+        if (site.mode == MODE_SAMPLE) site.every = best->param;
+        if (site.mode == MODE_RATE) {
+            // Token bucket kept as the time it will be full again: a call may
+            // go when that is no more than burst - 1 intervals ahead
+            site.perSecond = best->param;
+            site.burst = best->burst;
+            site.interval = static_cast<uint64_t>(g_qpcFreq.QuadPart) / site.perSecond;
+            if (!site.interval) site.interval = 1;
+            site.slack = site.interval * (site.burst - 1);
+        }
+    }
+
+    inline bool TakeToken(Site& site) {
+        LARGE_INTEGER qpc;
+        QueryPerformanceCounter(&qpc);
+        uint64_t now = static_cast<uint64_t>(qpc.QuadPart);
+        uint64_t tat = site.tat.load(std::memory_order_relaxed);
+        for (;;) {
+            uint64_t from = tat > now ? tat : now;
+            if (from - now > site.slack) return false;
+            if (site.tat.compare_exchange_weak(tat, from + site.interval, std::memory_order_relaxed)) return true;
+        }
+    }
+
+    // Whether this call is traced, counting it as the site's mode wants
+    inline bool Admit(Site& site) {
+        switch (site.mode) {
+            case MODE_ON:
+                return true;
+            case MODE_OFF:
+                return false;
+            case MODE_SAMPLE:
+                if (site.calls.fetch_add(1, std::memory_order_relaxed) % site.every) return false;
+                break;
+            case MODE_RATE:
+                site.calls.fetch_add(1, std::memory_order_relaxed);
+                if (!TakeToken(site)) return false;
+                break;
+            case MODE_COUNT:
+                site.calls.fetch_add(1, std::memory_order_relaxed);
+                return false;
+        }
+        site.traced.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Bucket b holds [2^b, 2^(b+1)) ticks
+    inline void CountLatency(Site& site, uint64_t ticks) {
+        int bucket = 0;
+        for (int step = 32; step; step >>= 1) {
+            if (ticks >> bucket >> step) bucket += step;
+        }
+        if (bucket >= OSF_TRACE_HIST_BUCKETS) bucket = OSF_TRACE_HIST_BUCKETS - 1;
+        site.histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+        site.totalTicks.fetch_add(ticks, std::memory_order_relaxed);
+        uint64_t max = site.maxTicks.load(std::memory_order_relaxed);
+        while (ticks > max && !site.maxTicks.compare_exchange_weak(max, ticks, std::memory_order_relaxed)) {}
+    }
+
+    // Upper bound of the bucket the p-th percentile call fell in (at most the
+    // slowest call), in ticks
+    inline uint64_t LatencyPercentile(const Site& site, uint64_t calls, double p) {
+        uint64_t want = static_cast<uint64_t>(calls * p / 100.0);
+        uint64_t seen = 0;
+        int b = 0;
+        for (; b < OSF_TRACE_HIST_BUCKETS; b++) {
+            seen += site.histogram[b].load(std::memory_order_relaxed);
+            if (seen > want) break;
+        }
+        uint64_t max = site.maxTicks.load(std::memory_order_relaxed);
+        return b + 1 < 64 && (2ull << b) < max ? 2ull << b : max;
+    }
+
+    // osf_counts_<DLL>.txt: every site not simply on, most called first
+    inline void WriteCounts() {
+        int sites = g_siteCount.load();
+        if (sites > OSF_TRACE_MAX_SITES) sites = OSF_TRACE_MAX_SITES;
+        static int order[OSF_TRACE_MAX_SITES];
+        int count = 0;
+        for (int i = 0; i < sites; i++) {
+            if (g_sites[i].ready.load() && g_sites[i].mode != MODE_ON && g_sites[i].mode != MODE_OFF) {
+                order[count++] = i;
+            }
+        }
+        if (!count && !g_badRuleCount) return;
+        for (int i = 1; i < count; i++) {
+            int site = order[i];
+            uint64_t calls = g_sites[site].calls.load();
+            int j = i;
+            for (; j > 0 && g_sites[order[j - 1]].calls.load() < calls; j--) order[j] = order[j - 1];
+            order[j] = site;
+        }
+
+        char path[MAX_PATH];
+        snprintf(path, sizeof(path), "osf_counts_%s.txt", DLL_NAME);
+        FILE* file = fopen(path, "w");
+        if (!file) return;
+
+        LARGE_INTEGER qpc;
+        QueryPerformanceCounter(&qpc);
+        double nsPerTick = NsPerTick();
+        double seconds = NsSinceStart(qpc) / 1e9;
+        fprintf(file, "=== OpenShadowFlare call counts: %s, %04u-%02u-%02u %02u:%02u:%02u, %.1f s ===\n",
+                DLL_NAME, g_start.year, g_start.month, g_start.day, g_start.hour, g_start.minute, g_start.second,
+                seconds);
+        for (int i = 0; i < g_badRuleCount && i < 4; i++) fprintf(file, "Ignored rule: %s\n", g_badRules[i]);
+        if (g_badRuleCount > 4) fprintf(file, "Ignored %d more rules\n", g_badRuleCount - 4);
+        fprintf(file, "%-12s %12s %10s %10s %10s %10s %10s %10s  %s\n", "mode", "calls", "per sec", "traced",
+                "total ms", "p50 us", "p99 us", "max us", "function");
+        for (int i = 0; i < count; i++) {
+            const Site& site = g_sites[order[i]];
+            uint64_t calls = site.calls.load();
+            char mode[24];
+            switch (site.mode) {
+                case MODE_SAMPLE: snprintf(mode, sizeof(mode), "sample:%u", site.every); break;
+                case MODE_RATE: snprintf(mode, sizeof(mode), "rate:%u/%u", site.perSecond, site.burst); break;
+                default: snprintf(mode, sizeof(mode), "count"); break;
+            }
+            fprintf(file, "%-12s %12llu %10.1f ", mode, static_cast<unsigned long long>(calls),
+                    seconds > 0 ? calls / seconds : 0.0);
+            if (site.mode != MODE_COUNT) {
+                fprintf(file, "%10llu %10s %10s %10s %10s", static_cast<unsigned long long>(site.traced.load()),
+                        "-", "-", "-", "-");
+            } else if (calls) {
+                // Percentiles are bucket bounds, so within a factor of two
+                fprintf(file, "%10s %10.3f %10.3f %10.3f %10.3f", "-", site.totalTicks.load() * nsPerTick / 1e6,
+                        LatencyPercentile(site, calls, 50) * nsPerTick / 1e3,
+                        LatencyPercentile(site, calls, 99) * nsPerTick / 1e3,
+                        site.maxTicks.load() * nsPerTick / 1e3);
+            } else {
+                fprintf(file, "%10s %10s %10s %10s %10s", "-", "-", "-", "-", "-");
+            }
+            fprintf(file, "  %s::%s%s%s\n", site.dll, site.func, site.fmt[0] ? " " : "", site.fmt);
+        }
+        fclose(file);
+    }
+
     inline void Initialize() {
-        if (g_initialized) return;
-        InitializeCriticalSection(&g_traceLock);
-        
-        // Open log file (append mode)
+        int state = STATE_NONE;
+        if (!g_state.compare_exchange_strong(state, STATE_STARTING)) {
+            while (g_state.load() == STATE_STARTING) Sleep(0);
+            return;
+        }
+
+        SYSTEMTIME st;
+        GetLocalTime(&st);
+        g_start = { st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond, st.wMilliseconds };
+        QueryPerformanceFrequency(&g_qpcFreq);
+        QueryPerformanceCounter(&g_startQpc);
+        g_startTsc = __rdtsc();
+        LoadRules();
+
+        // Binary trace, one per DLL and session
         if (g_logToFile) {
-            g_logFile = fopen("osf_trace.log", "a");
+            char path[MAX_PATH];
+            snprintf(path, sizeof(path), "osf_trace_%s.bin", DLL_NAME);
+            g_logFile = fopen(path, "wb");
             if (g_logFile) {
-                fprintf(g_logFile, "\n=== OpenShadowFlare Session Started ===\n");
-                fflush(g_logFile);
+                g_writer.setFile(g_logFile);
+                g_writer.header(g_start, g_startTsc);
+                g_writer.flush();
+                g_flushEvent = CreateEventA(nullptr, FALSE, FALSE, nullptr);
+                g_flushThread = CreateThread(nullptr, 0, FlushThread, nullptr, 0, nullptr);
             }
         }
-        
-        g_initialized = true;
+
+        g_state.store(STATE_RUNNING);
     }
-    
+
     inline void Shutdown() {
-        if (!g_initialized) return;
+        int state = STATE_RUNNING;
+        if (!g_state.compare_exchange_strong(state, STATE_SHUT_DOWN)) return;
+        g_stop.store(true);
+        if (g_flushEvent) SetEvent(g_flushEvent);
+
+        // Called from DllMain, where joining the flusher could deadlock on the
+        // loader lock. Taking the drain lock keeps it off the file; at process
+        // exit it may have been killed holding the lock, so that is taken anyway
+        LockDrain(200);
         if (g_logFile) {
-            fprintf(g_logFile, "=== Session Ended ===\n");
+            Drain();
+            g_writer.end();
+            g_writer.setFile(nullptr);
             fclose(g_logFile);
             g_logFile = nullptr;
         }
-        DeleteCriticalSection(&g_traceLock);
-        g_initialized = false;
+        WriteCounts();
+        // Give a live flusher (FreeLibrary) the chance to leave our code
+        if (g_flushThread) {
+            WaitForSingleObject(g_flushThread, 100);
+            CloseHandle(g_flushThread);
+            g_flushThread = nullptr;
+        }
+        if (g_flushEvent) {
+            CloseHandle(g_flushEvent);
+            g_flushEvent = nullptr;
+        }
+        // g_draining stays held: the file is gone
     }
-    
-    inline void Trace(const char* dllName, const char* funcName, const char* fmt, ...) {
-        if (!g_initialized) Initialize();
-        
-        EnterCriticalSection(&g_traceLock);
-        
-        // Format the message
-        char argBuf[128] = "";
-        if (fmt && fmt[0]) {
-            va_list args;
-            va_start(args, fmt);
-            vsnprintf(argBuf, sizeof(argBuf), fmt, args);
-            va_end(args);
-        }
-        
-        // Get timestamp
-        SYSTEMTIME st;
-        GetLocalTime(&st);
-        
-        // Format trace entry
-        char* entry = g_traceBuffer[g_traceIndex];
-        snprintf(entry, OSF_TRACE_ENTRY_LEN, 
-                 "[%02d:%02d:%02d.%03d] %s::%s(%s)",
-                 st.wHour, st.wMinute, st.wSecond, st.wMilliseconds,
-                 dllName, funcName, argBuf);
-        
-        // Write to log file
-        if (g_logFile) {
-            fprintf(g_logFile, "%s\n", entry);
-            fflush(g_logFile);
-        }
-        
-        // Write to console if enabled
-        if (g_logToConsole) {
-            printf("%s\n", entry);
-        }
-        
-        // Advance ring buffer
-        g_traceIndex = (g_traceIndex + 1) % OSF_TRACE_BUFFER_SIZE;
-        
-        LeaveCriticalSection(&g_traceLock);
+
+    // Rings are never freed: a thread's records may be read after it ends
+    inline ThreadRing* CurrentRing() {
+        if (t_ring || t_noRing) return t_ring;
+        if (g_state.load(std::memory_order_acquire) == STATE_NONE) Initialize();
+        int slot = g_ringCount.fetch_add(1);
+        ThreadRing* ring = slot < OSF_TRACE_MAX_THREADS
+            ? static_cast<ThreadRing*>(VirtualAlloc(nullptr, sizeof(ThreadRing), MEM_COMMIT | MEM_RESERVE,
+                                                    PAGE_READWRITE))
+            : nullptr;
+        if (!ring) {
+            t_noRing = true;
+            return nullptr;
+        }
+        ring->threadId = GetCurrentThreadId();
+        g_rings[slot].store(ring, std::memory_order_release);
+        t_ring = ring;
+        return ring;
+    }
+
+    // Register a call site once (the macros keep the ID in a static)
+    template <typename... Args>
+    inline int InternSite(const char* dll, const char* func, const char* fmt, const Args&...) {
+        if (g_state.load(std::memory_order_acquire) == STATE_NONE) Initialize();
+        int id = g_siteCount.fetch_add(1);
+        if (id >= OSF_TRACE_MAX_SITES) return -1;
+        g_sites[id].dll = dll;
+        g_sites[id].func = func;
+        g_sites[id].fmt = fmt ? fmt : "";
+        ApplyRules(g_sites[id]);
+        g_sites[id].ready.store(true, std::memory_order_release);
+        return id;
+    }
+
+    template <typename... Args>
+    inline void Emit(int site, uint8_t kind, const Args&... args) {
+        if (site < 0) return;
+        ThreadRing* ring = CurrentRing();
+        if (!ring) return;
+        uint32_t head = ring->head.load(std::memory_order_relaxed);
+        Record& r = ring->records[head % OSF_TRACE_RING_RECORDS];
+        r.tsc = __rdtsc();
+        r.site = static_cast<uint16_t>(site);
+        r.kind = kind;
+        OsfTrace::PackArgs(r, args...);
+        ring->head.store(head + 1, std::memory_order_release);
+        // Wake the flusher early when a ring is half full
+        if ((head + 1) % (OSF_TRACE_RING_RECORDS / 2) == 0 && g_flushEvent) SetEvent(g_flushEvent);
+    }
+
+    template <typename... Args>
+    inline void Trace(int site, uint8_t kind, const char* fmt, const Args&... args) {
+        (void)fmt;  // Kept with the site
+        if (site < 0 || !Admit(g_sites[site])) return;
+        Emit(site, kind, args...);
     }
-    
+
     inline void DumpRecentCalls(const char* reason) {
-        if (!g_initialized) return;
-        
+        if (g_state.load() == STATE_NONE) return;
+
+        // Get the trace file up to date as well, if the flusher is not at it
+        if (LockDrain(0)) {
+            if (!g_stop.load()) Drain();
+            UnlockDrain();
+        }
+
         FILE* crashLog = fopen("osf_crash.log", "a");
         if (!crashLog) return;
-        
+
         SYSTEMTIME st;
         GetLocalTime(&st);
-        
+
         fprintf(crashLog, "\n========================================\n");
         fprintf(crashLog, "CRASH/ERROR at %04d-%02d-%02d %02d:%02d:%02d\n",
                 st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
         fprintf(crashLog, "Reason: %s\n", reason);
         fprintf(crashLog, "Recent function calls (oldest first):\n");
         fprintf(crashLog, "----------------------------------------\n");
-        
-        EnterCriticalSection(&g_traceLock);
-        
-        // Dump ring buffer from oldest to newest
-        for (int i = 0; i < OSF_TRACE_BUFFER_SIZE; i++) {
-            int idx = (g_traceIndex + i) % OSF_TRACE_BUFFER_SIZE;
-            if (g_traceBuffer[idx][0]) {
-                fprintf(crashLog, "  %s\n", g_traceBuffer[idx]);
+
+        // Newest records across all threads, merged by TSC. No heap here
+        static uint32_t cursor[OSF_TRACE_MAX_THREADS];
+        static uint32_t oldest[OSF_TRACE_MAX_THREADS];
+        static ThreadRing* rings[OSF_TRACE_MAX_THREADS];
+        static Record picked[OSF_TRACE_BUFFER_SIZE];
+        static DWORD pickedThread[OSF_TRACE_BUFFER_SIZE];
+        int ringCount = g_ringCount.load();
+        if (ringCount > OSF_TRACE_MAX_THREADS) ringCount = OSF_TRACE_MAX_THREADS;
+        for (int i = 0; i < ringCount; i++) {
+            rings[i] = g_rings[i].load(std::memory_order_acquire);
+            cursor[i] = rings[i] ? rings[i]->head.load(std::memory_order_acquire) : 0;
+            oldest[i] = cursor[i] > OSF_TRACE_RING_RECORDS ? cursor[i] - OSF_TRACE_RING_RECORDS + 1 : 0;
+        }
+        int count = 0;
+        while (count < OSF_TRACE_BUFFER_SIZE) {
+            int best = -1;
+            uint64_t bestTsc = 0;
+            for (int i = 0; i < ringCount; i++) {
+                if (!rings[i] || cursor[i] <= oldest[i]) continue;
+                uint64_t tsc = rings[i]->records[(cursor[i] - 1) % OSF_TRACE_RING_RECORDS].tsc;
+                if (best < 0 || tsc > bestTsc) {
+                    best = i;
+                    bestTsc = tsc;
+                }
             }
+            if (best < 0) break;
+            cursor[best]--;
+            picked[count] = rings[best]->records[cursor[best] % OSF_TRACE_RING_RECORDS];
+            pickedThread[count] = rings[best]->threadId;
+            count++;
         }
-        
-        LeaveCriticalSection(&g_traceLock);
-        
+
+        double nsPerTick = NsPerTick();
+        int sites = g_siteCount.load();
+        for (int i = count - 1; i >= 0; i--) {
+            const Record& r = picked[i];
+            char time[32];
+            char entry[OSF_TRACE_ENTRY_LEN];
+            OsfTrace::FormatTime(g_start, static_cast<uint64_t>((r.tsc - g_startTsc) * nsPerTick), time, sizeof(time));
+            if (r.site < sites && r.site < OSF_TRACE_MAX_SITES && g_sites[r.site].ready.load()) {
+                const Site& site = g_sites[r.site];
+                OsfTrace::FormatCall(site.dll, site.func, site.fmt, r, entry, sizeof(entry));
+            } else {
+                snprintf(entry, sizeof(entry), "site %u?", static_cast<unsigned>(r.site));
+            }
+            fprintf(crashLog, "  %s %lu %s\n", time, static_cast<unsigned long>(pickedThread[i]), entry);
+        }
+
         fprintf(crashLog, "========================================\n");
         fclose(crashLog);
     }
-    
+
     // Crash handler
     static LONG WINAPI CrashHandler(EXCEPTION_POINTERS* pExceptionInfo) {
         const char* exceptionName = "UNKNOWN";
@@ -174,63 +741,76 @@ namespace OsfDebug {
             case EXCEPTION_SINGLE_STEP: exceptionName = "SINGLE_STEP"; break;
             case EXCEPTION_STACK_OVERFLOW: exceptionName = "STACK_OVERFLOW"; break;
         }
-        
+
         char reason[256];
         snprintf(reason, sizeof(reason), "Exception %s (0x%08X) at address 0x%p",
                  exceptionName,
                  (unsigned int)pExceptionInfo->ExceptionRecord->ExceptionCode,
                  pExceptionInfo->ExceptionRecord->ExceptionAddress);
-        
+
         DumpRecentCalls(reason);
-        
+
         // Continue with default exception handling
         return EXCEPTION_CONTINUE_SEARCH;
     }
-    
+
     inline void InstallCrashHandler() {
         SetUnhandledExceptionFilter(CrashHandler);
     }
-    
+
     // RAII class for automatic ENTER/EXIT tracing
     class ScopedTrace {
     public:
-        const char* m_dll;
-        const char* m_func;
-        
-        ScopedTrace(const char* dll, const char* func, const char* fmt, ...) 
-            : m_dll(dll), m_func(func) {
-            char argBuf[128] = "";
-            if (fmt && fmt[0]) {
-                va_list args;
-                va_start(args, fmt);
-                vsnprintf(argBuf, sizeof(argBuf), fmt, args);
-                va_end(args);
+        int m_site;         // -1 when the call is neither traced nor timed
+        uint64_t m_start;   // MODE_COUNT: TSC on entry
+
+        // The ENTER decides for the EXIT, so that sampled calls stay paired
+        template <typename... Args>
+        ScopedTrace(int site, const char* fmt, const Args&... args) : m_site(-1), m_start(0) {
+            (void)fmt;
+            if (site < 0) return;
+            Site& s = g_sites[site];
+            if (Admit(s)) {
+                m_site = site;
+                Emit(site, OsfTrace::KIND_ENTER, args...);
+            } else if (s.mode == MODE_COUNT) {
+                m_site = site;
+                m_start = __rdtsc();
             }
-            Trace(dll, func, "ENTER %s", argBuf);
         }
-        
+
         ~ScopedTrace() {
-            Trace(m_dll, m_func, "EXIT");
+            if (m_site < 0) return;
+            if (m_start) CountLatency(g_sites[m_site], __rdtsc() - m_start);
+            else Emit(m_site, OsfTrace::KIND_EXIT);
         }
     };
 }
 
-// Macro for easy tracing - define DLL_NAME before using
-#ifndef DLL_NAME
-#define DLL_NAME "UNKNOWN"
-#endif
+// Each use is a call site with its own static ID; func must be a literal
 
 // Legacy macros (still usable)
-#define OSF_TRACE(func, ...) OsfDebug::Trace(DLL_NAME, func, __VA_ARGS__)
-#define OSF_TRACE_ENTER(func) OsfDebug::Trace(DLL_NAME, func, "ENTER")
-#define OSF_TRACE_EXIT(func) OsfDebug::Trace(DLL_NAME, func, "EXIT")
+#define OSF_TRACE(func, ...) do { \
+    static const int _osfSite_ = OsfDebug::InternSite(DLL_NAME, func, __VA_ARGS__); \
+    OsfDebug::Trace(_osfSite_, OsfTrace::KIND_MESSAGE, __VA_ARGS__); \
+} while(0)
+#define OSF_TRACE_ENTER(func) do { \
+    static const int _osfSite_ = OsfDebug::InternSite(DLL_NAME, func, ""); \
+    OsfDebug::Trace(_osfSite_, OsfTrace::KIND_ENTER, ""); \
+} while(0)
+#define OSF_TRACE_EXIT(func) do { \
+    static const int _osfSite_ = OsfDebug::InternSite(DLL_NAME, func, ""); \
+    OsfDebug::Trace(_osfSite_, OsfTrace::KIND_EXIT, ""); \
+} while(0)
 
 // MANDATORY: Use these in every function - auto-logs ENTER on call, EXIT on return
 #define OSF_FUNC_TRACE(...) \
-    OsfDebug::ScopedTrace _osfTrace_(DLL_NAME, __func__, __VA_ARGS__)
+    static const int _osfSite_ = OsfDebug::InternSite(DLL_NAME, __func__, __VA_ARGS__); \
+    OsfDebug::ScopedTrace _osfTrace_(_osfSite_, __VA_ARGS__)
 
 #define OSF_FUNC_TRACE_NOARGS \
-    OsfDebug::ScopedTrace _osfTrace_(DLL_NAME, __func__, "")
+    static const int _osfSite_ = OsfDebug::InternSite(DLL_NAME, __func__, ""); \
+    OsfDebug::ScopedTrace _osfTrace_(_osfSite_, "")
 
 // Initialize in DllMain
 #define OSF_DEBUG_INIT() do { \
@@ -0,0 +1,157 @@
+/*
+ * bench_atlas.cpp - TextureAtlas packing: occupancy and pack time
+ *
+ * Packs the patterns of the given NJP files (or, without files, a synthetic
+ * set of sprite-sized bitmaps: many small icons, character frames, a few
+ * large portraits) three ways: the old single-texture row packing (computed
+ * only - it is what createFromSpriteSheet did before, capped at 4096), the
+ * skyline packer sorted by height (createFromBitmaps), and the same patterns
+ * streamed in unsorted with addPattern. Reports pages, texture area,
+ * occupancy, pack and upload time, and checks that no two padded rects on a
+ * page overlap. Runs headless on a surfaceless EGL context (llvmpipe is fine).
+ *
+ * Build (Linux):
+ *   g++ -std=c++17 -O2 bench_atlas.cpp njp_loader.cpp h2d.cpp -o bench_atlas -lEGL -lGL
+ *
+ * Usage: bench_atlas [-s pageSize] [-p padding] [njp file] [njp file] ...
+ */
+
+#include "njp_loader.hpp"
+#include "test_util.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+using namespace h2d;
+
+// The packing createFromSpriteSheet used before: one row-packed power-of-two
+// texture, capped at 4096; returns the texture area and the pattern area that fit
+static int64_t OldRowPacking(const std::vector<const Bitmap*>& bitmaps, int64_t& placedPixels) {
+    int totalWidth = 0;
+    for (const Bitmap* b : bitmaps) totalWidth += b->width();
+    int atlasWidth = 1;
+    while (atlasWidth < totalWidth && atlasWidth < 4096) atlasWidth *= 2;
+    std::vector<Rect> rects;
+    int x = 0, y = 0, rowHeight = 0;
+    for (const Bitmap* b : bitmaps) {
+        if (x + b->width() > atlasWidth) {
+            x = 0;
+            y += rowHeight;
+            rowHeight = 0;
+        }
+        rects.push_back(Rect(x, y, b->width(), b->height()));
+        x += b->width();
+        rowHeight = std::max(rowHeight, b->height());
+    }
+    int h = 1;
+    while (h < y + rowHeight && h < 4096) h *= 2;
+    placedPixels = 0;
+    for (const Rect& r : rects) {
+        if (r.y + r.h <= h && r.x + r.w <= atlasWidth) placedPixels += static_cast<int64_t>(r.w) * r.h;
+    }
+    return static_cast<int64_t>(atlasWidth) * h;
+}
+
+// Padded rects on the same page must not overlap
+static int CountOverlaps(const TextureAtlas& atlas, int padding) {
+    int overlaps = 0;
+    for (int i = 0; i < atlas.patternCount(); i++) {
+        Rect a = atlas.getPatternRect(i);
+        if (atlas.getPatternPage(i) < 0) continue;
+        a = Rect(a.x - padding, a.y - padding, a.w + padding * 2, a.h + padding * 2);
+        for (int j = i + 1; j < atlas.patternCount(); j++) {
+            if (atlas.getPatternPage(j) != atlas.getPatternPage(i)) continue;
+            Rect b = atlas.getPatternRect(j);
+            b = Rect(b.x - padding, b.y - padding, b.w + padding * 2, b.h + padding * 2);
+            if (a.intersects(b)) overlaps++;
+        }
+    }
+    return overlaps;
+}
+
+static void MakeSynthetic(std::vector<std::unique_ptr<Bitmap>>& owned) {
+    srand(1);
+    for (int i = 0; i < 3000; i++) {
+        int kind = rand() % 20;
+        int w, h;
+        if (kind < 12) { w = 16 + rand() % 33; h = 16 + rand() % 33; }          // Icons, effects
+        else if (kind < 19) { w = 40 + rand() % 60; h = 60 + rand() % 80; }     // Character frames
+        else { w = 200 + rand() % 200; h = 200 + rand() % 240; }                // Portraits
+        owned.emplace_back(new Bitmap(w, h));
+        owned.back()->clear(Color(static_cast<uint8_t>(i), 128, 64, 255));
+    }
+}
+
+int main(int argc, char* argv[]) {
+    AtlasOptions options;
+    std::vector<const char*> files;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) options.pageSize = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) options.padding = atoi(argv[++i]);
+        else files.push_back(argv[i]);
+    }
+    if (!CreateHeadlessContext()) {
+        fprintf(stderr, "No EGL/OpenGL context (need Mesa with surfaceless EGL)\n");
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<SpriteSheet>> sheets;
+    std::vector<std::unique_ptr<Bitmap>> owned;
+    std::vector<const Bitmap*> bitmaps;
+    for (const char* file : files) {
+        sheets.emplace_back(new SpriteSheet());
+        if (!sheets.back()->loadFromFile(file)) {
+            fprintf(stderr, "Failed to load %s\n", file);
+            return 1;
+        }
+        sheets.back()->setDecodeBudget(0);  // The bitmap pointers must stay valid
+        for (int i = 0; i < sheets.back()->patternCount(); i++) {
+            const Bitmap* b = sheets.back()->getBitmap(i);
+            if (b && b->valid()) bitmaps.push_back(b);
+        }
+    }
+    if (files.empty()) {
+        MakeSynthetic(owned);
+        for (const auto& b : owned) bitmaps.push_back(b.get());
+    }
+    int64_t patternPixels = 0;
+    for (const Bitmap* b : bitmaps) patternPixels += static_cast<int64_t>(b->width()) * b->height();
+    printf("%zu patterns, %.2f Mpixels, page size %d, padding %d%s\n", bitmaps.size(), patternPixels / 1e6,
+           options.pageSize, options.padding, options.extrude ? " (extruded)" : "");
+
+    int64_t placedPixels;
+    int64_t oldPixels = OldRowPacking(bitmaps, placedPixels);
+    printf("%-12s %6s %12s %10s %10s %10s\n", "", "pages", "Mpixels", "occupied", "pack ms", "upload ms");
+    printf("%-12s %6d %12.2f %9.1f%% %10s %10s", "old rows", 1, oldPixels / 1e6,
+           100.0 * placedPixels / oldPixels, "-", "-");
+    if (placedPixels < patternPixels) {
+        printf("  (%.1f%% of the pattern area cut off by the 4096 cap)", 100.0 - 100.0 * placedPixels / patternPixels);
+    }
+    printf("\n");
+
+    int fails = 0;
+    TextureAtlas sorted;
+    sorted.createFromBitmaps(bitmaps, options);
+    const AtlasStats& s = sorted.stats();
+    printf("%-12s %6d %12.2f %9.1f%% %10.2f %10.2f\n", "skyline", s.pages, s.pagePixels / 1e6,
+           s.occupancy() * 100.0f, s.packMs, s.uploadMs);
+    int overlaps = CountOverlaps(sorted, options.padding);
+    if (overlaps || s.patterns + s.failed != static_cast<int>(bitmaps.size())) fails++;
+
+    TextureAtlas streamed;
+    streamed.createFromBitmaps({}, options);
+    for (const Bitmap* b : bitmaps) streamed.addPattern(*b);
+    const AtlasStats& t = streamed.stats();
+    printf("%-12s %6d %12.2f %9.1f%% %10.2f %10.2f\n", "incremental", t.pages, t.pagePixels / 1e6,
+           t.occupancy() * 100.0f, t.packMs, t.uploadMs);
+    overlaps += CountOverlaps(streamed, options.padding);
+    if (overlaps || t.patterns + t.failed != static_cast<int>(bitmaps.size())) fails++;
+
+    printf("overlapping rects: %d, too large: %d\n", overlaps, s.failed);
+    return fails ? 1 : 0;
+}
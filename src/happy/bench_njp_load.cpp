@@ -0,0 +1,164 @@
+/*
+ * bench_njp_load.cpp - SpriteSheet load time and resident memory
+ *
+ * Loads an NJP file (or, without one, a synthetic sheet of sprite-sized 8bpp
+ * patterns written in memory with literal-only RCLIB-L blocks) and reports:
+ * the time to index it and the bytes held afterwards (next to the byte scan
+ * for "RCLIB-L" the index used before it seeked by block size), the time to
+ * fetch the few patterns a first frame needs, the cost of decoding and
+ * converting every pattern (what loading did before decoding became lazy),
+ * and random access under a small decode budget, checking the budget is
+ * never exceeded.
+ *
+ * Build (Linux):
+ *   g++ -std=c++17 -O2 bench_njp_load.cpp njp_loader.cpp h2d.cpp -o bench_njp_load -lGL
+ *
+ * Usage: bench_njp_load [njp file] [budget MB]
+ */
+
+#include "njp_loader.hpp"
+#include "test_util.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+using namespace h2d;
+
+// 8bpp patterns sized like the atlas bench's set: icons, character frames, portraits
+static std::vector<uint8_t> MakeSynthetic(int count) {
+    std::vector<NJPPart> parts;
+    srand(1);
+    for (int i = 0; i < count; i++) {
+        int kind = rand() % 20;
+        int w, h;
+        if (kind < 12) { w = 16 + rand() % 33; h = 16 + rand() % 33; }
+        else if (kind < 19) { w = 40 + rand() % 60; h = 60 + rand() % 80; }
+        else { w = 200 + rand() % 200; h = 200 + rand() % 240; }
+        NJPPart part = { 8, w, h, std::vector<uint8_t>(static_cast<size_t>(NJPStride(w, 8)) * h) };
+        for (size_t p = 0; p < part.pixels.size(); p++) part.pixels[p] = static_cast<uint8_t>((p * 7 + i) & 0xFF);
+        parts.push_back(std::move(part));
+    }
+    // Two palettes
+    std::vector<uint32_t> palettes(512);
+    for (int i = 0; i < 512; i++) palettes[i] = static_cast<uint32_t>(i * 0x010203);
+    return BuildNJP(parts, palettes);
+}
+
+// The index before it seeked by block size: scan every byte after a block for
+// "RCLIB-L" behind something that looks like a pattern header
+static int ScanIndex(const std::vector<uint8_t>& file) {
+    const uint8_t* data = file.data();
+    size_t size = file.size();
+    if (size < 24 || memcmp(data, "NJudgeUniPat", 12) != 0) return 0;
+    uint32_t count = data[16] | (data[17] << 8) | (data[18] << 16) | (data[19] << 24);
+    size_t pos = 20;
+    int found = 0;
+    for (uint32_t i = 0; i < count && pos + 20 <= size; i++) {
+        pos += 20;
+        if (pos + 16 > size || memcmp(data + pos, "RCLIB-L", 7) != 0) break;
+        size_t nextPos = pos + 16;
+        while (nextPos + 20 < size) {
+            if (memcmp(data + nextPos + 20, "RCLIB-L", 7) == 0) {
+                uint32_t bpp = data[nextPos + 4] | (data[nextPos + 5] << 8);
+                uint32_t w = data[nextPos + 8] | (data[nextPos + 9] << 8);
+                uint32_t h = data[nextPos + 12] | (data[nextPos + 13] << 8);
+                if ((bpp == 4 || bpp == 8 || bpp == 24 || bpp == 32) && w > 0 && w < 4096 && h > 0 && h < 4096) break;
+            }
+            nextPos++;
+        }
+        pos = (i == count - 1 || nextPos + 20 >= size) ? size : nextPos;
+        found++;
+    }
+    return found;
+}
+
+int main(int argc, char* argv[]) {
+    size_t budget = (argc > 2 ? atol(argv[2]) : 8) * 1024 * 1024;
+    std::vector<uint8_t> file;
+    if (argc > 1) {
+        std::ifstream in(argv[1], std::ios::binary);
+        if (!in) {
+            fprintf(stderr, "Failed to open %s\n", argv[1]);
+            return 1;
+        }
+        file.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    } else {
+        file = MakeSynthetic(3000);
+    }
+
+    // loadFromMemory copies the file first, so time a plain copy too; best of 5
+    double copyMs = 1e9, indexMs = 1e9;
+    SpriteSheet sheet;
+    for (int run = 0; run < 5; run++) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<uint8_t> copy(file);
+        copyMs = std::min(copyMs, ElapsedMs(start));
+        copy.clear();
+        copy.shrink_to_fit();
+
+        start = std::chrono::steady_clock::now();
+        if (!sheet.loadFromMemory(file.data(), file.size())) {
+            fprintf(stderr, "Failed to parse %s\n", argc > 1 ? argv[1] : "synthetic sheet");
+            return 1;
+        }
+        indexMs = std::min(indexMs, ElapsedMs(start));
+    }
+    int count = sheet.patternCount();
+    printf("%d patterns, %.2f MB file, %d embedded palettes\n", count, file.size() / 1048576.0,
+           sheet.embeddedPaletteCount());
+    printf("load:         %8.2f ms (copying the file alone %.2f ms), %.2f MB resident\n", indexMs, copyMs,
+           sheet.residentBytes() / 1048576.0);
+    double scanMs = 1e9;
+    int scanned = 0;
+    for (int run = 0; run < 5; run++) {
+        auto start = std::chrono::steady_clock::now();
+        scanned = ScanIndex(file);
+        scanMs = std::min(scanMs, ElapsedMs(start));
+    }
+    printf("byte scan:    %8.2f ms (%d patterns found)\n", scanMs, scanned);
+
+
+    // A first frame touches a handful of patterns
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count && i < 32; i++) sheet.getBitmap(i);
+    printf("first 32:     %8.2f ms, %8.2f MB resident\n", ElapsedMs(start), sheet.residentBytes() / 1048576.0);
+
+    // Everything, as the eager loader did
+    sheet.setDecodeBudget(0);
+    start = std::chrono::steady_clock::now();
+    int decoded = 0;
+    for (int i = 0; i < count; i++) {
+        if (sheet.getBitmap(i)) decoded++;
+    }
+    printf("decode all:   %8.2f ms, %8.2f MB resident (%d decoded)\n", ElapsedMs(start),
+           sheet.residentBytes() / 1048576.0, decoded);
+
+    // Random access under a budget
+    sheet.setDecodeBudget(budget);
+    int fails = sheet.decodedBytes() > budget ? 1 : 0;
+    srand(2);
+    start = std::chrono::steady_clock::now();
+    size_t peak = 0;
+    for (int n = 0; n < count * 4; n++) {
+        sheet.getBitmap(rand() % count);
+        if (sheet.decodedBytes() > peak) peak = sheet.decodedBytes();
+    }
+    // A single pattern larger than the budget is kept while it is in use
+    size_t largest = 0;
+    for (int i = 0; i < count; i++) {
+        const Pattern* p = sheet.getPatternInfo(i);
+        size_t bytes = static_cast<size_t>(p->width) * p->height * 5 + 16;
+        if (bytes > largest) largest = bytes;
+    }
+    if (peak > budget + largest) fails++;
+    printf("random x%d:  %8.2f ms, peak %.2f MB decoded, budget %.2f MB\n", count * 4, ElapsedMs(start),
+           peak / 1048576.0, budget / 1048576.0);
+
+    printf(fails ? "FAILED\n" : "ok\n");
+    return fails ? 1 : 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * bench_palette.cpp - Cost of an animated palette: re-expanding vs staying indexed
+ *
+ * Runs a palette animation (a fade to black with a colour cycle and a flash
+ * on top) over a sheet of 8bpp patterns, three ways per frame:
+ *   - re-expand: SpriteSheet::applyPalette and getBitmap for every pattern,
+ *     which is what changing the palette cost before
+ *   - re-expand + upload: the same, then the RGBA atlas pages rebuilt, as the
+ *     h2d::Renderer path needs to show it
+ *   - indexed: PaletteAnimator::update and one Compositor palette row upload
+ *     of the entries that changed; the atlas pages are never touched
+ * and checks that a pattern converted through the animated palette with
+ * SpriteSheet::convertPattern matches the re-expanded one. Runs headless on a
+ * surfaceless EGL context (llvmpipe is fine).
+ *
+ * Build (Linux):
+ *   g++ -std=c++17 -O2 bench_palette.cpp compositor.cpp njp_loader.cpp h2d.cpp -o bench_palette -lEGL -lGL
+ *
+ * Usage: bench_palette [njp file] [frames]
+ */
+
+#include "compositor.hpp"
+#include "test_util.hpp"
+#include <GL/gl.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace h2d;
+
+// 8bpp character frames and effects with one embedded palette
+static std::vector<uint8_t> MakeSynthetic(int count) {
+    std::vector<NJPPart> parts;
+    srand(1);
+    for (int i = 0; i < count; i++) {
+        int w = 24 + rand() % 80, h = 32 + rand() % 100;
+        NJPPart part = { 8, w, h, std::vector<uint8_t>(static_cast<size_t>(NJPStride(w, 8)) * h) };
+        for (size_t p = 0; p < part.pixels.size(); p++) {
+            part.pixels[p] = static_cast<uint8_t>((p * 7 + i) % 97 ? p * 13 + i : 0);
+        }
+        parts.push_back(std::move(part));
+    }
+    std::vector<uint32_t> palette(256);
+    for (int i = 0; i < 256; i++) palette[i] = static_cast<uint32_t>(i * 0x010307);
+    return BuildNJP(parts, palette);
+}
+
+int main(int argc, char* argv[]) {
+    const char* file = argc > 1 ? argv[1] : nullptr;
+    int frames = argc > 2 ? atoi(argv[2]) : 30;
+    if (!CreateHeadlessContext()) {
+        fprintf(stderr, "No EGL/OpenGL 3.3 context (need Mesa with surfaceless EGL)\n");
+        return 1;
+    }
+
+    SpriteSheet sheet;
+    bool loaded;
+    if (file) {
+        loaded = sheet.loadFromFile(file);
+    } else {
+        std::vector<uint8_t> njp = MakeSynthetic(600);
+        loaded = sheet.loadFromMemory(njp.data(), njp.size());
+    }
+    if (!loaded) {
+        fprintf(stderr, "Failed to load %s\n", file ? file : "synthetic sheet");
+        return 1;
+    }
+    sheet.setDecodeBudget(0);
+    Palette base = sheet.hasEmbeddedPalette() ? *sheet.getEmbeddedPalette() : Palette();
+    int indexed = 0;
+    for (int i = 0; i < sheet.patternCount(); i++) {
+        const Pattern* p = sheet.getPatternInfo(i);
+        if (p->bpp == 8 || p->bpp == 4) indexed++;
+    }
+    printf("%d patterns (%d indexed), %d frames of fade + cycle + flash\n", sheet.patternCount(), indexed, frames);
+
+    Compositor compositor;
+    if (!compositor.init(LoadProc)) {
+        fprintf(stderr, "Compositor needs OpenGL 3.3\n");
+        return 1;
+    }
+    int sheetId = compositor.addSheet(sheet);
+    int row = compositor.sheetPalette(sheetId);
+
+    auto start = [&](PaletteAnimator& animator) {
+        animator.setBase(base);
+        animator.fade(Color(0, 0, 0), 1.0f, frames * 16.0f);
+        animator.cycle(32, 64, 20.0f);
+        animator.flash(Color(255, 255, 255), 100.0f);
+    };
+
+    PaletteAnimator animator;
+    double expandMs = 0.0, rebuildMs = 0.0, indexedMs = 0.0;
+    size_t entries = 0;
+
+    start(animator);
+    for (int f = 0; f < frames; f++) {
+        animator.update(16.0f);
+        auto t0 = std::chrono::steady_clock::now();
+        sheet.applyPalette(animator.current());
+        for (int i = 0; i < sheet.patternCount(); i++) sheet.getBitmap(i);
+        expandMs += ElapsedMs(t0);
+    }
+
+    start(animator);
+    for (int f = 0; f < frames; f++) {
+        animator.update(16.0f);
+        auto t0 = std::chrono::steady_clock::now();
+        sheet.applyPalette(animator.current());
+        TextureAtlas atlas;
+        atlas.createFromSpriteSheet(sheet);
+        glFinish();
+        rebuildMs += ElapsedMs(t0);
+    }
+
+    start(animator);
+    size_t uploaded = compositor.stats().uploadedBytes;
+    for (int f = 0; f < frames; f++) {
+        auto t0 = std::chrono::steady_clock::now();
+        if (animator.update(16.0f)) compositor.setPalette(row, animator);
+        glFinish();
+        indexedMs += ElapsedMs(t0);
+        entries += animator.dirtyCount();
+    }
+    uploaded = compositor.stats().uploadedBytes - uploaded;
+
+    printf("%-22s %12s\n", "", "ms/frame");
+    printf("%-22s %12.3f\n", "re-expand", expandMs / frames);
+    printf("%-22s %12.3f\n", "re-expand + upload", rebuildMs / frames);
+    printf("%-22s %12.4f  (%zu entries, %zu bytes uploaded over %d frames)\n", "indexed",
+           indexedMs / frames, entries, uploaded, frames);
+
+    // The animated palette through convertPattern matches the re-expanded form
+    int fails = 0;
+    sheet.applyPalette(animator.current());
+    Bitmap converted;
+    for (int i = 0; i < sheet.patternCount(); i++) {
+        const Bitmap* expanded = sheet.getBitmap(i);
+        if (!expanded || !sheet.convertPattern(i, animator.current(), converted)) continue;
+        size_t bytes = static_cast<size_t>(expanded->width()) * expanded->height() * 4;
+        if (converted.width() != expanded->width() || memcmp(converted.pixels(), expanded->pixels(), bytes) != 0) {
+            fails++;
+        }
+    }
+    printf("convertPattern vs applyPalette: %d mismatches\n", fails);
+    printf(fails ? "FAILED\n" : "ok\n");
+    compositor.shutdown();
+    return fails ? 1 : 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * bench_sprites.cpp - Renderer sprites per frame: batched vs one draw per sprite
+ *
+ * Draws a frame of sprites (random positions and textures out of eight, at
+ * 1x or 2x, a fifth of them rotated, tinted or additive) into a 640x480
+ * offscreen framebuffer three ways: the bind + glBegin/glEnd per sprite that
+ * Renderer::drawTexture used to do (kept here as the reference), the
+ * Renderer's SpriteBatch in submission order, and SpriteBatch sorted by
+ * texture. A fourth run draws every sprite from one texture, as sprites from
+ * one atlas page are. The submission-order frame must match the reference
+ * pixel for pixel (the scales are whole so that no pixel centre lands on a
+ * texel edge, where GL_NEAREST may pick either texel depending on how the
+ * driver splits the quad). Runs headless on a surfaceless EGL context (llvmpipe is fine).
+ *
+ * Build (Linux):
+ *   g++ -std=c++17 -O2 bench_sprites.cpp h2d.cpp -o bench_sprites -lEGL -lGL
+ *
+ * Usage: bench_sprites [sprites per frame] [frames]
+ */
+
+#define GL_GLEXT_PROTOTYPES
+#include "h2d.hpp"
+#include "test_util.hpp"
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace h2d;
+
+static const int kWidth = 640;
+static const int kHeight = 480;
+
+struct Sprite {
+    int tex;
+    Rect dest;
+    float angle;
+    Color tint;
+    BlendMode blend;
+};
+
+// The old path: one bind and one glBegin/glEnd per sprite
+static void DrawImmediate(const Texture& tex, const Sprite& s) {
+    glBindTexture(GL_TEXTURE_2D, tex.glId());
+    glColor4ub(s.tint.r, s.tint.g, s.tint.b, s.tint.a);
+    if (s.blend == BLEND_ADD) glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+    float x0 = static_cast<float>(s.dest.x), y0 = static_cast<float>(s.dest.y);
+    float x[4] = { x0, x0 + s.dest.w, x0 + s.dest.w, x0 };
+    float y[4] = { y0, y0, y0 + s.dest.h, y0 + s.dest.h };
+    if (s.angle != 0.0f) {
+        float rad = s.angle * 3.14159265358979f / 180.0f;
+        float c = std::cos(rad), sn = std::sin(rad);
+        float cx = x0 + s.dest.w * 0.5f, cy = y0 + s.dest.h * 0.5f;
+        for (int i = 0; i < 4; i++) {
+            float dx = x[i] - cx, dy = y[i] - cy;
+            x[i] = cx + dx * c - dy * sn;
+            y[i] = cy + dx * sn + dy * c;
+        }
+    }
+    const float u[4] = { 0, 1, 1, 0 }, v[4] = { 0, 0, 1, 1 };
+    glBegin(GL_QUADS);
+    for (int i = 0; i < 4; i++) {
+        glTexCoord2f(u[i], v[i]);
+        glVertex2f(x[i], y[i]);
+    }
+    glEnd();
+    if (s.blend == BLEND_ADD) glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+static void ReadFrame(std::vector<uint8_t>& pixels) {
+    pixels.resize(kWidth * kHeight * 4);
+    glReadPixels(0, 0, kWidth, kHeight, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+}
+
+int main(int argc, char* argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : 2000;
+    int frames = argc > 2 ? atoi(argv[2]) : 50;
+    if (!CreateHeadlessContext()) {
+        fprintf(stderr, "No EGL/OpenGL context (need Mesa with surfaceless EGL)\n");
+        return 1;
+    }
+    printf("GL: %s, %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+
+    GLuint fbo, color;
+    glGenFramebuffers(1, &fbo);
+    glGenRenderbuffers(1, &color);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, kWidth, kHeight);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+
+    Renderer renderer;
+    renderer.init(kWidth, kHeight);
+
+    // Eight 32x32 textures: a disc with a soft edge in a different colour each
+    Texture textures[8];
+    for (int t = 0; t < 8; t++) {
+        Bitmap b(32, 32);
+        for (int y = 0; y < 32; y++) {
+            for (int x = 0; x < 32; x++) {
+                float d = 16.0f - std::sqrt((x - 15.5f) * (x - 15.5f) + (y - 15.5f) * (y - 15.5f));
+                uint8_t a = d <= 0 ? 0 : d >= 2 ? 255 : static_cast<uint8_t>(d * 127);
+                b.setPixel(x, y, Color(t * 32, 255 - t * 24, x * 8, a));
+            }
+        }
+        textures[t].createFromBitmap(b);
+    }
+
+    srand(1);
+    std::vector<Sprite> scene(count);
+    for (Sprite& s : scene) {
+        s.tex = rand() % 8;
+        int size = (rand() % 2) ? 32 : 64;
+        s.dest = Rect(rand() % (kWidth + size) - size, rand() % (kHeight + size) - size, size, size);
+        s.angle = 0.0f;
+        s.tint = Color(255, 255, 255, 255);
+        s.blend = BLEND_ALPHA;
+        switch (rand() % 15) {
+            case 0: s.angle = static_cast<float>(rand() % 360); break;
+            case 1: s.tint = Color(255, 128, 128, 200); break;
+            case 2: s.blend = BLEND_ADD; break;
+        }
+    }
+
+    std::vector<uint8_t> reference, batched;
+    auto runImmediate = [&]() {
+        renderer.clear(Color(20, 20, 30, 255));
+        for (const Sprite& s : scene) DrawImmediate(textures[s.tex], s);
+        glFinish();
+    };
+    auto runBatched = [&](bool oneTexture) {
+        renderer.beginFrame();
+        renderer.clear(Color(20, 20, 30, 255));
+        for (const Sprite& s : scene) {
+            const Texture& tex = textures[oneTexture ? 0 : s.tex];
+            renderer.drawTextureEx(tex, s.dest, Rect(0, 0, 32, 32), s.angle, s.tint, s.blend);
+        }
+        renderer.endFrame();
+        glFinish();
+    };
+
+    runImmediate();
+    ReadFrame(reference);
+    renderer.setSortMode(SpriteBatch::SORT_NONE);
+    runBatched(false);
+    ReadFrame(batched);
+    int bad = 0;
+    for (size_t i = 0; i < reference.size(); i += 4) {
+        if (memcmp(&reference[i], &batched[i], 4) != 0) bad++;
+    }
+
+    printf("%d sprites/frame, %d frames, %dx%d\n", count, frames, kWidth, kHeight);
+    printf("%-22s %10s %10s %14s\n", "", "ms/frame", "draws", "sprites/s");
+    auto start = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; f++) runImmediate();
+    double ms = ElapsedMs(start) / frames;
+    printf("%-22s %10.3f %10d %14.0f\n", "immediate", ms, count, count / ms * 1000.0);
+
+    const char* names[] = { "batched", "batched, by texture", "batched, one texture" };
+    for (int mode = 0; mode < 3; mode++) {
+        renderer.setSortMode(mode == 1 ? SpriteBatch::SORT_TEXTURE : SpriteBatch::SORT_NONE);
+        start = std::chrono::steady_clock::now();
+        for (int f = 0; f < frames; f++) runBatched(mode == 2);
+        ms = ElapsedMs(start) / frames;
+        printf("%-22s %10.3f %10d %14.0f\n", names[mode], ms, renderer.batchStats().batches, count / ms * 1000.0);
+    }
+
+    printf("batched vs immediate: %d differing pixels\n", bad);
+    printf(bad ? "FAILED\n" : "ok\n");
+    return bad ? 1 : 0;
+}
@@ -0,0 +1,256 @@
+/*
+ * bench_texcache.cpp - Resident texture memory and load time of sprite sheets
+ *
+ * Loads NJP files (or, without files, a synthetic set: one sheet of 8bpp
+ * character frames and one of 24bpp colour-keyed effects and portraits) and
+ * uploads them four ways:
+ *   - TextureAtlas: RGBA pages, what the h2d::Renderer path holds
+ *   - Compositor: 8-bit index pages for indexed parts, RGBA for the rest
+ *   - Compositor + BC1: colour-keyed RGBA parts compressed (if the driver has DXT1)
+ *   - the same again from the disk cache written by the previous run
+ * reporting pages, resident texture bytes and load time for each. The
+ * cached sheets must draw exactly what the freshly built ones do; the BC1
+ * frame is compared against the uncompressed one for colour error and for
+ * pixels whose colour key changed (there must be none). Runs headless on a
+ * surfaceless EGL context (llvmpipe is fine).
+ *
+ * The synthetic set is random frames sized like game sprites, not game
+ * data: its pages and bytes show how the layouts compare, not what a real
+ * scenario keeps resident. Pass the scenario's NJP files for that.
+ *
+ * Build (Linux):
+ *   g++ -std=c++17 -O2 bench_texcache.cpp compositor.cpp njp_loader.cpp h2d.cpp -o bench_texcache -lEGL -lGL
+ *
+ * Usage: bench_texcache [njp file] [njp file] ...
+ */
+
+#define GL_GLEXT_PROTOTYPES
+#include "compositor.hpp"
+#include "test_util.hpp"
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <unistd.h>
+
+using namespace h2d;
+
+static const int kWidth = 1024;
+static const int kHeight = 1024;
+
+// Round sprites on a key background: 8bpp indices, or 24bpp shaded colour with magenta as the key
+static std::vector<uint8_t> MakeSynthetic(int count, int bpp, int seed) {
+    std::vector<NJPPart> parts;
+    srand(seed);
+    for (int i = 0; i < count; i++) {
+        int w, h;
+        if (bpp == 8) { w = 32 + rand() % 64; h = 48 + rand() % 80; }
+        else if (rand() % 8) { w = 24 + rand() % 100; h = 24 + rand() % 100; }
+        else { w = 200 + rand() % 200; h = 200 + rand() % 240; }
+        int stride = NJPStride(w, bpp);
+        NJPPart part = { bpp, w, h, std::vector<uint8_t>(static_cast<size_t>(stride) * h) };
+        float hue = (rand() % 360) * 3.14159265f / 180.0f;
+        for (int y = 0; y < h; y++) {
+            uint8_t* row = part.pixels.data() + static_cast<size_t>(y) * stride;
+            for (int x = 0; x < w; x++) {
+                float dx = (x + 0.5f) / w - 0.5f, dy = (y + 0.5f) / h - 0.5f;
+                bool inside = dx * dx + dy * dy < 0.25f;
+                if (bpp == 8) {
+                    row[x] = inside ? static_cast<uint8_t>(1 + (x / 3 + y / 5 + i) % 255) : 0;
+                } else if (!inside) {
+                    row[x * 3 + 0] = 255; row[x * 3 + 1] = 0; row[x * 3 + 2] = 255;
+                } else {
+                    float shade = 0.55f + 0.45f * std::cos(dx * 5.0f + dy * 3.0f);
+                    row[x * 3 + 0] = static_cast<uint8_t>(shade * (128 + 127 * std::cos(hue)));
+                    row[x * 3 + 1] = static_cast<uint8_t>(shade * (128 + 127 * std::sin(hue + y * 0.02f)));
+                    row[x * 3 + 2] = static_cast<uint8_t>(shade * (128 + 100 * std::sin(hue * 2 + x * 0.03f)) + (x ^ y) % 16);
+                }
+            }
+        }
+        parts.push_back(std::move(part));
+    }
+    std::vector<uint32_t> palette(256);
+    for (int i = 0; i < 256; i++) palette[i] = static_cast<uint32_t>(i * 0x010203);
+    return BuildNJP(parts, palette);
+}
+
+// Every part of every sheet, laid out left to right, top to bottom
+static std::vector<uint8_t> DrawAll(Compositor& compositor, const std::vector<int>& ids,
+                                    const std::vector<std::unique_ptr<SpriteSheet>>& sheets) {
+    glClearColor(1.0f, 0.0f, 1.0f, 1.0f);  // Magenta: the colour key, never drawn
+    glClear(GL_COLOR_BUFFER_BIT);
+    compositor.beginFrame();
+    int x = 0, y = 0, rowHeight = 0;
+    for (size_t s = 0; s < sheets.size(); s++) {
+        for (int i = 0; i < sheets[s]->patternCount(); i++) {
+            int w = compositor.partWidth(ids[s], i), h = compositor.partHeight(ids[s], i);
+            if (x + w > kWidth) {
+                x = 0;
+                y += rowHeight;
+                rowHeight = 0;
+            }
+            if (y >= kHeight) {
+                // Out of room: start over on top, the frame still covers every page
+                y = 0;
+            }
+            SpritePacket p;
+            p.sheet = ids[s];
+            p.part = i;
+            p.x = x;
+            p.y = y;
+            compositor.submit(p);
+            x += w;
+            rowHeight = std::max(rowHeight, h);
+        }
+    }
+    compositor.compose(kWidth, kHeight);
+    std::vector<uint8_t> pixels(kWidth * kHeight * 4);
+    glReadPixels(0, 0, kWidth, kHeight, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    return pixels;
+}
+
+struct Run {
+    const char* name;
+    int pages;
+    size_t bytes;
+    double ms;
+};
+
+int main(int argc, char* argv[]) {
+    if (!CreateHeadlessContext()) {
+        fprintf(stderr, "No EGL/OpenGL 3.3 context (need Mesa with surfaceless EGL)\n");
+        return 1;
+    }
+    GLuint fbo, color;
+    glGenFramebuffers(1, &fbo);
+    glGenRenderbuffers(1, &color);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, kWidth, kHeight);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+
+    std::vector<std::unique_ptr<SpriteSheet>> sheets;
+    for (int i = 1; i < argc; i++) {
+        sheets.emplace_back(new SpriteSheet());
+        if (!sheets.back()->loadFromFile(argv[i])) {
+            fprintf(stderr, "Failed to load %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (sheets.empty()) {
+        for (int bpp : { 8, 24 }) {
+            std::vector<uint8_t> njp = MakeSynthetic(bpp == 8 ? 1500 : 400, bpp, bpp);
+            sheets.emplace_back(new SpriteSheet());
+            sheets.back()->loadFromMemory(njp.data(), njp.size());
+        }
+    }
+    int64_t pixels = 0;
+    int parts = 0;
+    for (const auto& sheet : sheets) {
+        for (int i = 0; i < sheet->patternCount(); i++) {
+            const Pattern* p = sheet->getPatternInfo(i);
+            pixels += static_cast<int64_t>(p->width) * p->height;
+        }
+        parts += sheet->patternCount();
+    }
+    printf("%zu %s sheets, %d parts, %.2f Mpixels\n", sheets.size(), argc > 1 ? "NJP" : "synthetic", parts, pixels / 1e6);
+
+    std::vector<Run> runs;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::unique_ptr<TextureAtlas>> atlases;
+        int pages = 0;
+        int64_t pagePixels = 0;
+        for (const auto& sheet : sheets) {
+            atlases.emplace_back(new TextureAtlas());
+            atlases.back()->createFromSpriteSheet(*sheet);
+            pages += atlases.back()->stats().pages;
+            pagePixels += atlases.back()->stats().pagePixels;
+        }
+        glFinish();
+        runs.push_back({ "TextureAtlas (RGBA)", pages, static_cast<size_t>(pagePixels) * 4, ElapsedMs(start) });
+    }
+
+    char cacheDir[] = "/tmp/bench_texcache_XXXXXX";
+    if (!mkdtemp(cacheDir)) return 1;
+    std::vector<uint8_t> frames[4];
+    bool bc1 = false;
+    const char* names[] = { "Compositor (R8/RGBA)", "cached", "Compositor (R8/BC1)", "cached" };
+    for (int mode = 0; mode < 4; mode++) {
+        Compositor compositor;
+        compositor.init(LoadProc);
+        if (mode >= 2) {
+            bc1 = compositor.setCompression(true);
+            if (!bc1) break;
+        }
+        // The uncached runs write the cache files the cached runs read
+        size_t paletteBytes = compositor.stats().textureBytes;
+        std::vector<int> ids;
+        start = std::chrono::steady_clock::now();
+        for (const auto& sheet : sheets) ids.push_back(compositor.addSheet(*sheet, cacheDir));
+        glFinish();
+        double ms = ElapsedMs(start);
+        const CompositorStats& s = compositor.stats();
+        runs.push_back({ names[mode], s.pages, s.textureBytes - paletteBytes, ms });
+        if ((mode & 1) != (s.cacheHits > 0)) {
+            fprintf(stderr, "%s: expected %s\n", names[mode], mode & 1 ? "cache hits" : "no cache hits");
+            return 1;
+        }
+        frames[mode] = DrawAll(compositor, ids, sheets);
+    }
+    for (const auto& sheet : sheets) {
+        char path[128];
+        snprintf(path, sizeof(path), "%s/%016llx.tcache", cacheDir, static_cast<unsigned long long>(sheet->contentHash()));
+        remove(path);
+    }
+    rmdir(cacheDir);
+
+    printf("%-22s %6s %12s %10s\n", "", "pages", "texture MB", "load ms");
+    for (const Run& r : runs) printf("%-22s %6d %12.2f %10.2f\n", r.name, r.pages, r.bytes / 1048576.0, r.ms);
+
+    int fails = 0;
+    if (frames[0] != frames[1]) {
+        printf("cached R8/RGBA frame differs\n");
+        fails++;
+    }
+    if (bc1) {
+        if (frames[2] != frames[3]) {
+            printf("cached BC1 frame differs\n");
+            fails++;
+        }
+        // Colour error where both frames drew, and pixels drawn in only one
+        double sq = 0.0;
+        int64_t drawn = 0, keyChanged = 0, maxError = 0;
+        for (size_t i = 0; i < frames[0].size(); i += 4) {
+            const uint8_t* a = &frames[0][i];
+            const uint8_t* b = &frames[2][i];
+            bool da = !(a[0] == 255 && a[1] == 0 && a[2] == 255), db = !(b[0] == 255 && b[1] == 0 && b[2] == 255);
+            if (!da && !db) continue;
+            if (da != db) {
+                keyChanged++;
+                continue;
+            }
+            drawn++;
+            for (int c = 0; c < 3; c++) {
+                int d = a[c] - b[c];
+                sq += d * d;
+                maxError = std::max<int64_t>(maxError, std::abs(d));
+            }
+        }
+        double mse = drawn ? sq / (drawn * 3.0) : 0.0;
+        printf("BC1 vs RGBA: PSNR %.1f dB, max error %lld, %lld pixels with the key changed\n",
+               mse > 0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0, static_cast<long long>(maxError),
+               static_cast<long long>(keyChanged));
+        if (keyChanged) fails++;
+    } else {
+        printf("no DXT1 support, BC1 runs skipped\n");
+    }
+    printf(fails ? "FAILED\n" : "ok\n");
+    return fails ? 1 : 0;
+}
@@ -0,0 +1,947 @@
+/*
+ * compositor.cpp - Implementation of the GPU sprite compositor
+ */
+
+#include "compositor.hpp"
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#endif
+#include <GL/gl.h>
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+namespace h2d {
+
+/*==============================================================================
+ * GL 3.3 entry points
+ *
+ * h2d itself sticks to GL 1.2, which every opengl32.dll/libGL exports; the
+ * shader, buffer and instancing calls used here are loaded at init().
+ *============================================================================*/
+
+#define GL_TEXTURE0_             0x84C0
+#define GL_TEXTURE1_             0x84C1
+#define GL_R8_                   0x8229
+#define GL_RED_                  0x1903
+#define GL_ARRAY_BUFFER_         0x8892
+#define GL_STREAM_DRAW_          0x88E0
+#define GL_FRAGMENT_SHADER_      0x8B30
+#define GL_VERTEX_SHADER_        0x8B31
+#define GL_COMPILE_STATUS_       0x8B81
+#define GL_LINK_STATUS_          0x8B82
+#define GL_CLAMP_TO_EDGE_        0x812F
+#define GL_MAJOR_VERSION_        0x821B
+#define GL_MINOR_VERSION_        0x821C
+#define GL_NUM_EXTENSIONS_       0x821D
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT_ 0x83F1
+
+typedef char GLchar_;
+typedef ptrdiff_t GLsizeiptr_;
+typedef ptrdiff_t GLintptr_;
+
+static struct {
+    void (APIENTRY* ActiveTexture)(GLenum);
+    GLuint (APIENTRY* CreateShader)(GLenum);
+    void (APIENTRY* ShaderSource)(GLuint, GLsizei, const GLchar_* const*, const GLint*);
+    void (APIENTRY* CompileShader)(GLuint);
+    void (APIENTRY* GetShaderiv)(GLuint, GLenum, GLint*);
+    void (APIENTRY* GetShaderInfoLog)(GLuint, GLsizei, GLsizei*, GLchar_*);
+    void (APIENTRY* DeleteShader)(GLuint);
+    GLuint (APIENTRY* CreateProgram)();
+    void (APIENTRY* AttachShader)(GLuint, GLuint);
+    void (APIENTRY* LinkProgram)(GLuint);
+    void (APIENTRY* GetProgramiv)(GLuint, GLenum, GLint*);
+    void (APIENTRY* GetProgramInfoLog)(GLuint, GLsizei, GLsizei*, GLchar_*);
+    void (APIENTRY* DeleteProgram)(GLuint);
+    void (APIENTRY* UseProgram)(GLuint);
+    GLint (APIENTRY* GetUniformLocation)(GLuint, const GLchar_*);
+    void (APIENTRY* Uniform1i)(GLint, GLint);
+    void (APIENTRY* Uniform2f)(GLint, GLfloat, GLfloat);
+    void (APIENTRY* GenVertexArrays)(GLsizei, GLuint*);
+    void (APIENTRY* DeleteVertexArrays)(GLsizei, const GLuint*);
+    void (APIENTRY* BindVertexArray)(GLuint);
+    void (APIENTRY* GenBuffers)(GLsizei, GLuint*);
+    void (APIENTRY* DeleteBuffers)(GLsizei, const GLuint*);
+    void (APIENTRY* BindBuffer)(GLenum, GLuint);
+    void (APIENTRY* BufferData)(GLenum, GLsizeiptr_, const void*, GLenum);
+    void (APIENTRY* BufferSubData)(GLenum, GLintptr_, GLsizeiptr_, const void*);
+    void (APIENTRY* EnableVertexAttribArray)(GLuint);
+    void (APIENTRY* VertexAttribPointer)(GLuint, GLint, GLenum, GLboolean, GLsizei, const void*);
+    void (APIENTRY* VertexAttribIPointer)(GLuint, GLint, GLenum, GLsizei, const void*);
+    void (APIENTRY* VertexAttribDivisor)(GLuint, GLuint);
+    void (APIENTRY* DrawArraysInstanced)(GLenum, GLint, GLsizei, GLsizei);
+    void (APIENTRY* CompressedTexImage2D)(GLenum, GLint, GLenum, GLsizei, GLsizei, GLint, GLsizei, const void*);
+    const GLubyte* (APIENTRY* GetStringi)(GLenum, GLuint);
+} gl;
+
+static bool LoadGL(Compositor::GLProcLoader loader) {
+    struct Entry { void** fn; const char* name; };
+    const Entry entries[] = {
+        { (void**)&gl.ActiveTexture, "glActiveTexture" },
+        { (void**)&gl.CreateShader, "glCreateShader" },
+        { (void**)&gl.ShaderSource, "glShaderSource" },
+        { (void**)&gl.CompileShader, "glCompileShader" },
+        { (void**)&gl.GetShaderiv, "glGetShaderiv" },
+        { (void**)&gl.GetShaderInfoLog, "glGetShaderInfoLog" },
+        { (void**)&gl.DeleteShader, "glDeleteShader" },
+        { (void**)&gl.CreateProgram, "glCreateProgram" },
+        { (void**)&gl.AttachShader, "glAttachShader" },
+        { (void**)&gl.LinkProgram, "glLinkProgram" },
+        { (void**)&gl.GetProgramiv, "glGetProgramiv" },
+        { (void**)&gl.GetProgramInfoLog, "glGetProgramInfoLog" },
+        { (void**)&gl.DeleteProgram, "glDeleteProgram" },
+        { (void**)&gl.UseProgram, "glUseProgram" },
+        { (void**)&gl.GetUniformLocation, "glGetUniformLocation" },
+        { (void**)&gl.Uniform1i, "glUniform1i" },
+        { (void**)&gl.Uniform2f, "glUniform2f" },
+        { (void**)&gl.GenVertexArrays, "glGenVertexArrays" },
+        { (void**)&gl.DeleteVertexArrays, "glDeleteVertexArrays" },
+        { (void**)&gl.BindVertexArray, "glBindVertexArray" },
+        { (void**)&gl.GenBuffers, "glGenBuffers" },
+        { (void**)&gl.DeleteBuffers, "glDeleteBuffers" },
+        { (void**)&gl.BindBuffer, "glBindBuffer" },
+        { (void**)&gl.BufferData, "glBufferData" },
+        { (void**)&gl.BufferSubData, "glBufferSubData" },
+        { (void**)&gl.EnableVertexAttribArray, "glEnableVertexAttribArray" },
+        { (void**)&gl.VertexAttribPointer, "glVertexAttribPointer" },
+        { (void**)&gl.VertexAttribIPointer, "glVertexAttribIPointer" },
+        { (void**)&gl.VertexAttribDivisor, "glVertexAttribDivisor" },
+        { (void**)&gl.DrawArraysInstanced, "glDrawArraysInstanced" },
+        { (void**)&gl.CompressedTexImage2D, "glCompressedTexImage2D" },
+        { (void**)&gl.GetStringi, "glGetStringi" },
+    };
+    for (const Entry& e : entries) {
+        *e.fn = loader(e.name);
+        if (!*e.fn) {
+            fprintf(stderr, "Compositor: missing %s\n", e.name);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*==============================================================================
+ * Shaders
+ *
+ * One quad per instance, corners from gl_VertexID (triangle strip). Texels
+ * are fetched, not sampled, so scaled parts stay nearest-neighbour and never
+ * bleed into their atlas neighbours. Indexed pages hold palette indices that
+ * are looked up in the palette texture (one 256-wide row per palette); index
+ * 0 (or alpha 0 on RGBA pages) is the colour key. Tint, invert and grey are
+ * applied in the same order as RKC_UPDIB's VSPACKET_SetupPalette.
+ *============================================================================*/
+
+static const char* kVertexShader = R"(#version 330
+layout(location = 0) in vec4 a_dst;     // x, y, w, h in target pixels
+layout(location = 1) in vec4 a_uv;      // u0, v0, u1, v1 in page texels (swapped when mirrored)
+layout(location = 2) in vec4 a_color;   // tint r, g, b (-1..1), alpha (0..1)
+layout(location = 3) in vec4 a_clip;    // left, top, right, bottom (exclusive)
+layout(location = 4) in uvec2 a_misc;   // palette row, packet flags
+uniform vec2 u_target;
+out vec2 v_pos;
+out vec2 v_uv;
+flat out vec4 v_color;
+flat out vec4 v_clip;
+flat out vec4 v_rect;
+flat out uvec2 v_misc;
+void main() {
+    vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+    vec2 pos = a_dst.xy + corner * a_dst.zw;
+    v_pos = pos;
+    v_uv = mix(a_uv.xy, a_uv.zw, corner);
+    v_color = a_color;
+    v_clip = a_clip;
+    v_rect = vec4(min(a_uv.xy, a_uv.zw), max(a_uv.xy, a_uv.zw) - 1.0);
+    v_misc = a_misc;
+    gl_Position = vec4(pos.x / u_target.x * 2.0 - 1.0, 1.0 - pos.y / u_target.y * 2.0, 0.0, 1.0);
+}
+)";
+
+static const char* kFragmentShader = R"(#version 330
+uniform sampler2D u_page;
+uniform sampler2D u_palettes;
+uniform bool u_indexed;
+in vec2 v_pos;
+in vec2 v_uv;
+flat in vec4 v_color;
+flat in vec4 v_clip;
+flat in vec4 v_rect;
+flat in uvec2 v_misc;
+out vec4 o_color;
+void main() {
+    if (v_pos.x < v_clip.x || v_pos.y < v_clip.y || v_pos.x >= v_clip.z || v_pos.y >= v_clip.w) discard;
+    ivec2 t = ivec2(clamp(floor(v_uv), v_rect.xy, v_rect.zw));
+    bool opaque = (v_misc.y & 0x0001u) != 0u;
+    vec3 c;
+    if (u_indexed) {
+        int index = int(texelFetch(u_page, t, 0).r * 255.0 + 0.5);
+        if (index == 0 && !opaque) discard;
+        c = texelFetch(u_palettes, ivec2(index, int(v_misc.x)), 0).rgb;
+    } else {
+        vec4 texel = texelFetch(u_page, t, 0);
+        if (texel.a == 0.0 && !opaque) discard;
+        c = texel.rgb;
+    }
+    vec3 tint = v_color.rgb;
+    c += mix((vec3(1.0) - c) * tint, c * tint, lessThan(tint, vec3(0.0)));
+    if ((v_misc.y & 0x0010u) != 0u) c = vec3(1.0) - c;
+    if ((v_misc.y & 0x2000u) != 0u) c = vec3(max(c.r, max(c.g, c.b)));
+    o_color = vec4(c, v_color.a);
+}
+)";
+
+static GLuint CompileShader(GLenum type, const char* source) {
+    GLuint shader = gl.CreateShader(type);
+    gl.ShaderSource(shader, 1, &source, nullptr);
+    gl.CompileShader(shader);
+    GLint ok = 0;
+    gl.GetShaderiv(shader, GL_COMPILE_STATUS_, &ok);
+    if (!ok) {
+        char log[1024];
+        gl.GetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        fprintf(stderr, "Compositor: shader compile failed:\n%s\n", log);
+        gl.DeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+/*==============================================================================
+ * Compositor Implementation
+ *============================================================================*/
+
+Compositor::Compositor() = default;
+
+Compositor::~Compositor() {
+    shutdown();
+}
+
+bool Compositor::init(GLProcLoader loader, int pageSize) {
+    shutdown();
+
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION_, &major);
+    glGetIntegerv(GL_MINOR_VERSION_, &minor);
+    if (major < 3 || (major == 3 && minor < 3)) {
+        fprintf(stderr, "Compositor: needs OpenGL 3.3, context is %d.%d\n", major, minor);
+        return false;
+    }
+    if (!LoadGL(loader)) return false;
+
+    GLuint vs = CompileShader(GL_VERTEX_SHADER_, kVertexShader);
+    GLuint fs = CompileShader(GL_FRAGMENT_SHADER_, kFragmentShader);
+    if (!vs || !fs) {
+        if (vs) gl.DeleteShader(vs);
+        if (fs) gl.DeleteShader(fs);
+        return false;
+    }
+    GLuint program = gl.CreateProgram();
+    gl.AttachShader(program, vs);
+    gl.AttachShader(program, fs);
+    gl.LinkProgram(program);
+    gl.DeleteShader(vs);
+    gl.DeleteShader(fs);
+    GLint ok = 0;
+    gl.GetProgramiv(program, GL_LINK_STATUS_, &ok);
+    if (!ok) {
+        char log[1024];
+        gl.GetProgramInfoLog(program, sizeof(log), nullptr, log);
+        fprintf(stderr, "Compositor: shader link failed:\n%s\n", log);
+        gl.DeleteProgram(program);
+        return false;
+    }
+    m_program = program;
+    m_uTarget = gl.GetUniformLocation(program, "u_target");
+    m_uIndexed = gl.GetUniformLocation(program, "u_indexed");
+    m_uPage = gl.GetUniformLocation(program, "u_page");
+    m_uPalettes = gl.GetUniformLocation(program, "u_palettes");
+
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    m_pageSize = std::max(64, std::min(pageSize, static_cast<int>(maxSize)));
+
+    gl.GenVertexArrays(1, &m_vao);
+    gl.GenBuffers(1, &m_vbo);
+    gl.BindVertexArray(m_vao);
+    gl.BindBuffer(GL_ARRAY_BUFFER_, m_vbo);
+    for (GLuint i = 0; i < 5; i++) {
+        gl.EnableVertexAttribArray(i);
+        gl.VertexAttribDivisor(i, 1);
+    }
+    gl.BindVertexArray(0);
+
+    // DXT1 with alpha comes with S3TC (Mesa has it since 19.3, but leaves it
+    // out of GL_COMPRESSED_TEXTURE_FORMATS, so look for the extension)
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS_, &extensionCount);
+    m_bc1Supported = false;
+    for (GLint i = 0; i < extensionCount && !m_bc1Supported; i++) {
+        const char* name = reinterpret_cast<const char*>(gl.GetStringi(GL_EXTENSIONS, i));
+        m_bc1Supported = name && strcmp(name, "GL_EXT_texture_compression_s3tc") == 0;
+    }
+
+    glGenTextures(1, &m_paletteTex);
+    growPalettes(16);
+    return true;
+}
+
+void Compositor::shutdown() {
+    if (!m_program) return;
+    for (Page& page : m_pages) glDeleteTextures(1, &page.texId);
+    glDeleteTextures(1, &m_paletteTex);
+    gl.DeleteBuffers(1, &m_vbo);
+    gl.DeleteVertexArrays(1, &m_vao);
+    gl.DeleteProgram(m_program);
+    m_program = 0;
+    m_vao = 0;
+    m_vbo = 0;
+    m_vboCapacity = 0;
+    m_paletteTex = 0;
+    m_pages.clear();
+    m_sheets.clear();
+    m_palettes.clear();
+    m_paletteRows = 0;
+    m_paletteCapacity = 0;
+    m_queue.clear();
+    m_stats = CompositorStats();
+}
+
+bool Compositor::setCompression(bool enable) {
+    m_compress = enable && m_bc1Supported;
+    return m_compress || !enable;
+}
+
+int Compositor::addSheet(const SpriteSheet& sheet, const char* cacheDir) {
+    if (!m_program) return -1;
+
+    Sheet entry;
+    entry.palette = m_paletteRows;
+    for (int i = 0; i < sheet.embeddedPaletteCount(); i++) addPalette(*sheet.getEmbeddedPalette(i));
+    if (!sheet.hasEmbeddedPalette()) addPalette(Palette());  // Grayscale, as SpriteSheet converts
+
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    SheetImage image;
+    uint64_t hash = cacheDir ? sheet.contentHash() : 0;
+    std::string path = cacheDir ? cachePath(hash, cacheDir) : std::string();
+    if (cacheDir && readCache(path, hash, m_pageSize, m_compress, maxSize, image)) {
+        m_stats.cacheHits++;
+    } else {
+        buildSheet(sheet, m_pageSize, m_compress, image);
+        if (cacheDir && !saveCache(path, hash, m_pageSize, m_compress, image)) {
+            fprintf(stderr, "Compositor: could not write %s\n", path.c_str());
+        }
+    }
+
+    std::vector<int> pageIds(image.pages.size(), -1);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (size_t i = 0; i < image.pages.size(); i++) {
+        const PageImage& img = image.pages[i];
+        if (img.w > maxSize || img.h > maxSize) {
+            fprintf(stderr, "Compositor: page %dx%d does not fit a texture\n", img.w, img.h);
+            continue;
+        }
+        Page page;
+        page.indexed = img.format == PAGE_R8;
+        page.bytes = img.texels.size();
+        glGenTextures(1, &page.texId);
+        glBindTexture(GL_TEXTURE_2D, page.texId);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE_);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE_);
+        if (img.format == PAGE_BC1) {
+            gl.CompressedTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT_, img.w, img.h, 0,
+                                    static_cast<GLsizei>(img.texels.size()), img.texels.data());
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, 0, page.indexed ? GL_R8_ : GL_RGBA, img.w, img.h, 0,
+                         page.indexed ? GL_RED_ : GL_RGBA, GL_UNSIGNED_BYTE, img.texels.data());
+        }
+        m_stats.uploadedBytes += img.texels.size();
+        pageIds[i] = static_cast<int>(m_pages.size());
+        m_pages.push_back(page);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    entry.parts = std::move(image.parts);
+    for (PartSlot& slot : entry.parts) {
+        if (slot.page >= 0) slot.page = pageIds[slot.page];
+    }
+    m_sheets.push_back(std::move(entry));
+    m_stats.pages = static_cast<int>(m_pages.size());
+    updateTextureBytes();
+    return static_cast<int>(m_sheets.size()) - 1;
+}
+
+void Compositor::updateTextureBytes() {
+    size_t bytes = static_cast<size_t>(m_paletteCapacity) * 256 * sizeof(Color);
+    for (const Page& page : m_pages) bytes += page.bytes;
+    m_stats.textureBytes = bytes;
+}
+
+// Reallocate the palette texture for at least rows rows, re-uploading the CPU copy
+void Compositor::growPalettes(int rows) {
+    if (rows <= m_paletteCapacity) return;
+    int capacity = std::max(16, m_paletteCapacity);
+    while (capacity < rows) capacity *= 2;
+    m_palettes.resize(static_cast<size_t>(capacity) * 256);
+    m_paletteCapacity = capacity;
+
+    glBindTexture(GL_TEXTURE_2D, m_paletteTex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, capacity, 0, GL_RGBA, GL_UNSIGNED_BYTE, m_palettes.data());
+    m_stats.uploadedBytes += m_palettes.size() * sizeof(Color);
+    updateTextureBytes();
+}
+
+int Compositor::addPalette(const Palette& palette) {
+    if (!m_program) return -1;
+    growPalettes(m_paletteRows + 1);
+    int row = m_paletteRows++;
+    m_stats.paletteRows = m_paletteRows;
+    setPalette(row, palette);
+    return row;
+}
+
+bool Compositor::setPalette(int row, const Palette& palette) {
+    return setPalette(row, palette, 0, 256);
+}
+
+bool Compositor::setPalette(int row, const Palette& palette, int first, int count) {
+    if (!m_program || row < 0 || row >= m_paletteRows) return false;
+    first = std::max(0, first);
+    count = std::min(count, 256 - first);
+    if (count <= 0) return true;
+    Color* colors = m_palettes.data() + static_cast<size_t>(row) * 256;
+    for (int i = first; i < first + count; i++) {
+        colors[i] = palette.getColor(i);
+        colors[i].a = 255;  // Transparency is the index 0 key, not the palette
+    }
+    glBindTexture(GL_TEXTURE_2D, m_paletteTex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, first, row, count, 1, GL_RGBA, GL_UNSIGNED_BYTE, colors + first);
+    m_stats.uploadedBytes += count * sizeof(Color);
+    return true;
+}
+
+bool Compositor::setPalette(int row, const PaletteAnimator& animator) {
+    return setPalette(row, animator.current(), animator.dirtyFirst(), animator.dirtyCount());
+}
+
+int Compositor::sheetPalette(int sheet) const {
+    if (sheet < 0 || sheet >= static_cast<int>(m_sheets.size())) return -1;
+    return m_sheets[sheet].palette;
+}
+
+int Compositor::partWidth(int sheet, int part) const {
+    if (sheet < 0 || sheet >= static_cast<int>(m_sheets.size())) return 0;
+    const std::vector<PartSlot>& parts = m_sheets[sheet].parts;
+    return part >= 0 && part < static_cast<int>(parts.size()) ? parts[part].w : 0;
+}
+
+int Compositor::partHeight(int sheet, int part) const {
+    if (sheet < 0 || sheet >= static_cast<int>(m_sheets.size())) return 0;
+    const std::vector<PartSlot>& parts = m_sheets[sheet].parts;
+    return part >= 0 && part < static_cast<int>(parts.size()) ? parts[part].h : 0;
+}
+
+void Compositor::beginFrame() {
+    m_queue.clear();
+    m_stats.packets = 0;
+    m_stats.drawn = 0;
+    m_stats.culled = 0;
+    m_stats.batches = 0;
+}
+
+// Translate a packet into its instance now; the target size is only known at
+// compose(), so clipping against it happens there
+void Compositor::submit(const SpritePacket& packet) {
+    m_stats.packets++;
+    if (packet.sheet < 0 || packet.sheet >= static_cast<int>(m_sheets.size())) return;
+    const Sheet& sheet = m_sheets[packet.sheet];
+    if (packet.part < 0 || packet.part >= static_cast<int>(sheet.parts.size())) return;
+    const PartSlot& slot = sheet.parts[packet.part];
+    if (slot.page < 0) return;
+
+    // Same placement as RKC_UPDIB's VSPACKET_PartRect for a part at offset (0, 0)
+    bool mirrorX = (packet.flags & PACKET_MIRRORX) != 0;
+    bool mirrorY = (packet.flags & PACKET_MIRRORY) != 0;
+    int lx = mirrorX ? -slot.w : 0;
+    int ly = mirrorY ? -slot.h : 0;
+    int left = packet.scaleX * lx / 1000 + packet.x;
+    int top = packet.scaleY * ly / 1000 + packet.y;
+    int right = (slot.w + lx) * packet.scaleX / 1000 + packet.x;
+    int bottom = (slot.h + ly) * packet.scaleY / 1000 + packet.y;
+    if (right <= left || bottom <= top || packet.alpha <= 0) {
+        m_stats.culled++;
+        return;
+    }
+
+    Queued q;
+    Instance& inst = q.inst;
+    inst.dst[0] = static_cast<float>(left);
+    inst.dst[1] = static_cast<float>(top);
+    inst.dst[2] = static_cast<float>(right - left);
+    inst.dst[3] = static_cast<float>(bottom - top);
+    float u0 = static_cast<float>(slot.x), u1 = static_cast<float>(slot.x + slot.w);
+    float v0 = static_cast<float>(slot.y), v1 = static_cast<float>(slot.y + slot.h);
+    inst.uv[0] = mirrorX ? u1 : u0;
+    inst.uv[1] = mirrorY ? v1 : v0;
+    inst.uv[2] = mirrorX ? u0 : u1;
+    inst.uv[3] = mirrorY ? v0 : v1;
+    inst.color[0] = std::max(-1000, std::min(packet.r - 1000, 1000)) / 1000.0f;
+    inst.color[1] = std::max(-1000, std::min(packet.g - 1000, 1000)) / 1000.0f;
+    inst.color[2] = std::max(-1000, std::min(packet.b - 1000, 1000)) / 1000.0f;
+    inst.color[3] = std::min(packet.alpha, 1000) / 1000.0f;
+    if (packet.flags & PACKET_CLIP) {
+        inst.clip[0] = static_cast<float>(std::max(left, packet.clip.x));
+        inst.clip[1] = static_cast<float>(std::max(top, packet.clip.y));
+        inst.clip[2] = static_cast<float>(std::min(right, packet.clip.x + packet.clip.w));
+        inst.clip[3] = static_cast<float>(std::min(bottom, packet.clip.y + packet.clip.h));
+        if (inst.clip[2] <= inst.clip[0] || inst.clip[3] <= inst.clip[1]) {
+            m_stats.culled++;
+            return;
+        }
+    } else {
+        inst.clip[0] = static_cast<float>(left);
+        inst.clip[1] = static_cast<float>(top);
+        inst.clip[2] = static_cast<float>(right);
+        inst.clip[3] = static_cast<float>(bottom);
+    }
+    int row = packet.palette < 0 ? sheet.palette : packet.palette;
+    inst.paletteRow = static_cast<uint32_t>(std::min(row, m_paletteRows - 1));
+    inst.flags = packet.flags;
+    q.page = slot.page;
+    q.add = (packet.flags & PACKET_ADD) != 0;
+    m_queue.push_back(q);
+}
+
+/**
+ * Draw the queued packets back to front. Packets outside the target are
+ * dropped; the rest go into one instance buffer upload, and every run of
+ * consecutive packets on the same page with the same blend is one draw call.
+ * Runs are never merged across other packets, so overlap order is exactly
+ * the submission order.
+ */
+void Compositor::compose(int targetWidth, int targetHeight) {
+    if (!m_program || targetWidth <= 0 || targetHeight <= 0) return;
+
+    m_instances.clear();
+    size_t kept = 0;
+    for (size_t i = 0; i < m_queue.size(); i++) {
+        const Instance& inst = m_queue[i].inst;
+        if (inst.clip[2] <= 0 || inst.clip[3] <= 0 ||
+            inst.clip[0] >= targetWidth || inst.clip[1] >= targetHeight) {
+            m_stats.culled++;
+            continue;
+        }
+        m_queue[kept++] = m_queue[i];
+        m_instances.push_back(inst);
+    }
+    m_queue.resize(kept);
+    m_stats.drawn = static_cast<int>(kept);
+    if (m_instances.empty()) return;
+
+    gl.UseProgram(m_program);
+    gl.BindVertexArray(m_vao);
+    gl.BindBuffer(GL_ARRAY_BUFFER_, m_vbo);
+    size_t bytes = m_instances.size() * sizeof(Instance);
+    if (bytes > m_vboCapacity) {
+        m_vboCapacity = std::max(bytes, m_vboCapacity * 2);
+        gl.BufferData(GL_ARRAY_BUFFER_, m_vboCapacity, nullptr, GL_STREAM_DRAW_);
+    }
+    gl.BufferSubData(GL_ARRAY_BUFFER_, 0, bytes, m_instances.data());
+
+    gl.Uniform2f(m_uTarget, static_cast<float>(targetWidth), static_cast<float>(targetHeight));
+    gl.Uniform1i(m_uPage, 0);
+    gl.Uniform1i(m_uPalettes, 1);
+    gl.ActiveTexture(GL_TEXTURE1_);
+    glBindTexture(GL_TEXTURE_2D, m_paletteTex);
+    gl.ActiveTexture(GL_TEXTURE0_);
+
+    glViewport(0, 0, targetWidth, targetHeight);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+
+    int boundPage = -1, boundAdd = -1;
+    size_t first = 0;
+    while (first < m_queue.size()) {
+        size_t last = first + 1;
+        while (last < m_queue.size() && m_queue[last].page == m_queue[first].page &&
+               m_queue[last].add == m_queue[first].add) {
+            last++;
+        }
+        const Page& page = m_pages[m_queue[first].page];
+        if (boundPage != m_queue[first].page) {
+            glBindTexture(GL_TEXTURE_2D, page.texId);
+            gl.Uniform1i(m_uIndexed, page.indexed ? 1 : 0);
+            boundPage = m_queue[first].page;
+        }
+        if (boundAdd != static_cast<int>(m_queue[first].add)) {
+            glBlendFunc(GL_SRC_ALPHA, m_queue[first].add ? GL_ONE : GL_ONE_MINUS_SRC_ALPHA);
+            boundAdd = m_queue[first].add;
+        }
+
+        // GL 3.3 has no base instance, so the attributes are pointed at the run
+        const char* base = reinterpret_cast<const char*>(first * sizeof(Instance));
+        GLsizei stride = sizeof(Instance);
+        gl.VertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride, base + offsetof(Instance, dst));
+        gl.VertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, base + offsetof(Instance, uv));
+        gl.VertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride, base + offsetof(Instance, color));
+        gl.VertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, stride, base + offsetof(Instance, clip));
+        gl.VertexAttribIPointer(4, 2, GL_UNSIGNED_INT, stride, base + offsetof(Instance, paletteRow));
+        gl.DrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(last - first));
+        m_stats.batches++;
+        first = last;
+    }
+
+    gl.BindVertexArray(0);
+    gl.UseProgram(0);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);  // h2d::Renderer's default
+}
+
+/*==============================================================================
+ * Sheet pages and the disk cache
+ *
+ * A sheet's parts are packed tallest first into pages of their own, one kind
+ * of page per PageFormat, and every page is trimmed to what it holds. BC1
+ * parts take whole 4x4 blocks, so no block is shared with a neighbour; the
+ * rest of the block is transparent and the shader never fetches it.
+ *
+ * Cache file, little-endian: "OSFTEXC2", u64 content hash, u32 page size,
+ * u32 compress, u32 part count, u32 page count; per part i32 page, x, y, w,
+ * h; per page u32 format, width, height, byte count, then the texels as
+ * uploaded. A file that does not match (or is cut short) is rebuilt.
+ *============================================================================*/
+
+static const char kCacheMagic[8] = { 'O', 'S', 'F', 'T', 'E', 'X', 'C', '2' };
+
+static size_t PageBytes(uint32_t format, size_t w, size_t h) {
+    switch (format) {
+        case 0: return w * h;                   // PAGE_R8
+        case 1: return w * h * 4;               // PAGE_RGBA
+        default: return (w / 4) * (h / 4) * 8;  // PAGE_BC1
+    }
+}
+
+// Alpha only 0 or 255, so BC1's 1-bit alpha keeps it exactly
+static bool KeyedAlpha(const Bitmap& bitmap) {
+    const uint8_t* p = bitmap.pixels();
+    size_t count = static_cast<size_t>(bitmap.width()) * bitmap.height();
+    for (size_t i = 0; i < count; i++) {
+        if (p[i * 4 + 3] != 0 && p[i * 4 + 3] != 255) return false;
+    }
+    return true;
+}
+
+static uint16_t Pack565(const uint8_t* p) {
+    return static_cast<uint16_t>(((p[0] * 31 + 127) / 255) << 11 | ((p[1] * 63 + 127) / 255) << 5 |
+                                 ((p[2] * 31 + 127) / 255));
+}
+
+static void Expand565(uint16_t c, int* rgb) {
+    int r = c >> 11, g = (c >> 5) & 0x3F, b = c & 0x1F;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+// One 4x4 RGBA block (rows stride bytes apart) to 8 bytes of BC1. The
+// endpoints are the two pixels furthest apart along the block's principal
+// axis; blocks with transparent pixels use the 3-colour mode, whose index 3
+// is transparent black.
+static void EncodeBC1Block(const uint8_t* rgba, size_t stride, uint8_t* out) {
+    const uint8_t* px[16];
+    int opaque = 0;
+    bool transparent = false;
+    float mean[3] = { 0, 0, 0 };
+    for (int i = 0; i < 16; i++) {
+        px[i] = rgba + (i / 4) * stride + (i % 4) * 4;
+        if (px[i][3] < 128) {
+            transparent = true;
+            continue;
+        }
+        for (int c = 0; c < 3; c++) mean[c] += px[i][c];
+        opaque++;
+    }
+    if (opaque == 0) {
+        // c0 == c1 selects the 3-colour mode; every index 3
+        memset(out, 0, 4);
+        memset(out + 4, 0xFF, 4);
+        return;
+    }
+    for (int c = 0; c < 3; c++) mean[c] /= opaque;
+
+    // Covariance (rr, rg, rb, gg, gb, bb), then a few power iterations
+    float cov[6] = { 0, 0, 0, 0, 0, 0 };
+    for (int i = 0; i < 16; i++) {
+        if (px[i][3] < 128) continue;
+        float r = px[i][0] - mean[0], g = px[i][1] - mean[1], b = px[i][2] - mean[2];
+        cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+        cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+    }
+    float axis[3] = { 1, 1, 1 };
+    for (int iter = 0; iter < 4; iter++) {
+        float v[3] = { cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                       cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                       cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2] };
+        float len = std::max(std::fabs(v[0]), std::max(std::fabs(v[1]), std::fabs(v[2])));
+        if (len < 1e-6f) break;  // Flat block, any axis will do
+        for (int c = 0; c < 3; c++) axis[c] = v[c] / len;
+    }
+    const uint8_t* lo = nullptr;
+    const uint8_t* hi = nullptr;
+    float tmin = 0, tmax = 0;
+    for (int i = 0; i < 16; i++) {
+        if (px[i][3] < 128) continue;
+        float t = px[i][0] * axis[0] + px[i][1] * axis[1] + px[i][2] * axis[2];
+        if (!lo || t < tmin) { lo = px[i]; tmin = t; }
+        if (!hi || t > tmax) { hi = px[i]; tmax = t; }
+    }
+
+    uint16_t c0 = Pack565(hi), c1 = Pack565(lo);
+    if (transparent ? c0 > c1 : c0 < c1) std::swap(c0, c1);
+    int palette[4][3];
+    Expand565(c0, palette[0]);
+    Expand565(c1, palette[1]);
+    int colours = c0 > c1 ? 4 : 3;
+    for (int c = 0; c < 3; c++) {
+        if (colours == 4) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        } else {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+        }
+    }
+
+    uint32_t indices = 0;
+    for (int i = 0; i < 16; i++) {
+        int best = 3;
+        if (px[i][3] >= 128) {
+            int bestDist = 1 << 30;
+            for (int k = 0; k < colours; k++) {
+                int dr = px[i][0] - palette[k][0], dg = px[i][1] - palette[k][1], db = px[i][2] - palette[k][2];
+                int dist = dr * dr + dg * dg + db * db;
+                if (dist < bestDist) {
+                    bestDist = dist;
+                    best = k;
+                }
+            }
+        }
+        indices |= static_cast<uint32_t>(best) << (i * 2);
+    }
+    out[0] = static_cast<uint8_t>(c0);
+    out[1] = static_cast<uint8_t>(c0 >> 8);
+    out[2] = static_cast<uint8_t>(c1);
+    out[3] = static_cast<uint8_t>(c1 >> 8);
+    for (int i = 0; i < 4; i++) out[4 + i] = static_cast<uint8_t>(indices >> (i * 8));
+}
+
+void Compositor::buildSheet(const SpriteSheet& sheet, int pageSize, bool compress, SheetImage& out) {
+    out = SheetImage();
+    out.parts.resize(sheet.patternCount());
+
+    // Tallest first packs tightest
+    std::vector<int> order;
+    for (int i = 0; i < sheet.patternCount(); i++) {
+        const Pattern* info = sheet.getPatternInfo(i);
+        if (info && info->width > 0 && info->height > 0) order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&sheet](int a, int b) {
+        return sheet.getPatternInfo(a)->height > sheet.getPatternInfo(b)->height;
+    });
+
+    std::vector<SkylinePacker> packers;     // One per page
+    for (int i : order) {
+        const Pattern* p = sheet.getPattern(i);
+        if (!p) continue;
+        // 1bpp parts are white on transparent in the CPU path whatever the
+        // palette says (SpriteSheet::convert), so they go in as RGBA
+        bool indexed = (p->bpp == 4 || p->bpp == 8) && !p->indexedData.empty();
+        int stride = ((p->width * p->bpp + 7) / 8 + 3) & ~3;
+        if (indexed && p->indexedData.size() < static_cast<size_t>(stride) * p->height) continue;
+        const Bitmap* bitmap = indexed ? nullptr : sheet.getBitmap(i);
+        if (!indexed && !bitmap) continue;
+        uint32_t format = indexed ? PAGE_R8 : (compress && KeyedAlpha(*bitmap)) ? PAGE_BC1 : PAGE_RGBA;
+
+        int w = p->width, h = p->height;
+        if (format == PAGE_BC1) {
+            w = (w + 3) & ~3;
+            h = (h + 3) & ~3;
+        }
+        Rect rect;
+        int page = -1;
+        for (size_t j = 0; j < out.pages.size() && page < 0; j++) {
+            if (out.pages[j].format == format && packers[j].insert(w, h, rect)) page = static_cast<int>(j);
+        }
+        if (page < 0) {
+            // Oversized parts get a page of their own size
+            PageImage fresh;
+            fresh.format = format;
+            fresh.w = std::max(pageSize, w);
+            fresh.h = std::max(pageSize, h);
+            fresh.texels.resize(static_cast<size_t>(fresh.w) * fresh.h * (format == PAGE_R8 ? 1 : 4));
+            packers.emplace_back(fresh.w, fresh.h);
+            packers.back().insert(w, h, rect);
+            out.pages.push_back(std::move(fresh));
+            page = static_cast<int>(out.pages.size()) - 1;
+        }
+
+        PartSlot& slot = out.parts[i];
+        slot.page = page;
+        slot.x = rect.x;
+        slot.y = rect.y;
+        slot.w = p->width;
+        slot.h = p->height;
+        PageImage& img = out.pages[page];
+        if (indexed) {
+            // One byte per index, top-down (NJP rows are bottom-up, 4-byte aligned)
+            for (int y = 0; y < p->height; y++) {
+                const uint8_t* src = p->indexedData.data() + (p->height - 1 - y) * stride;
+                uint8_t* dst = img.texels.data() + static_cast<size_t>(rect.y + y) * img.w + rect.x;
+                for (int x = 0; x < p->width; x++) {
+                    switch (p->bpp) {
+                        case 8: dst[x] = src[x]; break;
+                        default: dst[x] = (x & 1) ? (src[x / 2] & 0x0F) : (src[x / 2] >> 4); break;
+                    }
+                }
+            }
+        } else {
+            for (int y = 0; y < p->height; y++) {
+                memcpy(img.texels.data() + (static_cast<size_t>(rect.y + y) * img.w + rect.x) * 4,
+                       bitmap->pixels() + static_cast<size_t>(y) * p->width * 4, static_cast<size_t>(p->width) * 4);
+            }
+        }
+    }
+
+    // Trim every page to what it holds; BC1 pages become blocks
+    for (size_t j = 0; j < out.pages.size(); j++) {
+        PageImage& img = out.pages[j];
+        img.h = packers[j].shrinkToFit(false);
+        if (img.format == PAGE_BC1) img.h = (img.h + 3) & ~3;
+        img.texels.resize(static_cast<size_t>(img.w) * img.h * (img.format == PAGE_R8 ? 1 : 4));
+        if (img.format != PAGE_BC1) continue;
+        std::vector<uint8_t> blocks(PageBytes(PAGE_BC1, img.w, img.h));
+        uint8_t* dst = blocks.data();
+        for (int by = 0; by < img.h; by += 4) {
+            for (int bx = 0; bx < img.w; bx += 4, dst += 8) {
+                EncodeBC1Block(img.texels.data() + (static_cast<size_t>(by) * img.w + bx) * 4,
+                               static_cast<size_t>(img.w) * 4, dst);
+            }
+        }
+        img.texels.swap(blocks);
+    }
+}
+
+std::string Compositor::cachePath(uint64_t hash, const char* cacheDir) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.tcache", static_cast<unsigned long long>(hash));
+    std::string path = cacheDir;
+    if (!path.empty() && path.back() != '/' && path.back() != '\\') path += '/';
+    return path + name;
+}
+
+// Pages are checked against the texture limit and the bytes left in the file
+// before anything is allocated, so a damaged file is rebuilt, not trusted
+bool Compositor::readCache(const std::string& path, uint64_t hash, int pageSize, bool compress, int maxPageSize,
+                           SheetImage& out) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    long fileSize = fseek(f, 0, SEEK_END) == 0 ? ftell(f) : -1;
+    if (fileSize < 0 || fseek(f, 0, SEEK_SET) != 0) {
+        fclose(f);
+        return false;
+    }
+    auto left = [&]() { return static_cast<uint64_t>(fileSize - ftell(f)); };
+    out = SheetImage();
+    char magic[8];
+    uint64_t fileHash = 0;
+    uint32_t header[4];     // Page size, compress, parts, pages
+    bool ok = fread(magic, 8, 1, f) == 1 && memcmp(magic, kCacheMagic, 8) == 0 &&
+              fread(&fileHash, 8, 1, f) == 1 && fileHash == hash && fread(header, 4, 4, f) == 4 &&
+              header[0] == static_cast<uint32_t>(pageSize) && header[1] == (compress ? 1u : 0u) &&
+              static_cast<uint64_t>(header[2]) * 20 <= left() && static_cast<uint64_t>(header[3]) * 16 <= left();
+    if (ok) out.parts.resize(header[2]);
+    for (size_t i = 0; ok && i < out.parts.size(); i++) {
+        int32_t v[5];
+        ok = fread(v, 4, 5, f) == 5;
+        out.parts[i].page = v[0];
+        out.parts[i].x = v[1];
+        out.parts[i].y = v[2];
+        out.parts[i].w = v[3];
+        out.parts[i].h = v[4];
+    }
+    for (uint32_t i = 0; ok && i < header[3]; i++) {
+        uint32_t page[4];   // Format, width, height, bytes
+        ok = fread(page, 4, 4, f) == 4 && page[0] <= PAGE_BC1 && page[1] > 0 && page[2] > 0 &&
+             page[1] <= static_cast<uint32_t>(maxPageSize) && page[2] <= static_cast<uint32_t>(maxPageSize) &&
+             page[3] == PageBytes(page[0], page[1], page[2]) && page[3] <= left();
+        if (!ok) break;
+        PageImage img;
+        img.format = page[0];
+        img.w = static_cast<int>(page[1]);
+        img.h = static_cast<int>(page[2]);
+        img.texels.resize(page[3]);
+        ok = img.texels.empty() || fread(img.texels.data(), 1, img.texels.size(), f) == img.texels.size();
+        out.pages.push_back(std::move(img));
+    }
+    fclose(f);
+
+    // Every part must lie on its page
+    for (size_t i = 0; ok && i < out.parts.size(); i++) {
+        const PartSlot& slot = out.parts[i];
+        if (slot.page < 0) continue;
+        ok = slot.page < static_cast<int>(out.pages.size()) && slot.x >= 0 && slot.y >= 0 && slot.w > 0 &&
+             slot.h > 0 && slot.x + slot.w <= out.pages[slot.page].w && slot.y + slot.h <= out.pages[slot.page].h;
+    }
+    if (!ok) out = SheetImage();
+    return ok;
+}
+
+// Written to <path>.tmp and renamed over path, as UPDIB does its arena cache
+bool Compositor::saveCache(const std::string& path, uint64_t hash, int pageSize, bool compress,
+                           const SheetImage& image) {
+    std::string temp = path + ".tmp";
+    FILE* f = fopen(temp.c_str(), "wb");
+    if (!f) return false;
+    uint32_t header[4] = { static_cast<uint32_t>(pageSize), compress ? 1u : 0u,
+                           static_cast<uint32_t>(image.parts.size()), static_cast<uint32_t>(image.pages.size()) };
+    bool ok = fwrite(kCacheMagic, 8, 1, f) == 1 && fwrite(&hash, 8, 1, f) == 1 && fwrite(header, 4, 4, f) == 4;
+    for (size_t i = 0; ok && i < image.parts.size(); i++) {
+        const PartSlot& slot = image.parts[i];
+        int32_t v[5] = { slot.page, slot.x, slot.y, slot.w, slot.h };
+        ok = fwrite(v, 4, 5, f) == 5;
+    }
+    for (size_t i = 0; ok && i < image.pages.size(); i++) {
+        const PageImage& img = image.pages[i];
+        uint32_t page[4] = { img.format, static_cast<uint32_t>(img.w), static_cast<uint32_t>(img.h),
+                             static_cast<uint32_t>(img.texels.size()) };
+        ok = fwrite(page, 4, 4, f) == 4 &&
+             (img.texels.empty() || fwrite(img.texels.data(), 1, img.texels.size(), f) == img.texels.size());
+    }
+    if (fclose(f) != 0) ok = false;
+#ifdef _WIN32
+    if (ok) ok = MoveFileExA(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    if (ok) ok = rename(temp.c_str(), path.c_str()) == 0;
+#endif
+    if (!ok) remove(temp.c_str());
+    return ok;
+}
+
+bool Compositor::writeCache(const SpriteSheet& sheet, const char* cacheDir, int pageSize, bool compress) {
+    SheetImage image;
+    buildSheet(sheet, pageSize, compress, image);
+    uint64_t hash = sheet.contentHash();
+    return saveCache(cachePath(hash, cacheDir), hash, pageSize, compress, image);
+}
+
+} // namespace h2d
@@ -0,0 +1,220 @@
+/*
+ * compositor.hpp - GPU sprite composition for UPD/NJP parts
+ * Part of the Happy Library (hwl, h2d, haudio)
+ *
+ * Optional GPU replacement for the RKC_UPDIB -> RKC_DIB -> present path.
+ * Instead of blitting every part into a 24bpp back buffer on the CPU, the
+ * parts of a SpriteSheet are packed once into atlas pages of their own (8-bit
+ * palette indices for 4bpp and 8bpp parts, RGBA otherwise, or BC1 for
+ * colour-keyed parts with setCompression) and each frame's packets become
+ * instanced quads. Colour is resolved in the fragment shader from a palette
+ * texture with one row per palette, so a palette change is a 1 KB upload
+ * (less for a colour cycle; see PaletteAnimator). Packets are composed in
+ * submission order, one draw call per run of packets that share an atlas
+ * page and blend state.
+ *
+ * Packed pages can be cached on disk, keyed by the NJP's content hash, so a
+ * sheet seen before is uploaded without decoding or packing anything. Cache
+ * files are written beside the target and renamed over it, so a crash or a
+ * concurrent reader never sees half a file, and a file whose sizes do not add
+ * up is rebuilt rather than trusted.
+ *
+ * Needs OpenGL 3.3 (llvmpipe is enough, so it also runs headless). init()
+ * returns false on older contexts; keep using the CPU path then.
+ *
+ * Concepts:
+ *   - SpritePacket: one part to draw, the fields of RKC_UPDIB's VSPACKET
+ *   - Compositor: atlas pages, palette rows and the per-frame packet queue
+ */
+
+#ifndef COMPOSITOR_HPP
+#define COMPOSITOR_HPP
+
+#include "h2d.hpp"
+#include "njp_loader.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace h2d {
+
+/*==============================================================================
+ * SpritePacket - one part drawn at a position (like RKC_UPDIB's VSPACKET)
+ *============================================================================*/
+
+// Packet flags, same bits as VSPACKET_FLAG_* in RKC_UPDIB
+enum : uint32_t {
+    PACKET_OPAQUE  = 0x0001,      // No colour key (index 0 is drawn too)
+    PACKET_ADD     = 0x0002,      // Additive blend
+    PACKET_INVERT  = 0x0010,      // Invert the palette
+    PACKET_CLIP    = 0x0020,      // Clip to the packet's own clip rect
+    PACKET_GREY    = 0x2000,      // Grey the palette (max of r, g, b)
+    PACKET_MIRRORX = 0x40000000,
+    PACKET_MIRRORY = 0x80000000
+};
+
+struct SpritePacket {
+    int sheet = 0;          // Handle from Compositor::addSheet
+    int part = 0;           // Pattern index within the sheet
+    int palette = -1;       // Palette row (addPalette, sheetPalette + n), -1 = sheet default
+    uint32_t flags = 0;     // PACKET_*
+    int x = 0, y = 0;       // Target position (mirrored parts extend left/up from it)
+    int scaleX = 1000;      // 1000 = 100%
+    int scaleY = 1000;
+    int alpha = 1000;       // 0..1000
+    int r = 1000;           // Tint per channel: < 1000 towards black, > 1000 towards white
+    int g = 1000;
+    int b = 1000;
+    Rect clip;              // With PACKET_CLIP
+};
+
+/*==============================================================================
+ * Compositor - atlas pages + instanced packet rendering
+ *============================================================================*/
+
+struct CompositorStats {
+    int packets = 0;            // Packets submitted in the last frame
+    int drawn = 0;              // Instances sent to the GPU
+    int culled = 0;             // Packets outside the target or their clip rect
+    int batches = 0;            // Draw calls
+    int pages = 0;              // Atlas pages
+    int paletteRows = 0;        // Palette rows in use
+    size_t uploadedBytes = 0;   // Atlas and palette texels uploaded so far
+    size_t textureBytes = 0;    // Atlas pages and palette texture held on the GPU
+    int cacheHits = 0;          // Sheets whose pages came from the disk cache
+};
+
+class Compositor {
+public:
+    // GL entry point lookup, e.g. hwl::getGLProc or eglGetProcAddress
+    typedef void* (*GLProcLoader)(const char* name);
+
+    Compositor();
+    ~Compositor();
+
+    // Non-copyable
+    Compositor(const Compositor&) = delete;
+    Compositor& operator=(const Compositor&) = delete;
+
+    // Load GL 3.3 entry points, build the shader; needs a current context.
+    // pageSize is the atlas page edge (clamped to GL_MAX_TEXTURE_SIZE).
+    bool init(GLProcLoader loader, int pageSize = 2048);
+    void shutdown();
+    bool valid() const { return m_program != 0; }
+
+    // Upload every part of a sheet (and its embedded palettes) once.
+    // Returns the sheet handle for SpritePacket::sheet, -1 on failure.
+    // With a cache directory the packed pages are read from
+    // <cacheDir>/<contentHash>.tcache if it matches, else built and saved there.
+    int addSheet(const SpriteSheet& sheet, const char* cacheDir = nullptr);
+
+    // Offline step: pack a sheet and save its cache file (no GL context needed).
+    // pageSize and compress must match the Compositor that will read it.
+    static bool writeCache(const SpriteSheet& sheet, const char* cacheDir, int pageSize = 2048,
+                           bool compress = false);
+
+    // Store colour-keyed RGBA parts (alpha only 0 or 255) as BC1/DXT1: 1/8 of
+    // the memory, lossy colour, exact key. Takes effect for sheets added
+    // afterwards; returns false if the driver has no DXT1 support.
+    bool setCompression(bool enable);
+
+    // Palette rows: add one, or replace one in place (a single row upload).
+    // The ranged form uploads entries first..first+count-1 only; the
+    // PaletteAnimator form uploads what its last update() changed.
+    int addPalette(const Palette& palette);
+    bool setPalette(int row, const Palette& palette);
+    bool setPalette(int row, const Palette& palette, int first, int count);
+    bool setPalette(int row, const PaletteAnimator& animator);
+
+    // Default palette row of a sheet (its first embedded palette)
+    int sheetPalette(int sheet) const;
+
+    // Size of a part as uploaded, (0, 0) if unknown
+    int partWidth(int sheet, int part) const;
+    int partHeight(int sheet, int part) const;
+
+    // Per frame: queue packets, then draw them into the bound framebuffer,
+    // whose top-left is (0, 0) and size targetWidth x targetHeight
+    void beginFrame();
+    void submit(const SpritePacket& packet);
+    void compose(int targetWidth, int targetHeight);
+
+    const CompositorStats& stats() const { return m_stats; }
+
+private:
+    enum PageFormat : uint32_t {
+        PAGE_R8,                        // Palette indices
+        PAGE_RGBA,
+        PAGE_BC1                        // DXT1 with 1-bit alpha
+    };
+    struct Page {
+        unsigned int texId = 0;
+        bool indexed = false;           // R8 palette indices, else RGBA8 or BC1
+        size_t bytes = 0;               // GPU memory
+    };
+    struct PartSlot {
+        int page = -1;                  // -1 = empty part
+        int x = 0, y = 0, w = 0, h = 0;
+    };
+    struct PageImage {                  // A packed page before upload (or as cached)
+        uint32_t format = PAGE_R8;
+        int w = 0, h = 0;
+        std::vector<uint8_t> texels;
+    };
+    struct SheetImage {
+        std::vector<PageImage> pages;
+        std::vector<PartSlot> parts;    // Page indices into pages
+    };
+    struct Sheet {
+        std::vector<PartSlot> parts;
+        int palette = 0;
+    };
+    struct Instance {                   // Per-instance vertex data, see compositor.cpp
+        float dst[4];
+        float uv[4];
+        float color[4];
+        float clip[4];
+        uint32_t paletteRow;
+        uint32_t flags;
+    };
+    struct Queued {
+        Instance inst;
+        int page;
+        bool add;
+    };
+
+    static void buildSheet(const SpriteSheet& sheet, int pageSize, bool compress, SheetImage& out);
+    static std::string cachePath(uint64_t hash, const char* cacheDir);
+    static bool readCache(const std::string& path, uint64_t hash, int pageSize, bool compress, int maxPageSize,
+                          SheetImage& out);
+    static bool saveCache(const std::string& path, uint64_t hash, int pageSize, bool compress,
+                          const SheetImage& image);
+    void growPalettes(int rows);
+    void updateTextureBytes();
+
+    std::vector<Page> m_pages;
+    std::vector<Sheet> m_sheets;
+    std::vector<Color> m_palettes;      // 256 entries per row, CPU copy
+    int m_paletteRows = 0;
+    int m_paletteCapacity = 0;
+    int m_pageSize = 2048;
+    bool m_compress = false;
+    bool m_bc1Supported = false;
+
+    std::vector<Queued> m_queue;
+    std::vector<Instance> m_instances;
+
+    unsigned int m_program = 0;
+    unsigned int m_vao = 0;
+    unsigned int m_vbo = 0;
+    size_t m_vboCapacity = 0;
+    unsigned int m_paletteTex = 0;
+    int m_uTarget = -1, m_uIndexed = -1, m_uPage = -1, m_uPalettes = -1;
+
+    CompositorStats m_stats;
+};
+
+} // namespace h2d
+
+#endif // COMPOSITOR_HPP
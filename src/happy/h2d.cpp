@@ -3,16 +3,25 @@
  */
 
 #include "h2d.hpp"
+#include "hprof.hpp"
+#include <cstdio>
 #include <cstring>
+#include <cmath>
 #include <algorithm>
 
 // OpenGL 1.2 - no extensions needed, just the basic fixed-function stuff
 #ifdef _WIN32
     #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
     #include <windows.h>
 #endif
 #include <GL/gl.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define H2D_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace h2d {
 
 /*==============================================================================
@@ -125,14 +134,10 @@ void Bitmap::fillRect(const Rect& rect, Color c) {
     }
 }
 
-void Bitmap::blit(const Bitmap& src, int destX, int destY) {
-    blit(src, destX, destY, Rect(0, 0, src.width(), src.height()));
-}
-
-void Bitmap::blit(const Bitmap& src, int destX, int destY, const Rect& srcRect) {
-    if (!m_pixels || !src.valid()) return;
-    
-    // Clip source rect
+// Clip a blit once: srcRect against the source, then the target against this
+// bitmap. Leaves the source area to copy in area and its target in destX/destY.
+static bool ClipBlit(int dstWidth, int dstHeight, const Bitmap& src, const Rect& srcRect,
+                     int& destX, int& destY, Rect& area) {
     int sx0 = std::max(0, srcRect.x);
     int sy0 = std::max(0, srcRect.y);
     int sx1 = std::min(src.width(), srcRect.x + srcRect.w);
@@ -141,84 +146,137 @@ void Bitmap::blit(const Bitmap& src, int destX, int destY, const Rect& srcRect)
     // Adjust dest based on clipping
     destX += sx0 - srcRect.x;
     destY += sy0 - srcRect.y;
+    if (destX < 0) { sx0 -= destX; destX = 0; }
+    if (destY < 0) { sy0 -= destY; destY = 0; }
     
-    for (int sy = sy0; sy < sy1; sy++) {
-        int dy = destY + (sy - sy0);
-        if (dy < 0 || dy >= m_height) continue;
-        
-        for (int sx = sx0; sx < sx1; sx++) {
-            int dx = destX + (sx - sx0);
-            if (dx < 0 || dx >= m_width) continue;
-            
-            const uint8_t* sp = src.pixels() + (sy * src.width() + sx) * 4;
-            uint8_t* dp = m_pixels + (dy * m_width + dx) * 4;
-            
-            dp[0] = sp[0];
-            dp[1] = sp[1];
-            dp[2] = sp[2];
-            dp[3] = sp[3];
-        }
+    area = Rect(sx0, sy0, std::min(sx1 - sx0, dstWidth - destX), std::min(sy1 - sy0, dstHeight - destY));
+    return area.w > 0 && area.h > 0;
+}
+
+void Bitmap::blit(const Bitmap& src, int destX, int destY) {
+    blit(src, destX, destY, Rect(0, 0, src.width(), src.height()));
+}
+
+void Bitmap::blit(const Bitmap& src, int destX, int destY, const Rect& srcRect) {
+    if (!m_pixels || !src.valid()) return;
+    
+    Rect area;
+    if (!ClipBlit(m_width, m_height, src, srcRect, destX, destY, area)) return;
+    
+    for (int y = 0; y < area.h; y++) {
+        const uint8_t* sp = src.pixels() + ((area.y + y) * src.width() + area.x) * 4;
+        uint8_t* dp = m_pixels + ((destY + y) * m_width + destX) * 4;
+        memmove(dp, sp, area.w * 4);  // memmove: src may be this bitmap
     }
 }
 
 void Bitmap::blitKeyed(const Bitmap& src, int destX, int destY, Color colorKey) {
+    blitKeyed(src, destX, destY, Rect(0, 0, src.width(), src.height()), colorKey);
+}
+
+void Bitmap::blitKeyed(const Bitmap& src, int destX, int destY, const Rect& srcRect, Color colorKey) {
     if (!m_pixels || !src.valid()) return;
     
+    Rect area;
+    if (!ClipBlit(m_width, m_height, src, srcRect, destX, destY, area)) return;
+    
     uint32_t key = colorKey.toRGBA() & 0x00FFFFFF;  // Ignore alpha in key
+#ifdef H2D_SSE2
+    const __m128i rgbMask = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i keyVec = _mm_set1_epi32(static_cast<int>(key));
+#endif
     
-    for (int sy = 0; sy < src.height(); sy++) {
-        int dy = destY + sy;
-        if (dy < 0 || dy >= m_height) continue;
-        
-        for (int sx = 0; sx < src.width(); sx++) {
-            int dx = destX + sx;
-            if (dx < 0 || dx >= m_width) continue;
-            
-            const uint8_t* sp = src.pixels() + (sy * src.width() + sx) * 4;
-            uint32_t srcPixel = *reinterpret_cast<const uint32_t*>(sp);
-            
+    for (int y = 0; y < area.h; y++) {
+        const uint32_t* sp = reinterpret_cast<const uint32_t*>(src.pixels()) + (area.y + y) * src.width() + area.x;
+        uint32_t* dp = reinterpret_cast<uint32_t*>(m_pixels) + (destY + y) * m_width + destX;
+        int x = 0;
+#ifdef H2D_SSE2
+        // Keyed pixels keep the target, the rest take the source
+        for (; x + 4 <= area.w; x += 4) {
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sp + x));
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dp + x));
+            __m128i keyed = _mm_cmpeq_epi32(_mm_and_si128(s, rgbMask), keyVec);
+            __m128i out = _mm_or_si128(_mm_and_si128(keyed, d), _mm_andnot_si128(keyed, s));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dp + x), out);
+        }
+#endif
+        for (; x < area.w; x++) {
             // Skip if matches color key (compare RGB only)
-            if ((srcPixel & 0x00FFFFFF) == key) continue;
-            
-            uint8_t* dp = m_pixels + (dy * m_width + dx) * 4;
-            dp[0] = sp[0];
-            dp[1] = sp[1];
-            dp[2] = sp[2];
-            dp[3] = sp[3];
+            if ((sp[x] & 0x00FFFFFF) != key) dp[x] = sp[x];
         }
     }
 }
 
 void Bitmap::blitAlpha(const Bitmap& src, int destX, int destY) {
+    blitAlpha(src, destX, destY, Rect(0, 0, src.width(), src.height()));
+}
+
+// out = (src * alpha + dst * (255 - alpha)) / 255 rounded down, alpha 255;
+// alpha 0 leaves the target untouched. x / 255 for x <= 65025 is
+// (x + 1 + (x >> 8)) >> 8, which keeps the SSE2 kernel exact.
+void Bitmap::blitAlpha(const Bitmap& src, int destX, int destY, const Rect& srcRect) {
     if (!m_pixels || !src.valid()) return;
     
-    for (int sy = 0; sy < src.height(); sy++) {
-        int dy = destY + sy;
-        if (dy < 0 || dy >= m_height) continue;
-        
-        for (int sx = 0; sx < src.width(); sx++) {
-            int dx = destX + sx;
-            if (dx < 0 || dx >= m_width) continue;
-            
-            const uint8_t* sp = src.pixels() + (sy * src.width() + sx) * 4;
-            uint8_t* dp = m_pixels + (dy * m_width + dx) * 4;
+    Rect area;
+    if (!ClipBlit(m_width, m_height, src, srcRect, destX, destY, area)) return;
+    
+#ifdef H2D_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(0xFF000000));
+    const __m128i max = _mm_set1_epi16(255);
+    const __m128i one = _mm_set1_epi16(1);
+#endif
+    
+    for (int y = 0; y < area.h; y++) {
+        const uint8_t* sp = src.pixels() + ((area.y + y) * src.width() + area.x) * 4;
+        uint8_t* dp = m_pixels + ((destY + y) * m_width + destX) * 4;
+        int x = 0;
+#ifdef H2D_SSE2
+        for (; x + 4 <= area.w; x += 4) {
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sp + x * 4));
+            __m128i sa = _mm_and_si128(s, alphaMask);
+            __m128i clear = _mm_cmpeq_epi32(sa, zero);
+            int clearBits = _mm_movemask_epi8(clear);
+            if (clearBits == 0xFFFF) continue;                          // All transparent
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(sa, alphaMask)) == 0xFFFF) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dp + x * 4), s);  // All opaque
+                continue;
+            }
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dp + x * 4));
+            __m128i out[2];
+            for (int half = 0; half < 2; half++) {
+                __m128i s16 = half ? _mm_unpackhi_epi8(s, zero) : _mm_unpacklo_epi8(s, zero);
+                __m128i d16 = half ? _mm_unpackhi_epi8(d, zero) : _mm_unpacklo_epi8(d, zero);
+                __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s16, _MM_SHUFFLE(3, 3, 3, 3)),
+                                                _MM_SHUFFLE(3, 3, 3, 3));
+                __m128i t = _mm_add_epi16(_mm_mullo_epi16(s16, a), _mm_mullo_epi16(d16, _mm_sub_epi16(max, a)));
+                out[half] = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(t, one), _mm_srli_epi16(t, 8)), 8);
+            }
+            __m128i blended = _mm_or_si128(_mm_packus_epi16(out[0], out[1]), alphaMask);
+            blended = _mm_or_si128(_mm_and_si128(clear, d), _mm_andnot_si128(clear, blended));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dp + x * 4), blended);
+        }
+#endif
+        for (; x < area.w; x++) {
+            const uint8_t* s = sp + x * 4;
+            uint8_t* d = dp + x * 4;
             
-            uint8_t sa = sp[3];
+            uint8_t sa = s[3];
             if (sa == 0) continue;        // Fully transparent, skip
             if (sa == 255) {              // Fully opaque, just copy
-                dp[0] = sp[0];
-                dp[1] = sp[1];
-                dp[2] = sp[2];
-                dp[3] = 255;
+                d[0] = s[0];
+                d[1] = s[1];
+                d[2] = s[2];
+                d[3] = 255;
                 continue;
             }
             
             // Alpha blend: out = src * alpha + dst * (1 - alpha)
             uint8_t da = 255 - sa;
-            dp[0] = (sp[0] * sa + dp[0] * da) / 255;
-            dp[1] = (sp[1] * sa + dp[1] * da) / 255;
-            dp[2] = (sp[2] * sa + dp[2] * da) / 255;
-            dp[3] = 255;
+            d[0] = (s[0] * sa + d[0] * da) / 255;
+            d[1] = (s[1] * sa + d[1] * da) / 255;
+            d[2] = (s[2] * sa + d[2] * da) / 255;
+            d[3] = 255;
         }
     }
 }
@@ -288,6 +346,44 @@ bool Texture::updateFromBitmap(const Bitmap& bitmap) {
     return true;
 }
 
+bool Texture::create(int width, int height) {
+    if (width <= 0 || height <= 0) return false;
+    
+    release();
+    
+    glGenTextures(1, &m_texId);
+    glBindTexture(GL_TEXTURE_2D, m_texId);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    
+    // GL leaves new texture contents undefined; start transparent
+    std::vector<uint8_t> zero(static_cast<size_t>(width) * height * 4, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height,
+                 0, GL_RGBA, GL_UNSIGNED_BYTE, zero.data());
+    
+    m_width = width;
+    m_height = height;
+    return true;
+}
+
+bool Texture::updateRegion(const Bitmap& bitmap, int x, int y) {
+    if (!valid() || !bitmap.valid()) return false;
+    if (x < 0 || y < 0 || x + bitmap.width() > m_width || y + bitmap.height() > m_height) return false;
+    
+    glBindTexture(GL_TEXTURE_2D, m_texId);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, bitmap.width(), bitmap.height(),
+                    GL_RGBA, GL_UNSIGNED_BYTE, bitmap.pixels());
+    return true;
+}
+
+int Texture::maxSize() {
+    GLint size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &size);
+    return size > 0 ? size : 64;  // The minimum GL guarantees
+}
+
 void Texture::release() {
     if (m_texId != 0) {
         glDeleteTextures(1, &m_texId);
@@ -297,6 +393,101 @@ void Texture::release() {
     m_height = 0;
 }
 
+/*==============================================================================
+ * SpriteBatch Implementation
+ *============================================================================*/
+
+void SpriteBatch::add(const Texture& tex, float x, float y, float w, float h, const Rect& src,
+                      float angle, Color tint, BlendMode blend) {
+    if (!tex.valid()) return;
+    
+    // Calculate texture coordinates
+    float u0 = static_cast<float>(src.x) / tex.width();
+    float v0 = static_cast<float>(src.y) / tex.height();
+    float u1 = static_cast<float>(src.x + src.w) / tex.width();
+    float v1 = static_cast<float>(src.y + src.h) / tex.height();
+    uint32_t color = tint.toRGBA();
+    
+    Vertex quad[4] = {
+        { x, y, u0, v0, color },
+        { x + w, y, u1, v0, color },
+        { x + w, y + h, u1, v1, color },
+        { x, y + h, u0, v1, color }
+    };
+    if (angle != 0.0f) {
+        // Y points down, so a positive angle turns clockwise on screen
+        float rad = angle * 3.14159265358979f / 180.0f;
+        float c = std::cos(rad), s = std::sin(rad);
+        float cx = x + w * 0.5f, cy = y + h * 0.5f;
+        for (Vertex& v : quad) {
+            float dx = v.x - cx, dy = v.y - cy;
+            v.x = cx + dx * c - dy * s;
+            v.y = cy + dx * s + dy * c;
+        }
+    }
+    m_vertices.insert(m_vertices.end(), quad, quad + 4);
+    m_keys.push_back(Key{ tex.glId(), blend });
+}
+
+void SpriteBatch::flush() {
+    int count = static_cast<int>(m_keys.size());
+    if (count == 0) return;
+    HPROF_SCOPE("batch");
+    
+    const Vertex* vertices = m_vertices.data();
+    const Key* keys = m_keys.data();
+    if (m_sortMode == SORT_TEXTURE) {
+        m_order.resize(count);
+        for (int i = 0; i < count; i++) m_order[i] = i;
+        std::stable_sort(m_order.begin(), m_order.end(), [this](int a, int b) {
+            if (m_keys[a].blend != m_keys[b].blend) return m_keys[a].blend < m_keys[b].blend;
+            return m_keys[a].texId < m_keys[b].texId;
+        });
+        m_sorted.resize(m_vertices.size());
+        m_sortedKeys.resize(count);
+        for (int i = 0; i < count; i++) {
+            std::copy(&m_vertices[m_order[i] * 4], &m_vertices[m_order[i] * 4] + 4, &m_sorted[i * 4]);
+            m_sortedKeys[i] = m_keys[m_order[i]];
+        }
+        vertices = m_sorted.data();
+        keys = m_sortedKeys.data();
+    }
+    
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(2, GL_FLOAT, sizeof(Vertex), &vertices[0].x);
+    glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), &vertices[0].u);
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(Vertex), &vertices[0].color);
+    
+    // One draw per run of quads sharing texture and blend
+    BlendMode blend = BLEND_ALPHA;
+    for (int first = 0; first < count;) {
+        int last = first + 1;
+        while (last < count && keys[last].texId == keys[first].texId && keys[last].blend == keys[first].blend) {
+            last++;
+        }
+        if (keys[first].blend != blend) {
+            blend = keys[first].blend;
+            glBlendFunc(GL_SRC_ALPHA, blend == BLEND_ADD ? GL_ONE : GL_ONE_MINUS_SRC_ALPHA);
+        }
+        glBindTexture(GL_TEXTURE_2D, keys[first].texId);
+        glDrawArrays(GL_QUADS, first * 4, (last - first) * 4);
+        m_stats.batches++;
+        first = last;
+    }
+    if (blend != BLEND_ALPHA) glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    
+    m_stats.sprites += count;
+    HPROF_COUNT("sprites", count);
+    m_vertices.clear();
+    m_keys.clear();
+}
+
 /*==============================================================================
  * Renderer Implementation
  *============================================================================*/
@@ -331,6 +522,7 @@ void Renderer::shutdown() {
 }
 
 void Renderer::setVirtualSize(int width, int height) {
+    flush();
     m_virtualWidth = width;
     m_virtualHeight = height;
     setupOrtho();
@@ -348,15 +540,21 @@ void Renderer::setupOrtho() {
 }
 
 void Renderer::beginFrame() {
-    // Could add state tracking here if needed
+    m_batch.resetStats();
 }
 
 void Renderer::endFrame() {
     // Flush any pending draws
+    flush();
     glFlush();
 }
 
+void Renderer::flush() {
+    m_batch.flush();
+}
+
 void Renderer::clear(Color c) {
+    m_batch.flush();
     glClearColor(c.r / 255.0f, c.g / 255.0f, c.b / 255.0f, c.a / 255.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 }
@@ -366,28 +564,8 @@ void Renderer::drawTexture(const Texture& tex, int x, int y) {
 }
 
 void Renderer::drawTexture(const Texture& tex, int x, int y, const Rect& srcRect) {
-    if (!tex.valid()) return;
-    
-    glBindTexture(GL_TEXTURE_2D, tex.glId());
-    glColor4f(1, 1, 1, 1);
-    
-    // Calculate texture coordinates
-    float u0 = static_cast<float>(srcRect.x) / tex.width();
-    float v0 = static_cast<float>(srcRect.y) / tex.height();
-    float u1 = static_cast<float>(srcRect.x + srcRect.w) / tex.width();
-    float v1 = static_cast<float>(srcRect.y + srcRect.h) / tex.height();
-    
-    float x0 = static_cast<float>(x);
-    float y0 = static_cast<float>(y);
-    float x1 = x0 + srcRect.w;
-    float y1 = y0 + srcRect.h;
-    
-    glBegin(GL_QUADS);
-        glTexCoord2f(u0, v0); glVertex2f(x0, y0);
-        glTexCoord2f(u1, v0); glVertex2f(x1, y0);
-        glTexCoord2f(u1, v1); glVertex2f(x1, y1);
-        glTexCoord2f(u0, v1); glVertex2f(x0, y1);
-    glEnd();
+    m_batch.add(tex, static_cast<float>(x), static_cast<float>(y),
+                static_cast<float>(srcRect.w), static_cast<float>(srcRect.h), srcRect);
 }
 
 void Renderer::drawTextureScaled(const Texture& tex, const Rect& dest) {
@@ -395,30 +573,18 @@ void Renderer::drawTextureScaled(const Texture& tex, const Rect& dest) {
 }
 
 void Renderer::drawTextureScaled(const Texture& tex, const Rect& dest, const Rect& src) {
-    if (!tex.valid()) return;
-    
-    glBindTexture(GL_TEXTURE_2D, tex.glId());
-    glColor4f(1, 1, 1, 1);
-    
-    float u0 = static_cast<float>(src.x) / tex.width();
-    float v0 = static_cast<float>(src.y) / tex.height();
-    float u1 = static_cast<float>(src.x + src.w) / tex.width();
-    float v1 = static_cast<float>(src.y + src.h) / tex.height();
-    
-    float x0 = static_cast<float>(dest.x);
-    float y0 = static_cast<float>(dest.y);
-    float x1 = x0 + dest.w;
-    float y1 = y0 + dest.h;
-    
-    glBegin(GL_QUADS);
-        glTexCoord2f(u0, v0); glVertex2f(x0, y0);
-        glTexCoord2f(u1, v0); glVertex2f(x1, y0);
-        glTexCoord2f(u1, v1); glVertex2f(x1, y1);
-        glTexCoord2f(u0, v1); glVertex2f(x0, y1);
-    glEnd();
+    m_batch.add(tex, static_cast<float>(dest.x), static_cast<float>(dest.y),
+                static_cast<float>(dest.w), static_cast<float>(dest.h), src);
+}
+
+void Renderer::drawTextureEx(const Texture& tex, const Rect& dest, const Rect& src, float angle,
+                             Color tint, BlendMode blend) {
+    m_batch.add(tex, static_cast<float>(dest.x), static_cast<float>(dest.y),
+                static_cast<float>(dest.w), static_cast<float>(dest.h), src, angle, tint, blend);
 }
 
 void Renderer::drawRect(const Rect& rect, Color c) {
+    m_batch.flush();
     glDisable(GL_TEXTURE_2D);
     glColor4ub(c.r, c.g, c.b, c.a);
     
@@ -432,7 +598,18 @@ void Renderer::drawRect(const Rect& rect, Color c) {
     glEnable(GL_TEXTURE_2D);
 }
 
+void Renderer::fillRect(const Rect& rect, Color c) {
+    if (!m_white.valid()) {
+        Bitmap white(1, 1);
+        white.setPixel(0, 0, Color(255, 255, 255, 255));
+        if (!m_white.createFromBitmap(white)) return;
+    }
+    m_batch.add(m_white, static_cast<float>(rect.x), static_cast<float>(rect.y),
+                static_cast<float>(rect.w), static_cast<float>(rect.h), Rect(0, 0, 1, 1), 0.0f, c);
+}
+
 void Renderer::drawRectOutline(const Rect& rect, Color c) {
+    m_batch.flush();
     glDisable(GL_TEXTURE_2D);
     glColor4ub(c.r, c.g, c.b, c.a);
     
@@ -451,6 +628,132 @@ void Renderer::drawRectOutline(const Rect& rect, Color c) {
     glEnable(GL_TEXTURE_2D);
 }
 
+/*==============================================================================
+ * ProfilerOverlay Implementation
+ *============================================================================*/
+
+// 3x5 glyph, one octal digit per row from the top, 4 = left column
+static int Glyph(char c) {
+    static const int kDigits[10] = {
+        075557, 026227, 071747, 071717, 055711, 074717, 074757, 071111, 075757, 075717
+    };
+    static const int kLetters[26] = {
+        025755, 065656, 034443, 065556, 074647, 074644, 034553, 055755, 072227, 011152,
+        055655, 044447, 057755, 065555, 025552, 065644, 025563, 065655, 034216, 072222,
+        055557, 055552, 055775, 055255, 055222, 071247
+    };
+    if (c >= '0' && c <= '9') return kDigits[c - '0'];
+    if (c >= 'A' && c <= 'Z') return kLetters[c - 'A'];
+    if (c >= 'a' && c <= 'z') return kLetters[c - 'a'];
+    switch (c) {
+        case '.': return 000002;
+        case ':': return 002020;
+        case '-': return 000700;
+        case '/': return 011244;
+        case '%': return 051245;
+        case '_': return 000007;
+        case '(': return 012221;
+        case ')': return 042224;
+        case '=': return 007070;
+        case '+': return 002720;
+        case ',': return 000024;
+        default: return 0;
+    }
+}
+
+int ProfilerOverlay::drawText(Renderer& renderer, const char* text, int x, int y, Color c, int scale) {
+    int cx = x;
+    for (const char* p = text; *p; p++, cx += 4 * scale) {
+        int glyph = Glyph(*p);
+        for (int row = 0; row < 5 && glyph; row++) {
+            int bits = (glyph >> ((4 - row) * 3)) & 7;
+            // One rect per horizontal run of set pixels
+            for (int col = 0; col < 3;) {
+                if (!(bits & (4 >> col))) {
+                    col++;
+                    continue;
+                }
+                int run = 1;
+                while (col + run < 3 && (bits & (4 >> (col + run)))) run++;
+                renderer.fillRect(Rect(cx + col * scale, y + row * scale, run * scale, scale), c);
+                col += run;
+            }
+        }
+    }
+    return cx > x ? cx - x - scale : 0;
+}
+
+Color ProfilerOverlay::spanColor(const char* name) {
+    static const Color kColors[8] = {
+        Color(230, 90, 70), Color(90, 180, 240), Color(120, 210, 90), Color(240, 200, 60),
+        Color(190, 110, 230), Color(60, 210, 190), Color(240, 140, 50), Color(230, 110, 170)
+    };
+    size_t i = 0;
+    while (i < m_spanNames.size() && m_spanNames[i] != name) i++;
+    if (i == m_spanNames.size()) m_spanNames.push_back(name);
+    return kColors[i % 8];
+}
+
+int ProfilerOverlay::draw(Renderer& renderer, const hprof::Profiler& profiler, int x, int y) {
+    const int pad = 4, barWidth = 2, graphHeight = 60, line = 7;
+    const Color text(255, 255, 255), dim(170, 170, 170), rest(110, 110, 110);
+    int frames = std::min(m_frames, profiler.frameCount());
+    const hprof::Frame* last = frames ? &profiler.frame(0) : nullptr;
+    int lines = 1 + (last ? last->partCount + profiler.counterCount() : 0);
+    int width = std::max(m_frames * barWidth, 160) + pad * 2;
+    int height = pad + graphHeight + 4 + lines * line + pad;
+    
+    // Sprites queued before the overlay go first, so a texture-sorted batch
+    // cannot pull them over it
+    renderer.flush();
+    renderer.fillRect(Rect(x, y, width, height), Color(0, 0, 0, 170));
+    
+    // Bars, newest on the right, scaled so the budget sits half way up
+    float pxPerMs = graphHeight / (m_budgetMs * 2.0f);
+    int base = y + pad + graphHeight;
+    for (int i = 0; i < frames; i++) {
+        const hprof::Frame& f = profiler.frame(frames - 1 - i);
+        int bx = x + pad + (m_frames - frames + i) * barWidth;
+        double ms = 0.0;
+        int top = base;
+        auto stack = [&](double partMs, Color c) {
+            ms += partMs;
+            int next = base - std::min(static_cast<int>(ms * pxPerMs + 0.5), graphHeight);
+            if (next < top) renderer.fillRect(Rect(bx, next, barWidth, top - next), c);
+            top = next;
+        };
+        double spans = 0.0;
+        for (int p = 0; p < f.partCount; p++) {
+            spans += f.parts[p].ns / 1e6;
+            stack(f.parts[p].ns / 1e6, spanColor(f.parts[p].name));
+        }
+        stack(std::max(f.ms() - spans, 0.0), rest);
+    }
+    int budgetY = base - static_cast<int>(m_budgetMs * pxPerMs + 0.5);
+    renderer.fillRect(Rect(x + pad, budgetY, m_frames * barWidth, 1), Color(255, 255, 255, 120));
+    
+    char buf[96];
+    int ty = base + 4;
+    snprintf(buf, sizeof(buf), "FRAME P50 %.2f P99 %.2f MAX %.2f MS", profiler.frameMsPercentile(50),
+             profiler.frameMsPercentile(99), profiler.frameMsPercentile(100));
+    drawText(renderer, buf, x + pad, ty, text);
+    if (!last) return height;
+    
+    // The last frame: its spans by colour, then its counters
+    for (int p = 0; p < last->partCount; p++) {
+        ty += line;
+        renderer.fillRect(Rect(x + pad, ty, 5, 5), spanColor(last->parts[p].name));
+        snprintf(buf, sizeof(buf), "%.40s %.2f", last->parts[p].name, last->parts[p].ns / 1e6);
+        drawText(renderer, buf, x + pad + 8, ty, text);
+    }
+    for (int c = 0; c < profiler.counterCount(); c++) {
+        ty += line;
+        snprintf(buf, sizeof(buf), "%.40s %lld", profiler.counterName(c), static_cast<long long>(last->counters[c]));
+        drawText(renderer, buf, x + pad + 8, ty, dim);
+    }
+    return height;
+}
+
 /*==============================================================================
  * Palette Implementation
  *============================================================================*/
@@ -490,13 +793,17 @@ void Palette::applyTo(const uint8_t* indexed, int width, int height, Bitmap& out
         out.create(width, height);
     }
     
+    uint32_t lut[256];
+    toRGBA(lut);
     uint8_t* dest = out.pixels();
     for (int i = 0; i < width * height; i++) {
-        Color c = m_colors[indexed[i]];
-        dest[i * 4 + 0] = c.r;
-        dest[i * 4 + 1] = c.g;
-        dest[i * 4 + 2] = c.b;
-        dest[i * 4 + 3] = c.a;
+        memcpy(dest + i * 4, &lut[indexed[i]], 4);
+    }
+}
+
+void Palette::toRGBA(uint32_t* out) const {
+    for (int i = 0; i < 256; i++) {
+        out[i] = m_colors[i].toRGBA();
     }
 }
 
@@ -554,4 +861,167 @@ Palette Palette::loadFromFile(const char* filename) {
     return pal;
 }
 
+/*==============================================================================
+ * PaletteAnimator Implementation
+ *============================================================================*/
+
+// a towards b by weight w (0..256), alpha kept from a
+static Color LerpColor(Color a, Color b, int w) {
+    return Color(static_cast<uint8_t>((a.r * (256 - w) + b.r * w + 128) >> 8),
+                 static_cast<uint8_t>((a.g * (256 - w) + b.g * w + 128) >> 8),
+                 static_cast<uint8_t>((a.b * (256 - w) + b.b * w + 128) >> 8), a.a);
+}
+
+static int Weight(float t) {
+    return std::max(0, std::min(256, static_cast<int>(t * 256.0f + 0.5f)));
+}
+
+PaletteAnimator::PaletteAnimator() {
+    setBase(Palette());
+}
+
+void PaletteAnimator::setBase(const Palette& palette) {
+    m_base = palette;
+    m_crossfade = Ramp();
+    m_fade = Ramp();
+    m_flash = Ramp();
+    m_cycles.clear();
+    m_pendingFull = true;
+    rebuild(0, 256);
+}
+
+void PaletteAnimator::crossfade(const Palette& target, float ms) {
+    // A crossfade still running becomes the new starting point
+    int w = Weight(m_crossfade.value());
+    for (int i = 0; w > 0 && i < 256; i++) {
+        m_base.setColor(i, LerpColor(m_base.getColor(i), m_target.getColor(i), w));
+    }
+    m_target = target;
+    m_crossfade = Ramp();
+    m_crossfade.to = 1.0f;
+    m_crossfade.ms = ms;
+    m_pendingFull = true;
+}
+
+void PaletteAnimator::fade(Color c, float level, float ms) {
+    float from = m_fade.value();
+    m_fade = Ramp();
+    m_fade.from = from;
+    m_fade.to = std::max(0.0f, std::min(1.0f, level));
+    m_fade.ms = ms;
+    m_fadeColor = c;
+    m_pendingFull = true;
+}
+
+void PaletteAnimator::flash(Color c, float ms) {
+    m_flash = Ramp();
+    m_flash.from = 1.0f;
+    m_flash.ms = ms;
+    m_flashColor = c;
+    m_pendingFull = true;
+}
+
+int PaletteAnimator::cycle(int first, int count, float stepsPerSecond) {
+    first = std::max(0, std::min(255, first));
+    count = std::min(count, 256 - first);
+    if (count < 2) return -1;
+    Cycle cycle;
+    cycle.first = first;
+    cycle.count = count;
+    cycle.rate = stepsPerSecond;
+    size_t slot = 0;
+    while (slot < m_cycles.size() && m_cycles[slot].count > 0) slot++;
+    if (slot == m_cycles.size()) m_cycles.push_back(cycle);
+    else m_cycles[slot] = cycle;
+    return static_cast<int>(slot);
+}
+
+void PaletteAnimator::stopCycle(int id) {
+    if (id < 0 || id >= static_cast<int>(m_cycles.size()) || m_cycles[id].count == 0) return;
+    Cycle& cycle = m_cycles[id];
+    bool moved = cycle.shift != 0;
+    int first = cycle.first, count = cycle.count;
+    cycle.count = 0;
+    if (moved) {
+        // Back to unrotated on the next update
+        m_pendingFirst = std::min(m_pendingFirst, first);
+        m_pendingLast = std::max(m_pendingLast, first + count);
+    }
+}
+
+bool PaletteAnimator::active() const {
+    if (!m_crossfade.done() || !m_fade.done() || !m_flash.done()) return true;
+    for (const Cycle& cycle : m_cycles) {
+        if (cycle.count > 0 && cycle.rate != 0.0f) return true;
+    }
+    return false;
+}
+
+bool PaletteAnimator::update(float dtMs) {
+    bool full = m_pendingFull;
+    int first = m_pendingFirst, last = m_pendingLast;
+    m_pendingFull = false;
+    m_pendingFirst = 256;
+    m_pendingLast = 0;
+    
+    // Fades touch every entry while they move (and once more as they land)
+    for (Ramp* ramp : { &m_crossfade, &m_fade, &m_flash }) {
+        if (ramp->done()) continue;
+        ramp->elapsed += dtMs;
+        full = true;
+    }
+    if (m_crossfade.done() && m_crossfade.to > 0.0f) {
+        m_base = m_target;
+        m_crossfade = Ramp();
+    }
+    
+    // Cycles touch their own range when they step
+    for (Cycle& cycle : m_cycles) {
+        if (cycle.count == 0) continue;
+        cycle.phase += cycle.rate * dtMs / 1000.0f;
+        cycle.phase = std::fmod(cycle.phase, static_cast<float>(cycle.count));
+        int shift = static_cast<int>(std::floor(cycle.phase));
+        shift = ((shift % cycle.count) + cycle.count) % cycle.count;
+        if (shift == cycle.shift) continue;
+        cycle.shift = shift;
+        first = std::min(first, cycle.first);
+        last = std::max(last, cycle.first + cycle.count);
+    }
+    
+    if (full) {
+        first = 0;
+        last = 256;
+    }
+    if (first >= last) {
+        m_dirtyFirst = 0;
+        m_dirtyCount = 0;
+        return false;
+    }
+    rebuild(first, last - first);
+    m_dirtyFirst = first;
+    m_dirtyCount = last - first;
+    return true;
+}
+
+// Recompute entries first..first+count-1 from the base and every effect
+void PaletteAnimator::rebuild(int first, int count) {
+    int crossfade = Weight(m_crossfade.value());
+    int fade = Weight(m_fade.value());
+    int flash = Weight(m_flash.value());
+    for (int i = first; i < first + count; i++) {
+        int src = i;
+        for (const Cycle& cycle : m_cycles) {
+            if (cycle.count > 0 && i >= cycle.first && i < cycle.first + cycle.count) {
+                src = cycle.first + (i - cycle.first + cycle.shift) % cycle.count;
+                break;
+            }
+        }
+        Color c = m_base.getColor(src);
+        if (crossfade) c = LerpColor(c, m_target.getColor(src), crossfade);
+        if (fade) c = LerpColor(c, m_fadeColor, fade);
+        if (flash) c = LerpColor(c, m_flashColor, flash);
+        m_current.setColor(i, c);
+    }
+}
+
 } // namespace h2d
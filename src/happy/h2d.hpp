@@ -9,6 +9,7 @@
  *   - Bitmap: CPU-side pixel buffer (like RKC_DIB)
  *   - Texture: GPU-side texture created from Bitmap
  *   - Renderer: Handles drawing to screen (like RKC_DBFCONTROL)
+ *   - ProfilerOverlay: hprof frame timings drawn with the Renderer
  */
 
 #ifndef H2D_HPP
@@ -19,6 +20,8 @@
 #include <vector>
 #include <string>
 
+namespace hprof { class Profiler; }
+
 namespace h2d {
 
 /*==============================================================================
@@ -97,11 +100,15 @@ public:
     void clear(Color c = Color(0, 0, 0, 255));
     void fillRect(const Rect& rect, Color c);
     
-    // Blit operations (like RKC_DIB::TransferToDIB)
+    // Blit operations (like RKC_DIB::TransferToDIB), clipped to both bitmaps.
+    // blitKeyed skips pixels whose RGB matches the key; blitAlpha blends by
+    // source alpha into an opaque result.
     void blit(const Bitmap& src, int destX, int destY);
     void blit(const Bitmap& src, int destX, int destY, const Rect& srcRect);
     void blitKeyed(const Bitmap& src, int destX, int destY, Color colorKey);
+    void blitKeyed(const Bitmap& src, int destX, int destY, const Rect& srcRect, Color colorKey);
     void blitAlpha(const Bitmap& src, int destX, int destY);
+    void blitAlpha(const Bitmap& src, int destX, int destY, const Rect& srcRect);
     
 private:
     int m_width = 0;
@@ -130,6 +137,15 @@ public:
     // Update from bitmap (re-uploads, must be same size)
     bool updateFromBitmap(const Bitmap& bitmap);
     
+    // Create empty (transparent) texture, e.g. an atlas page filled piecewise
+    bool create(int width, int height);
+    
+    // Upload a bitmap into part of the texture at (x, y)
+    bool updateRegion(const Bitmap& bitmap, int x, int y);
+    
+    // Largest texture edge the current context supports
+    static int maxSize();
+    
     void release();
     
     // Properties
@@ -144,8 +160,74 @@ private:
     int m_height = 0;
 };
 
+/*==============================================================================
+ * SpriteBatch - textured quads gathered into one vertex array
+ * 
+ * Quads are queued with their texture and blend state and drawn at flush()
+ * with one glDrawArrays per group (OpenGL 1.1 client-side arrays, so still
+ * no extensions). By default groups are runs of consecutive quads with the
+ * same state, which keeps submission order; SORT_TEXTURE stable-sorts by
+ * blend and texture first, for layers whose quads do not overlap. Textures
+ * must stay alive until the batch is flushed.
+ *============================================================================*/
+
+enum BlendMode {
+    BLEND_ALPHA,    // src * a + dst * (1 - a)
+    BLEND_ADD       // src * a + dst
+};
+
+struct BatchStats {
+    int sprites = 0;        // Quads drawn in the last frame
+    int batches = 0;        // glDrawArrays calls in the last frame
+};
+
+class SpriteBatch {
+public:
+    enum SortMode {
+        SORT_NONE,          // Submission order, consecutive quads merged
+        SORT_TEXTURE        // Grouped by blend and texture
+    };
+    
+    // Queue a quad: dest rect, source rect in texels, clockwise rotation in
+    // degrees about the dest centre, tint multiplied with the texels
+    void add(const Texture& tex, float x, float y, float w, float h, const Rect& src,
+             float angle = 0.0f, Color tint = Color(255, 255, 255, 255), BlendMode blend = BLEND_ALPHA);
+    
+    // Draw everything queued and empty the queue
+    void flush();
+    
+    // Start counting a new frame
+    void resetStats() { m_stats = BatchStats(); }
+    
+    void setSortMode(SortMode mode) { m_sortMode = mode; }
+    int pending() const { return static_cast<int>(m_keys.size()); }
+    const BatchStats& stats() const { return m_stats; }
+    
+private:
+    struct Vertex {
+        float x, y, u, v;
+        uint32_t color;     // Packed RGBA, Color::toRGBA
+    };
+    struct Key {
+        unsigned int texId;
+        BlendMode blend;
+    };
+    
+    std::vector<Vertex> m_vertices;     // 4 per quad
+    std::vector<Key> m_keys;            // 1 per quad
+    std::vector<Vertex> m_sorted;       // SORT_TEXTURE reorders into these
+    std::vector<Key> m_sortedKeys;
+    std::vector<int> m_order;
+    SortMode m_sortMode = SORT_NONE;
+    BatchStats m_stats;
+};
+
 /*==============================================================================
  * Renderer - Draws to screen using OpenGL 1.2 (like RKC_DBFCONTROL)
+ * 
+ * Texture draws go through a SpriteBatch and reach GL at endFrame (or when a
+ * clear or rect draw needs them first), so a frame of sprites costs a few
+ * draw calls instead of one glBegin/glEnd each.
  *============================================================================*/
 
 class Renderer {
@@ -173,10 +255,25 @@ public:
     void drawTextureScaled(const Texture& tex, const Rect& dest);
     void drawTextureScaled(const Texture& tex, const Rect& dest, const Rect& src);
     
+    // Rotated (degrees, clockwise about the dest centre), tinted and/or additive
+    void drawTextureEx(const Texture& tex, const Rect& dest, const Rect& src, float angle,
+                       Color tint = Color(255, 255, 255, 255), BlendMode blend = BLEND_ALPHA);
+    
     // Draw colored rectangle (for debug/UI)
     void drawRect(const Rect& rect, Color c);
     void drawRectOutline(const Rect& rect, Color c);
     
+    // Colored rectangle queued in the sprite batch as a tinted white texel,
+    // so runs of them cost one draw call instead of one glBegin/glEnd each
+    void fillRect(const Rect& rect, Color c);
+    
+    // Send queued texture draws to GL now
+    void flush();
+    
+    // Sprite batching: order of queued draws, and counts for the last frame
+    void setSortMode(SpriteBatch::SortMode mode) { m_batch.setSortMode(mode); }
+    const BatchStats& batchStats() const { return m_batch.stats(); }
+    
     // Screen properties
     int screenWidth() const { return m_screenWidth; }
     int screenHeight() const { return m_screenHeight; }
@@ -187,10 +284,45 @@ private:
     int m_virtualWidth = 0;
     int m_virtualHeight = 0;
     bool m_initialized = false;
+    SpriteBatch m_batch;
+    Texture m_white;                    // 1x1, for fillRect
     
     void setupOrtho();
 };
 
+/*==============================================================================
+ * ProfilerOverlay - hprof frame timings drawn over the game
+ *
+ * One bar per recent frame, stacked by the frame's outermost spans (present,
+ * blit, ...) with the time no span covers in grey, against a line at the
+ * frame budget; then p50/p99/max frame times and the last frame's spans and
+ * counters in a small built-in font. Everything is a Renderer::fillRect, down
+ * to each run of lit pixels in a glyph, so the whole overlay is one batched
+ * draw. Draw it last, before Renderer::endFrame.
+ *============================================================================*/
+
+class ProfilerOverlay {
+public:
+    // Frame budget in ms (the line; bars are scaled to twice this) and bars shown
+    void setBudgetMs(float ms) { m_budgetMs = ms; }
+    void setFrames(int frames) { m_frames = frames; }
+
+    // Draw with its top-left corner at x, y; returns the height used
+    int draw(Renderer& renderer, const hprof::Profiler& profiler, int x, int y);
+
+    // 3x5 font, upper case, digits and . : - / % _ ( ) = + ,; returns the width
+    static int drawText(Renderer& renderer, const char* text, int x, int y, Color c, int scale = 1);
+
+    // Colour of a span in the bars: handed out as names first show up, so it
+    // stays the same for a name from frame to frame
+    Color spanColor(const char* name);
+
+private:
+    float m_budgetMs = 1000.0f / 60.0f;
+    int m_frames = 120;
+    std::vector<std::string> m_spanNames;   // Index picks the colour
+};
+
 /*==============================================================================
  * Palette support (for 8-bit indexed images like original ShadowFlare)
  *============================================================================*/
@@ -209,6 +341,10 @@ public:
     // Convert indexed bitmap to RGBA
     void applyTo(const uint8_t* indexed, int width, int height, Bitmap& out) const;
     
+    // All 256 entries as packed RGBA (Color::toRGBA), e.g. for
+    // SpriteSheet::convertIndexedToRGBA
+    void toRGBA(uint32_t* out) const;
+    
     // Create a default palette suitable for ShadowFlare-style sprites
     static Palette createDefault();
     
@@ -219,6 +355,82 @@ private:
     Color m_colors[256];
 };
 
+/*==============================================================================
+ * PaletteAnimator - fades, flashes and colour cycling on a palette
+ * 
+ * Works on the 256 palette entries only: indexed sprites stay indexed and
+ * pick up the result where colour is resolved (a Compositor palette row, or
+ * the LUT that SpriteSheet converts with), so an animated palette never
+ * re-expands a bitmap. Effects stack in this order: the base palette
+ * (crossfading towards a target), colour cycles, the fade colour, the flash.
+ *============================================================================*/
+
+class PaletteAnimator {
+public:
+    PaletteAnimator();
+    
+    // Start from a palette; stops every effect
+    void setBase(const Palette& palette);
+    
+    // Blend the base palette into another one over ms milliseconds
+    void crossfade(const Palette& target, float ms);
+    
+    // Mix towards a colour: level 0 = none, 1 = solid colour. The level moves
+    // from where it is to the new one over ms (fade(black, 1, 500) fades out,
+    // fade(black, 0, 500) back in)
+    void fade(Color c, float level, float ms);
+    
+    // Jump to a colour and fade back over ms
+    void flash(Color c, float ms);
+    
+    // Rotate entries first..first+count-1 by one every 1000/stepsPerSecond ms
+    // (negative rates rotate the other way); returns an id for stopCycle
+    int cycle(int first, int count, float stepsPerSecond);
+    void stopCycle(int id);
+    
+    // Advance by dt milliseconds. Returns true if current() changed; the
+    // changed entries are dirtyFirst()..dirtyFirst()+dirtyCount()-1
+    bool update(float dtMs);
+    
+    const Palette& current() const { return m_current; }
+    int dirtyFirst() const { return m_dirtyFirst; }
+    int dirtyCount() const { return m_dirtyCount; }
+    
+    // Any effect still moving
+    bool active() const;
+    
+private:
+    struct Cycle {
+        int first, count;
+        float rate;             // Steps per second
+        float phase = 0.0f;     // Steps taken, fractional
+        int shift = 0;          // Whole steps applied
+    };
+    struct Ramp {               // A value moving linearly to a target
+        float from = 0.0f, to = 0.0f;
+        float ms = 0.0f, elapsed = 0.0f;
+        float value() const { return elapsed >= ms ? to : from + (to - from) * (elapsed / ms); }
+        bool done() const { return elapsed >= ms; }
+    };
+    
+    void rebuild(int first, int count);
+    
+    Palette m_base;
+    Palette m_target;           // Crossfade target
+    Palette m_current;
+    Ramp m_crossfade;
+    Ramp m_fade;
+    Ramp m_flash;
+    Color m_fadeColor;
+    Color m_flashColor;
+    std::vector<Cycle> m_cycles;    // Unused slots have count 0
+    bool m_pendingFull = false;     // Changed by a call since the last update
+    int m_pendingFirst = 256;
+    int m_pendingLast = 0;
+    int m_dirtyFirst = 0;
+    int m_dirtyCount = 0;
+};
+
 } // namespace h2d
 
 #endif // H2D_HPP
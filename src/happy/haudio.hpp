@@ -217,6 +217,8 @@ private:
     #include <thread>
 #endif
 
+#include "hprof.hpp"
+
 namespace haudio {
 
 /*==============================================================================
@@ -693,6 +695,7 @@ void Mixer::reset() {
 }
 
 void Mixer::mixAudio(int16_t* buffer, size_t frames) {
+    HPROF_SCOPE("audio mix");
     std::lock_guard<std::mutex> lock(m_mutex);
     
     // Clear buffer
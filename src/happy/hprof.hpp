@@ -0,0 +1,472 @@
+/*
+ * hprof.hpp - Happy Profiler - frame timings from scoped timers
+ * Part of the Happy Library (hwl, h2d, haudio, hprof)
+ *
+ * Named spans from scoped timers (QueryPerformanceCounter / CLOCK_MONOTONIC),
+ * kept per thread in lock-free rings, cut into frames by frameMark, with
+ * per-frame counters. Reports p50/p99 frame times, the parts of each frame
+ * (for h2d::ProfilerOverlay) and exports Chrome trace JSON (chrome://tracing,
+ * ui.perfetto.dev).
+ *
+ * Header-only with no dependencies, so the DLLs can use it as well as the
+ * happy library. On Windows every module that includes it shares the first
+ * module's Profiler, so spans from all DLLs land in one timeline and nest on
+ * one ring per thread.
+ *
+ * Usage:
+ *   hprof::Profiler::instance().setEnabled(true);
+ *   void blitAll() { HPROF_SCOPE("blit"); ... }
+ *   HPROF_COUNT("uploads", bytes);
+ *   hprof::Profiler::instance().frameMark();   // After each present
+ *
+ * Define HPROF_DISABLE to compile the macros out. While disabled at runtime a
+ * scope costs one atomic load.
+ */
+
+#ifndef HPROF_HPP
+#define HPROF_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if defined(_WIN32) || defined(_WIN64)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <time.h>
+    #include <unistd.h>
+    #include <sys/syscall.h>
+#endif
+
+namespace hprof {
+
+/*==============================================================================
+ * Clock
+ *============================================================================*/
+
+// Monotonic nanoseconds
+inline uint64_t now() {
+#if defined(_WIN32) || defined(_WIN64)
+    static const LONGLONG freq = [] { LARGE_INTEGER f; QueryPerformanceFrequency(&f); return f.QuadPart; }();
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return static_cast<uint64_t>(t.QuadPart / freq) * 1000000000ull +
+           static_cast<uint64_t>(t.QuadPart % freq) * 1000000000ull / freq;
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+#endif
+}
+
+inline uint32_t threadId() {
+#if defined(_WIN32) || defined(_WIN64)
+    return static_cast<uint32_t>(GetCurrentThreadId());
+#else
+    return static_cast<uint32_t>(syscall(SYS_gettid));
+#endif
+}
+
+/*==============================================================================
+ * Records
+ *============================================================================*/
+
+struct Span {
+    const char* name = nullptr;     // Must outlive the profiler: a string literal
+    uint64_t start = 0;             // now()
+    uint64_t end = 0;
+    uint32_t thread = 0;
+    uint32_t depth = 0;             // Nesting on its thread, 0 = outermost
+};
+
+// One frame: frameMark to frameMark
+struct Frame {
+    static constexpr int kMaxParts = 12;
+    static constexpr int kMaxCounters = 16;
+
+    struct Part {
+        const char* name;
+        uint64_t ns;
+    };
+
+    uint64_t start = 0;
+    uint64_t end = 0;
+    // Outermost spans of the frame thread, summed by name, in the order they ran
+    std::array<Part, kMaxParts> parts{};
+    int partCount = 0;
+    // Counter totals over the frame, indexed like Profiler::counterName
+    std::array<int64_t, kMaxCounters> counters{};
+
+    double ms() const { return (end - start) / 1e6; }
+};
+
+/*==============================================================================
+ * Profiler
+ *============================================================================*/
+
+class Profiler {
+public:
+    static constexpr int kFrames = 256;             // Frames kept
+    static constexpr int kSpansPerThread = 16384;   // Spans kept per thread
+    static constexpr int kMaxThreads = 32;
+    static constexpr int kMaxDepth = 32;
+
+    // The process's profiler (see the header on DLLs)
+    static Profiler& instance();
+
+#if defined(_WIN32) || defined(_WIN64)
+    ~Profiler() {
+        if (m_ringTls != TLS_OUT_OF_INDEXES) TlsFree(m_ringTls);
+    }
+#endif
+
+    void setEnabled(bool on) { m_enabled.store(on, std::memory_order_relaxed); }
+    bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+    // Close the current frame and open the next; call from the thread that
+    // presents, after the present. That thread's spans make up Frame::parts
+    void frameMark();
+
+    // Spans, usually through HPROF_SCOPE
+    void begin(const char* name);
+    void end();
+
+    // Add to a counter for the current frame (draw calls, bytes uploaded)
+    void count(const char* name, int64_t delta = 1);
+
+    // Completed frames: 0 is the last one
+    int frameCount() const { return static_cast<int>(m_frameIndex < kFrames ? m_frameIndex : kFrames); }
+    const Frame& frame(int back) const { return m_frames[(m_frameIndex - 1 - back) % kFrames]; }
+    double frameMsPercentile(double p) const;
+
+    int counterCount() const { return m_counterCount.load(std::memory_order_acquire); }
+    const char* counterName(int i) const { return m_counterNames[i]; }
+
+    // Every span still held that ended within frame `back`, all threads
+    void spansInFrame(int back, std::vector<Span>& out) const;
+
+    // Chrome trace JSON of everything still held: spans, frames, counters
+    bool writeChromeTrace(const char* path) const;
+
+private:
+    struct ThreadRing {
+        uint32_t thread = 0;
+        std::atomic<uint64_t> head{0};              // Spans written
+        std::array<Span, kSpansPerThread> spans{};
+        std::array<Span, kMaxDepth> open{};         // Begun, not yet ended (owner only)
+        int depth = 0;
+    };
+
+    ThreadRing* threadRing();
+    int counterIndex(const char* name);
+    template <typename Fn> void forEachSpan(Fn fn) const;
+
+    std::atomic<bool> m_enabled{false};
+
+    std::array<std::atomic<ThreadRing*>, kMaxThreads> m_rings{};
+    std::atomic<int> m_ringCount{0};
+#if defined(_WIN32) || defined(_WIN64)
+    DWORD m_ringTls = TLS_OUT_OF_INDEXES;   // Thread's ring; see threadRing. Only
+                                            // the published profiler holds one
+#endif
+
+    std::array<const char*, Frame::kMaxCounters> m_counterNames{};
+    std::array<std::atomic<int64_t>, Frame::kMaxCounters> m_counters{};
+    std::atomic<int> m_counterCount{0};
+    std::atomic_flag m_counterLock = ATOMIC_FLAG_INIT;
+
+    std::array<Frame, kFrames> m_frames{};
+    uint64_t m_frameIndex = 0;          // Frames completed
+    uint64_t m_frameStart = 0;          // 0 until the first frameMark
+};
+
+/*==============================================================================
+ * Scope - times the enclosing block
+ *============================================================================*/
+
+class Scope {
+public:
+    explicit Scope(const char* name) : m_active(Profiler::instance().enabled()) {
+        if (m_active) Profiler::instance().begin(name);
+    }
+    ~Scope() {
+        if (m_active) Profiler::instance().end();
+    }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+private:
+    bool m_active;      // Enabling mid-scope must not end a span never begun
+};
+
+#define HPROF_CONCAT2(a, b) a##b
+#define HPROF_CONCAT(a, b) HPROF_CONCAT2(a, b)
+
+#ifndef HPROF_DISABLE
+#define HPROF_SCOPE(name) hprof::Scope HPROF_CONCAT(hprofScope_, __LINE__)(name)
+#define HPROF_COUNT(name, delta) \
+    do { if (hprof::Profiler::instance().enabled()) hprof::Profiler::instance().count(name, delta); } while (0)
+#define HPROF_FRAME() hprof::Profiler::instance().frameMark()
+#else
+#define HPROF_SCOPE(name) ((void)0)
+#define HPROF_COUNT(name, delta) ((void)0)
+#define HPROF_FRAME() ((void)0)
+#endif
+
+/*==============================================================================
+ * Implementation
+ *============================================================================*/
+
+inline Profiler& Profiler::instance() {
+#if defined(_WIN32) || defined(_WIN64)
+    // Each DLL has its own copy of this header's statics. The first module to
+    // get here publishes its profiler in a per-process named mapping and the
+    // others use that one (the game's DLLs stay loaded until exit). The
+    // mapping stays open for the next module to look. TLS indices are scarce,
+    // so only the profiler that gets published allocates one
+    static Profiler* shared = [] {
+        static Profiler local;
+        char name[64];
+        snprintf(name, sizeof(name), "Local\\hprof.%lu", static_cast<unsigned long>(GetCurrentProcessId()));
+        HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(void*), name);
+        void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(void*)) : nullptr;
+        if (!view) {
+            local.m_ringTls = TlsAlloc();
+            return &local;
+        }
+        PVOID volatile* slot = static_cast<PVOID volatile*>(view);
+        if (void* published = *slot) return static_cast<Profiler*>(published);
+        // Another module can publish between the check and here; the loser
+        // hands its index straight back
+        local.m_ringTls = TlsAlloc();
+        void* prev = InterlockedCompareExchangePointer(slot, &local, nullptr);
+        if (prev) {
+            TlsFree(local.m_ringTls);
+            local.m_ringTls = TLS_OUT_OF_INDEXES;
+        }
+        return prev ? static_cast<Profiler*>(prev) : &local;
+    }();
+    return *shared;
+#else
+    static Profiler profiler;
+    return profiler;
+#endif
+}
+
+// Rings are never freed: a thread may end while its spans are still being read.
+// Readers only look below head, but a thread that laps its ring during a read
+// can still tear a span there; a profiler can live with that.
+// On Windows the thread's ring is found through a TLS index held by the shared
+// Profiler, not a thread_local (which each DLL would have its own copy of), so
+// a thread has one ring and one nesting depth across all modules
+inline Profiler::ThreadRing* Profiler::threadRing() {
+    ThreadRing* const noRing = reinterpret_cast<ThreadRing*>(static_cast<uintptr_t>(1));  // Over kMaxThreads
+#if defined(_WIN32) || defined(_WIN64)
+    if (m_ringTls == TLS_OUT_OF_INDEXES) return nullptr;
+    ThreadRing* ring = static_cast<ThreadRing*>(TlsGetValue(m_ringTls));
+#else
+    static thread_local ThreadRing* current = nullptr;
+    ThreadRing* ring = current;
+#endif
+    if (ring) return ring == noRing ? nullptr : ring;
+    int slot = m_ringCount.fetch_add(1);
+    if (slot < kMaxThreads) {
+        ring = new ThreadRing();
+        ring->thread = threadId();
+        m_rings[slot].store(ring, std::memory_order_release);
+    } else {
+        ring = noRing;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    TlsSetValue(m_ringTls, ring);
+#else
+    current = ring;
+#endif
+    return ring == noRing ? nullptr : ring;
+}
+
+inline void Profiler::begin(const char* name) {
+    ThreadRing* ring = threadRing();
+    if (!ring) return;
+    if (ring->depth < kMaxDepth) {
+        Span& s = ring->open[ring->depth];
+        s.name = name;
+        s.start = now();
+        s.depth = static_cast<uint32_t>(ring->depth);
+    }
+    ring->depth++;
+}
+
+inline void Profiler::end() {
+    ThreadRing* ring = threadRing();
+    if (!ring || ring->depth == 0) return;
+    ring->depth--;
+    if (ring->depth >= kMaxDepth) return;  // Too deep to have been kept
+    Span s = ring->open[ring->depth];
+    s.end = now();
+    s.thread = ring->thread;
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    ring->spans[head % kSpansPerThread] = s;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+inline int Profiler::counterIndex(const char* name) {
+    int n = m_counterCount.load(std::memory_order_acquire);
+    for (int i = 0; i < n; i++) {
+        if (m_counterNames[i] == name || strcmp(m_counterNames[i], name) == 0) return i;
+    }
+    while (m_counterLock.test_and_set(std::memory_order_acquire)) {}
+    n = m_counterCount.load(std::memory_order_relaxed);
+    int index = -1;
+    for (int i = 0; i < n && index < 0; i++) {
+        if (strcmp(m_counterNames[i], name) == 0) index = i;
+    }
+    if (index < 0 && n < Frame::kMaxCounters) {
+        m_counterNames[n] = name;
+        m_counterCount.store(n + 1, std::memory_order_release);
+        index = n;
+    }
+    m_counterLock.clear(std::memory_order_release);
+    return index;
+}
+
+inline void Profiler::count(const char* name, int64_t delta) {
+    int i = counterIndex(name);
+    if (i >= 0) m_counters[i].fetch_add(delta, std::memory_order_relaxed);
+}
+
+template <typename Fn>
+void Profiler::forEachSpan(Fn fn) const {
+    int rings = (std::min)(m_ringCount.load(std::memory_order_acquire), kMaxThreads);
+    for (int r = 0; r < rings; r++) {
+        const ThreadRing* ring = m_rings[r].load(std::memory_order_acquire);
+        if (!ring) continue;
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > kSpansPerThread ? head - kSpansPerThread : 0;
+        // Newest first; a thread's spans are stored in the order they ended
+        for (uint64_t i = head; i > first; i--) {
+            if (!fn(ring->spans[(i - 1) % kSpansPerThread])) break;
+        }
+    }
+}
+
+inline void Profiler::frameMark() {
+    if (!enabled()) {
+        m_frameStart = 0;   // The next frame starts at the next mark after enabling
+        return;
+    }
+    uint64_t t = now();
+    uint32_t thread = threadId();
+    if (m_frameStart) {
+        Frame& f = m_frames[m_frameIndex % kFrames];
+        f = Frame();
+        f.start = m_frameStart;
+        f.end = t;
+        forEachSpan([&](const Span& s) {
+            if (s.end < f.start) return false;
+            if (s.thread != thread || s.depth != 0 || s.end > f.end) return true;
+            int p = 0;
+            while (p < f.partCount && f.parts[p].name != s.name && strcmp(f.parts[p].name, s.name) != 0) p++;
+            if (p == f.partCount) {
+                // Seen newest first, so new names go in front: parts end up in the
+                // order the frame ran them
+                if (p == Frame::kMaxParts) return true;
+                std::copy_backward(f.parts.begin(), f.parts.begin() + f.partCount, f.parts.begin() + f.partCount + 1);
+                f.parts[0] = { s.name, 0 };
+                f.partCount++;
+                p = 0;
+            }
+            f.parts[p].ns += s.end - (std::max)(s.start, f.start);
+            return true;
+        });
+        for (int i = 0; i < counterCount(); i++) {
+            f.counters[i] = m_counters[i].exchange(0, std::memory_order_relaxed);
+        }
+        m_frameIndex++;
+    } else {
+        for (auto& c : m_counters) c.store(0, std::memory_order_relaxed);
+    }
+    m_frameStart = t;
+}
+
+inline double Profiler::frameMsPercentile(double p) const {
+    int n = frameCount();
+    if (!n) return 0.0;
+    std::vector<double> ms(n);
+    for (int i = 0; i < n; i++) ms[i] = frame(i).ms();
+    int k = std::clamp(static_cast<int>(p / 100.0 * n), 0, n - 1);
+    std::nth_element(ms.begin(), ms.begin() + k, ms.end());
+    return ms[k];
+}
+
+inline void Profiler::spansInFrame(int back, std::vector<Span>& out) const {
+    out.clear();
+    if (back >= frameCount()) return;
+    const Frame& f = frame(back);
+    forEachSpan([&](const Span& s) {
+        if (s.end < f.start) return false;
+        if (s.end <= f.end) out.push_back(s);
+        return true;
+    });
+}
+
+inline bool Profiler::writeChromeTrace(const char* path) const {
+    FILE* file = fopen(path, "w");
+    if (!file) return false;
+
+    // Times in microseconds from the oldest frame held (or span, if earlier)
+    uint64_t origin = frameCount() ? frame(frameCount() - 1).start : now();
+    forEachSpan([&](const Span& s) {
+        origin = (std::min)(origin, s.start);
+        return true;
+    });
+    auto us = [&](uint64_t t) { return (t - origin) / 1000.0; };
+    auto putName = [&](const char* name) {
+        fputc('"', file);
+        for (const char* c = name; *c; c++) {
+            if (*c == '"' || *c == '\\') fputc('\\', file);
+            if (static_cast<unsigned char>(*c) >= 0x20) fputc(*c, file);
+        }
+        fputc('"', file);
+    };
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"frames\"}}");
+    for (int i = frameCount() - 1; i >= 0; i--) {
+        const Frame& f = frame(i);
+        fprintf(file, ",\n{\"name\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f}",
+                us(f.start), (f.end - f.start) / 1000.0);
+        if (!counterCount()) continue;
+        fprintf(file, ",\n{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{", us(f.start));
+        for (int c = 0; c < counterCount(); c++) {
+            if (c) fputc(',', file);
+            putName(counterName(c));
+            fprintf(file, ":%lld", static_cast<long long>(f.counters[c]));
+        }
+        fprintf(file, "}}");
+    }
+    forEachSpan([&](const Span& s) {
+        fprintf(file, ",\n{\"name\":");
+        putName(s.name);
+        fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                s.thread, us(s.start), (s.end - s.start) / 1000.0);
+        return true;
+    });
+    fprintf(file, "\n]}\n");
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
+
+} // namespace hprof
+
+#endif // HPROF_HPP
@@ -9,7 +9,7 @@
  * 
  * Usage:
  *   #define HWL_IMPLEMENTATION in ONE .cpp file before including
- *   Link: -lX11 -lGL (Linux), -lopengl32 -lgdi32 (Windows)
+ *   Link: -lX11 -lGL -ldl -lpthread (Linux), -lopengl32 -lgdi32 (Windows)
  */
 
 #ifndef HWL_HPP
@@ -20,7 +20,10 @@
 #include <optional>
 #include <functional>
 #include <array>
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <deque>
 
 /*==============================================================================
  * Platform Detection
@@ -50,6 +53,7 @@ enum class EventType {
     MouseScroll,
     Focus,
     Blur,
+    MouseRaw,       // Unaccelerated device motion, see HwlWindow::setRawMouse
 };
 
 enum class MouseButton {
@@ -111,6 +115,75 @@ struct Event {
     float scroll_y = 0.0f;
     int width = 0;
     int height = 0;
+    float delta_x = 0.0f;   // MouseRaw: device counts since the last report
+    float delta_y = 0.0f;
+    uint64_t time_ns = 0;   // getTimeNs() clock: when the input arrived, as near as the platform tells
+};
+
+/*==============================================================================
+ * Clock
+ *============================================================================*/
+// Monotonic nanoseconds (QueryPerformanceCounter / CLOCK_MONOTONIC); the
+// clock of Event::time_ns, for fixed timesteps and latency measurement
+uint64_t getTimeNs();
+
+/*==============================================================================
+ * SpscRing - fixed-capacity lock-free queue, one producer thread, one consumer
+ *============================================================================*/
+template <typename T, size_t Capacity>
+class SpscRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+    
+public:
+    // Producer side: false when full
+    bool push(const T& item) {
+        size_t head = head_index.load(std::memory_order_relaxed);
+        if (head - tail_index.load(std::memory_order_acquire) == Capacity) return false;
+        items[head & (Capacity - 1)] = item;
+        head_index.store(head + 1, std::memory_order_release);
+        return true;
+    }
+    
+    // Consumer side: the oldest item, valid until pop(); nullptr when empty
+    T* front() {
+        size_t tail = tail_index.load(std::memory_order_relaxed);
+        if (tail == head_index.load(std::memory_order_acquire)) return nullptr;
+        return &items[tail & (Capacity - 1)];
+    }
+    
+    void pop() {
+        tail_index.store(tail_index.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    
+    bool pop(T& out) {
+        T* item = front();
+        if (!item) return false;
+        out = *item;
+        pop();
+        return true;
+    }
+    
+    // Exact on either side's own thread, a snapshot anywhere else
+    size_t size() const {
+        return head_index.load(std::memory_order_acquire) - tail_index.load(std::memory_order_acquire);
+    }
+    static constexpr size_t capacity() { return Capacity; }
+    
+private:
+    // Each index on its own cache line so the two threads do not share one
+    alignas(64) std::atomic<size_t> head_index{0};
+    alignas(64) std::atomic<size_t> tail_index{0};
+    alignas(64) std::array<T, Capacity> items{};
+};
+
+/*==============================================================================
+ * InputStats - what the input thread's ring has been through
+ *============================================================================*/
+struct InputStats {
+    uint64_t delivered = 0;     // Events pushed into the ring
+    uint64_t coalesced = 0;     // Mouse reports folded into a neighbour instead
+    uint64_t dropped = 0;       // Events lost with the ring and the held list full (motion first)
+    size_t high_water = 0;      // Most events waiting at once
 };
 
 /*==============================================================================
@@ -135,6 +208,12 @@ public:
     
     // Events
     virtual std::optional<Event> pollEvent() = 0;
+    // Block until an event is queued (true), the timeout passes or wakeUp is
+    // called (false); timeoutMs < 0 waits forever. For menus and viewers that
+    // only redraw on input, instead of spinning on pollEvent
+    virtual bool waitEvents(int timeoutMs = -1) = 0;
+    // Return a waitEvents blocked on the window's thread; safe from any thread
+    virtual void wakeUp() = 0;
     
     // Rendering
     virtual void swapBuffers() = 0;
@@ -156,10 +235,89 @@ public:
     virtual void releaseMouse() = 0;
     virtual bool isMouseGrabbed() const = 0;
     
+    // Raw mouse: MouseRaw events with unaccelerated deltas at the device's own
+    // rate (Raw Input / XInput2 raw motion) while the window has focus, next
+    // to the usual MouseMove. Returns false where the platform has no support
+    virtual bool setRawMouse(bool enable) = 0;
+    virtual bool isRawMouse() const = 0;
+    
+    // Input thread: keyboard and mouse are read on a thread of their own into
+    // a lock-free ring that pollEvent drains (in time order with the window
+    // events, which stay on this thread), so input is picked up as it arrives
+    // rather than when a busy frame next pumps. Key and button state follow the
+    // events as they are drained. Runs of mouse moves are coalesced and a full
+    // ring is counted in inputStats
+    static constexpr size_t kInputRingSize = 1024;
+    virtual bool startInputThread() = 0;
+    virtual void stopInputThread() = 0;
+    virtual bool hasInputThread() const = 0;
+    virtual InputStats inputStats() const = 0;
+    
 protected:
     HwlWindow() = default;
 };
 
+/*==============================================================================
+ * LatencyProbe - input-to-present latency
+ *
+ * Pass it the input events the game acted on and call present() right after
+ * swapBuffers: each presented frame records how long the oldest input handled
+ * since the previous present had been waiting, i.e. the latency of the frame
+ * that first showed it. Swap returning is not scanout, so this is a lower
+ * bound; glFinish before present() and add a refresh interval for the
+ * photon side.
+ *============================================================================*/
+class LatencyProbe {
+public:
+    static constexpr int kSamples = 256;
+    
+    void input(const Event& e) {
+        switch (e.type) {
+            case EventType::KeyDown: case EventType::KeyUp:
+            case EventType::MouseDown: case EventType::MouseUp:
+            case EventType::MouseMove: case EventType::MouseScroll: case EventType::MouseRaw:
+                if (e.time_ns && (!pending_ns || e.time_ns < pending_ns)) pending_ns = e.time_ns;
+                break;
+            default:
+                break;
+        }
+    }
+    
+    // Latency of this frame in ms, or -1 if it carried no new input
+    double present(uint64_t presentNs = getTimeNs()) {
+        if (!pending_ns) return -1.0;
+        uint64_t ns = presentNs > pending_ns ? presentNs - pending_ns : 0;
+        pending_ns = 0;
+        latency_us[count % kSamples] = static_cast<uint32_t>(std::min<uint64_t>(ns / 1000, UINT32_MAX));
+        count++;
+        return ns / 1e6;
+    }
+    
+    void reset() { count = 0; pending_ns = 0; }
+    
+    // Over the last kSamples frames that presented input
+    int samples() const { return static_cast<int>(std::min<uint64_t>(count, kSamples)); }
+    double lastMs() const { return count ? latency_us[(count - 1) % kSamples] / 1000.0 : 0.0; }
+    double averageMs() const {
+        double sum = 0.0;
+        for (int i = 0; i < samples(); i++) sum += latency_us[i];
+        return samples() ? sum / samples() / 1000.0 : 0.0;
+    }
+    double percentileMs(double p) const {
+        int n = samples();
+        if (!n) return 0.0;
+        std::array<uint32_t, kSamples> sorted = latency_us;
+        int k = std::clamp(static_cast<int>(p / 100.0 * n), 0, n - 1);
+        std::nth_element(sorted.begin(), sorted.begin() + k, sorted.begin() + n);
+        return sorted[k] / 1000.0;
+    }
+    
+private:
+    std::array<uint32_t, kSamples> latency_us{};
+    uint64_t count = 0;
+    uint64_t pending_ns = 0;
+};
+
 /*==============================================================================
  * GL loader helper
  *============================================================================*/
@@ -176,6 +334,7 @@ void* getGLProc(const char* name);
 
 #include <cstring>
 #include <queue>
+#include <thread>
 
 /*==============================================================================
  * Platform includes - MUST be outside namespace
@@ -193,10 +352,106 @@ void* getGLProc(const char* name);
     #include <X11/keysym.h>
     #include <GL/glx.h>
     #include <dlfcn.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <time.h>
+    #include <unistd.h>
+    #if __has_include(<X11/extensions/XInput2.h>)
+        #include <X11/extensions/XInput2.h>
+        #define HWL_XINPUT2
+    #endif
 #endif
 
 namespace hwl {
 
+/*==============================================================================
+ * InputQueue - the input thread's end of the ring
+ *
+ * Events wait in a held list, in arrival order, until the ring takes them.
+ * A run of MouseMove collapses to its latest position, and MouseRaw deltas add
+ * up, until another event or an idle moment (flush) pushes them. A 1000 Hz
+ * mouse then takes a slot per batch instead of per report. Presses and
+ * releases are pushed at once; a full ring makes them wait like the moves.
+ * Only a full held list loses events, and then motion goes first. Folded
+ * reports keep the time of the first, so LatencyProbe still sees how long
+ * the run waited.
+ *============================================================================*/
+struct InputQueue {
+    static constexpr size_t kMaxHeld = HwlWindow::kInputRingSize;  // Waiting behind a full ring
+    
+    SpscRing<Event, HwlWindow::kInputRingSize> ring;
+    std::atomic<uint64_t> delivered{0};
+    std::atomic<uint64_t> coalesced{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<size_t> high_water{0};
+    std::atomic<bool> consumer_waiting{false};  // Set by a blocked waitEvents: signal it after pushing
+    std::deque<Event> held;                     // Not in the ring yet, input thread only
+    
+    static bool isMotion(EventType type) {
+        return type == EventType::MouseMove || type == EventType::MouseRaw;
+    }
+    
+    void add(const Event& e) {
+        if (isMotion(e.type)) {
+            // Fold into its kind in the motion at the end of the list (one of each at most)
+            for (auto it = held.rbegin(); it != held.rend() && isMotion(it->type); ++it) {
+                if (it->type != e.type) continue;
+                if (e.type == EventType::MouseMove) {
+                    uint64_t first = it->time_ns;
+                    *it = e;
+                    it->time_ns = first;
+                } else {
+                    it->delta_x += e.delta_x;
+                    it->delta_y += e.delta_y;
+                }
+                coalesced.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            hold(e);
+            return;
+        }
+        hold(e);
+        flush();
+    }
+    
+    void hold(const Event& e) {
+        if (held.size() >= kMaxHeld) {
+            // Make room by losing held motion; a press or release only goes when there is none
+            auto victim = isMotion(e.type) ? held.end()
+                        : std::find_if(held.begin(), held.end(), [](const Event& h) { return isMotion(h.type); });
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            if (victim == held.end()) return;
+            held.erase(victim);
+        }
+        held.push_back(e);
+    }
+    
+    // Push the held events in order; false while the ring is too full to take them all
+    bool flush() {
+        while (!held.empty() && push(held.front())) held.pop_front();
+        return held.empty();
+    }
+    
+    bool push(const Event& e) {
+        if (!ring.push(e)) return false;
+        delivered.fetch_add(1, std::memory_order_relaxed);
+        size_t waiting = ring.size();
+        if (waiting > high_water.load(std::memory_order_relaxed)) {
+            high_water.store(waiting, std::memory_order_relaxed);
+        }
+        return true;
+    }
+    
+    InputStats stats() const {
+        InputStats st;
+        st.delivered = delivered.load(std::memory_order_relaxed);
+        st.coalesced = coalesced.load(std::memory_order_relaxed);
+        st.dropped = dropped.load(std::memory_order_relaxed);
+        st.high_water = high_water.load(std::memory_order_relaxed);
+        return st;
+    }
+};
+
 /*==============================================================================
  * Windows Implementation
  *============================================================================*/
@@ -221,6 +476,18 @@ typedef BOOL  (WINAPI* PFNWGLSWAPINTERVALEXTPROC)(int);
 #define WGL_DEPTH_BITS_ARB                0x2022
 #define WGL_STENCIL_BITS_ARB              0x2023
 
+// Posted by wakeUp to end a waitEvents early
+static const UINT kWakeMessage = WM_APP + 0x48;
+
+uint64_t getTimeNs() {
+    static const LONGLONG freq = [] { LARGE_INTEGER f; QueryPerformanceFrequency(&f); return f.QuadPart; }();
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    // Split so the multiply cannot overflow at high counter frequencies
+    return static_cast<uint64_t>(now.QuadPart / freq) * 1000000000ull +
+           static_cast<uint64_t>(now.QuadPart % freq) * 1000000000ull / freq;
+}
+
 class WindowsWindow : public HwlWindow {
 public:
     HWND hwnd = nullptr;
@@ -230,6 +497,8 @@ public:
     int win_width = 0;
     int win_height = 0;
     bool mouse_grabbed = false;
+    bool raw_mouse = false;
+    bool woken = false;
     
     std::array<bool, static_cast<size_t>(Key::Count)> keys{};
     std::array<bool, 3> mouse_buttons{};
@@ -237,7 +506,22 @@ public:
     int mouse_y = 0;
     std::queue<Event> event_queue;
     
+    // Input thread: window messages only reach the thread that made the
+    // window, so it reads keyboard and mouse as Raw Input on a message-only
+    // window of its own
+    std::thread input_thread;
+    HWND input_hwnd = nullptr;
+    HANDLE input_ready = nullptr;   // Auto-reset, set for a waitEvents blocked on an empty ring
+    std::atomic<bool> input_raw{false};
+    int input_mouse_x = -1;
+    int input_mouse_y = -1;
+    InputQueue input;
+    
+    void handleRawInput(HRAWINPUT handle);
+    void inputLoop(HANDLE started);
+    
     ~WindowsWindow() override {
+        stopInputThread();
         if (hglrc) {
             wglMakeCurrent(nullptr, nullptr);
             wglDeleteContext(hglrc);
@@ -249,18 +533,61 @@ public:
     bool shouldClose() const override { return should_close; }
     void setShouldClose(bool close) override { should_close = close; }
     
-    std::optional<Event> pollEvent() override {
+    void pumpMessages() {
         MSG msg;
         while (PeekMessageW(&msg, hwnd, 0, 0, PM_REMOVE)) {
             TranslateMessage(&msg);
             DispatchMessageW(&msg);
         }
-        if (!event_queue.empty()) {
+    }
+    
+    std::optional<Event> pollEvent() override {
+        pumpMessages();
+        return nextEvent();
+    }
+    
+    // Window events and the input thread's ring, merged in time order
+    std::optional<Event> nextEvent() {
+        const Event* in = input.ring.front();
+        if (!event_queue.empty() && (!in || event_queue.front().time_ns <= in->time_ns)) {
             Event e = event_queue.front();
             event_queue.pop();
             return e;
         }
-        return std::nullopt;
+        if (!in) return std::nullopt;
+        Event e = *in;
+        input.ring.pop();
+        applyEvent(e);
+        return e;
+    }
+    
+    bool hasEvents() {
+        return !event_queue.empty() || input.ring.size() > 0;
+    }
+    
+    bool waitEvents(int timeoutMs) override {
+        uint64_t start = getTimeNs();
+        for (;;) {
+            pumpMessages();
+            input.consumer_waiting.store(true);
+            if (hasEvents() || woken) break;
+            DWORD wait = INFINITE;
+            if (timeoutMs >= 0) {
+                uint64_t elapsedMs = (getTimeNs() - start) / 1000000;
+                if (elapsedMs >= static_cast<uint64_t>(timeoutMs)) break;
+                wait = static_cast<DWORD>(timeoutMs - elapsedMs);
+            }
+            // Messages that make no Event (paint, timers) just loop round
+            MsgWaitForMultipleObjectsEx(input_ready ? 1 : 0, &input_ready, wait, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+            input.consumer_waiting.store(false);
+        }
+        input.consumer_waiting.store(false);
+        woken = false;
+        return hasEvents();
+    }
+    
+    void wakeUp() override {
+        PostMessageW(hwnd, kWakeMessage, 0, 0);
     }
     
     void swapBuffers() override {
@@ -328,8 +655,101 @@ public:
     bool isMouseGrabbed() const override {
         return mouse_grabbed;
     }
+    
+    bool setRawMouse(bool enable) override {
+        if (enable == raw_mouse) return true;
+        if (input_thread.joinable()) {
+            // The input thread owns the mouse's Raw Input already
+            input_raw.store(enable);
+            raw_mouse = enable;
+            return true;
+        }
+        RAWINPUTDEVICE rid{};
+        rid.usUsagePage = 0x01;  // Generic desktop
+        rid.usUsage = 0x02;      // Mouse
+        rid.dwFlags = enable ? 0 : RIDEV_REMOVE;
+        rid.hwndTarget = enable ? hwnd : nullptr;
+        if (!RegisterRawInputDevices(&rid, 1, sizeof(rid))) return false;
+        raw_mouse = enable;
+        return true;
+    }
+    
+    bool isRawMouse() const override {
+        return raw_mouse;
+    }
+    
+    bool startInputThread() override {
+        if (input_thread.joinable()) return true;
+        input_ready = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+        HANDLE started = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        if (!input_ready || !started) {
+            if (input_ready) CloseHandle(input_ready);
+            if (started) CloseHandle(started);
+            input_ready = nullptr;
+            return false;
+        }
+        // One Raw Input target per device class: the thread takes the mouse over
+        bool raw = raw_mouse;
+        setRawMouse(false);
+        raw_mouse = raw;
+        input_raw.store(raw);
+        input_thread = std::thread([this, started] { inputLoop(started); });
+        WaitForSingleObject(started, INFINITE);
+        CloseHandle(started);
+        if (!input_hwnd) {
+            input_thread.join();
+            CloseHandle(input_ready);
+            input_ready = nullptr;
+            raw_mouse = false;
+            setRawMouse(raw);
+            return false;
+        }
+        return true;
+    }
+    
+    void stopInputThread() override {
+        if (!input_thread.joinable()) return;
+        PostMessageW(input_hwnd, WM_CLOSE, 0, 0);
+        input_thread.join();
+        input_hwnd = nullptr;
+        CloseHandle(input_ready);
+        input_ready = nullptr;
+        if (raw_mouse) {
+            raw_mouse = false;
+            setRawMouse(true);
+        }
+    }
+    
+    bool hasInputThread() const override {
+        return input_thread.joinable();
+    }
+    
+    InputStats inputStats() const override {
+        return input.stats();
+    }
+    
+    void applyEvent(const Event& e) {
+        switch (e.type) {
+            case EventType::KeyDown:
+            case EventType::KeyUp:
+                keys[static_cast<size_t>(e.key)] = e.type == EventType::KeyDown;
+                break;
+            case EventType::MouseDown:
+            case EventType::MouseUp:
+                mouse_buttons[static_cast<size_t>(e.mouse_button)] = e.type == EventType::MouseDown;
+                break;
+            case EventType::MouseMove:
+                mouse_x = e.mouse_x;
+                mouse_y = e.mouse_y;
+                break;
+            default:
+                break;
+        }
+    }
 
-    void pushEvent(const Event& e) {
+    // Stamped on dispatch: GetMessageTime only has the 10-16 ms tick resolution
+    void pushEvent(Event e) {
+        e.time_ns = getTimeNs();
         event_queue.push(e);
     }
 };
@@ -387,6 +807,12 @@ static LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lPara
     WindowsWindow* win = reinterpret_cast<WindowsWindow*>(GetWindowLongPtrW(hwnd, GWLP_USERDATA));
     if (!win) return DefWindowProcW(hwnd, msg, wParam, lParam);
     
+    // With the input thread running, keyboard and mouse come from its Raw Input
+    if (win->input_thread.joinable() &&
+        ((msg >= WM_KEYFIRST && msg <= WM_KEYLAST) || (msg >= WM_MOUSEFIRST && msg <= WM_MOUSELAST))) {
+        return DefWindowProcW(hwnd, msg, wParam, lParam);
+    }
+    
     Event e;
     switch (msg) {
         case WM_CLOSE:
@@ -486,10 +912,163 @@ static LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lPara
             e.type = EventType::Blur;
             win->pushEvent(e);
             return 0;
+            
+        case WM_INPUT: {
+            RAWINPUT raw;
+            UINT size = sizeof(raw);
+            if (GetRawInputData(reinterpret_cast<HRAWINPUT>(lParam), RID_INPUT, &raw, &size,
+                                sizeof(RAWINPUTHEADER)) != static_cast<UINT>(-1) &&
+                raw.header.dwType == RIM_TYPEMOUSE && !(raw.data.mouse.usFlags & MOUSE_MOVE_ABSOLUTE) &&
+                (raw.data.mouse.lLastX || raw.data.mouse.lLastY)) {
+                e.type = EventType::MouseRaw;
+                e.delta_x = static_cast<float>(raw.data.mouse.lLastX);
+                e.delta_y = static_cast<float>(raw.data.mouse.lLastY);
+                win->pushEvent(e);
+            }
+            break;  // DefWindowProc releases the input buffer
+        }
+            
+        case kWakeMessage:
+            win->woken = true;
+            return 0;
     }
     return DefWindowProcW(hwnd, msg, wParam, lParam);
 }
 
+static LRESULT CALLBACK InputProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+    WindowsWindow* win = reinterpret_cast<WindowsWindow*>(GetWindowLongPtrW(hwnd, GWLP_USERDATA));
+    if (msg == WM_INPUT && win) win->handleRawInput(reinterpret_cast<HRAWINPUT>(lParam));
+    if (msg == WM_CLOSE) {
+        PostQuitMessage(0);
+        return 0;
+    }
+    return DefWindowProcW(hwnd, msg, wParam, lParam);  // Also releases WM_INPUT's buffer
+}
+
+void WindowsWindow::inputLoop(HANDLE started) {
+    WNDCLASSEXW wc{};
+    wc.cbSize = sizeof(wc);
+    wc.lpfnWndProc = InputProc;
+    wc.hInstance = GetModuleHandleW(nullptr);
+    wc.lpszClassName = L"HwlInputClass";
+    RegisterClassExW(&wc);
+    HWND sink = CreateWindowExW(0, L"HwlInputClass", L"", 0, 0, 0, 0, 0, HWND_MESSAGE, nullptr, wc.hInstance, nullptr);
+    
+    // Sink mode reports input whichever window is in front; handleRawInput keeps ours
+    RAWINPUTDEVICE rid[2] = {};
+    for (RAWINPUTDEVICE& r : rid) {
+        r.usUsagePage = 0x01;  // Generic desktop
+        r.dwFlags = RIDEV_INPUTSINK;
+        r.hwndTarget = sink;
+    }
+    rid[0].usUsage = 0x02;     // Mouse
+    rid[1].usUsage = 0x06;     // Keyboard
+    if (sink) SetWindowLongPtrW(sink, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(this));
+    if (sink && !RegisterRawInputDevices(rid, 2, sizeof(RAWINPUTDEVICE))) {
+        DestroyWindow(sink);
+        sink = nullptr;
+    }
+    input_hwnd = sink;
+    SetEvent(started);
+    if (!sink) return;
+    
+    bool running = true;
+    while (running) {
+        MSG msg;
+        while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
+            if (msg.message == WM_QUIT) running = false;
+            else DispatchMessageW(&msg);
+        }
+        // Held events that a full ring refused are retried every millisecond
+        bool held = !input.flush();
+        if (input.consumer_waiting.load()) SetEvent(input_ready);
+        if (running) MsgWaitForMultipleObjectsEx(0, nullptr, held ? 1 : INFINITE, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+    }
+    
+    for (RAWINPUTDEVICE& r : rid) {
+        r.dwFlags = RIDEV_REMOVE;
+        r.hwndTarget = nullptr;
+    }
+    RegisterRawInputDevices(rid, 2, sizeof(RAWINPUTDEVICE));
+    DestroyWindow(sink);
+}
+
+// On the input thread: Raw Input to the Events the window would have made
+void WindowsWindow::handleRawInput(HRAWINPUT handle) {
+    RAWINPUT raw;
+    UINT size = sizeof(raw);
+    if (GetRawInputData(handle, RID_INPUT, &raw, &size, sizeof(RAWINPUTHEADER)) == static_cast<UINT>(-1)) return;
+    if (GetForegroundWindow() != hwnd) return;
+    Event e;
+    e.time_ns = getTimeNs();
+    
+    if (raw.header.dwType == RIM_TYPEKEYBOARD) {
+        const RAWKEYBOARD& kb = raw.data.keyboard;
+        if (kb.VKey == 0xFF) return;  // Fake key, part of an escaped sequence
+        // The lParam translateKey reads: scan code in bits 16-23, extended flag in bit 24
+        LPARAM lParam = (static_cast<LPARAM>(kb.MakeCode & 0xFF) << 16) | ((kb.Flags & RI_KEY_E0) ? 0x01000000 : 0);
+        e.type = (kb.Flags & RI_KEY_BREAK) ? EventType::KeyUp : EventType::KeyDown;
+        e.key = translateKey(kb.VKey, lParam);
+        input.add(e);
+        return;
+    }
+    if (raw.header.dwType != RIM_TYPEMOUSE) return;
+    
+    // Moves and presses count inside the client area, as window messages do
+    const RAWMOUSE& m = raw.data.mouse;
+    POINT pt;
+    RECT client;
+    GetCursorPos(&pt);
+    ScreenToClient(hwnd, &pt);
+    GetClientRect(hwnd, &client);
+    bool inside = PtInRect(&client, pt) != FALSE;
+    
+    if (m.lLastX || m.lLastY) {
+        if (!(m.usFlags & MOUSE_MOVE_ABSOLUTE) && input_raw.load(std::memory_order_relaxed)) {
+            Event r = e;
+            r.type = EventType::MouseRaw;
+            r.delta_x = static_cast<float>(m.lLastX);
+            r.delta_y = static_cast<float>(m.lLastY);
+            input.add(r);
+        }
+        if (inside && (pt.x != input_mouse_x || pt.y != input_mouse_y)) {
+            input_mouse_x = pt.x;
+            input_mouse_y = pt.y;
+            Event move = e;
+            move.type = EventType::MouseMove;
+            move.mouse_x = pt.x;
+            move.mouse_y = pt.y;
+            input.add(move);
+        }
+    }
+    
+    static const struct { USHORT down, up; MouseButton button; } kButtons[] = {
+        { RI_MOUSE_LEFT_BUTTON_DOWN, RI_MOUSE_LEFT_BUTTON_UP, MouseButton::Left },
+        { RI_MOUSE_RIGHT_BUTTON_DOWN, RI_MOUSE_RIGHT_BUTTON_UP, MouseButton::Right },
+        { RI_MOUSE_MIDDLE_BUTTON_DOWN, RI_MOUSE_MIDDLE_BUTTON_UP, MouseButton::Middle },
+    };
+    for (const auto& b : kButtons) {
+        if ((m.usButtonFlags & b.down) && inside) {
+            Event press = e;
+            press.type = EventType::MouseDown;
+            press.mouse_button = b.button;
+            input.add(press);
+        }
+        if (m.usButtonFlags & b.up) {  // Always, so no button is left held
+            Event release = e;
+            release.type = EventType::MouseUp;
+            release.mouse_button = b.button;
+            input.add(release);
+        }
+    }
+    if ((m.usButtonFlags & RI_MOUSE_WHEEL) && inside) {
+        Event wheel = e;
+        wheel.type = EventType::MouseScroll;
+        wheel.scroll_y = static_cast<SHORT>(m.usButtonData) / 120.0f;
+        input.add(wheel);
+    }
+}
+
 std::unique_ptr<HwlWindow> HwlWindow::create(const std::string& title, int width, int height) {
     auto win = std::make_unique<WindowsWindow>();
     win->win_width = width;
@@ -565,6 +1144,18 @@ void* getGLProc(const char* name) {
 // Use X11's Window type explicitly
 using XWindow = ::Window;
 
+// The window's connection keeps the window events; with an input thread the
+// input events move to a second connection of its own
+static const long kWindowEventMask = ExposureMask | StructureNotifyMask | FocusChangeMask;
+static const long kInputEventMask = KeyPressMask | KeyReleaseMask | ButtonPressMask | ButtonReleaseMask |
+                                    PointerMotionMask;
+
+uint64_t getTimeNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
 class X11Window : public HwlWindow {
 public:
     Display* display = nullptr;
@@ -575,7 +1166,14 @@ public:
     int win_width = 0;
     int win_height = 0;
     bool mouse_grabbed = false;
+    bool raw_mouse = false;
+    bool focused = false;
     Cursor invisible_cursor = None;
+    int wake_pipe[2] = { -1, -1 };
+    int xi_opcode = -1;     // XInput2 major opcode once raw mouse has been set up
+#ifdef HWL_XINPUT2
+    decltype(&XISelectEvents) xi_select_events = nullptr;
+#endif
     
     std::array<bool, static_cast<size_t>(Key::Count)> keys{};
     std::array<bool, 3> mouse_buttons{};
@@ -583,6 +1181,18 @@ public:
     int mouse_y = 0;
     
     std::queue<Event> event_queue;
+    std::atomic<bool> wake_requested{false};
+    
+    // Input thread: its own connection, so Xlib needs no XInitThreads, and
+    // requests the game thread hands it (grabs and raw motion are per connection)
+    static constexpr uint32_t kRequestStop = 1, kRequestGrab = 2, kRequestUngrab = 4;
+    static constexpr uint32_t kRequestRawOn = 8, kRequestRawOff = 16;
+    std::thread input_thread;
+    Display* input_display = nullptr;
+    bool input_focused = false;
+    int input_pipe[2] = { -1, -1 };
+    std::atomic<uint32_t> input_requests{0};
+    InputQueue input;
     
     void createInvisibleCursor() {
         if (invisible_cursor == None) {
@@ -595,6 +1205,7 @@ public:
     }
     
     ~X11Window() override {
+        stopInputThread();
         if (invisible_cursor != None) {
             XFreeCursor(display, invisible_cursor);
         }
@@ -604,23 +1215,80 @@ public:
         }
         if (xwindow) XDestroyWindow(display, xwindow);
         if (display) XCloseDisplay(display);
+        if (wake_pipe[0] >= 0) close(wake_pipe[0]);
+        if (wake_pipe[1] >= 0) close(wake_pipe[1]);
     }
     
     bool shouldClose() const override { return should_close; }
     void setShouldClose(bool close) override { should_close = close; }
     
-    std::optional<Event> pollEvent() override {
+    void pumpEvents() {
         while (XPending(display) > 0) {
             XEvent xev;
             XNextEvent(display, &xev);
-            handleEvent(xev);
+            handleEvent(display, xev);
         }
-        if (!event_queue.empty()) {
+    }
+    
+    std::optional<Event> pollEvent() override {
+        pumpEvents();
+        return nextEvent();
+    }
+    
+    // Window events and the input thread's ring, merged in time order
+    std::optional<Event> nextEvent() {
+        const Event* in = input.ring.front();
+        if (!event_queue.empty() && (!in || event_queue.front().time_ns <= in->time_ns)) {
             Event e = event_queue.front();
             event_queue.pop();
             return e;
         }
-        return std::nullopt;
+        if (!in) return std::nullopt;
+        Event e = *in;
+        input.ring.pop();
+        applyEvent(e);
+        return e;
+    }
+    
+    bool hasEvents() {
+        return !event_queue.empty() || input.ring.size() > 0;
+    }
+    
+    bool waitEvents(int timeoutMs) override {
+        uint64_t start = getTimeNs();
+        for (;;) {
+            pumpEvents();   // XPending also flushes requests, so none are stuck while we sleep
+            input.consumer_waiting.store(true);
+            if (hasEvents() || wake_requested.exchange(false)) break;
+            int wait = -1;
+            if (timeoutMs >= 0) {
+                uint64_t elapsedMs = (getTimeNs() - start) / 1000000;
+                if (elapsedMs >= static_cast<uint64_t>(timeoutMs)) break;
+                wait = static_cast<int>(timeoutMs - elapsedMs);
+            }
+            pollfd fds[2] = { { ConnectionNumber(display), POLLIN, 0 }, { wake_pipe[0], POLLIN, 0 } };
+            int ready = poll(fds, 2, wait);
+            input.consumer_waiting.store(false);
+            if (ready > 0 && (fds[1].revents & POLLIN)) drainPipe(wake_pipe[0]);
+            // X traffic that makes no Event (expose, reparent) just loops round
+        }
+        input.consumer_waiting.store(false);
+        return hasEvents();
+    }
+    
+    void wakeUp() override {
+        wake_requested.store(true);
+        signalPipe(wake_pipe[1]);
+    }
+    
+    static void signalPipe(int fd) {
+        char c = 0;
+        if (write(fd, &c, 1) < 0) {}  // Pipe full: a wake is already pending
+    }
+    
+    static void drainPipe(int fd) {
+        char drain[64];
+        while (read(fd, drain, sizeof(drain)) > 0) {}
     }
     
     void swapBuffers() override {
@@ -665,7 +1333,13 @@ public:
     }
     
     void grabMouse() override {
-        if (!mouse_grabbed) {
+        if (!mouse_grabbed && input_thread.joinable()) {
+            // Pointer events go to the grabbing connection, so the input thread grabs
+            createInvisibleCursor();
+            XFlush(display);
+            request(kRequestGrab, kRequestUngrab);
+            mouse_grabbed = true;
+        } else if (!mouse_grabbed) {
             // Create invisible cursor if not already done
             createInvisibleCursor();
             
@@ -685,7 +1359,10 @@ public:
     }
     
     void releaseMouse() override {
-        if (mouse_grabbed) {
+        if (mouse_grabbed && input_thread.joinable()) {
+            request(kRequestUngrab, kRequestGrab);
+            mouse_grabbed = false;
+        } else if (mouse_grabbed) {
             XUngrabPointer(display, CurrentTime);
             XFlush(display);
             mouse_grabbed = false;
@@ -696,6 +1373,181 @@ public:
         return mouse_grabbed;
     }
     
+    bool setRawMouse(bool enable) override {
+#ifdef HWL_XINPUT2
+        if (enable == raw_mouse) return true;
+        if (xi_opcode < 0 && !initXInput2()) return false;
+        if (input_thread.joinable()) {
+            request(enable ? kRequestRawOn : kRequestRawOff, enable ? kRequestRawOff : kRequestRawOn);
+        } else {
+            selectRawMotion(display, enable);
+        }
+        raw_mouse = enable;
+        return true;
+#else
+        return !enable;
+#endif
+    }
+    
+    bool isRawMouse() const override {
+        return raw_mouse;
+    }
+    
+    bool startInputThread() override {
+        if (input_thread.joinable()) return true;
+        input_display = XOpenDisplay(DisplayString(display));
+        if (!input_display) return false;
+        if (pipe2(input_pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+            XCloseDisplay(input_display);
+            input_display = nullptr;
+            return false;
+        }
+        // Only one client may select button presses: hand them over, and the
+        // grab and raw motion with them
+        bool grabbed = mouse_grabbed;
+        releaseMouse();
+#ifdef HWL_XINPUT2
+        if (raw_mouse) selectRawMotion(display, false);
+#endif
+        XSelectInput(display, xwindow, kWindowEventMask);
+        XSync(display, False);
+        XSelectInput(input_display, xwindow, kInputEventMask | FocusChangeMask);
+        XFlush(input_display);
+        input_focused = focused;
+        input_requests.store(raw_mouse ? kRequestRawOn : 0);
+        input_thread = std::thread([this] { inputLoop(); });
+        if (grabbed) grabMouse();
+        return true;
+    }
+    
+    void stopInputThread() override {
+        if (!input_thread.joinable()) return;
+        request(kRequestStop);
+        input_thread.join();
+        XCloseDisplay(input_display);   // Drops its selection, grab and raw motion
+        input_display = nullptr;
+        close(input_pipe[0]);
+        close(input_pipe[1]);
+        input_pipe[0] = input_pipe[1] = -1;
+        XSelectInput(display, xwindow, kWindowEventMask | kInputEventMask);
+#ifdef HWL_XINPUT2
+        if (raw_mouse) selectRawMotion(display, true);
+#endif
+        if (mouse_grabbed) {
+            mouse_grabbed = false;
+            grabMouse();
+        }
+        XFlush(display);
+    }
+    
+    bool hasInputThread() const override {
+        return input_thread.joinable();
+    }
+    
+    InputStats inputStats() const override {
+        return input.stats();
+    }
+    
+    void request(uint32_t set, uint32_t cancel = 0) {
+        input_requests.fetch_and(~cancel);
+        input_requests.fetch_or(set);
+        signalPipe(input_pipe[1]);
+    }
+    
+    void inputLoop() {
+        for (;;) {
+            uint32_t requests = input_requests.exchange(0);
+            if (requests & kRequestStop) break;
+            if (requests & kRequestUngrab) XUngrabPointer(input_display, CurrentTime);
+            if (requests & kRequestGrab) {
+                XGrabPointer(input_display, xwindow, True, ButtonPressMask | ButtonReleaseMask | PointerMotionMask,
+                             GrabModeAsync, GrabModeAsync, xwindow, invisible_cursor, CurrentTime);
+            }
+#ifdef HWL_XINPUT2
+            if (requests & (kRequestRawOn | kRequestRawOff)) selectRawMotion(input_display, requests & kRequestRawOn);
+#endif
+            while (XPending(input_display) > 0) {
+                XEvent xev;
+                XNextEvent(input_display, &xev);
+                handleEvent(input_display, xev);
+            }
+            // Held events that a full ring refused are retried every millisecond
+            bool held = !input.flush();
+            if (input.consumer_waiting.load()) signalPipe(wake_pipe[1]);
+            pollfd fds[2] = { { ConnectionNumber(input_display), POLLIN, 0 }, { input_pipe[0], POLLIN, 0 } };
+            if (poll(fds, 2, held ? 1 : -1) > 0 && (fds[1].revents & POLLIN)) drainPipe(input_pipe[0]);
+        }
+        input.flush();
+    }
+    
+    // Where an event made on a connection goes: the ring from the input
+    // thread's, straight to the queue (and key state) from the window's
+    void emit(Display* dpy, const Event& e) {
+        if (dpy == input_display) {
+            input.add(e);
+            return;
+        }
+        applyEvent(e);
+        event_queue.push(e);
+    }
+    
+    void applyEvent(const Event& e) {
+        switch (e.type) {
+            case EventType::KeyDown:
+            case EventType::KeyUp:
+                keys[static_cast<size_t>(e.key)] = e.type == EventType::KeyDown;
+                break;
+            case EventType::MouseDown:
+            case EventType::MouseUp:
+                mouse_buttons[static_cast<size_t>(e.mouse_button)] = e.type == EventType::MouseDown;
+                break;
+            case EventType::MouseMove:
+                mouse_x = e.mouse_x;
+                mouse_y = e.mouse_y;
+                break;
+            default:
+                break;
+        }
+    }
+    
+#ifdef HWL_XINPUT2
+    // Raw events are only delivered to the root window
+    void selectRawMotion(Display* dpy, bool enable) {
+        unsigned char mask[XIMaskLen(XI_LASTEVENT)] = {};
+        if (enable) XISetMask(mask, XI_RawMotion);
+        XIEventMask em;
+        em.deviceid = XIAllMasterDevices;
+        em.mask_len = sizeof(mask);
+        em.mask = mask;
+        xi_select_events(dpy, DefaultRootWindow(dpy), &em, 1);
+        XFlush(dpy);
+    }
+    
+
+    // libXi is opened at runtime so that -lXi is not needed and its absence is not fatal
+    bool initXInput2() {
+        int event, error, opcode;
+        if (!XQueryExtension(display, "XInputExtension", &opcode, &event, &error)) return false;
+        static void* libxi = dlopen("libXi.so.6", RTLD_LAZY);
+        if (!libxi) return false;
+        auto queryVersion = reinterpret_cast<decltype(&XIQueryVersion)>(dlsym(libxi, "XIQueryVersion"));
+        xi_select_events = reinterpret_cast<decltype(&XISelectEvents)>(dlsym(libxi, "XISelectEvents"));
+        int major = 2, minor = 0;
+        if (!queryVersion || !xi_select_events || queryVersion(display, &major, &minor) != Success) return false;
+        xi_opcode = opcode;
+        return true;
+    }
+#endif
+    
+    // Linux X servers stamp input with CLOCK_MONOTONIC in ms; when that agrees
+    // with ours, events that sat in the queue keep the time they arrived
+    uint64_t eventTime(Time serverMs) const {
+        uint64_t now = getTimeNs();
+        uint32_t age = static_cast<uint32_t>(now / 1000000) - static_cast<uint32_t>(serverMs);  // 32-bit wrap
+        if (serverMs == CurrentTime || age > 1000) return now;
+        return now - static_cast<uint64_t>(age) * 1000000;
+    }
+    
     Key translateKeySym(KeySym ks) {
         switch (ks) {
             case XK_Escape: return Key::Escape;
@@ -744,14 +1596,16 @@ public:
         }
     }
     
-    void handleEvent(XEvent& xev) {
+    // Runs on whichever thread owns dpy: the window's, or the input thread's
+    void handleEvent(Display* dpy, XEvent& xev) {
         Event e;
+        e.time_ns = getTimeNs();
         switch (xev.type) {
             case ClientMessage:
                 if (static_cast<Atom>(xev.xclient.data.l[0]) == wm_delete_window) {
                     should_close = true;
                     e.type = EventType::Close;
-                    event_queue.push(e);
+                    emit(dpy, e);
                 }
                 break;
                 
@@ -762,73 +1616,96 @@ public:
                     e.type = EventType::Resize;
                     e.width = win_width;
                     e.height = win_height;
-                    event_queue.push(e);
+                    emit(dpy, e);
                 }
                 break;
                 
             case KeyPress: {
                 KeySym ks = XLookupKeysym(&xev.xkey, 0);
                 e.type = EventType::KeyDown;
+                e.time_ns = eventTime(xev.xkey.time);
                 e.key = translateKeySym(ks);
-                keys[static_cast<size_t>(e.key)] = true;
-                event_queue.push(e);
+                emit(dpy, e);
                 break;
             }
             
             case KeyRelease: {
                 // Check for auto-repeat
-                if (XEventsQueued(display, QueuedAfterReading)) {
+                if (XEventsQueued(dpy, QueuedAfterReading)) {
                     XEvent next;
-                    XPeekEvent(display, &next);
+                    XPeekEvent(dpy, &next);
                     if (next.type == KeyPress && next.xkey.time == xev.xkey.time && next.xkey.keycode == xev.xkey.keycode) {
                         return; // Skip auto-repeat release
                     }
                 }
                 KeySym ks = XLookupKeysym(&xev.xkey, 0);
                 e.type = EventType::KeyUp;
+                e.time_ns = eventTime(xev.xkey.time);
                 e.key = translateKeySym(ks);
-                keys[static_cast<size_t>(e.key)] = false;
-                event_queue.push(e);
+                emit(dpy, e);
                 break;
             }
             
             case ButtonPress:
                 e.type = EventType::MouseDown;
-                if (xev.xbutton.button == Button1) { e.mouse_button = MouseButton::Left; mouse_buttons[0] = true; }
-                else if (xev.xbutton.button == Button2) { e.mouse_button = MouseButton::Middle; mouse_buttons[2] = true; }
-                else if (xev.xbutton.button == Button3) { e.mouse_button = MouseButton::Right; mouse_buttons[1] = true; }
+                e.time_ns = eventTime(xev.xbutton.time);
+                if (xev.xbutton.button == Button1) { e.mouse_button = MouseButton::Left; }
+                else if (xev.xbutton.button == Button2) { e.mouse_button = MouseButton::Middle; }
+                else if (xev.xbutton.button == Button3) { e.mouse_button = MouseButton::Right; }
                 else if (xev.xbutton.button == Button4) { e.type = EventType::MouseScroll; e.scroll_y = 1.0f; }
                 else if (xev.xbutton.button == Button5) { e.type = EventType::MouseScroll; e.scroll_y = -1.0f; }
-                event_queue.push(e);
+                emit(dpy, e);
                 break;
                 
             case ButtonRelease:
                 e.type = EventType::MouseUp;
-                if (xev.xbutton.button == Button1) { e.mouse_button = MouseButton::Left; mouse_buttons[0] = false; }
-                else if (xev.xbutton.button == Button2) { e.mouse_button = MouseButton::Middle; mouse_buttons[2] = false; }
-                else if (xev.xbutton.button == Button3) { e.mouse_button = MouseButton::Right; mouse_buttons[1] = false; }
+                e.time_ns = eventTime(xev.xbutton.time);
+                if (xev.xbutton.button == Button1) { e.mouse_button = MouseButton::Left; }
+                else if (xev.xbutton.button == Button2) { e.mouse_button = MouseButton::Middle; }
+                else if (xev.xbutton.button == Button3) { e.mouse_button = MouseButton::Right; }
                 else break; // Ignore scroll release
-                event_queue.push(e);
+                emit(dpy, e);
                 break;
                 
             case MotionNotify:
-                mouse_x = xev.xmotion.x;
-                mouse_y = xev.xmotion.y;
                 e.type = EventType::MouseMove;
-                e.mouse_x = mouse_x;
-                e.mouse_y = mouse_y;
-                event_queue.push(e);
+                e.mouse_x = xev.xmotion.x;
+                e.mouse_y = xev.xmotion.y;
+                e.time_ns = eventTime(xev.xmotion.time);
+                emit(dpy, e);
                 break;
                 
+            // The input thread only follows focus, for raw motion; the window reports it
             case FocusIn:
-                e.type = EventType::Focus;
-                event_queue.push(e);
+            case FocusOut:
+                (dpy == input_display ? input_focused : focused) = xev.type == FocusIn;
+                if (dpy == input_display) break;
+                e.type = xev.type == FocusIn ? EventType::Focus : EventType::Blur;
+                emit(dpy, e);
                 break;
                 
-            case FocusOut:
-                e.type = EventType::Blur;
-                event_queue.push(e);
+#ifdef HWL_XINPUT2
+            case GenericEvent:
+                if (xev.xcookie.extension != xi_opcode || !XGetEventData(dpy, &xev.xcookie)) break;
+                if (xev.xcookie.evtype == XI_RawMotion && (dpy == input_display ? input_focused : focused)) {
+                    const auto* raw = static_cast<const XIRawEvent*>(xev.xcookie.data);
+                    // raw_values holds only the valuators set in the mask, in order
+                    const double* value = raw->raw_values;
+                    double delta[2] = { 0.0, 0.0 };
+                    for (int i = 0; i < 2 && i < raw->valuators.mask_len * 8; i++) {
+                        if (XIMaskIsSet(raw->valuators.mask, i)) delta[i] = *value++;
+                    }
+                    if (delta[0] != 0.0 || delta[1] != 0.0) {
+                        e.type = EventType::MouseRaw;
+                        e.delta_x = static_cast<float>(delta[0]);
+                        e.delta_y = static_cast<float>(delta[1]);
+                        e.time_ns = eventTime(raw->time);
+                        emit(dpy, e);
+                    }
+                }
+                XFreeEventData(dpy, &xev.xcookie);
                 break;
+#endif
         }
     }
 };
@@ -840,6 +1717,7 @@ std::unique_ptr<HwlWindow> HwlWindow::create(const std::string& title, int width
     
     win->display = XOpenDisplay(nullptr);
     if (!win->display) return nullptr;
+    if (pipe2(win->wake_pipe, O_NONBLOCK | O_CLOEXEC) != 0) return nullptr;
     
     // Choose visual with GLX
     static int visual_attribs[] = {
@@ -858,9 +1736,7 @@ std::unique_ptr<HwlWindow> HwlWindow::create(const std::string& title, int width
     // Set window attributes
     XSetWindowAttributes swa{};
     swa.colormap = cmap;
-    swa.event_mask = ExposureMask | KeyPressMask | KeyReleaseMask | 
-                     ButtonPressMask | ButtonReleaseMask | PointerMotionMask |
-                     StructureNotifyMask | FocusChangeMask;
+    swa.event_mask = kWindowEventMask | kInputEventMask;
     
     // Create window
     win->xwindow = XCreateWindow(
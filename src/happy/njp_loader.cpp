@@ -6,8 +6,14 @@
 #include <fstream>
 #include <cstring>
 #include <algorithm>
+#include <chrono>
 #include <cstdio>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NJP_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace h2d {
 
 // Helper to read uint32_t little-endian
@@ -105,29 +111,62 @@ bool SpriteSheet::loadFromFile(const std::string& path) {
     std::vector<uint8_t> data(size);
     file.read(reinterpret_cast<char*>(data.data()), size);
     
-    return loadFromMemory(data.data(), size);
+    return loadData(std::move(data));
 }
 
 bool SpriteSheet::loadFromMemory(const uint8_t* data, size_t size) {
+    if (!data) {
+        m_patterns.clear();
+        return false;
+    }
+    return loadData(std::vector<uint8_t>(data, data + size));
+}
+
+// Take over the file contents and index them
+bool SpriteSheet::loadData(std::vector<uint8_t>&& data) {
     m_patterns.clear();
+    m_slots.clear();
+    m_embeddedPalettes.clear();
+    m_hasPalette = false;
+    m_decodedBytes = 0;
+    m_useClock = 0;
+    m_data.clear();
     
-    if (!data || size < 16) return false;
+    if (data.size() < 16) return false;
     
     // Check if data is compressed (starts with RCLIB-L)
-    if (memcmp(data, "RCLIB-L", 7) == 0) {
-        std::vector<uint8_t> decompressed;
-        if (!decompressRCLIB(data, size, decompressed)) {
+    if (memcmp(data.data(), "RCLIB-L", 7) == 0) {
+        if (!decompressRCLIB(data.data(), data.size(), m_data)) {
             fprintf(stderr, "SpriteSheet: Failed to decompress RCLIB-L data\n");
+            m_data.clear();
             return false;
         }
-        return parseNJP(decompressed.data(), decompressed.size());
+    } else {
+        // Not compressed, parse directly
+        m_data = std::move(data);
     }
     
-    // Not compressed, parse directly
-    return parseNJP(data, size);
+    return parseNJP();
 }
 
-bool SpriteSheet::parseNJP(const uint8_t* data, size_t size) {
+/*==============================================================================
+ * Pattern Index
+ * 
+ * One linear pass over the pattern headers. Each header is followed by an
+ * RCLIB-L block whose header carries the compressed payload size at +12 (as
+ * RK_LzEncodeMemoryToMemory writes it and RKC_UPDIB reads it), or by raw rows
+ * when the compressed word is 0, so every next header is found by seeking:
+ *   Magic (16 bytes, "NJudgeUniPat" + 3-digit version)
+ *   Pattern count, [version 3: total pixel bytes]
+ *   Per pattern: bpp, width, height, compressed (16 bytes), pixel block
+ * The extended header and metadata after the last block are then walked to
+ * check that the index ended where they start (see extractPalettes).
+ *============================================================================*/
+
+bool SpriteSheet::parseNJP() {
+    const uint8_t* data = m_data.data();
+    size_t size = m_data.size();
+    
     // Header: "NJudgeUniPat003" (16 bytes) + patternCount (4 bytes)
     if (size < 20) return false;
     
@@ -136,120 +175,88 @@ bool SpriteSheet::parseNJP(const uint8_t* data, size_t size) {
         fprintf(stderr, "SpriteSheet: Invalid NJP magic\n");
         return false;
     }
+    int version = 0;
+    for (int i = 12; i < 15 && data[i] >= '0' && data[i] <= '9'; i++) {
+        version = version * 10 + (data[i] - '0');
+    }
     
-    // Get pattern count (little-endian at offset 16)
-    uint32_t patternCount = data[16] | (data[17] << 8) | (data[18] << 16) | (data[19] << 24);
+    // Get pattern count (little-endian at offset 16); a header is at least 16 bytes
+    uint32_t patternCount = readU32LE(data + 16);
+    if (patternCount > (size - 20) / 16) {
+        fprintf(stderr, "SpriteSheet: Pattern count %u does not fit the file\n", patternCount);
+        return false;
+    }
     
-    // Parse each pattern
     size_t pos = 20;
+    if (version >= 3) pos += 4;  // Total pixel bytes, not needed for the index
+    
     m_patterns.reserve(patternCount);
+    m_slots.reserve(patternCount);
     
+    bool complete = true;
     for (uint32_t i = 0; i < patternCount; i++) {
-        // Per-pattern header: 20 bytes
-        // 0x00: uint32_t unknown (possibly offset or ID)
-        // 0x04: uint32_t bpp
-        // 0x08: uint32_t width
-        // 0x0C: uint32_t height
-        // 0x10: uint32_t flags
-        // 0x14: RCLIB-L compressed pixel data (size determined by scanning)
-        
-        if (pos + 20 > size) {
+        if (pos + 16 > size) {
             fprintf(stderr, "SpriteSheet: Truncated pattern header at pattern %u\n", i);
+            complete = false;
             break;
         }
         
-        // Skip the unknown field (we don't use it)
-        // uint32_t unknown = data[pos] | ... 
-        
         Pattern pattern;
-        pattern.bpp = data[pos + 4] | (data[pos + 5] << 8) | 
-                      (data[pos + 6] << 16) | (data[pos + 7] << 24);
-        pattern.width = data[pos + 8] | (data[pos + 9] << 8) | 
-                        (data[pos + 10] << 16) | (data[pos + 11] << 24);
-        pattern.height = data[pos + 12] | (data[pos + 13] << 8) | 
-                         (data[pos + 14] << 16) | (data[pos + 15] << 24);
-        pattern.flags = data[pos + 16] | (data[pos + 17] << 8) | 
-                        (data[pos + 18] << 16) | (data[pos + 19] << 24);
-        
-        pos += 20;
+        PatternSlot slot;
+        pattern.bpp = static_cast<int>(readU32LE(data + pos));
+        pattern.width = static_cast<int>(readU32LE(data + pos + 4));
+        pattern.height = static_cast<int>(readU32LE(data + pos + 8));
+        pattern.flags = static_cast<int>(readU32LE(data + pos + 12));
+        pos += 16;
         
         // Debug output for the first few patterns
         if (i < 3) {
-            printf("  Pattern %u: bpp=%u, %ux%u, flags=0x%x\n",
+            printf("  Pattern %u: bpp=%d, %dx%d, flags=0x%x\n",
                    i, pattern.bpp, pattern.width, pattern.height, pattern.flags);
         }
         
-        // Skip empty patterns
-        if (pattern.width == 0 || pattern.height == 0) {
-            m_patterns.push_back(std::move(pattern));
-            continue;
-        }
-        
-        // The pixel data should be RCLIB-L compressed
-        if (pos + 16 > size) {
-            fprintf(stderr, "SpriteSheet: No room for RCLIB-L header at pattern %u\n", i);
+        if (pattern.width < 0 || pattern.height < 0 || pattern.width >= 65536 || pattern.height >= 65536) {
+            fprintf(stderr, "SpriteSheet: Bad size %dx%d at pattern %u\n", pattern.width, pattern.height, i);
+            complete = false;
             break;
         }
         
-        if (memcmp(data + pos, "RCLIB-L", 7) != 0) {
-            fprintf(stderr, "SpriteSheet: Expected RCLIB-L at pattern %u, offset 0x%zx\n", i, pos);
-            break;
+        size_t extent;
+        if (pattern.flags) {
+            // RCLIB-L block: 16-byte header + compressed payload
+            if (pos + 16 > size || memcmp(data + pos, "RCLIB-L", 7) != 0) {
+                fprintf(stderr, "SpriteSheet: Expected RCLIB-L at pattern %u, offset 0x%zx\n", i, pos);
+                complete = false;
+                break;
+            }
+            extent = 16 + static_cast<size_t>(readU32LE(data + pos + 12));
+            slot.packed = true;
+        } else {
+            // Raw rows, 4-byte aligned
+            int stride = ((pattern.width * pattern.bpp + 7) / 8 + 3) & ~3;
+            extent = static_cast<size_t>(stride) * pattern.height;
         }
-        
-        // Decompress the RCLIB-L data
-        // We pass the remaining buffer size; decompression will stop when done
-        std::vector<uint8_t> pixelData;
-        if (!decompressRCLIB(data + pos, size - pos, pixelData)) {
-            fprintf(stderr, "SpriteSheet: Failed to decompress pattern %u pixels\n", i);
-            m_patterns.push_back(std::move(pattern));
-            // Try to find next pattern by scanning for next header
-            // This is a recovery mechanism
+        if (extent > size - pos) {
+            fprintf(stderr, "SpriteSheet: Pixel data of pattern %u runs past the end\n", i);
+            complete = false;
             break;
         }
         
-        // Store indexed data
-        pattern.indexedData = std::move(pixelData);
-        
-        // Convert to RGBA bitmap
-        convertIndexedToRGBA(pattern.indexedData.data(), 
-                             pattern.width, pattern.height,
-                             pattern.bpp, pattern.bitmap);
-        
-        // Find the next pattern by scanning for next RCLIB-L header preceded by
-        // what looks like a valid pattern header (bpp 4/8/24, reasonable width/height)
-        // Or we can scan for the end of the compressed data
-        // For now, scan forward for next pattern header
-        size_t nextPos = pos + 16;  // Skip RCLIB-L header minimum
-        while (nextPos + 20 < size) {
-            // Check if this could be a pattern header followed by RCLIB-L
-            if (memcmp(data + nextPos + 20, "RCLIB-L", 7) == 0) {
-                // Validate the header looks reasonable
-                uint32_t nextBpp = data[nextPos + 4] | (data[nextPos + 5] << 8);
-                uint32_t nextW = data[nextPos + 8] | (data[nextPos + 9] << 8);
-                uint32_t nextH = data[nextPos + 12] | (data[nextPos + 13] << 8);
-                if ((nextBpp == 4 || nextBpp == 8 || nextBpp == 24 || nextBpp == 32) &&
-                    nextW > 0 && nextW < 4096 && nextH > 0 && nextH < 4096) {
-                    break;
-                }
-            }
-            nextPos++;
-        }
-        
-        // If we're at the last pattern or didn't find next, go to end
-        if (i == patternCount - 1 || nextPos + 20 >= size) {
-            pos = size;  // End
-        } else {
-            pos = nextPos;
+        // Empty patterns keep offset 0 (nothing to decode)
+        if (pattern.width > 0 && pattern.height > 0) {
+            slot.offset = pos;
+            slot.extent = extent;
         }
+        pos += extent;
         
         m_patterns.push_back(std::move(pattern));
+        m_slots.push_back(slot);
     }
     
-    // Try to extract embedded palettes
-    // We need to find the extended header after all patterns
-    // For now, get BPP from first pattern
+    // Embedded palettes follow the extended header; only trust its position
+    // if every pattern was indexed
     int primaryBpp = m_patterns.empty() ? 8 : m_patterns[0].bpp;
-    extractPalettes(data, size, primaryBpp, patternCount);
+    extractPalettes(data, size, primaryBpp, version, complete ? pos : 0);
     
     // If we found embedded palettes, apply the first one automatically
     if (!m_embeddedPalettes.empty()) {
@@ -265,14 +272,17 @@ bool SpriteSheet::parseNJP(const uint8_t* data, size_t size) {
  * NJP files have an extended header after all pattern data, followed by 
  * metadata and then palette data in BGRA format.
  * 
- * Structure after patterns:
- *   Extended Header (12 bytes): pattern_count, pattern_count, palette_count
- *   Extended Metadata (32 bytes per pattern)
- *   Optional nested section counts
- *   Palette data (at end of file)
+ * Structure after patterns (the UPD pattern table, as RKC_UPDIB reads it):
+ *   Extended Header: entry count, [version 3: total parts list entries]
+ *   Extended Metadata per entry: list count, rect (16 bytes),
+ *     [version >= 1: default palette], list count * 28 bytes
+ *     (flags, pattern index, x, y, exParam, scaleX, scaleY)
+ *   Palette count, then the palettes
+ * The walk checks the list totals and that every pattern index is in range;
+ * a file that does not validate falls back to the palette at end of file.
  *============================================================================*/
 
-bool SpriteSheet::extractPalettes(const uint8_t* data, size_t size, int bpp, int patternCount) {
+bool SpriteSheet::extractPalettes(const uint8_t* data, size_t size, int bpp, int version, size_t extPos) {
     m_embeddedPalettes.clear();
     
     // Only 4-bit and 8-bit indexed images have palettes
@@ -282,85 +292,70 @@ bool SpriteSheet::extractPalettes(const uint8_t* data, size_t size, int bpp, int
     
     size_t paletteSize = (bpp == 4) ? 64 : 1024;  // 16 or 256 colors * 4 bytes
     
-    // Method: Scan backward from end of file to find palette data
-    // Palette entries are BGRA (4 bytes each), color 0 is often black/transparent
-    // We look for the palette region at the end of the file
-    
-    // Minimum file size for palette
-    if (size < 20 + 16 + paletteSize) {  // header + rclib + palette
-        return false;
-    }
-    
-    // Strategy: Look for extended header pattern (three uint32s where first two match patternCount)
-    // Then calculate where palettes should be based on metadata
-    
-    // Scan for extended header: two consecutive values matching pattern count
-    // It appears after all RCLIB blocks
-    size_t extHeaderPos = 0;
-    size_t minHeaderPos = 20 + static_cast<size_t>(patternCount) * 20;
-    for (size_t pos = 20; pos + 12 < size; pos++) {
-        uint32_t v1 = readU32LE(data + pos);
-        uint32_t v2 = readU32LE(data + pos + 4);
-        
-        // Check if both match pattern count and we're past the RCLIB data
-        if (v1 == static_cast<uint32_t>(patternCount) && 
-            v2 == static_cast<uint32_t>(patternCount)) {
-            // Make sure we're not in the middle of RCLIB data
-            // Check that we're at least after all pattern headers
-            if (pos > minHeaderPos) {
-                extHeaderPos = pos;
-                break;
+    // Walk the extended header and metadata
+    size_t palPos = 0;
+    uint32_t paletteCount = 0;
+    bool valid = extPos != 0 && extPos + 4 <= size;
+    if (valid) {
+        size_t pos = extPos;
+        uint32_t entryCount = readU32LE(data + pos);
+        pos += 4;
+        uint32_t listTotal = 0;
+        if (version >= 3) {
+            valid = pos + 4 <= size;
+            if (valid) listTotal = readU32LE(data + pos);
+            pos += 4;
+        }
+        uint64_t listSum = 0;
+        for (uint32_t e = 0; valid && e < entryCount; e++) {
+            if (pos + 4 > size) { valid = false; break; }
+            uint32_t listCount = readU32LE(data + pos);
+            size_t entryBytes = 4 + 16 + (version >= 1 ? 4 : 0);
+            if (listCount > (size - pos) / 28 || pos + entryBytes + listCount * 28 > size) { valid = false; break; }
+            const uint8_t* list = data + pos + entryBytes;
+            for (uint32_t n = 0; n < listCount; n++) {
+                if (readU32LE(list + n * 28 + 4) >= m_patterns.size()) { valid = false; break; }
             }
+            pos += entryBytes + listCount * 28;
+            listSum += listCount;
         }
-    }
-    
-    if (extHeaderPos == 0) {
-        // Couldn't find extended header, try reading palette from end of file
-        // This is a fallback for files where we can't parse the header
-        if (size >= paletteSize) {
-            size_t palOffset = size - paletteSize;
-            
-            // Sanity check: first color is often 0 (transparent/black)
-            // and palette should have varied colors
-            Palette pal;
-            for (int i = 0; i < (bpp == 4 ? 16 : 256); i++) {
-                const uint8_t* c = data + palOffset + i * 4;
-                // BGRA -> RGBA
-                pal.setColor(i, Color(c[2], c[1], c[0], 255));
+        if (valid && version >= 3 && listSum != listTotal) valid = false;
+        if (valid && pos + 4 <= size) {
+            paletteCount = readU32LE(data + pos);
+            palPos = pos + 4;
+            // RKC_UPDIB reads 256 entries per palette; small 4bpp files hold 16
+            if (paletteCount > 0 && paletteCount <= (size - palPos) / 1024) {
+                paletteSize = 1024;
+            } else if (bpp == 4 && paletteCount > 0 && paletteCount <= (size - palPos) / 64) {
+                paletteSize = 64;
+            } else {
+                valid = false;
             }
-            // Color 0 is transparent
-            pal.setColor(0, Color(0, 0, 0, 0));
-            
-            m_embeddedPalettes.push_back(std::move(pal));
-            return true;
+        } else {
+            valid = false;
         }
-        return false;
-    }
-    
-    // Read palette count from extended header
-    uint32_t paletteCount = readU32LE(data + extHeaderPos + 8);
-    
-    // Sanity check - palette count should be reasonable
-    if (paletteCount == 0 || paletteCount > 16) {
-        // Either no palettes or something's wrong, try the fallback
-        paletteCount = 1;
     }
     
-    // Calculate expected palette region size
-    size_t totalPaletteBytes = paletteCount * paletteSize;
-    
-    // Palette region is at end of file
-    if (size < totalPaletteBytes) {
-        return false;
+    if (!valid) {
+        // Couldn't validate the extended header, try reading palette from end of file
+        // This is a fallback for files where we can't parse the header
+        if (extPos != 0) {
+            fprintf(stderr, "SpriteSheet: Extended header at 0x%zx does not validate\n", extPos);
+        }
+        paletteSize = (bpp == 4) ? 64 : 1024;
+        if (size >= 20 + 16 + paletteSize) {  // header + rclib + palette
+            paletteCount = 1;
+            palPos = size - paletteSize;
+        } else {
+            return false;
+        }
     }
     
-    size_t palOffset = size - totalPaletteBytes;
-    
     // Parse each palette
+    int colorCount = static_cast<int>(paletteSize / 4);
     for (uint32_t p = 0; p < paletteCount; p++) {
         Palette pal;
-        size_t thisOffset = palOffset + p * paletteSize;
-        int colorCount = (bpp == 4) ? 16 : 256;
+        size_t thisOffset = palPos + p * paletteSize;
         
         for (int i = 0; i < colorCount; i++) {
             const uint8_t* c = data + thisOffset + i * 4;
@@ -392,9 +387,155 @@ bool SpriteSheet::applyEmbeddedPalette(int paletteIndex) {
     return false;
 }
 
+/*==============================================================================
+ * Pixel Conversion
+ * 
+ * One row kernel per format, picked once per pattern, writing packed RGBA
+ * straight into the bitmap. Indexed formats go through a 256-entry colour
+ * table; RGB565, BGR and BGRA have SSE2 bodies with scalar tails (and scalar
+ * only where SSE2 is not available).
+ *============================================================================*/
+
+static const uint32_t kMagenta = 0xFF00FF;  // Colour key, r | g << 8 | b << 16
+
+static inline uint32_t PackRGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+    return r | (g << 8) | (b << 16) | (static_cast<uint32_t>(a) << 24);
+}
+
+// Default tables when no palette is applied: grayscale, index 0 transparent
+struct GrayTables {
+    uint32_t gray8[256], gray4[256], mono[256];
+    GrayTables() {
+        for (int i = 0; i < 256; i++) {
+            int v4 = (i & 15) * 17;
+            gray8[i] = i ? PackRGBA(i, i, i, 255) : 0;
+            gray4[i] = (i & 15) ? PackRGBA(v4, v4, v4, 255) : 0;
+            mono[i] = (i & 1) ? 0xFFFFFFFF : 0;
+        }
+    }
+};
+
+static const uint32_t* GrayLut(int bpp) {
+    static const GrayTables tables;
+    return bpp == 8 ? tables.gray8 : bpp == 4 ? tables.gray4 : tables.mono;
+}
+
+static void RowIndexed1(const uint8_t* src, uint32_t* dst, int width, const uint32_t* lut) {
+    for (int x = 0; x < width; x++) {
+        dst[x] = lut[(src[x >> 3] >> (7 - (x & 7))) & 1];
+    }
+}
+
+static void RowIndexed4(const uint8_t* src, uint32_t* dst, int width, const uint32_t* lut) {
+    int x = 0;
+    for (; x + 1 < width; x += 2) {
+        uint8_t byte = src[x >> 1];
+        dst[x] = lut[byte >> 4];
+        dst[x + 1] = lut[byte & 0x0F];
+    }
+    if (x < width) dst[x] = lut[src[x >> 1] >> 4];
+}
+
+// Table lookups, four independent loads per step (SSE2 has no gather and
+// emulating one is slower than the scalar loads)
+static void RowIndexed8(const uint8_t* src, uint32_t* dst, int width, const uint32_t* lut) {
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        uint32_t c0 = lut[src[x]], c1 = lut[src[x + 1]], c2 = lut[src[x + 2]], c3 = lut[src[x + 3]];
+        dst[x] = c0;
+        dst[x + 1] = c1;
+        dst[x + 2] = c2;
+        dst[x + 3] = c3;
+    }
+    for (; x < width; x++) dst[x] = lut[src[x]];
+}
+
+// RGB565 -> 8 bits per channel as v * 255 / max, rounded down; 0xF81F is the key
+static void RowRGB565(const uint8_t* src, uint32_t* dst, int width) {
+    int x = 0;
+#ifdef NJP_SSE2
+    const __m128i mask5 = _mm_set1_epi16(0x1F), mask6 = _mm_set1_epi16(0x3F);
+    const __m128i mul31 = _mm_set1_epi16(2106), mul63 = _mm_set1_epi16(49);
+    const __m128i alpha = _mm_set1_epi16(static_cast<short>(0xFF00));
+    const __m128i key = _mm_set1_epi16(static_cast<short>(0xF81F));
+    for (; x + 8 <= width; x += 8) {
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 2));
+        __m128i r = _mm_srli_epi16(p, 11);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(p, 5), mask6);
+        __m128i b = _mm_and_si128(p, mask5);
+        r = _mm_srli_epi16(_mm_mullo_epi16(r, mul31), 8);                     // v * 255 / 31
+        b = _mm_srli_epi16(_mm_mullo_epi16(b, mul31), 8);
+        g = _mm_add_epi16(_mm_slli_epi16(g, 2), _mm_srli_epi16(_mm_mullo_epi16(g, mul63), 10));  // v * 255 / 63
+        __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+        __m128i ba = _mm_or_si128(b, alpha);
+        __m128i keyed = _mm_cmpeq_epi16(p, key);
+        __m128i lo = _mm_andnot_si128(_mm_unpacklo_epi16(keyed, keyed), _mm_unpacklo_epi16(rg, ba));
+        __m128i hi = _mm_andnot_si128(_mm_unpackhi_epi16(keyed, keyed), _mm_unpackhi_epi16(rg, ba));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x + 4), hi);
+    }
+#endif
+    for (; x < width; x++) {
+        uint16_t pixel = src[x * 2] | (src[x * 2 + 1] << 8);
+        if (pixel == 0xF81F) {
+            dst[x] = 0;
+        } else {
+            dst[x] = PackRGBA(((pixel >> 11) & 0x1F) * 255 / 31, ((pixel >> 5) & 0x3F) * 255 / 63,
+                              (pixel & 0x1F) * 255 / 31, 255);
+        }
+    }
+}
+
+// BGR -> RGBA, magenta transparent
+static void RowBGR24(const uint8_t* src, uint32_t* dst, int width) {
+    int x = 0;
+#ifdef NJP_SSE2
+    // 4-byte loads; the last pixel of a row is left to the tail so they never
+    // read past the row
+    const __m128i rgbMask = _mm_set1_epi32(0x00FFFFFF), rbMask = _mm_set1_epi32(0x00FF00FF);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000)), key = _mm_set1_epi32(kMagenta);
+    for (; x + 4 < width; x += 4) {
+        uint32_t q0, q1, q2, q3;
+        memcpy(&q0, src + x * 3, 4);
+        memcpy(&q1, src + x * 3 + 3, 4);
+        memcpy(&q2, src + x * 3 + 6, 4);
+        memcpy(&q3, src + x * 3 + 9, 4);
+        __m128i v = _mm_and_si128(_mm_setr_epi32(q0, q1, q2, q3), rgbMask);
+        __m128i rb = _mm_and_si128(v, rbMask);
+        __m128i c = _mm_or_si128(_mm_andnot_si128(rbMask, v),
+                                 _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16)));
+        c = _mm_andnot_si128(_mm_cmpeq_epi32(c, key), _mm_or_si128(c, alpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), c);
+    }
+#endif
+    for (; x < width; x++) {
+        const uint8_t* p = src + x * 3;
+        uint32_t c = PackRGBA(p[2], p[1], p[0], 0);
+        dst[x] = c == kMagenta ? 0 : c | 0xFF000000;
+    }
+}
+
+// BGRA -> RGBA
+static void RowBGRA32(const uint8_t* src, uint32_t* dst, int width) {
+    int x = 0;
+#ifdef NJP_SSE2
+    const __m128i rbMask = _mm_set1_epi32(0x00FF00FF);
+    for (; x + 4 <= width; x += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+        __m128i rb = _mm_and_si128(v, rbMask);
+        v = _mm_or_si128(_mm_andnot_si128(rbMask, v), _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), v);
+    }
+#endif
+    for (; x < width; x++) {
+        const uint8_t* p = src + x * 4;
+        dst[x] = PackRGBA(p[2], p[1], p[0], p[3]);
+    }
+}
+
 void SpriteSheet::convertIndexedToRGBA(const uint8_t* indexed, int width, int height,
-                                        int bpp, Bitmap& out) {
-    out.create(width, height);
+                                        int bpp, Bitmap& out, const uint32_t* lut) {
+    if (!out.create(width, height)) return;
     
     // Calculate stride: bytes per row, aligned to 4 bytes
     // For sub-byte bpp, we need to round up the bits to bytes first
@@ -402,136 +543,128 @@ void SpriteSheet::convertIndexedToRGBA(const uint8_t* indexed, int width, int he
     int bytesPerRow = (bitsPerRow + 7) / 8;  // Round up to bytes
     int stride = (bytesPerRow + 3) & ~3;     // Align to 4 bytes
     
+    if (!lut) lut = GrayLut(bpp);
+    uint32_t* pixels = reinterpret_cast<uint32_t*>(out.pixels());
+    
     for (int y = 0; y < height; y++) {
         // NJP data is stored bottom-up (like Windows DIB)
-        int srcY = height - 1 - y;
+        const uint8_t* src = indexed + static_cast<size_t>(height - 1 - y) * stride;
+        uint32_t* dst = pixels + static_cast<size_t>(y) * width;
         
-        for (int x = 0; x < width; x++) {
-            Color c;
-            
-            switch (bpp) {
-                case 8: {
-                    // 8-bit indexed - use grayscale for now (palette applied later)
-                    uint8_t idx = indexed[srcY * stride + x];
-                    // Index 0 is typically transparent in ShadowFlare sprites
-                    if (idx == 0) {
-                        c = Color(0, 0, 0, 0);  // Transparent
-                    } else {
-                        // Grayscale - real palette would be loaded from game data
-                        c = Color(idx, idx, idx, 255);
-                    }
-                    break;
-                }
-                case 16: {
-                    // 16-bit RGB565
-                    int offset = srcY * stride + x * 2;
-                    uint16_t pixel = indexed[offset] | (indexed[offset + 1] << 8);
-                    // Check for magenta color key (0xF81F in RGB565 = R=31, G=0, B=31)
-                    if (pixel == 0xF81F) {
-                        c = Color(0, 0, 0, 0);  // Transparent
-                    } else {
-                        uint8_t r = ((pixel >> 11) & 0x1F) * 255 / 31;
-                        uint8_t g = ((pixel >> 5) & 0x3F) * 255 / 63;
-                        uint8_t b = (pixel & 0x1F) * 255 / 31;
-                        c = Color(r, g, b, 255);
-                    }
-                    break;
-                }
-                case 24: {
-                    // 24-bit BGR
-                    int offset = srcY * stride + x * 3;
-                    uint8_t b_val = indexed[offset];
-                    uint8_t g_val = indexed[offset + 1];
-                    uint8_t r_val = indexed[offset + 2];
-                    // Magenta color key
-                    if (r_val == 255 && g_val == 0 && b_val == 255) {
-                        c = Color(0, 0, 0, 0);
-                    } else {
-                        c = Color(r_val, g_val, b_val, 255);
-                    }
-                    break;
-                }
-                case 32: {
-                    // 32-bit BGRA
-                    int offset = srcY * stride + x * 4;
-                    uint8_t b_val = indexed[offset];
-                    uint8_t g_val = indexed[offset + 1];
-                    uint8_t r_val = indexed[offset + 2];
-                    uint8_t a_val = indexed[offset + 3];
-                    c = Color(r_val, g_val, b_val, a_val);
-                    break;
-                }
-                case 4: {
-                    // 4-bit indexed (2 pixels per byte)
-                    int offset = srcY * stride + x / 2;
-                    uint8_t byte = indexed[offset];
-                    uint8_t idx = (x & 1) ? (byte & 0x0F) : (byte >> 4);
-                    if (idx == 0) {
-                        c = Color(0, 0, 0, 0);  // Transparent
-                    } else {
-                        // Grayscale - real palette would be loaded from game data
-                        c = Color(idx * 17, idx * 17, idx * 17, 255);
-                    }
-                    break;
-                }
-                case 1: {
-                    // 1-bit (8 pixels per byte)
-                    int offset = srcY * stride + x / 8;
-                    uint8_t byte = indexed[offset];
-                    uint8_t bit = (byte >> (7 - (x & 7))) & 1;
-                    c = bit ? Color(255, 255, 255, 255) : Color(0, 0, 0, 0);
-                    break;
-                }
-                default:
-                    c = Color(255, 0, 255, 255);  // Error: magenta
-                    break;
-            }
-            
-            out.setPixel(x, y, c);
+        switch (bpp) {
+            case 1:  RowIndexed1(src, dst, width, lut); break;
+            case 4:  RowIndexed4(src, dst, width, lut); break;
+            case 8:  RowIndexed8(src, dst, width, lut); break;
+            case 16: RowRGB565(src, dst, width); break;
+            case 24: RowBGR24(src, dst, width); break;
+            case 32: RowBGRA32(src, dst, width); break;
+            default:
+                // Error: magenta
+                for (int x = 0; x < width; x++) dst[x] = PackRGBA(255, 0, 255, 255);
+                break;
         }
     }
 }
 
 void SpriteSheet::applyPalette(const Palette& palette) {
+    m_palette = palette;
+    m_hasPalette = true;
+    palette.toRGBA(m_paletteLut);
+    m_paletteLut[0] = 0;  // Transparent
+    
+    // Indexed RGBA forms are stale now; getBitmap converts them again
     for (auto& pattern : m_patterns) {
-        if ((pattern.bpp == 8 || pattern.bpp == 4) && !pattern.indexedData.empty()) {
-            // Calculate stride (same as in convertIndexedToRGBA)
-            int bitsPerRow = pattern.width * pattern.bpp;
-            int bytesPerRow = (bitsPerRow + 7) / 8;
-            int stride = (bytesPerRow + 3) & ~3;
-            
-            pattern.bitmap.create(pattern.width, pattern.height);
-            
-            for (int y = 0; y < pattern.height; y++) {
-                // NJP data is stored bottom-up (like Windows DIB)
-                int srcY = pattern.height - 1 - y;
-                
-                for (int x = 0; x < pattern.width; x++) {
-                    uint8_t idx;
-                    if (pattern.bpp == 8) {
-                        idx = pattern.indexedData[srcY * stride + x];
-                    } else {
-                        // 4-bit: 2 pixels per byte
-                        int offset = srcY * stride + x / 2;
-                        uint8_t byte = pattern.indexedData[offset];
-                        idx = (x & 1) ? (byte & 0x0F) : (byte >> 4);
-                    }
-                    
-                    Color c;
-                    if (idx == 0) {
-                        c = Color(0, 0, 0, 0);  // Transparent
-                    } else {
-                        c = palette.getColor(idx);
-                    }
-                    pattern.bitmap.setPixel(x, y, c);
-                }
-            }
+        if ((pattern.bpp == 8 || pattern.bpp == 4) && pattern.bitmap.valid()) {
+            m_decodedBytes -= static_cast<size_t>(pattern.width) * pattern.height * 4;
+            pattern.bitmap.release();
         }
     }
 }
 
+uint64_t SpriteSheet::contentHash() const {
+    // Eight bytes per step; the size goes in first so zero padding changes it
+    uint64_t hash = 14695981039346656037ull ^ m_data.size();
+    const uint8_t* p = m_data.data();
+    size_t n = m_data.size();
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for (; n > 0; p++, n--) hash = (hash ^ *p) * 1099511628211ull;
+    return hash;
+}
+
+void SpriteSheet::setDecodeBudget(size_t bytes) {
+    m_decodeBudget = bytes;
+    evict(-1);
+}
+
+void SpriteSheet::touch(int index) const {
+    m_slots[index].lastUse = ++m_useClock;
+}
+
+// Drop decoded forms, least recently used first, until under budget (never keep)
+void SpriteSheet::evict(int keep) const {
+    while (m_decodeBudget && m_decodedBytes > m_decodeBudget) {
+        int victim = -1;
+        for (int i = 0; i < static_cast<int>(m_patterns.size()); i++) {
+            if (i == keep) continue;
+            if (m_patterns[i].indexedData.empty() && !m_patterns[i].bitmap.valid()) continue;
+            if (victim < 0 || m_slots[i].lastUse < m_slots[victim].lastUse) victim = i;
+        }
+        if (victim < 0) return;
+        
+        Pattern& p = m_patterns[victim];
+        m_decodedBytes -= p.indexedData.size();
+        if (p.bitmap.valid()) m_decodedBytes -= static_cast<size_t>(p.width) * p.height * 4;
+        std::vector<uint8_t>().swap(p.indexedData);
+        p.bitmap.release();
+    }
+}
+
+// Decompress a pattern's pixels if they are not held already
+bool SpriteSheet::decode(int index) const {
+    Pattern& p = m_patterns[index];
+    PatternSlot& slot = m_slots[index];
+    touch(index);
+    if (!p.indexedData.empty()) return true;
+    if (slot.offset == 0 || slot.failed) return false;
+    
+    if (!slot.packed) {
+        p.indexedData.assign(m_data.begin() + slot.offset, m_data.begin() + slot.offset + slot.extent);
+    } else if (!decompressRCLIB(m_data.data() + slot.offset, slot.extent, p.indexedData)) {
+        fprintf(stderr, "SpriteSheet: Failed to decompress pattern %d pixels\n", index);
+        std::vector<uint8_t>().swap(p.indexedData);
+        slot.failed = true;
+        return false;
+    }
+    m_decodedBytes += p.indexedData.size();
+    evict(index);
+    return true;
+}
+
+// Convert a pattern to RGBA if it is not held already
+bool SpriteSheet::convert(int index) const {
+    Pattern& p = m_patterns[index];
+    if (!decode(index)) return false;
+    if (p.bitmap.valid()) return true;
+    
+    // Short data (a truncated block) would be read past its end
+    size_t stride = ((static_cast<size_t>(p.width) * p.bpp + 7) / 8 + 3) & ~static_cast<size_t>(3);
+    if (p.indexedData.size() < stride * p.height) return false;
+    
+    bool indexed = p.bpp == 8 || p.bpp == 4;
+    convertIndexedToRGBA(p.indexedData.data(), p.width, p.height, p.bpp, p.bitmap,
+                         indexed && m_hasPalette ? m_paletteLut : nullptr);
+    m_decodedBytes += static_cast<size_t>(p.width) * p.height * 4;
+    evict(index);
+    return true;
+}
+
 Pattern* SpriteSheet::getPattern(int index) {
     if (index >= 0 && index < static_cast<int>(m_patterns.size())) {
+        decode(index);
         return &m_patterns[index];
     }
     return nullptr;
@@ -539,11 +672,131 @@ Pattern* SpriteSheet::getPattern(int index) {
 
 const Pattern* SpriteSheet::getPattern(int index) const {
     if (index >= 0 && index < static_cast<int>(m_patterns.size())) {
+        decode(index);
         return &m_patterns[index];
     }
     return nullptr;
 }
 
+const Pattern* SpriteSheet::getPatternInfo(int index) const {
+    if (index >= 0 && index < static_cast<int>(m_patterns.size())) {
+        return &m_patterns[index];
+    }
+    return nullptr;
+}
+
+const Bitmap* SpriteSheet::getBitmap(int index) const {
+    if (index < 0 || index >= static_cast<int>(m_patterns.size())) return nullptr;
+    if (!convert(index)) return nullptr;
+    return &m_patterns[index].bitmap;
+}
+
+bool SpriteSheet::convertPattern(int index, const Palette& palette, Bitmap& out) const {
+    if (index < 0 || index >= static_cast<int>(m_patterns.size())) return false;
+    if (!decode(index)) return false;
+    const Pattern& p = m_patterns[index];
+    size_t stride = ((static_cast<size_t>(p.width) * p.bpp + 7) / 8 + 3) & ~static_cast<size_t>(3);
+    if (p.indexedData.size() < stride * p.height) return false;
+    
+    uint32_t lut[256];
+    palette.toRGBA(lut);
+    lut[0] = 0;  // Transparent
+    bool indexed = p.bpp == 8 || p.bpp == 4;
+    convertIndexedToRGBA(p.indexedData.data(), p.width, p.height, p.bpp, out, indexed ? lut : nullptr);
+    return true;
+}
+
+/*==============================================================================
+ * SkylinePacker Implementation
+ * 
+ * The skyline is the top edge of everything placed so far, as runs of equal
+ * height sorted by x. A rect goes where its top ends lowest (ties: on the
+ * narrowest run, which wastes the least), then the runs it covers are cut
+ * back and equal neighbours merged.
+ *============================================================================*/
+
+void SkylinePacker::reset(int width, int height) {
+    m_width = width;
+    m_height = height;
+    m_usedArea = 0;
+    m_skyline.clear();
+    m_skyline.push_back({ 0, 0, width });
+}
+
+// Height a w-wide rect starting at run index would sit at, -1 if it sticks out
+int SkylinePacker::fitY(size_t index, int w) const {
+    if (m_skyline[index].x + w > m_width) return -1;
+    int y = 0;
+    int remaining = w;
+    for (size_t i = index; remaining > 0 && i < m_skyline.size(); i++) {
+        y = std::max(y, m_skyline[i].y);
+        remaining -= m_skyline[i].w;
+    }
+    return y;
+}
+
+bool SkylinePacker::insert(int w, int h, Rect& out) {
+    if (w <= 0 || h <= 0 || w > m_width || h > m_height) return false;
+    
+    size_t best = m_skyline.size();
+    int bestTop = m_height + 1;
+    int bestRunW = 0;
+    for (size_t i = 0; i < m_skyline.size(); i++) {
+        int y = fitY(i, w);
+        if (y < 0 || y + h > m_height) continue;
+        if (y + h < bestTop || (y + h == bestTop && m_skyline[i].w < bestRunW)) {
+            best = i;
+            bestTop = y + h;
+            bestRunW = m_skyline[i].w;
+        }
+    }
+    if (best == m_skyline.size()) return false;
+    
+    out = Rect(m_skyline[best].x, bestTop - h, w, h);
+    m_skyline.insert(m_skyline.begin() + best, { out.x, bestTop, w });
+    
+    // Cut back the runs now under the new one
+    for (size_t i = best + 1; i < m_skyline.size();) {
+        int prevEnd = m_skyline[i - 1].x + m_skyline[i - 1].w;
+        if (m_skyline[i].x >= prevEnd) break;
+        int overlap = prevEnd - m_skyline[i].x;
+        m_skyline[i].x += overlap;
+        m_skyline[i].w -= overlap;
+        if (m_skyline[i].w > 0) break;
+        m_skyline.erase(m_skyline.begin() + i);
+    }
+    
+    // Merge neighbours of equal height
+    for (size_t i = 0; i + 1 < m_skyline.size();) {
+        if (m_skyline[i].y == m_skyline[i + 1].y) {
+            m_skyline[i].w += m_skyline[i + 1].w;
+            m_skyline.erase(m_skyline.begin() + i + 1);
+        } else {
+            i++;
+        }
+    }
+    
+    m_usedArea += static_cast<int64_t>(w) * h;
+    return true;
+}
+
+int SkylinePacker::shrinkToFit(bool pow2) {
+    int top = 1;
+    for (const Segment& s : m_skyline) top = std::max(top, s.y);
+    if (pow2) {
+        int h = 1;
+        while (h < top) h *= 2;
+        top = h;
+    }
+    m_height = std::min(m_height, top);
+    return m_height;
+}
+
+float SkylinePacker::occupancy() const {
+    int64_t area = static_cast<int64_t>(m_width) * m_height;
+    return area ? static_cast<float>(m_usedArea) / area : 0.0f;
+}
+
 /*==============================================================================
  * TextureAtlas Implementation
  *============================================================================*/
@@ -551,81 +804,208 @@ const Pattern* SpriteSheet::getPattern(int index) const {
 TextureAtlas::TextureAtlas() = default;
 TextureAtlas::~TextureAtlas() = default;
 
-bool TextureAtlas::createFromSpriteSheet(const SpriteSheet& sheet) {
+static double ElapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static int NextPow2(int v) {
+    int p = 1;
+    while (p < v) p *= 2;
+    return p;
+}
+
+void TextureAtlas::release() {
+    m_pages.clear();
     m_rects.clear();
+    m_pageOf.clear();
+    m_stats = AtlasStats();
+}
+
+// Find room for a padded w x h rect, first in the existing pages, then (with
+// allocate) in a new page. Oversized rects get a page of their own size.
+bool TextureAtlas::place(int w, int h, int& page, Rect& rect, bool allocate) {
+    for (size_t i = 0; i < m_pages.size(); i++) {
+        if (m_pages[i].packer.insert(w, h, rect)) {
+            page = static_cast<int>(i);
+            return true;
+        }
+    }
+    if (!allocate) return false;
     
-    int count = sheet.patternCount();
-    if (count == 0) return false;
+    int maxSize = Texture::maxSize();
+    int pageSize = std::min(NextPow2(std::max(m_options.pageSize, 64)), maxSize);
+    int pageW = std::max(pageSize, NextPow2(w));
+    int pageH = std::max(pageSize, NextPow2(h));
+    if (pageW > maxSize || pageH > maxSize) return false;
     
-    // Calculate atlas dimensions
-    // Simple row-based packing for now
-    int totalWidth = 0;
-    int maxHeight = 0;
+    m_pages.emplace_back();
+    m_pages.back().packer.reset(pageW, pageH);
+    page = static_cast<int>(m_pages.size()) - 1;
+    return m_pages.back().packer.insert(w, h, rect);
+}
+
+// Upload a pattern into its padded rect, the padding extruded from its edges
+void TextureAtlas::upload(const Bitmap& bitmap, int page, const Rect& rect) {
+    Texture& texture = m_pages[page].texture;
+    int pad = m_options.padding;
+    if (pad == 0) {
+        texture.updateRegion(bitmap, rect.x, rect.y);
+        return;
+    }
     
-    for (int i = 0; i < count; i++) {
-        const Pattern* p = sheet.getPattern(i);
-        if (p && p->bitmap.valid()) {
-            totalWidth += p->width;
-            maxHeight = std::max(maxHeight, p->height);
+    Bitmap staging(rect.w, rect.h);
+    staging.blit(bitmap, pad, pad);
+    if (m_options.extrude) {
+        uint32_t* px = reinterpret_cast<uint32_t*>(staging.pixels());
+        int w = bitmap.width(), h = bitmap.height();
+        for (int y = 0; y < pad; y++) {
+            std::memcpy(px + y * rect.w + pad, px + pad * rect.w + pad, w * 4);
+            std::memcpy(px + (pad + h + y) * rect.w + pad, px + (pad + h - 1) * rect.w + pad, w * 4);
+        }
+        for (int y = 0; y < rect.h; y++) {
+            uint32_t* row = px + y * rect.w;
+            for (int x = 0; x < pad; x++) {
+                row[x] = row[pad];
+                row[pad + w + x] = row[pad + w - 1];
+            }
         }
     }
-    
-    // If patterns are too wide, we should use multiple rows
-    // For simplicity, use a power-of-2 texture with simple row packing
-    int atlasWidth = 1;
-    while (atlasWidth < totalWidth && atlasWidth < 4096) {
-        atlasWidth *= 2;
+    texture.updateRegion(staging, rect.x, rect.y);
+}
+
+void TextureAtlas::updateStats() {
+    m_stats.pages = static_cast<int>(m_pages.size());
+    m_stats.pagePixels = 0;
+    for (const Page& page : m_pages) {
+        m_stats.pagePixels += static_cast<int64_t>(page.packer.width()) * page.packer.height();
+    }
+}
+
+bool TextureAtlas::createFromSpriteSheet(const SpriteSheet& sheet, const AtlasOptions& options) {
+    // Pack from the header sizes; each pattern is decoded just before its upload
+    std::vector<Rect> sizes(sheet.patternCount(), Rect(0, 0, 0, 0));
+    for (int i = 0; i < sheet.patternCount(); i++) {
+        const Pattern* p = sheet.getPatternInfo(i);
+        if (p) sizes[i] = Rect(0, 0, p->width, p->height);
+    }
+    return build(sizes, [&sheet](int i) { return sheet.getBitmap(i); }, options);
+}
+
+bool TextureAtlas::createFromBitmaps(const std::vector<const Bitmap*>& bitmaps, const AtlasOptions& options) {
+    std::vector<Rect> sizes(bitmaps.size(), Rect(0, 0, 0, 0));
+    for (size_t i = 0; i < bitmaps.size(); i++) {
+        if (bitmaps[i] && bitmaps[i]->valid()) sizes[i] = Rect(0, 0, bitmaps[i]->width(), bitmaps[i]->height());
     }
+    return build(sizes, [&bitmaps](int i) { return bitmaps[i]; }, options);
+}
+
+bool TextureAtlas::build(const std::vector<Rect>& sizes, const std::function<const Bitmap*(int)>& fetch,
+                         const AtlasOptions& options) {
+    release();
+    m_options = options;
+    m_options.padding = std::max(0, m_options.padding);
     
-    // Calculate height needed with row wrapping
-    int atlasHeight = maxHeight;
-    int currentX = 0;
-    int currentY = 0;
-    int rowHeight = 0;
+    int count = static_cast<int>(sizes.size());
+    m_rects.assign(count, Rect(0, 0, 0, 0));
+    m_pageOf.assign(count, -1);
+    if (count == 0) return false;
     
-    std::vector<Rect> tempRects;
+    // Tallest first (then widest), which keeps the skyline flat
+    std::vector<int> order;
     for (int i = 0; i < count; i++) {
-        const Pattern* p = sheet.getPattern(i);
-        if (!p || !p->bitmap.valid()) {
-            tempRects.push_back(Rect(0, 0, 0, 0));
+        if (sizes[i].w > 0 && sizes[i].h > 0) order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        if (sizes[a].h != sizes[b].h) return sizes[a].h > sizes[b].h;
+        return sizes[a].w > sizes[b].w;
+    });
+    
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Rect> padded(count);
+    int pad = m_options.padding;
+    for (int i : order) {
+        int w = sizes[i].w, h = sizes[i].h;
+        if (!place(w + pad * 2, h + pad * 2, m_pageOf[i], padded[i], true)) {
+            fprintf(stderr, "TextureAtlas: pattern %d (%dx%d) exceeds the texture size limit\n", i, w, h);
+            m_pageOf[i] = -1;
+            m_stats.failed++;
             continue;
         }
-        
-        // Wrap to next row if needed
-        if (currentX + p->width > atlasWidth) {
-            currentX = 0;
-            currentY += rowHeight;
-            rowHeight = 0;
-        }
-        
-        tempRects.push_back(Rect(currentX, currentY, p->width, p->height));
-        currentX += p->width;
-        rowHeight = std::max(rowHeight, p->height);
+        m_rects[i] = Rect(padded[i].x + pad, padded[i].y + pad, w, h);
+        m_stats.patterns++;
+        m_stats.patternPixels += static_cast<int64_t>(w) * h;
     }
-    atlasHeight = currentY + rowHeight;
+    // Nothing more goes in unless added later; trim every page to what it holds
+    for (Page& page : m_pages) page.packer.shrinkToFit(true);
+    m_stats.packMs += ElapsedMs(start);
     
-    // Round up to power of 2
-    int h = 1;
-    while (h < atlasHeight && h < 4096) {
-        h *= 2;
+    start = std::chrono::steady_clock::now();
+    for (Page& page : m_pages) page.texture.create(page.packer.width(), page.packer.height());
+    for (int i : order) {
+        if (m_pageOf[i] < 0) continue;
+        const Bitmap* bitmap = fetch(i);
+        if (bitmap && bitmap->valid()) upload(*bitmap, m_pageOf[i], padded[i]);
     }
-    atlasHeight = h;
+    m_stats.uploadMs += ElapsedMs(start);
     
-    // Create atlas bitmap
-    Bitmap atlas(atlasWidth, atlasHeight);
-    atlas.clear(Color(0, 0, 0, 0));  // Transparent
+    updateStats();
+    return m_stats.patterns > 0;
+}
+
+int TextureAtlas::addPattern(const Bitmap& bitmap) {
+    if (!bitmap.valid()) return -1;
     
-    // Blit all patterns into atlas
-    m_rects = std::move(tempRects);
-    for (int i = 0; i < count; i++) {
-        const Pattern* p = sheet.getPattern(i);
-        if (p && p->bitmap.valid() && m_rects[i].w > 0) {
-            atlas.blit(p->bitmap, m_rects[i].x, m_rects[i].y);
-        }
+    int index = static_cast<int>(m_rects.size());
+    m_rects.push_back(Rect(0, 0, 0, 0));
+    m_pageOf.push_back(-1);
+    
+    auto start = std::chrono::steady_clock::now();
+    int pad = m_options.padding;
+    int page = -1;
+    Rect padded;
+    bool placed = place(bitmap.width() + pad * 2, bitmap.height() + pad * 2, page, padded, true);
+    m_stats.packMs += ElapsedMs(start);
+    if (!placed) {
+        fprintf(stderr, "TextureAtlas: pattern %d (%dx%d) exceeds the texture size limit\n",
+                index, bitmap.width(), bitmap.height());
+        m_stats.failed++;
+        return index;
     }
     
-    // Upload to GPU
-    return m_texture.createFromBitmap(atlas);
+    start = std::chrono::steady_clock::now();
+    Page& target = m_pages[page];
+    if (!target.texture.valid()) target.texture.create(target.packer.width(), target.packer.height());
+    upload(bitmap, page, padded);
+    m_stats.uploadMs += ElapsedMs(start);
+    
+    m_pageOf[index] = page;
+    m_rects[index] = Rect(padded.x + pad, padded.y + pad, bitmap.width(), bitmap.height());
+    m_stats.patterns++;
+    m_stats.patternPixels += static_cast<int64_t>(bitmap.width()) * bitmap.height();
+    updateStats();
+    return index;
+}
+
+int TextureAtlas::addSpriteSheet(const SpriteSheet& sheet) {
+    int first = static_cast<int>(m_rects.size());
+    for (int i = 0; i < sheet.patternCount(); i++) {
+        const Bitmap* bitmap = sheet.getBitmap(i);
+        if (bitmap && bitmap->valid()) {
+            addPattern(*bitmap);
+        } else {
+            m_rects.push_back(Rect(0, 0, 0, 0));  // Keep indices in step with the sheet
+            m_pageOf.push_back(-1);
+        }
+    }
+    return sheet.patternCount() > 0 ? first : -1;
+}
+
+const Texture& TextureAtlas::texture(int page) const {
+    static const Texture empty;
+    if (page >= 0 && page < static_cast<int>(m_pages.size())) {
+        return m_pages[page].texture;
+    }
+    return empty;
 }
 
 Rect TextureAtlas::getPatternRect(int index) const {
@@ -635,12 +1015,20 @@ Rect TextureAtlas::getPatternRect(int index) const {
     return Rect(0, 0, 0, 0);
 }
 
+int TextureAtlas::getPatternPage(int index) const {
+    if (index >= 0 && index < static_cast<int>(m_pageOf.size())) {
+        return m_pageOf[index];
+    }
+    return -1;
+}
+
 void TextureAtlas::drawPattern(Renderer& renderer, int patternIndex, int x, int y) const {
-    if (!m_texture.valid()) return;
+    int page = getPatternPage(patternIndex);
+    if (page < 0 || !m_pages[page].texture.valid()) return;
     
     Rect src = getPatternRect(patternIndex);
     if (src.w > 0 && src.h > 0) {
-        renderer.drawTexture(m_texture, x, y, src);
+        renderer.drawTexture(m_pages[page].texture, x, y, src);
     }
 }
 
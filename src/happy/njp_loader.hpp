@@ -17,6 +17,7 @@
 #include <string>
 #include <cstdint>
 #include <memory>
+#include <functional>
 
 namespace h2d {
 
@@ -28,15 +29,24 @@ struct Pattern {
     int width = 0;
     int height = 0;
     int bpp = 0;           // Bits per pixel (1, 4, 8, 16, 24)
-    int flags = 0;
-    Bitmap bitmap;         // RGBA bitmap (converted from indexed if needed)
+    int flags = 0;         // Compressed word of the header (nonzero = RCLIB-L block)
+    Bitmap bitmap;         // RGBA bitmap (converted from indexed if needed), see SpriteSheet::getBitmap
     
     // For indexed images, we keep the original indexed data too
+    // (decompressed pixels, bottom-up rows aligned to 4 bytes)
     std::vector<uint8_t> indexedData;
 };
 
 /*==============================================================================
  * SpriteSheet - Collection of patterns from an NJP file (like RKC_UPDIB_UPD)
+ * 
+ * Loading only indexes the file: pattern headers are read and the offset of
+ * each pattern's RCLIB-L block recorded, seeking from block to block by the
+ * compressed size in its header. A pattern's pixels are decompressed the
+ * first time getPattern asks for it and converted to RGBA only when
+ * getBitmap does. Decoded forms are kept under a byte budget and evicted
+ * least recently used first, so a returned pattern's pixels stay valid until
+ * later calls have decoded more than the budget's worth of other patterns.
  *============================================================================*/
 
 class SpriteSheet {
@@ -50,7 +60,8 @@ public:
     // Load from memory (already read file contents)
     bool loadFromMemory(const uint8_t* data, size_t size);
     
-    // Apply a palette to all indexed patterns
+    // Apply a palette to all indexed patterns (drops their RGBA forms; they
+    // are converted again with this palette on the next getBitmap)
     void applyPalette(const Palette& palette);
     
     // Check if this NJP has an embedded palette
@@ -66,11 +77,33 @@ public:
     // Returns true if an embedded palette was found and applied
     bool applyEmbeddedPalette(int paletteIndex = 0);
     
-    // Access patterns
+    // Access patterns: header and decompressed pixels (decoded on first use)
     int patternCount() const { return static_cast<int>(m_patterns.size()); }
     Pattern* getPattern(int index);
     const Pattern* getPattern(int index) const;
     
+    // Header fields only (width, height, bpp, flags), never decodes
+    const Pattern* getPatternInfo(int index) const;
+    
+    // RGBA form of a pattern, converted on first use; nullptr if the pattern
+    // is empty or its data does not decompress
+    const Bitmap* getBitmap(int index) const;
+    
+    // RGBA form through another palette (a per-object or animated one) into
+    // the caller's bitmap; leaves the applied palette and getBitmap's forms
+    // alone. Patterns that are not 4/8bpp convert as getBitmap does.
+    bool convertPattern(int index, const Palette& palette, Bitmap& out) const;
+    
+    // Decoded bytes kept before evicting (0 = no limit, default 64 MB)
+    void setDecodeBudget(size_t bytes);
+    size_t decodedBytes() const { return m_decodedBytes; }
+    
+    // File data plus decoded forms currently held
+    size_t residentBytes() const { return m_data.size() + m_decodedBytes; }
+    
+    // FNV-1a over the file data in 64-bit words, e.g. to key caches built from it
+    uint64_t contentHash() const;
+    
     // Get filename (for debugging)
     const std::string& filename() const { return m_filename; }
     
@@ -80,52 +113,167 @@ public:
     // Get the BPP of the first pattern (for palette size determination)
     int primaryBpp() const { return m_patterns.empty() ? 8 : m_patterns[0].bpp; }
     
+    // Convert bottom-up pattern pixels (rows aligned to 4 bytes) to a top-down
+    // RGBA bitmap. lut holds 256 packed RGBA colours (Color::toRGBA) for 1/4/8bpp;
+    // nullptr = grayscale. 16bpp is RGB565 and 24bpp BGR, both keyed on magenta.
+    static void convertIndexedToRGBA(const uint8_t* indexed, int width, int height,
+                                     int bpp, Bitmap& out, const uint32_t* lut = nullptr);
+    
 private:
+    struct PatternSlot {
+        size_t offset = 0;          // Pixel block in m_data, 0 = no pixel data
+        size_t extent = 0;          // Block size (RCLIB-L header + payload, or raw rows)
+        bool packed = false;        // RCLIB-L, else raw rows
+        uint64_t lastUse = 0;       // For LRU eviction
+        bool failed = false;        // Did not decompress; not retried
+    };
+    
     std::string m_filename;
-    std::vector<Pattern> m_patterns;
-    std::vector<Palette> m_embeddedPalettes;  // Embedded palettes from NJP
+    std::vector<uint8_t> m_data;                // File contents (decompressed if the whole file was RCLIB-L)
+    mutable std::vector<Pattern> m_patterns;
+    mutable std::vector<PatternSlot> m_slots;
+    std::vector<Palette> m_embeddedPalettes;    // Embedded palettes from NJP
+    Palette m_palette;                          // Applied palette for 4/8bpp patterns
+    uint32_t m_paletteLut[256];                 // m_palette packed, index 0 transparent
+    bool m_hasPalette = false;
+    size_t m_decodeBudget = 64 * 1024 * 1024;
+    mutable size_t m_decodedBytes = 0;
+    mutable uint64_t m_useClock = 0;
+    
+    bool loadData(std::vector<uint8_t>&& data);
     
     // Internal: decompress RCLIB-L data
     static bool decompressRCLIB(const uint8_t* src, size_t srcSize, 
                                 std::vector<uint8_t>& dest);
     
-    // Internal: parse decompressed NJP data
-    bool parseNJP(const uint8_t* data, size_t size);
+    // Internal: index m_data (headers and block offsets, no pixels)
+    bool parseNJP();
+    
+    // Internal: extract embedded palettes from NJP data, validating the
+    // extended header at extPos (0 = unknown, use the end of the file)
+    bool extractPalettes(const uint8_t* data, size_t size, int bpp, int version, size_t extPos);
+    
+    // Internal: lazy decode/convert, LRU bookkeeping
+    bool decode(int index) const;
+    bool convert(int index) const;
+    void touch(int index) const;
+    void evict(int keep) const;
+};
+
+/*==============================================================================
+ * SkylinePacker - bottom-left skyline rectangle packing for one atlas page
+ *============================================================================*/
+
+class SkylinePacker {
+public:
+    SkylinePacker() = default;
+    SkylinePacker(int width, int height) { reset(width, height); }
+    
+    void reset(int width, int height);
+    
+    // Place a w x h rect at the lowest (then leftmost) spot on the skyline.
+    // Returns false if it does not fit in the page.
+    bool insert(int w, int h, Rect& out);
     
-    // Internal: extract embedded palettes from NJP data
-    bool extractPalettes(const uint8_t* data, size_t size, int bpp, int patternCount);
+    // Lower the page height to the skyline's top (rounded up to a power of two
+    // if pow2 is set); later inserts are limited to the new height.
+    int shrinkToFit(bool pow2);
     
-    // Internal: convert indexed pixels to RGBA bitmap
-    static void convertIndexedToRGBA(const uint8_t* indexed, int width, int height, 
-                                      int bpp, Bitmap& out);
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    int64_t usedArea() const { return m_usedArea; }
+    float occupancy() const;
+    
+private:
+    struct Segment { int x, y, w; };  // Skyline run at height y from x to x + w
+    std::vector<Segment> m_skyline;
+    int m_width = 0;
+    int m_height = 0;
+    int64_t m_usedArea = 0;
+    
+    int fitY(size_t index, int w) const;
 };
 
 /*==============================================================================
  * TextureAtlas - GPU-side sprite sheet with sub-texture regions
+ * 
+ * Patterns are skyline-packed into power-of-two pages of up to pageSize
+ * (clamped to the GL limit), spilling into more pages as they fill. Each
+ * pattern keeps a padding ring that is filled with its edge pixels when
+ * extrude is set, so filtered or scaled draws never pick up a neighbour.
+ * createFromSpriteSheet packs tallest first and trims the last page;
+ * addPattern/addSpriteSheet stream patterns into the existing pages.
  *============================================================================*/
 
+struct AtlasOptions {
+    int pageSize = 2048;    // Page edge, power of two
+    int padding = 1;        // Pixels around each pattern (1-2 for filtering)
+    bool extrude = true;    // Fill the padding with the pattern's edge pixels
+};
+
+struct AtlasStats {
+    int pages = 0;
+    int patterns = 0;               // Patterns placed (empty ones excluded)
+    int failed = 0;                 // Patterns larger than the GL texture limit
+    int64_t patternPixels = 0;      // Pattern area, padding excluded
+    int64_t pagePixels = 0;         // Texture area of all pages
+    double packMs = 0;              // Time spent placing rects
+    double uploadMs = 0;            // Time spent extruding and uploading
+    
+    float occupancy() const { return pagePixels ? static_cast<float>(patternPixels) / pagePixels : 0.0f; }
+};
+
 class TextureAtlas {
 public:
     TextureAtlas();
     ~TextureAtlas();
     
-    // Create from a sprite sheet (uploads all patterns to one texture)
-    bool createFromSpriteSheet(const SpriteSheet& sheet);
+    // Create from a sprite sheet (replaces the atlas contents)
+    bool createFromSpriteSheet(const SpriteSheet& sheet, const AtlasOptions& options = AtlasOptions());
+    
+    // Create from loose bitmaps (null or invalid entries get an empty rect)
+    bool createFromBitmaps(const std::vector<const Bitmap*>& bitmaps,
+                           const AtlasOptions& options = AtlasOptions());
     
-    // Get the texture
-    const Texture& texture() const { return m_texture; }
+    // Incremental: append one pattern / all of a sheet's patterns to the
+    // existing pages. Return the (first) new pattern index, -1 on failure.
+    int addPattern(const Bitmap& bitmap);
+    int addSpriteSheet(const SpriteSheet& sheet);
     
-    // Get source rect for a pattern
+    void release();
+    
+    // Pages
+    int pageCount() const { return static_cast<int>(m_pages.size()); }
+    const Texture& texture(int page = 0) const;
+    
+    // Get source rect (and page) for a pattern
     Rect getPatternRect(int index) const;
+    int getPatternPage(int index) const;
     
     // Draw a pattern
     void drawPattern(Renderer& renderer, int patternIndex, int x, int y) const;
     
     int patternCount() const { return static_cast<int>(m_rects.size()); }
+    const AtlasStats& stats() const { return m_stats; }
     
 private:
-    Texture m_texture;
+    struct Page {
+        SkylinePacker packer;
+        Texture texture;
+    };
+    
+    AtlasOptions m_options;
+    std::vector<Page> m_pages;
     std::vector<Rect> m_rects;  // Source rects for each pattern in the atlas
+    std::vector<int> m_pageOf;  // Page of each pattern, -1 if empty
+    AtlasStats m_stats;
+    
+    // Pack sizes (w, h; empty = skipped), then upload fetch(i) for each placed one
+    bool build(const std::vector<Rect>& sizes, const std::function<const Bitmap*(int)>& fetch,
+               const AtlasOptions& options);
+    bool place(int w, int h, int& page, Rect& rect, bool allocate);
+    void upload(const Bitmap& bitmap, int page, const Rect& rect);
+    void updateStats();
 };
 
 } // namespace h2d
@@ -15,8 +15,6 @@
 #include <vector>
 #include <dirent.h>
 #include <sys/stat.h>
-#include <chrono>
-#include <thread>
 
 // Find NJP files in a directory
 std::vector<std::string> findNjpFiles(const std::string& dir, int maxFiles = 20) {
@@ -137,7 +135,7 @@ int main(int argc, char* argv[]) {
             
             // Print pattern info
             for (int i = 0; i < std::min(5, sheet.patternCount()); i++) {
-                const auto* p = sheet.getPattern(i);
+                const auto* p = sheet.getPatternInfo(i);
                 if (p) {
                     printf("  Pattern %d: %dx%d, %d bpp\n", i, p->width, p->height, p->bpp);
                 }
@@ -148,7 +146,9 @@ int main(int argc, char* argv[]) {
             
             // Create texture atlas
             if (atlas.createFromSpriteSheet(sheet)) {
-                printf("  Atlas created successfully\n");;
+                const h2d::AtlasStats& st = atlas.stats();
+                printf("  Atlas: %d page(s), %.1f%% occupied, packed in %.2f ms, uploaded in %.2f ms\n",
+                       st.pages, st.occupancy() * 100.0f, st.packMs, st.uploadMs);
             }
             
             currentPattern = 0;
@@ -162,6 +162,9 @@ int main(int argc, char* argv[]) {
     bool needRedraw = true;
     
     while (!window->shouldClose()) {
+        // Nothing changes on screen without input: sleep until some arrives
+        if (!needRedraw) window->waitEvents();
+        
         // Handle events
         while (auto event = window->pollEvent()) {
             if (event->type == hwl::EventType::KeyDown) {
@@ -209,14 +212,14 @@ int main(int argc, char* argv[]) {
             int y = 10;
             
             // Draw the individual pattern (larger, for detail view)
-            const h2d::Pattern* pattern = sheet.getPattern(currentPattern);
-            if (pattern && pattern->bitmap.valid()) {
+            const h2d::Bitmap* pattern = sheet.getBitmap(currentPattern);
+            if (pattern && pattern->valid()) {
                 // Create a temporary texture for this pattern
                 static h2d::Texture patternTex;
-                patternTex.createFromBitmap(pattern->bitmap);
+                patternTex.createFromBitmap(*pattern);
                 
                 // Draw at 2x scale
-                h2d::Rect dest(50, 80, pattern->width * 2, pattern->height * 2);
+                h2d::Rect dest(50, 80, pattern->width() * 2, pattern->height() * 2);
                 renderer.drawTextureScaled(patternTex, dest);
                 
                 // Draw outline
@@ -230,7 +233,7 @@ int main(int argc, char* argv[]) {
             int thumbScale = 1;
             
             for (int i = 0; i < std::min(20, sheet.patternCount()); i++) {
-                const h2d::Pattern* p = sheet.getPattern(i);
+                const h2d::Pattern* p = sheet.getPatternInfo(i);
                 if (p && p->width > 0 && p->height > 0) {
                     h2d::Rect src = atlas.getPatternRect(i);
                     if (src.w > 0) {
@@ -243,7 +246,7 @@ int main(int argc, char* argv[]) {
                                                h2d::Color(255, 255, 0, 255));
                         }
                         
-                        renderer.drawTextureScaled(atlas.texture(), 
+                        renderer.drawTextureScaled(atlas.texture(atlas.getPatternPage(i)), 
                                                     h2d::Rect(thumbX, thumbY, w, h), src);
                         
                         thumbX += w + 4;
@@ -259,9 +262,6 @@ int main(int argc, char* argv[]) {
             window->swapBuffers();
             needRedraw = false;
         }
-        
-        // Small sleep to avoid spinning CPU when idle
-        std::this_thread::sleep_for(std::chrono::milliseconds(16));
     }
     
     printf("Done!\n");
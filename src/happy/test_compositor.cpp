@@ -0,0 +1,428 @@
+/*
+ * test_compositor.cpp - Headless test of the GPU compositor against a CPU reference
+ *
+ * Creates a surfaceless EGL context (Mesa llvmpipe is enough, no X server),
+ * builds a small NJP sheet in memory (8bpp, 4bpp, 24bpp and 1bpp parts),
+ * composes a frame of packets covering mirroring, scaling, alpha, additive
+ * blend, tint, invert, grey, clip rects and palettes into an offscreen
+ * framebuffer, and compares every pixel with the same frame composed on the
+ * CPU (1bpp parts white on transparent, as SpriteSheet draws them). Then swaps a
+ * palette row, cycles and fades one with PaletteAnimator (uploading only the
+ * entries it changed), compares after each, adds the sheet again through
+ * the disk cache (written, read back, then damaged and rebuilt) and compares,
+ * and times a crowded frame.
+ * An NJP file can be given to also upload and time its parts.
+ *
+ * Build (Linux):
+ *   g++ -std=c++17 -O2 test_compositor.cpp compositor.cpp njp_loader.cpp h2d.cpp -o test_compositor -lEGL -lGL
+ *
+ * Usage: test_compositor [njp file] [packets per frame]
+ */
+
+#define GL_GLEXT_PROTOTYPES
+#include "compositor.hpp"
+#include "test_util.hpp"
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace h2d;
+
+static const int kWidth = 320;
+static const int kHeight = 240;
+
+/*==============================================================================
+ * Test sheet: parts kept top-down for the CPU reference, written as an NJP
+ *============================================================================*/
+
+struct TestPart {
+    int bpp, width, height;
+    std::vector<uint8_t> rows;  // Top-down, one value per pixel (index, or 0xRRGGBB for 24bpp)
+    std::vector<uint32_t> rgb;
+};
+
+// The parts stored bottom-up, one pattern each, with one BGRA palette
+static std::vector<uint8_t> MakeSheet(const std::vector<TestPart>& parts) {
+    std::vector<NJPPart> stored;
+    for (const TestPart& p : parts) {
+        int stride = NJPStride(p.width, p.bpp);
+        NJPPart part = { p.bpp, p.width, p.height, std::vector<uint8_t>(static_cast<size_t>(stride) * p.height) };
+        for (int y = 0; y < p.height; y++) {
+            uint8_t* row = part.pixels.data() + (p.height - 1 - y) * stride;
+            for (int x = 0; x < p.width; x++) {
+                if (p.bpp == 8) {
+                    row[x] = p.rows[y * p.width + x];
+                } else if (p.bpp == 4) {
+                    row[x / 2] |= (x & 1) ? p.rows[y * p.width + x] : p.rows[y * p.width + x] << 4;
+                } else if (p.bpp == 1) {
+                    row[x / 8] |= p.rows[y * p.width + x] << (7 - (x & 7));
+                } else {
+                    uint32_t c = p.rgb[y * p.width + x];
+                    row[x * 3 + 0] = c & 0xFF;
+                    row[x * 3 + 1] = (c >> 8) & 0xFF;
+                    row[x * 3 + 2] = (c >> 16) & 0xFF;
+                }
+            }
+        }
+        stored.push_back(std::move(part));
+    }
+    std::vector<uint32_t> palette(256);
+    for (int i = 0; i < 256; i++) {
+        palette[i] = static_cast<uint32_t>((i * 3) | ((255 - i) << 8) | ((i * 7 & 0xFF) << 16));
+    }
+    return BuildNJP(stored, palette);
+}
+
+/*==============================================================================
+ * CPU reference: same placement, sampling and colour rules as the shader
+ *============================================================================*/
+
+struct RefFrame {
+    std::vector<float> px;  // RGB, 0..1
+    RefFrame() : px(kWidth * kHeight * 3, 0.0f) {}
+};
+
+static void RefCompose(RefFrame& frame, const std::vector<TestPart>& parts, const std::vector<Palette>& palettes,
+                       const std::vector<SpritePacket>& packets) {
+    for (const SpritePacket& pk : packets) {
+        const TestPart& part = parts[pk.part];
+        const Palette& pal = palettes[pk.palette];
+        bool mx = (pk.flags & PACKET_MIRRORX) != 0, my = (pk.flags & PACKET_MIRRORY) != 0;
+        int lx = mx ? -part.width : 0, ly = my ? -part.height : 0;
+        int left = pk.scaleX * lx / 1000 + pk.x, top = pk.scaleY * ly / 1000 + pk.y;
+        int right = (part.width + lx) * pk.scaleX / 1000 + pk.x;
+        int bottom = (part.height + ly) * pk.scaleY / 1000 + pk.y;
+        int cl = left, ct = top, cr = right, cb = bottom;
+        if (pk.flags & PACKET_CLIP) {
+            cl = std::max(cl, pk.clip.x);
+            ct = std::max(ct, pk.clip.y);
+            cr = std::min(cr, pk.clip.x + pk.clip.w);
+            cb = std::min(cb, pk.clip.y + pk.clip.h);
+        }
+        float a = std::min(pk.alpha, 1000) / 1000.0f;
+        float tint[3] = { (pk.r - 1000) / 1000.0f, (pk.g - 1000) / 1000.0f, (pk.b - 1000) / 1000.0f };
+        for (int y = std::max(ct, 0); y < std::min(cb, kHeight); y++) {
+            for (int x = std::max(cl, 0); x < std::min(cr, kWidth); x++) {
+                int tx = static_cast<int>((x + 0.5f - left) * part.width / (right - left));
+                int ty = static_cast<int>((y + 0.5f - top) * part.height / (bottom - top));
+                if (mx) tx = part.width - 1 - tx;
+                if (my) ty = part.height - 1 - ty;
+                float c[3];
+                if (part.bpp == 24) {
+                    uint32_t v = part.rgb[ty * part.width + tx];
+                    if (v == 0xFF00FF && !(pk.flags & PACKET_OPAQUE)) continue;
+                    if (v == 0xFF00FF) v = 0;  // Keyed texels are stored as transparent black
+                    c[0] = ((v >> 16) & 0xFF) / 255.0f;
+                    c[1] = ((v >> 8) & 0xFF) / 255.0f;
+                    c[2] = (v & 0xFF) / 255.0f;
+                } else if (part.bpp == 1) {
+                    // White on transparent, as SpriteSheet::convert draws it; no palette
+                    int index = part.rows[ty * part.width + tx];
+                    if (index == 0 && !(pk.flags & PACKET_OPAQUE)) continue;
+                    c[0] = c[1] = c[2] = index ? 1.0f : 0.0f;
+                } else {
+                    int index = part.rows[ty * part.width + tx];
+                    if (index == 0 && !(pk.flags & PACKET_OPAQUE)) continue;
+                    Color pc = pal.getColor(index);
+                    c[0] = pc.r / 255.0f;
+                    c[1] = pc.g / 255.0f;
+                    c[2] = pc.b / 255.0f;
+                }
+                for (int i = 0; i < 3; i++) c[i] += tint[i] < 0 ? c[i] * tint[i] : (1.0f - c[i]) * tint[i];
+                if (pk.flags & PACKET_INVERT) for (int i = 0; i < 3; i++) c[i] = 1.0f - c[i];
+                if (pk.flags & PACKET_GREY) c[0] = c[1] = c[2] = std::max(c[0], std::max(c[1], c[2]));
+                float* d = &frame.px[(y * kWidth + x) * 3];
+                for (int i = 0; i < 3; i++) {
+                    d[i] = (pk.flags & PACKET_ADD) ? std::min(1.0f, d[i] + c[i] * a) : c[i] * a + d[i] * (1.0f - a);
+                }
+            }
+        }
+    }
+}
+
+// Pixels whose channels differ by more than 2/255 (blend rounding)
+static int Compare(const RefFrame& ref, const std::vector<uint8_t>& gpu) {
+    int bad = 0;
+    for (int y = 0; y < kHeight; y++) {
+        for (int x = 0; x < kWidth; x++) {
+            // glReadPixels rows are bottom-up
+            const uint8_t* g = &gpu[((kHeight - 1 - y) * kWidth + x) * 4];
+            const float* r = &ref.px[(y * kWidth + x) * 3];
+            for (int i = 0; i < 3; i++) {
+                if (std::abs(g[i] - static_cast<int>(r[i] * 255.0f + 0.5f)) > 2) {
+                    if (bad < 5) {
+                        printf("  mismatch at %d,%d: gpu %d %d %d, cpu %.0f %.0f %.0f\n", x, y,
+                               g[0], g[1], g[2], r[0] * 255, r[1] * 255, r[2] * 255);
+                    }
+                    bad++;
+                    break;
+                }
+            }
+        }
+    }
+    return bad;
+}
+
+static std::vector<uint8_t> ReadFrame() {
+    std::vector<uint8_t> pixels(kWidth * kHeight * 4);
+    glReadPixels(0, 0, kWidth, kHeight, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    return pixels;
+}
+
+static std::vector<TestPart> MakeParts() {
+    std::vector<TestPart> parts(4);
+    parts[0] = { 8, 24, 16, {}, {} };
+    for (int y = 0; y < 16; y++) {
+        for (int x = 0; x < 24; x++) {
+            bool border = x == 0 || y == 0 || x == 23 || y == 15;
+            parts[0].rows.push_back(border ? 0 : static_cast<uint8_t>(1 + (x * 7 + y * 13) % 255));
+        }
+    }
+    parts[1] = { 4, 10, 10, {}, {} };
+    for (int y = 0; y < 10; y++) {
+        for (int x = 0; x < 10; x++) parts[1].rows.push_back(static_cast<uint8_t>((x + y) % 16));
+    }
+    parts[2] = { 24, 8, 8, {}, {} };
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            parts[2].rgb.push_back((x + y) % 5 == 0 ? 0xFF00FF : (x * 32) << 16 | (y * 32) << 8 | 0x80);
+        }
+    }
+    parts[3] = { 1, 12, 9, {}, {} };
+    for (int y = 0; y < 9; y++) {
+        for (int x = 0; x < 12; x++) parts[3].rows.push_back(static_cast<uint8_t>((x * 3 + y) % 4 != 0));
+    }
+    return parts;
+}
+
+static Palette MakePalette(int seed) {
+    Palette pal;
+    for (int i = 0; i < 256; i++) {
+        pal.setColor(i, Color(static_cast<uint8_t>(i * 3 + seed), static_cast<uint8_t>(255 - i),
+                              static_cast<uint8_t>(i * 5 + seed * 7)));
+    }
+    return pal;
+}
+
+int main(int argc, char* argv[]) {
+    const char* njpFile = argc > 1 ? argv[1] : nullptr;
+    int crowd = argc > 2 ? atoi(argv[2]) : 3000;
+
+    if (!CreateHeadlessContext()) {
+        fprintf(stderr, "No EGL/OpenGL 3.3 context (need Mesa with surfaceless EGL)\n");
+        return 1;
+    }
+    printf("GL: %s, %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+
+    GLuint fbo, color;
+    glGenFramebuffers(1, &fbo);
+    glGenRenderbuffers(1, &color);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, kWidth, kHeight);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+
+    Compositor compositor;
+    if (!compositor.init(LoadProc, 256)) return 1;
+
+    std::vector<TestPart> parts = MakeParts();
+    std::vector<uint8_t> njp = MakeSheet(parts);
+    SpriteSheet sheet;
+    if (!sheet.loadFromMemory(njp.data(), njp.size()) || sheet.patternCount() != 4) {
+        fprintf(stderr, "Test sheet did not load\n");
+        return 1;
+    }
+    int sheetId = compositor.addSheet(sheet);
+    // CPU copy of the palette rows: the sheet's own (grayscale unless it found one), then two more
+    std::vector<Palette> palettes;
+    for (int i = 0; i < sheet.embeddedPaletteCount(); i++) palettes.push_back(*sheet.getEmbeddedPalette(i));
+    if (!sheet.hasEmbeddedPalette()) palettes.push_back(Palette());
+    palettes.push_back(MakePalette(0));
+    palettes.push_back(MakePalette(40));
+    int palA = compositor.addPalette(palettes[palettes.size() - 2]);
+    int palB = compositor.addPalette(palettes[palettes.size() - 1]);
+
+    // One of everything; the run breaks (page or blend changes) give 4 batches
+    std::vector<SpritePacket> packets;
+    auto add = [&](int part, int palette, uint32_t flags, int x, int y) -> SpritePacket& {
+        SpritePacket p;
+        p.sheet = sheetId;
+        p.part = part;
+        p.palette = palette;
+        p.flags = flags;
+        p.x = x;
+        p.y = y;
+        packets.push_back(p);
+        return packets.back();
+    };
+    add(0, palA, 0, 10, 10);
+    add(0, palB, PACKET_MIRRORX, 80, 10);
+    add(0, palA, PACKET_MIRRORY, 90, 40);
+    add(0, palA, PACKET_OPAQUE, 100, 10);
+    add(1, palB, 0, 20, 20);                                    // Overlaps the first one
+    { SpritePacket& p = add(0, palA, 0, 130, 10); p.scaleX = 3000; p.scaleY = 2000; }
+    { SpritePacket& p = add(0, palB, 0, 150, 20); p.alpha = 400; }
+    { SpritePacket& p = add(0, palA, 0, 10, 80); p.r = 400; p.g = 1500; p.b = 1000; }
+    add(0, palA, PACKET_INVERT, 40, 80);
+    add(0, palB, PACKET_GREY, 70, 80);
+    { SpritePacket& p = add(0, palA, PACKET_CLIP, 100, 80); p.clip = Rect(105, 83, 10, 6); }
+    add(2, 0, 0, 200, 100);                                     // RGBA page
+    { SpritePacket& p = add(2, 0, PACKET_MIRRORX | PACKET_MIRRORY, 230, 110); p.scaleX = 2000; p.scaleY = 2000; }
+    add(3, palB, 0, 260, 100);                                  // 1bpp: white on the RGBA page, not palette entry 1
+    { SpritePacket& p = add(0, palB, PACKET_ADD, 160, 30); p.alpha = 700; }
+    { SpritePacket& p = add(1, palA, PACKET_ADD, 30, 15); p.alpha = 1000; }
+    add(0, palA, 0, 300, 230);                                  // Partly off the target
+    add(0, palA, 0, 400, 10);                                   // Culled
+    add(0, palA, PACKET_MIRRORX, -30, 130);                     // Culled (mirrored off the left edge)
+    { SpritePacket& p = add(0, palA, PACKET_CLIP, 10, 150); p.clip = Rect(200, 200, 5, 5); }  // Culled
+    add(0, palA, PACKET_MIRRORX, 5, 200);                       // Partly off the left edge
+
+    int fails = 0;
+    auto composeAndCheck = [&](const char* what) {
+        glClearColor(0, 0, 0, 1);
+        glClear(GL_COLOR_BUFFER_BIT);
+        compositor.beginFrame();
+        for (const SpritePacket& p : packets) compositor.submit(p);
+        compositor.compose(kWidth, kHeight);
+        std::vector<uint8_t> gpu = ReadFrame();
+        RefFrame ref;
+        std::vector<SpritePacket> refPackets = packets;
+        for (SpritePacket& p : refPackets) if (p.palette < 0) p.palette = compositor.sheetPalette(sheetId);
+        RefCompose(ref, parts, palettes, refPackets);
+        int bad = Compare(ref, gpu);
+        const CompositorStats& s = compositor.stats();
+        printf("%-14s %d packets, %d drawn, %d culled, %d batches, %d bad pixels\n",
+               what, s.packets, s.drawn, s.culled, s.batches, bad);
+        if (bad) fails++;
+        if (s.drawn != 18 || s.culled != 3 || s.batches != 4) {
+            printf("  expected 18 drawn, 3 culled, 4 batches\n");
+            fails++;
+        }
+    };
+    composeAndCheck("frame:");
+
+    // A palette change is one row upload; the parts stay as they are
+    size_t uploaded = compositor.stats().uploadedBytes;
+    palettes[palA] = MakePalette(90);
+    compositor.setPalette(palA, palettes[palA]);
+    composeAndCheck("palette swap:");
+    printf("palette swap uploaded %zu bytes\n", compositor.stats().uploadedBytes - uploaded);
+
+    // Palette animation: a colour cycle uploads its own range, a fade the row
+    PaletteAnimator animator;
+    animator.setBase(palettes[palB]);
+    animator.update(0);
+    animator.cycle(1, 48, 10.0f);
+    animator.update(250);                                       // 2.5 steps: rotated by 2
+    if (animator.current().getColor(1).toRGBA() != palettes[palB].getColor(3).toRGBA() ||
+        animator.current().getColor(48).toRGBA() != palettes[palB].getColor(2).toRGBA()) fails++;
+    uploaded = compositor.stats().uploadedBytes;
+    compositor.setPalette(palB, animator);
+    palettes[palB] = animator.current();
+    composeAndCheck("colour cycle:");
+    size_t cycleBytes = compositor.stats().uploadedBytes - uploaded;
+    if (animator.dirtyFirst() != 1 || animator.dirtyCount() != 48 || cycleBytes != 48 * 4) fails++;
+    if (animator.update(20)) fails++;                           // Still between steps
+    animator.fade(Color(0, 0, 0), 1.0f, 400.0f);
+    animator.update(100);
+    compositor.setPalette(palB, animator);
+    palettes[palB] = animator.current();
+    composeAndCheck("fade:");
+    printf("colour cycle uploaded %zu bytes, fade %d entries\n", cycleBytes, animator.dirtyCount());
+
+    // Disk cache: the first add writes <hash>.tcache, the second reads the
+    // pages back without decoding; both must draw the same frame
+    char cacheDir[] = "/tmp/test_compositor_XXXXXX";
+    if (!mkdtemp(cacheDir)) return 1;
+    char cacheFile[128];
+    snprintf(cacheFile, sizeof(cacheFile), "%s/%016llx.tcache", cacheDir,
+             static_cast<unsigned long long>(sheet.contentHash()));
+    for (int pass = 0; pass < 2; pass++) {
+        int id = compositor.addSheet(sheet, cacheDir);
+        for (SpritePacket& p : packets) p.sheet = id;
+        composeAndCheck(pass ? "cache read:" : "cache write:");
+    }
+    // A damaged file (first page claims 1M x 1M texels) is rebuilt and
+    // replaced, not allocated; no .tmp is left behind
+    if (FILE* f = fopen(cacheFile, "r+b")) {
+        uint32_t huge[2] = { 1u << 20, 1u << 20 };
+        fseek(f, 32 + 20 * sheet.patternCount() + 4, SEEK_SET);
+        fwrite(huge, 4, 2, f);
+        fclose(f);
+    }
+    int rebuilt = compositor.addSheet(sheet, cacheDir);
+    for (SpritePacket& p : packets) p.sheet = rebuilt;
+    composeAndCheck("cache damaged:");
+    int id = compositor.addSheet(sheet, cacheDir);
+    for (SpritePacket& p : packets) p.sheet = id;
+    composeAndCheck("cache redone:");
+    std::string tempFile = std::string(cacheFile) + ".tmp";
+    if (compositor.stats().cacheHits != 2 || access(tempFile.c_str(), F_OK) == 0) fails++;
+    printf("cache hits %d, %.1f KB of textures resident\n", compositor.stats().cacheHits,
+           compositor.stats().textureBytes / 1024.0);
+    remove(cacheFile);
+    rmdir(cacheDir);
+
+    // Crowded frame: same parts everywhere, normal blend -> one batch
+    std::vector<SpritePacket> scene(crowd);
+    srand(1);
+    for (SpritePacket& p : scene) {
+        p.sheet = sheetId;
+        p.part = rand() % 2;
+        p.palette = rand() % 2 ? palA : palB;
+        p.x = rand() % kWidth;
+        p.y = rand() % kHeight;
+        if (rand() % 4 == 0) p.alpha = 300 + rand() % 600;
+        if (rand() % 8 == 0) p.flags |= PACKET_MIRRORX;
+    }
+    const int frames = 50;
+    auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        glClear(GL_COLOR_BUFFER_BIT);
+        compositor.beginFrame();
+        for (const SpritePacket& p : scene) compositor.submit(p);
+        compositor.compose(kWidth, kHeight);
+        glFinish();
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+    printf("crowd: %d packets/frame, %d batches, %.3f ms/frame\n", crowd, compositor.stats().batches, ms);
+    if (compositor.stats().batches != 1) fails++;
+
+    if (njpFile) {
+        SpriteSheet big;
+        if (!big.loadFromFile(njpFile)) {
+            fprintf(stderr, "Failed to load %s\n", njpFile);
+            return 1;
+        }
+        size_t before = compositor.stats().uploadedBytes;
+        auto t0 = std::chrono::steady_clock::now();
+        int id = compositor.addSheet(big);
+        glFinish();
+        double uploadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        printf("%s: %d parts, %zu bytes uploaded in %.2f ms, %d pages\n", njpFile, big.patternCount(),
+               compositor.stats().uploadedBytes - before, uploadMs, compositor.stats().pages);
+        compositor.beginFrame();
+        for (int i = 0; i < big.patternCount(); i++) {
+            SpritePacket p;
+            p.sheet = id;
+            p.part = i;
+            p.x = (i * 37) % kWidth;
+            p.y = (i * 53) % kHeight;
+            compositor.submit(p);
+        }
+        compositor.compose(kWidth, kHeight);
+        printf("  all parts: %d drawn, %d batches\n", compositor.stats().drawn, compositor.stats().batches);
+    }
+
+    compositor.shutdown();
+    printf("%s\n", fails ? "FAILED" : "ok");
+    return fails ? 1 : 0;
+}
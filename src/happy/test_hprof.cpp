@@ -0,0 +1,220 @@
+/*
+ * test_hprof.cpp - hprof spans, frames, counters, Chrome trace and the h2d overlay
+ *
+ * Runs scripted frames of busy-waited spans (nested, repeated, on a second
+ * thread) and checks that each frame's parts are the frame thread's
+ * outermost spans summed by name, that counters are cut per frame, that
+ * percentiles come out of the frame times and that a disabled profiler
+ * records nothing. Reports what a scope costs enabled and disabled, writes a
+ * Chrome trace and checks its events, then draws the ProfilerOverlay into an
+ * offscreen framebuffer on a surfaceless EGL context (llvmpipe is fine) and
+ * checks the bars landed in their span colours, all in one batched draw.
+ *
+ * Build (Linux):
+ *   g++ -std=c++17 -O2 test_hprof.cpp h2d.cpp -o test_hprof -lEGL -lGL -lpthread
+ *
+ * Usage: test_hprof [trace file]   (default: a temp file, removed afterwards)
+ */
+
+#define GL_GLEXT_PROTOTYPES
+#include "h2d.hpp"
+#include "hprof.hpp"
+#include "test_util.hpp"
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+static int g_fails = 0;
+
+static void Check(bool ok, const char* what) {
+    printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) g_fails++;
+}
+
+// Busy-wait, so that span lengths do not depend on the scheduler
+static void Spin(double ms) {
+    uint64_t end = hprof::now() + static_cast<uint64_t>(ms * 1e6);
+    while (hprof::now() < end) {}
+}
+
+static double PartMs(const hprof::Frame& f, const char* name) {
+    for (int p = 0; p < f.partCount; p++) {
+        if (strcmp(f.parts[p].name, name) == 0) return f.parts[p].ns / 1e6;
+    }
+    return -1.0;
+}
+
+static bool Near(double ms, double want, double slack = 0.5) {
+    return ms >= want && ms < want + slack;
+}
+
+int main(int argc, char* argv[]) {
+    // Without a path the trace goes to a temp file, so runs leave nothing behind
+    char tempPath[] = "/tmp/test_hprof_XXXXXX";
+    const char* tracePath = argc > 1 ? argv[1] : tempPath;
+    if (argc <= 1) {
+        int fd = mkstemp(tempPath);
+        if (fd < 0) return 1;
+        close(fd);
+    }
+    hprof::Profiler& prof = hprof::Profiler::instance();
+
+    printf("disabled\n");
+    prof.frameMark();
+    { HPROF_SCOPE("ignored"); Spin(0.1); }
+    HPROF_COUNT("ignored", 1);
+    prof.frameMark();
+    Check(prof.frameCount() == 0 && prof.counterCount() == 0, "nothing is recorded while disabled");
+
+    printf("frames\n");
+    prof.setEnabled(true);
+    prof.frameMark();
+    // Frames of 1 ms blit, 2 x 0.5 ms render with a nested sort, 1 ms present,
+    // and a second thread whose spans must stay out of the parts (it sleeps in
+    // them so as not to take the frame thread's core)
+    std::thread worker([&] {
+        for (int i = 0; i < 40; i++) {
+            HPROF_SCOPE("worker");
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    });
+    for (int frame = 0; frame < 20; frame++) {
+        { HPROF_SCOPE("blit"); Spin(1.0); }
+        for (int r = 0; r < 2; r++) {
+            HPROF_SCOPE("render");
+            { HPROF_SCOPE("sort"); Spin(0.2); }
+            Spin(0.3);
+        }
+        HPROF_COUNT("sprites", 100);
+        HPROF_COUNT("sprites", frame);
+        { HPROF_SCOPE("present"); Spin(1.0); }
+        Spin(frame == 19 ? 4.0 : 0.5);     // Unattributed time, one slow frame
+        prof.frameMark();
+    }
+    worker.join();
+
+    const hprof::Frame& last = prof.frame(0);
+    Check(prof.frameCount() == 20, "one frame per frameMark after the first");
+    Check(last.partCount == 3, "parts are the outermost spans only");
+    Check(strcmp(last.parts[0].name, "blit") == 0 && strcmp(last.parts[2].name, "present") == 0,
+          "parts are in the order the frame ran them");
+    Check(Near(PartMs(last, "blit"), 1.0) && Near(PartMs(last, "render"), 1.0) &&
+          Near(PartMs(last, "present"), 1.0), "repeated spans are summed by name");
+    Check(Near(last.ms(), 7.0, 1.5), "frame time runs mark to mark");
+    Check(prof.counterCount() == 1 && last.counters[0] == 119 && prof.frame(1).counters[0] == 118,
+          "counters are summed per frame");
+    double p50 = prof.frameMsPercentile(50), p99 = prof.frameMsPercentile(99);
+    printf("  p50 %.2f ms, p99 %.2f ms\n", p50, p99);
+    Check(Near(p50, 3.5, 1.5) && Near(p99, 7.0, 1.5), "p50 and p99");
+
+    std::vector<hprof::Span> spans;
+    prof.spansInFrame(0, spans);
+    int sorts = 0, nested = 0;
+    for (const hprof::Span& s : spans) {
+        if (strcmp(s.name, "sort") == 0) {
+            sorts++;
+            if (s.depth == 1) nested++;
+        }
+    }
+    Check(sorts == 2 && nested == 2, "nested spans keep their depth");
+
+    printf("cost\n");
+    const int scopes = 1000000;
+    uint64_t t0 = hprof::now();
+    for (int i = 0; i < scopes; i++) { HPROF_SCOPE("cost"); }
+    double enabledNs = static_cast<double>(hprof::now() - t0) / scopes;
+    prof.setEnabled(false);
+    prof.frameMark();   // Drops the frame the enabled loop ran in
+    t0 = hprof::now();
+    for (int i = 0; i < scopes; i++) { HPROF_SCOPE("cost"); }
+    double disabledNs = static_cast<double>(hprof::now() - t0) / scopes;
+    prof.setEnabled(true);
+    printf("  %.1f ns per scope enabled, %.1f ns disabled\n", enabledNs, disabledNs);
+    prof.frameMark();
+    { HPROF_SCOPE("blit"); Spin(1.0); }
+    prof.frameMark();
+
+    printf("chrome trace\n");
+    Check(prof.writeChromeTrace(tracePath), "trace written");
+    std::string json;
+    if (FILE* f = fopen(tracePath, "r")) {
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) json.append(buf, n);
+        fclose(f);
+    }
+    if (argc <= 1) remove(tempPath);
+    auto occurrences = [&](const char* needle) {
+        int n = 0;
+        for (size_t at = json.find(needle); at != std::string::npos; at = json.find(needle, at + 1)) n++;
+        return n;
+    };
+    printf("  %zu bytes, %d complete events, %d counter events\n", json.size(),
+           occurrences("\"ph\":\"X\""), occurrences("\"ph\":\"C\""));
+    Check(json.rfind("{\"displayTimeUnit\"", 0) == 0 && json.find("]}") == json.size() - 3,
+          "trace is one object with an event list");
+    Check(occurrences("\"name\":\"frame\"") == 21 && occurrences("\"name\":\"worker\"") == 40,
+          "every frame and every span is exported");
+    Check(occurrences("\"name\":\"counters\"") == 21 && occurrences("\"sprites\":119") == 1,
+          "counters are exported per frame");
+
+    printf("overlay\n");
+    if (!CreateHeadlessContext()) {
+        printf("no EGL context, skipping overlay checks\n");
+    } else {
+        const int w = 320, h = 200;
+        GLuint fbo, color;
+        glGenFramebuffers(1, &fbo);
+        glGenRenderbuffers(1, &color);
+        glBindRenderbuffer(GL_RENDERBUFFER, color);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+
+        h2d::Renderer renderer;
+        renderer.init(w, h);
+        h2d::ProfilerOverlay overlay;
+        overlay.setFrames(30);
+        overlay.setBudgetMs(8.0f);
+        renderer.beginFrame();
+        renderer.clear(h2d::Color(0, 0, 0));
+        int used = overlay.draw(renderer, prof, 0, 0);
+        renderer.endFrame();
+        int batches = renderer.batchStats().batches;
+        std::vector<uint8_t> pixels(w * h * 4);
+        glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        auto at = [&](int x, int y) { return &pixels[((h - 1 - y) * w + x) * 4]; };
+
+        // The newest bar is the lone 1 ms blit: 60 px stand for 16 ms, so its
+        // bottom 4 rows are blit coloured; the bar before it starts with blit
+        // too, then render and present above
+        const int pad = 4, base = pad + 60;
+        int newest = pad + 29 * 2, before = pad + 28 * 2;
+        h2d::Color blit = overlay.spanColor("blit");
+        h2d::Color render = overlay.spanColor("render");
+        auto is = [&](const uint8_t* px, h2d::Color c) { return px[0] == c.r && px[1] == c.g && px[2] == c.b; };
+        Check(used > 70 && used < h, "overlay fits graph and text");
+        Check(is(at(newest, base - 1), blit) && is(at(newest, base - 4), blit) && !is(at(newest, base - 6), blit),
+              "a bar is as tall as its frame");
+        Check(is(at(before, base - 2), blit) && is(at(before, base - 6), render), "bars stack the parts in order");
+        int lit = 0;
+        for (int y = base + 4; y < base + 9; y++) {
+            for (int x = pad; x < pad + 100; x++) lit += at(x, y)[0] == 255;
+        }
+        Check(lit > 50, "text is drawn under the graph");
+        Check(batches == 1, "graph and text are one batched draw");
+        glDeleteRenderbuffers(1, &color);
+        glDeleteFramebuffers(1, &fbo);
+    }
+
+    printf(g_fails ? "FAILED\n" : "ok\n");
+    return g_fails ? 1 : 0;
+}
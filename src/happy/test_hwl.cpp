@@ -0,0 +1,199 @@
+/*
+ * test_hwl.cpp - hwl event timestamps, LatencyProbe, the input ring and the waitable pump
+ *
+ * Checks that getTimeNs is monotonic and runs at real time, and that
+ * LatencyProbe charges each presented frame with its oldest input and reports
+ * percentiles over a scripted run. Streams events through SpscRing between
+ * two threads (order and count must survive, the rate is reported) and feeds
+ * the input thread's queue mouse bursts and a full ring to check coalescing,
+ * arrival order, events held behind the ring and the overflow counters. When a display is available it also opens a
+ * window and checks that waitEvents honours its timeout, that wakeUp from
+ * another thread ends an unbounded wait, and that the input thread starts
+ * and stops.
+ *
+ * Build (Linux):
+ *   g++ -std=c++17 -O2 test_hwl.cpp -o test_hwl -lX11 -lGL -ldl -lpthread
+ *
+ * Usage: test_hwl [events through the ring]
+ */
+
+#define HWL_IMPLEMENTATION
+#include "hwl.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+static int g_fails = 0;
+
+static void Check(bool ok, const char* what) {
+    printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) g_fails++;
+}
+
+static hwl::Event InputAt(hwl::EventType type, uint64_t ns) {
+    hwl::Event e;
+    e.type = type;
+    e.time_ns = ns;
+    return e;
+}
+
+static hwl::Event MoveTo(int x, uint64_t ns) {
+    hwl::Event e = InputAt(hwl::EventType::MouseMove, ns);
+    e.mouse_x = x;
+    return e;
+}
+
+int main(int argc, char* argv[]) {
+    int streamed = argc > 1 ? atoi(argv[1]) : 2000000;
+
+    printf("clock\n");
+    uint64_t t0 = hwl::getTimeNs();
+    auto s0 = std::chrono::steady_clock::now();
+    bool monotonic = true;
+    uint64_t last = t0;
+    for (int i = 0; i < 100000; i++) {
+        uint64_t t = hwl::getTimeNs();
+        if (t < last) monotonic = false;
+        last = t;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    double clockMs = (hwl::getTimeNs() - t0) / 1e6;
+    double steadyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - s0).count();
+    Check(monotonic, "getTimeNs never goes backwards");
+    Check(std::fabs(clockMs - steadyMs) < 2.0, "getTimeNs keeps pace with steady_clock");
+
+    printf("latency probe\n");
+    hwl::LatencyProbe probe;
+    const uint64_t ms = 1000000;
+    Check(probe.present(10 * ms) < 0.0, "frame without input records nothing");
+    probe.input(InputAt(hwl::EventType::Resize, 11 * ms));
+    Check(probe.present(12 * ms) < 0.0, "non-input events are ignored");
+    probe.input(InputAt(hwl::EventType::MouseMove, 15 * ms));
+    probe.input(InputAt(hwl::EventType::KeyDown, 13 * ms));
+    probe.input(InputAt(hwl::EventType::MouseRaw, 17 * ms));
+    Check(std::fabs(probe.present(20 * ms) - 7.0) < 1e-9, "frame is charged with its oldest input");
+    Check(probe.present(30 * ms) < 0.0, "input is charged to one frame only");
+
+    probe.reset();
+    for (int i = 1; i <= 100; i++) {
+        uint64_t frame = static_cast<uint64_t>(i) * 1000 * ms;
+        probe.input(InputAt(hwl::EventType::KeyDown, frame - i * ms));
+        probe.present(frame);
+    }
+    Check(probe.samples() == 100 && probe.lastMs() == 100.0, "samples and last");
+    Check(std::fabs(probe.averageMs() - 50.5) < 1e-9, "average");
+    Check(probe.percentileMs(50) == 51.0 && probe.percentileMs(99) == 100.0, "p50 and p99");
+
+    printf("spsc ring\n");
+    hwl::SpscRing<hwl::Event, 1024> ring;
+    bool inOrder = true;
+    auto streamStart = std::chrono::steady_clock::now();
+    std::thread producer([&] {
+        for (int i = 0; i < streamed; i++) {
+            hwl::Event e = InputAt(hwl::EventType::KeyDown, static_cast<uint64_t>(i));
+            while (!ring.push(e)) std::this_thread::yield();
+        }
+    });
+    hwl::Event popped;
+    for (int i = 0; i < streamed; i++) {
+        while (!ring.pop(popped)) std::this_thread::yield();
+        if (popped.time_ns != static_cast<uint64_t>(i)) inOrder = false;
+    }
+    producer.join();
+    double streamMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - streamStart).count();
+    printf("  %d events across threads in %.1f ms (%.1f M events/s)\n", streamed, streamMs,
+           streamed / streamMs / 1000.0);
+    Check(inOrder && ring.size() == 0, "every event arrives once, in order");
+
+    printf("input queue\n");
+    hwl::InputQueue queue;
+    for (int i = 0; i < 100; i++) queue.add(MoveTo(i, 1000 + i));
+    for (int i = 0; i < 10; i++) {
+        hwl::Event raw = InputAt(hwl::EventType::MouseRaw, 2000 + i);
+        raw.delta_x = 1.5f;
+        raw.delta_y = -1.0f;
+        queue.add(raw);
+    }
+    Check(queue.ring.size() == 0, "moves are held until something else comes");
+    queue.add(InputAt(hwl::EventType::MouseDown, 3000));
+    queue.add(MoveTo(500, 4000));
+    queue.flush();
+    hwl::Event first, second, third, fourth;
+    bool four = queue.ring.pop(first) && queue.ring.pop(second) && queue.ring.pop(third) && queue.ring.pop(fourth);
+    Check(four && queue.ring.size() == 0, "a burst of 110 reports becomes four events");
+    Check(first.type == hwl::EventType::MouseMove && first.mouse_x == 99 && first.time_ns == 1000,
+          "moves keep the last position and the first time");
+    Check(second.type == hwl::EventType::MouseRaw && second.delta_x == 15.0f && second.delta_y == -10.0f &&
+          second.time_ns == 2000, "raw deltas are summed, keeping the first time");
+    Check(third.type == hwl::EventType::MouseDown && fourth.mouse_x == 500, "events keep their arrival order");
+
+    for (size_t i = 0; i < hwl::HwlWindow::kInputRingSize + 5; i++) {
+        queue.add(InputAt(hwl::EventType::KeyDown, i));
+    }
+    queue.add(MoveTo(7, 9000));
+    Check(!queue.flush() && queue.held.size() == 6, "presses and moves wait out a full ring");
+    for (int i = 0; i < 6; i++) queue.ring.pop(popped);
+    Check(queue.flush() && queue.ring.size() == hwl::HwlWindow::kInputRingSize, "and go in once there is room");
+    bool keyOrder = true;
+    for (size_t i = 6; i < hwl::HwlWindow::kInputRingSize + 5; i++) {
+        if (!queue.ring.pop(popped) || popped.time_ns != i) keyOrder = false;
+    }
+    Check(keyOrder && queue.ring.pop(popped) && popped.type == hwl::EventType::MouseMove, "in arrival order");
+
+    for (size_t i = 0; i < hwl::HwlWindow::kInputRingSize; i++) {
+        queue.add(InputAt(hwl::EventType::KeyUp, 10000 + i));
+    }
+    queue.add(MoveTo(8, 20000));
+    for (size_t i = 0; i <= hwl::InputQueue::kMaxHeld; i++) {
+        queue.add(InputAt(hwl::EventType::KeyDown, 30000 + i));
+    }
+    bool noMotion = std::none_of(queue.held.begin(), queue.held.end(),
+                                 [](const hwl::Event& e) { return hwl::InputQueue::isMotion(e.type); });
+    Check(noMotion && queue.held.size() == hwl::InputQueue::kMaxHeld && queue.held.back().time_ns == 30000 +
+          hwl::InputQueue::kMaxHeld - 1, "a full held list loses the move first, then new presses");
+    hwl::InputStats st = queue.stats();
+    printf("  delivered %llu, coalesced %llu, dropped %llu, high water %zu\n",
+           static_cast<unsigned long long>(st.delivered), static_cast<unsigned long long>(st.coalesced),
+           static_cast<unsigned long long>(st.dropped), st.high_water);
+    Check(st.coalesced == 108 && st.dropped == 2 && st.high_water == hwl::HwlWindow::kInputRingSize,
+          "coalesced, dropped and high water are counted");
+
+    auto window = hwl::HwlWindow::create("test_hwl", 64, 64);
+    if (!window) {
+        printf("no display, skipping window checks\n");
+    } else {
+        printf("window\n");
+        while (window->pollEvent()) {}
+        uint64_t start = hwl::getTimeNs();
+        bool got = window->waitEvents(50);
+        double waitedMs = (hwl::getTimeNs() - start) / 1e6;
+        Check(got || waitedMs < 50.0, "waitEvents returns early only with an event");
+        Check(got || waitedMs < 150.0, "waitEvents honours its timeout");
+
+        while (window->pollEvent()) {}
+        std::thread waker([&] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));
+            window->wakeUp();
+        });
+        start = hwl::getTimeNs();
+        bool woke = !window->waitEvents(-1);
+        waitedMs = (hwl::getTimeNs() - start) / 1e6;
+        waker.join();
+        Check(woke || waitedMs < 30.0, "wakeUp ends an unbounded wait");
+        bool raw = window->setRawMouse(true);
+        printf("  raw mouse %s\n", raw ? "available" : "unavailable");
+
+        bool started = window->startInputThread();
+        Check(started && window->hasInputThread(), "input thread starts");
+        window->waitEvents(50);
+        while (window->pollEvent()) {}
+        window->stopInputThread();
+        Check(!window->hasInputThread() && window->isRawMouse() == raw, "input thread stops, raw mouse carries over");
+    }
+
+    printf(g_fails ? "FAILED\n" : "ok\n");
+    return g_fails ? 1 : 0;
+}
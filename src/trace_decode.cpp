@@ -0,0 +1,228 @@
+/*
+ * trace_decode.cpp - Turn an OSF_DEBUG binary trace into the text log
+ *
+ * Reads osf_trace_<DLL>.bin as written by debug.h (format in trace_format.h)
+ * and prints one line per record, all threads merged by time:
+ *   [hh:mm:ss.uuuuuu] <thread> DLL::func(ENTER args)
+ * A trace cut short by a crash or a killed process is decoded up to where
+ * it stops.
+ *
+ * Build (Linux):
+ *   g++ -std=c++17 -O2 trace_decode.cpp -o trace_decode
+ *
+ * Usage: trace_decode <trace.bin> [out.txt]
+ */
+
+#include "trace_format.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+using OsfTrace::Record;
+
+struct Site {
+    std::string dll, func, fmt;
+};
+
+struct Entry {
+    Record record;
+    uint32_t ring;
+};
+
+// Reads the file's blocks; any read past the end marks the input truncated
+class Reader {
+public:
+    explicit Reader(std::vector<uint8_t> data) : m_data(std::move(data)) {}
+
+    bool atEnd() const { return m_pos >= m_data.size(); }
+    bool truncated() const { return m_truncated; }
+
+    uint8_t byte() {
+        if (m_pos >= m_data.size()) {
+            m_truncated = true;
+            return 0;
+        }
+        return m_data[m_pos++];
+    }
+    void bytes(void* out, size_t n) {
+        uint8_t* p = static_cast<uint8_t*>(out);
+        for (size_t i = 0; i < n; i++) p[i] = byte();
+    }
+    uint64_t varint() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t b = byte();
+            v |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) break;
+        }
+        return v;
+    }
+    uint16_t u16() {
+        uint16_t lo = byte();
+        return static_cast<uint16_t>(lo | byte() << 8);
+    }
+    uint64_t u64() {
+        uint64_t v = 0;
+        for (int i = 0; i < 8; i++) v |= static_cast<uint64_t>(byte()) << (i * 8);
+        return v;
+    }
+    std::string string() {
+        std::string s;
+        for (uint8_t c = byte(); c && !m_truncated; c = byte()) s += static_cast<char>(c);
+        return s;
+    }
+
+private:
+    std::vector<uint8_t> m_data;
+    size_t m_pos = 0;
+    bool m_truncated = false;
+};
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: trace_decode <trace.bin> [out.txt]\n");
+        return 1;
+    }
+
+    FILE* in = fopen(argv[1], "rb");
+    if (!in) {
+        fprintf(stderr, "Cannot open %s\n", argv[1]);
+        return 1;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) data.insert(data.end(), buf, buf + n);
+    fclose(in);
+
+    Reader r(std::move(data));
+    char magic[sizeof(OsfTrace::kMagic)];
+    r.bytes(magic, sizeof(magic));
+    if (r.truncated() || memcmp(magic, OsfTrace::kMagic, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s is not an OSF trace\n", argv[1]);
+        return 1;
+    }
+    OsfTrace::StartTime start;
+    start.year = r.u16();
+    start.month = r.u16();
+    start.day = r.u16();
+    start.hour = r.u16();
+    start.minute = r.u16();
+    start.second = r.u16();
+    start.ms = r.u16();
+    uint64_t tscBase = r.u64();
+
+    std::map<uint32_t, Site> sites;
+    std::map<uint32_t, uint32_t> threads;
+    std::map<uint32_t, uint64_t> dropped;
+    std::vector<Entry> entries;
+    uint64_t clockTsc = 0, clockNs = 0;
+    bool ended = false;
+    bool damaged = false;
+
+    while (!r.atEnd() && !r.truncated() && !damaged) {
+        uint8_t tag = r.byte();
+        switch (tag) {
+            case 'S': {
+                uint32_t id = static_cast<uint32_t>(r.varint());
+                Site site;
+                site.dll = r.string();
+                site.func = r.string();
+                site.fmt = r.string();
+                if (!r.truncated()) sites[id] = site;
+                break;
+            }
+            case 'T': {
+                uint32_t ring = static_cast<uint32_t>(r.varint());
+                uint32_t tid = static_cast<uint32_t>(r.varint());
+                if (!r.truncated()) threads[ring] = tid;
+                break;
+            }
+            case 'R': {
+                Entry e;
+                e.ring = static_cast<uint32_t>(r.varint());
+                uint64_t count = r.varint();
+                uint64_t tsc = tscBase + r.varint();
+                for (uint64_t i = 0; i < count && !r.truncated(); i++) {
+                    Record& rec = e.record;
+                    tsc += r.varint();
+                    rec.tsc = tsc;
+                    rec.site = static_cast<uint16_t>(r.varint());
+                    rec.kind = r.byte();
+                    rec.size = r.byte();
+                    if (rec.size > OsfTrace::kPayloadBytes) {
+                        damaged = true;
+                        break;
+                    }
+                    r.bytes(rec.payload, rec.size);
+                    if (!r.truncated()) entries.push_back(e);
+                }
+                break;
+            }
+            case 'D': {
+                uint32_t ring = static_cast<uint32_t>(r.varint());
+                uint64_t count = r.varint();
+                if (!r.truncated()) dropped[ring] += count;
+                break;
+            }
+            case 'C':
+                clockTsc = r.varint();
+                clockNs = r.varint();
+                break;
+            case 'E':
+                ended = true;
+                break;
+            default:
+                damaged = true;
+                break;
+        }
+    }
+
+    FILE* out = argc > 2 ? fopen(argv[2], "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Cannot write %s\n", argv[2]);
+        return 1;
+    }
+
+    // Rings are written a block at a time; merge the threads back by time
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const Entry& a, const Entry& b) { return a.record.tsc < b.record.tsc; });
+    double nsPerTick = clockTsc ? static_cast<double>(clockNs) / clockTsc : 0.0;
+
+    fprintf(out, "\n=== OpenShadowFlare Session Started: %04u-%02u-%02u %02u:%02u:%02u ===\n",
+            start.year, start.month, start.day, start.hour, start.minute, start.second);
+    for (const Entry& e : entries) {
+        const Record& rec = e.record;
+        char time[32];
+        char line[512];
+        OsfTrace::FormatTime(start, static_cast<uint64_t>((rec.tsc - tscBase) * nsPerTick), time, sizeof(time));
+        auto site = sites.find(rec.site);
+        if (site != sites.end()) {
+            OsfTrace::FormatCall(site->second.dll.c_str(), site->second.func.c_str(), site->second.fmt.c_str(),
+                                 rec, line, sizeof(line));
+        } else {
+            snprintf(line, sizeof(line), "site %u?", static_cast<unsigned>(rec.site));
+        }
+        auto thread = threads.find(e.ring);
+        fprintf(out, "%s %lu %s\n", time,
+                static_cast<unsigned long>(thread != threads.end() ? thread->second : 0), line);
+    }
+    if (ended) {
+        fprintf(out, "=== Session Ended ===\n");
+    } else {
+        fprintf(out, "=== Trace ends without shutdown (%s) ===\n",
+                damaged ? "damaged block" : r.truncated() ? "cut short" : "process did not shut down");
+    }
+    if (out != stdout) fclose(out);
+
+    uint64_t lost = 0;
+    for (const auto& d : dropped) lost += d.second;
+    fprintf(stderr, "%zu records, %zu threads, %zu sites", entries.size(), threads.size(), sites.size());
+    if (lost) fprintf(stderr, ", %llu dropped when rings were full", static_cast<unsigned long long>(lost));
+    if (!clockTsc) fprintf(stderr, ", no clock sample (times are session start)");
+    fprintf(stderr, "\n");
+    return damaged ? 1 : 0;
+}
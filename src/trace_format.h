@@ -0,0 +1,380 @@
+/**
+ * OpenShadowFlare binary trace format
+ *
+ * Shared by debug.h, which records and writes traces, and trace_decode.cpp,
+ * which turns them back into text. Nothing here needs Windows, so the
+ * decoder builds anywhere.
+ *
+ * In memory a trace entry is a fixed 64-byte Record: TSC timestamp, call
+ * site ID, kind (ENTER/EXIT/message) and the call's arguments packed raw,
+ * each behind a one-byte type tag (strings are copied, truncated to fit).
+ * Formatting is left to whoever reads them: the site's printf format is
+ * replayed over the packed arguments.
+ *
+ * On disk (osf_trace_<DLL>.bin) a trace is the header below followed by
+ * blocks, each a tag byte and varint (LEB128) fields:
+ *   'S' site:    id, dll\0 func\0 fmt\0 - before any record that uses it
+ *   'T' thread:  ring, thread ID - before any record from that ring
+ *   'R' records: ring, count, first TSC - TSC base; then per record
+ *                TSC - previous TSC, site, kind, size, size payload bytes
+ *   'D' dropped: ring, records lost because the ring was full
+ *   'C' clock:   TSC - TSC base, ns since the header's start time
+ *   'E' end:     session shut down cleanly
+ * Delta-coded varints and payloads cut to their used size bring a record
+ * from 64 bytes to around 8-30.
+ */
+
+#ifndef OSF_TRACE_FORMAT_H
+#define OSF_TRACE_FORMAT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+namespace OsfTrace {
+
+static const char kMagic[8] = { 'O', 'S', 'F', 'T', 'R', 'C', '1', '\n' };
+
+enum RecordKind : uint8_t {
+    KIND_ENTER = 0,
+    KIND_EXIT = 1,
+    KIND_MESSAGE = 2
+};
+
+// Set in Record::kind when arguments were left out for lack of room
+static const uint8_t KIND_CUT = 0x80;
+
+enum ArgTag : uint8_t {
+    ARG_I32 = 1,
+    ARG_U32,
+    ARG_I64,
+    ARG_U64,
+    ARG_F64,
+    ARG_PTR,        // 8 bytes whatever the pointer size
+    ARG_STR         // Length byte, then that many bytes (no terminator)
+};
+
+static const int kPayloadBytes = 52;
+
+struct Record {
+    uint64_t tsc;
+    uint16_t site;
+    uint8_t kind;                   // RecordKind, maybe | KIND_CUT
+    uint8_t size;                   // Payload bytes used
+    uint8_t payload[kPayloadBytes];
+};
+static_assert(sizeof(Record) == 64, "Record must stay one cache line");
+
+// Header: magic, then start time as year month day hour minute second ms
+// (u16 each) and the TSC at that moment (u64), little-endian
+static const int kHeaderBytes = 8 + 7 * 2 + 8;
+
+struct StartTime {
+    uint16_t year, month, day, hour, minute, second, ms;
+};
+
+/*==============================================================================
+ * Packing arguments into a Record
+ *============================================================================*/
+
+// Once one argument is left out the rest are too, so that the ones kept
+// still line up with the format
+inline void PutArg(Record& r, ArgTag tag, const void* data, int bytes) {
+    if ((r.kind & KIND_CUT) || r.size + 1 + bytes > kPayloadBytes) {
+        r.kind |= KIND_CUT;
+        return;
+    }
+    r.payload[r.size] = tag;
+    memcpy(r.payload + r.size + 1, data, bytes);
+    r.size = static_cast<uint8_t>(r.size + 1 + bytes);
+}
+
+// Strings are cut short to fit rather than left out
+inline void PackString(Record& r, const char* s) {
+    if (!s) s = "(null)";
+    int room = kPayloadBytes - r.size - 2;
+    if ((r.kind & KIND_CUT) || room < 0) {
+        r.kind |= KIND_CUT;
+        return;
+    }
+    size_t len = strnlen(s, static_cast<size_t>(room));
+    r.payload[r.size] = ARG_STR;
+    r.payload[r.size + 1] = static_cast<uint8_t>(len);
+    memcpy(r.payload + r.size + 2, s, len);
+    r.size = static_cast<uint8_t>(r.size + 2 + len);
+}
+
+template <typename T>
+inline void PackArg(Record& r, const T& v) {
+    using U = typename std::decay<T>::type;
+    if constexpr (std::is_same<U, char*>::value || std::is_same<U, const char*>::value) {
+        PackString(r, v);
+    } else if constexpr (std::is_pointer<U>::value || std::is_null_pointer<U>::value) {
+        uint64_t p = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(v));
+        PutArg(r, ARG_PTR, &p, 8);
+    } else if constexpr (std::is_floating_point<U>::value) {
+        double d = static_cast<double>(v);
+        PutArg(r, ARG_F64, &d, 8);
+    } else if constexpr (std::is_enum<U>::value) {
+        PackArg(r, static_cast<typename std::underlying_type<U>::type>(v));
+    } else if constexpr (sizeof(U) > 4) {
+        uint64_t u = static_cast<uint64_t>(v);
+        PutArg(r, std::is_signed<U>::value ? ARG_I64 : ARG_U64, &u, 8);
+    } else {
+        // Promoted as printf would: char, short, bool and int travel as int
+        if (std::is_signed<U>::value || sizeof(U) < 4) {
+            int32_t i = static_cast<int32_t>(v);
+            PutArg(r, ARG_I32, &i, 4);
+        } else {
+            uint32_t u = static_cast<uint32_t>(v);
+            PutArg(r, ARG_U32, &u, 4);
+        }
+    }
+}
+
+// String literals arrive as arrays
+template <size_t N>
+inline void PackArg(Record& r, const char (&s)[N]) {
+    PackString(r, s);
+}
+
+template <typename... Args>
+inline void PackArgs(Record& r, const Args&... args) {
+    r.size = 0;
+    (PackArg(r, args), ...);
+}
+
+/*==============================================================================
+ * Formatting a Record's arguments with its site's format
+ *============================================================================*/
+
+// snprintf(out, outSize, fmt, <the packed arguments>); returns the length
+inline int FormatArgs(const char* fmt, const uint8_t* payload, int size, char* out, int outSize) {
+    if (outSize <= 0) return 0;
+    if (size > kPayloadBytes) size = kPayloadBytes;
+    int len = 0;
+    int pos = 0;
+    auto room = [&] { return len < outSize ? outSize - len : 0; };
+    auto put = [&](int n) { if (n > 0) len += n; };
+    for (const char* f = fmt ? fmt : ""; *f && len < outSize - 1;) {
+        if (*f != '%') {
+            out[len++] = *f++;
+            continue;
+        }
+        if (f[1] == '%') {
+            out[len++] = '%';
+            f += 2;
+            continue;
+        }
+        // %[flags][width][.precision][length]conversion, length dropped: the
+        // tag says what was passed
+        char spec[24] = "%";
+        int s = 1;
+        const char* c = f + 1;
+        while (*c && strchr("-+ #0", *c) && s < 8) spec[s++] = *c++;
+        while (*c && ((*c >= '0' && *c <= '9') || *c == '.') && s < 16) spec[s++] = *c++;
+        while (*c && strchr("hlLzjtqI", *c)) c++;
+        while (*c >= '0' && *c <= '9') c++;     // I64 / I32
+        char conv = *c ? *c++ : 's';
+        f = c;
+
+        if (pos >= size) {
+            put(snprintf(out + len, room(), "?"));
+            continue;
+        }
+        // A record torn by a crash or a damaged file must not read past size
+        ArgTag tag = static_cast<ArgTag>(payload[pos]);
+        const uint8_t* data = payload + pos + 1;
+        int bytes = tag == ARG_I32 || tag == ARG_U32 ? 4
+                  : tag >= ARG_I64 && tag <= ARG_PTR ? 8
+                  : tag == ARG_STR && pos + 1 < size ? 1 + data[0] : -1;
+        if (bytes < 0 || pos + 1 + bytes > size) {
+            put(snprintf(out + len, room(), "?"));
+            pos = size;
+            continue;
+        }
+        pos += 1 + bytes;
+        uint64_t u64 = 0;
+        uint32_t u32 = 0;
+        double f64 = 0.0;
+        if (bytes == 4) memcpy(&u32, data, 4);
+        if (tag == ARG_F64) memcpy(&f64, data, 8);
+        else if (bytes == 8) memcpy(&u64, data, 8);
+
+        bool integral = strchr("diuxXoc", conv) != nullptr;
+        bool floating = strchr("feEgGaA", conv) != nullptr;
+        if (tag == ARG_STR) {
+            char text[kPayloadBytes];
+            memcpy(text, data + 1, data[0]);
+            text[data[0]] = '\0';
+            spec[s++] = 's';
+            spec[s] = '\0';
+            put(snprintf(out + len, room(), spec, text));
+        } else if (tag == ARG_PTR || conv == 'p') {
+            if (tag == ARG_I32 || tag == ARG_U32) u64 = u32;
+            put(snprintf(out + len, room(), "0x%08llx", static_cast<unsigned long long>(u64)));
+        } else if (tag == ARG_F64) {
+            spec[s++] = floating ? conv : 'g';
+            spec[s] = '\0';
+            put(snprintf(out + len, room(), spec, f64));
+        } else {
+            bool wide = tag == ARG_I64 || tag == ARG_U64;
+            bool isSigned = tag == ARG_I32 || tag == ARG_I64;
+            if (!integral) conv = isSigned ? 'd' : 'u';
+            if (conv == 'c') {
+                spec[s++] = 'c';
+                spec[s] = '\0';
+                put(snprintf(out + len, room(), spec, static_cast<int>(wide ? u64 : u32)));
+                continue;
+            }
+            spec[s++] = 'l';
+            spec[s++] = 'l';
+            spec[s++] = conv;
+            spec[s] = '\0';
+            long long v = wide ? static_cast<long long>(u64)
+                               : isSigned ? static_cast<long long>(static_cast<int32_t>(u32))
+                                          : static_cast<long long>(u32);
+            if (conv == 'd' || conv == 'i') {
+                put(snprintf(out + len, room(), spec, v));
+            } else {
+                unsigned long long uv = wide ? u64 : static_cast<unsigned long long>(u32);
+                put(snprintf(out + len, room(), spec, uv));
+            }
+        }
+    }
+    if (len >= outSize) len = outSize - 1;
+    out[len] = '\0';
+    return len;
+}
+
+// "DLL::func(ENTER args)", as the text log used to have it
+inline int FormatCall(const char* dll, const char* func, const char* fmt, const Record& r,
+                      char* out, int outSize) {
+    const char* kind = "";
+    switch (r.kind & ~KIND_CUT) {
+        case KIND_ENTER: kind = fmt && fmt[0] ? "ENTER " : "ENTER"; break;
+        case KIND_EXIT: kind = "EXIT"; break;
+    }
+    int len = snprintf(out, outSize, "%s::%s(%s", dll, func, kind);
+    if (len < 0 || len >= outSize - 1) return len < 0 ? 0 : outSize - 1;
+    if ((r.kind & ~KIND_CUT) != KIND_EXIT) {
+        len += FormatArgs(fmt, r.payload, r.size, out + len, outSize - len);
+    }
+    const char* tail = (r.kind & KIND_CUT) ? " ...)" : ")";
+    int n = snprintf(out + len, outSize - len, "%s", tail);
+    return n > 0 && len + n < outSize ? len + n : outSize - 1;
+}
+
+// "[hh:mm:ss.uuuuuu]" for a moment ns after start
+inline int FormatTime(const StartTime& start, uint64_t ns, char* out, int outSize) {
+    uint64_t us = ((start.hour * 60ull + start.minute) * 60 + start.second) * 1000000 + start.ms * 1000ull + ns / 1000;
+    us %= 86400ull * 1000000;
+    return snprintf(out, outSize, "[%02u:%02u:%02u.%06u]", static_cast<unsigned>(us / 3600000000ull),
+                    static_cast<unsigned>(us / 60000000 % 60), static_cast<unsigned>(us / 1000000 % 60),
+                    static_cast<unsigned>(us % 1000000));
+}
+
+/*==============================================================================
+ * Writing blocks
+ *============================================================================*/
+
+// Buffers blocks and hands them to a FILE in large writes
+class BlockWriter {
+public:
+    explicit BlockWriter(FILE* file = nullptr) : m_file(file) {}
+    ~BlockWriter() { flush(); }
+
+    void setFile(FILE* file) { flush(); m_file = file; }
+
+    void byte(uint8_t b) {
+        if (m_size == sizeof(m_buffer)) flush();
+        m_buffer[m_size++] = b;
+    }
+    void bytes(const void* data, size_t n) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < n; i++) byte(p[i]);
+    }
+    void varint(uint64_t v) {
+        while (v >= 0x80) {
+            byte(static_cast<uint8_t>(v | 0x80));
+            v >>= 7;
+        }
+        byte(static_cast<uint8_t>(v));
+    }
+    void u16(uint16_t v) { byte(v & 0xFF); byte(v >> 8); }
+    void u64(uint64_t v) { for (int i = 0; i < 8; i++) byte(static_cast<uint8_t>(v >> (i * 8))); }
+    void string(const char* s) { bytes(s ? s : "", strlen(s ? s : "") + 1); }
+
+    void header(const StartTime& t, uint64_t tsc) {
+        bytes(kMagic, sizeof(kMagic));
+        u16(t.year);
+        u16(t.month);
+        u16(t.day);
+        u16(t.hour);
+        u16(t.minute);
+        u16(t.second);
+        u16(t.ms);
+        u64(tsc);
+    }
+    void site(uint32_t id, const char* dll, const char* func, const char* fmt) {
+        byte('S');
+        varint(id);
+        string(dll);
+        string(func);
+        string(fmt);
+    }
+    void thread(uint32_t ring, uint32_t threadId) {
+        byte('T');
+        varint(ring);
+        varint(threadId);
+    }
+    // count records of one ring, oldest first; tscBase is the header's TSC
+    void records(uint32_t ring, const Record* recs, uint32_t count, uint64_t tscBase) {
+        if (!count) return;
+        byte('R');
+        varint(ring);
+        varint(count);
+        uint64_t prev = recs[0].tsc;
+        varint(prev - tscBase);
+        for (uint32_t i = 0; i < count; i++) {
+            const Record& r = recs[i];
+            varint(r.tsc - prev);
+            prev = r.tsc;
+            varint(r.site);
+            byte(r.kind);
+            byte(r.size);
+            bytes(r.payload, r.size);
+        }
+    }
+    void dropped(uint32_t ring, uint64_t count) {
+        byte('D');
+        varint(ring);
+        varint(count);
+    }
+    void clock(uint64_t tscSinceStart, uint64_t nsSinceStart) {
+        byte('C');
+        varint(tscSinceStart);
+        varint(nsSinceStart);
+    }
+    void end() { byte('E'); }
+
+    bool flush() {
+        bool ok = true;
+        if (m_file && m_size) {
+            ok = fwrite(m_buffer, 1, m_size, m_file) == m_size;
+            fflush(m_file);
+        }
+        m_size = 0;
+        return ok;
+    }
+
+private:
+    FILE* m_file;
+    uint8_t m_buffer[64 * 1024];
+    size_t m_size = 0;
+};
+
+} // namespace OsfTrace
+
+#endif // OSF_TRACE_FORMAT_H